@@ -8,7 +8,7 @@
 // AUTHOR:        Marijn Siemons 27-02-2018
 
 #include "Mirao52e.h"
-#include "windows.h"
+#include<cstdio>
 #include<cstdlib>
 #include<cstring>
 #include<string>
@@ -17,24 +17,83 @@
 #include "../../MMDevice/ModuleInterface.h"
 #include "../../MMDevice/MMDevice.h"
 #include "../../MMDevice/DeviceBase.h"
-#include "Mirror.hpp"
-#include "Model.h"
-#include "PhaseDiversity.h"
-#include "3NAlgorithm.h"
-#include "merit_functions.hpp"
-#include "conversion.hpp"
 
 #define IMPORT_IMOP_WAVEKITBIO_FROM_LIBRARY
 #define NOMINMAX
 
 const char* g_DMname  = "MIRAO52E";
 const char* g_DMfakename  = "MIRAO52E_FAKE";
+const char* g_PSFcameraname  = "MIRAO52E_PSF";
 
 const char* g_SetCalibration  = "Set calibration path";
 const char* g_SetCalibrationParams  = "Set calibration params path";
 const char* g_SetDiversityPref = "Set diversity preferences path";
 const char* g_LoadWavefront = "Load wavefront";
 const char* g_SaveCurrentPosition = "Save current position [input filename]";
+const char* g_ProjectionTime = "Projection time [us]";
+const char* g_ProjectionResidual = "Projection residual [mrad]";
+const char* g_SaturatedActuators = "Saturated actuators";
+const char* g_SettleTime = "Settle time [ms]";
+const char* g_SettleTimePerStep = "Settle time per command step [ms]";
+const char* g_ZernikeVector = "ZernikeVector";
+const char* g_ActuatorVector = "ActuatorVector";
+const char* g_Actuator = "Actuator ";
+const char* g_SequenceInterval = "Sequence interval [ms]";
+const char* g_QueueDepth = "Command queue depth";
+const char* g_CommandsSubmitted = "Commands submitted";
+const char* g_CommandsCompleted = "Commands completed";
+const char* g_CommandsCoalesced = "Commands coalesced";
+const char* g_CommandsFailed = "Commands failed";
+const char* g_LastMirrorError = "Last mirror error";
+const char* g_DacResolution = "Actuator DAC resolution";
+const char* g_WriteDeadband = "Write deadband [DAC steps]";
+const char* g_WritesSuppressed = "Writes suppressed";
+const char* g_DiversitySetup = "Diversity setup";
+const char* g_DiversityOnFirstUse = "On first use";
+const char* g_DiversityAtStartup = "At startup";
+const char* g_DiversityState = "Diversity state";
+const char* g_InitTime[MIRAO_INIT_PHASES] = {
+	"Init time mirror hardware [ms]",
+	"Init time calibration params [ms]",
+	"Init time diversity prefs [ms]",
+	"Init time projection [ms]",
+	"Init time diversity [ms]",
+	"Init time total [ms]"
+};
+// Per latency histogram: median, 99th percentile and maximum
+const char* g_Latency[MIRAO_NB_LATENCIES * 3] = {
+	"Latency queue p50 [us]",
+	"Latency queue p99 [us]",
+	"Latency queue max [us]",
+	"Latency SDK p50 [us]",
+	"Latency SDK p99 [us]",
+	"Latency SDK max [us]",
+	"Latency settled p50 [us]",
+	"Latency settled p99 [us]",
+	"Latency settled max [us]"
+};
+const char* g_AppliesPerSecond = "Applies per second";
+const char* g_TelemetryRecorded = "Telemetry commands recorded";
+const char* g_TelemetryReset = "Telemetry reset";
+const char* g_TelemetryDump = "Telemetry dump [input filename]";
+const char* g_SimLatency = "Simulated update latency [ms]";
+const char* g_SimSettling = "Simulated settling time constant [ms]";
+const char* g_SimResolution = "Simulated command resolution";
+const char* g_PsfMirror = "Mirror device";
+const char* g_PsfAberration = "Sample aberration [um]";
+const char* g_PsfSample = "Sample";
+const char* g_PsfEmitters = "Emitters";
+const char* g_PsfDutyCycle = "Blinking duty cycle";
+const char* g_PsfPhotons = "Photons per emitter";
+const char* g_PsfBackground = "Background [photons/pixel]";
+const char* g_PsfReadNoise = "Read noise [counts]";
+const char* g_PsfOffset = "Offset [counts]";
+const char* g_PsfSeed = "Seed";
+const char* g_PsfThreads = "Render threads";
+const char* g_PsfRenderTime = "Render time [ms]";
+const char* g_PsfFrames = "Frames rendered";
+
+const long g_maxSequenceLength = 1024;
 
 const char* g_fakemirrorinit_path  = "MIRAO/init/Fake_Mirao52-e_0219.dat";
 //const char* g_mirrorinit_path  = "MIRAO/init/WaveFrontCorrector_Mirao52-e_0235.dat";
@@ -44,27 +103,99 @@ const char* g_calibparams_initpath  = "MIRAO/init/Diversity_calibration.xml";
 const char* g_divpref_initpath  = "MIRAO/init/Diversity_prefs.xml";
 const char* g_wfc_initpath  = "MIRAO/init/WavefrontCorrection.wcs";
 const char* g_savepath  = "MIRAO/WavefrontCorrection_save.wcs";
+const char* g_presets_initpath  = "MIRAO/init/WavefrontPresets.xml";
+const char* g_preset_path  = "MIRAO/WavefrontPreset_";
+const char* g_depth_initpath  = "MIRAO/init/DepthCorrection.xml";
+// Focus moves smaller than this [um] do not update the depth correction
+const double g_depthTolerance = 0.01;
+const char* g_field_initpath  = "MIRAO/init/FieldCorrection.bin";
+// XY moves smaller than this [um] do not update the field correction
+const double g_fieldTolerance = 0.1;
+const char* g_telemetry_path  = "MIRAO/Telemetry.csv";
+const char* g_shframes_path  = "MIRAO/ShackHartmannFrames.bin";
+const char* g_calibcache_ext  = ".cache";
+// Settle time [ms] when neither the calibration nor the wavefront file sets
+// one, as the fixed sleep after every update the adapter started out with
+const double g_defaultSettleTime = 10;
+// Sensor of the simulated camera [pixels]
+const unsigned g_psfSensorSize = 512;
 
 const char* g_ApplyZernmodes  = "ApplyZernikes";
-const char* g_SetZernMode_Tip  = "Z11";
-const char* g_SetZernMode_Tilt  = "Z1-1";
-const char* g_SetZernMode_Defocus  = "Z20";
-const char* g_SetZernMode_Astig0deg  = "Z22";
-const char* g_SetZernMode_Astig45deg  = "Z2-2";
-const char* g_SetZernMode_Coma0deg  = "Z31";
-const char* g_SetZernMode_Coma90deg  = "Z3-1";
-const char* g_SetZernMode_PrimSpherical  = "Z40";
-const char* g_SetZernMode_Trefoil0deg  = "Z33";
-const char* g_SetZernMode_Trefoil90deg  = "Z3-3";
-const char* g_SetZernMode_SecondAstig0deg  = "Z42";
-const char* g_SetZernMode_SecondAstig45deg  = "Z4-2";
-const char* g_SetZernMode_Quadrafoil0deg  = "Z44";
-const char* g_SetZernMode_Quadrafoil45deg  = "Z4-4";
-const char* g_SetZernMode_SecondComa0deg  = "Z51";
-const char* g_SetZernMode_SecondComa90deg  = "Z5-1";
-const char* g_SetZernMode_SecondTrefoil0deg  = "Z53";
-const char* g_SetZernMode_SecondTrefoil90deg  = "Z5-3";
-const char* g_SetZernMode_SecondSpherical  = "Z60";
+
+const char* g_NbZernikes = "Number of Zernike modes";
+const char* g_HeadroomUp = " headroom + [um]";
+const char* g_HeadroomDown = " headroom - [um]";
+
+const char* g_Optimise = "Optimise";
+const char* g_OptimiserCamera = "Optimiser camera";
+const char* g_OptimiserModes = "Optimiser modes";
+const char* g_OptimiserBias = "Optimiser bias [um]";
+const char* g_OptimiserScheme = "Optimiser scheme";
+const char* g_OptimiserScheme3N = "3N";
+const char* g_OptimiserScheme2N1 = "2N+1";
+const char* g_OptimiserMetric = "Optimiser metric";
+const char* g_OptimiserRounds = "Optimiser rounds";
+const char* g_OptimiserPipelining = "Optimiser pipelining";
+const char* g_OptimiserThreads = "Optimiser metric threads";
+const char* g_OptimiserRoi = "Optimiser ROI";
+const char* g_OptimiserStatus = "Optimiser status";
+const char* g_OptimiserTime = "Optimiser time [ms]";
+const char* g_OptimiserMerit = "Optimiser merit";
+const char* g_PhaseDiversity = "Phase diversity";
+const char* g_PhaseDiversityThreads = "Phase diversity threads";
+const char* g_PhaseDiversityStatus = "Phase diversity status";
+const char* g_PhaseDiversityTime = "Phase diversity time [ms]";
+const char* g_PhaseDiversityRetrievalTime = "Phase diversity retrieval time [ms]";
+const char* g_PhaseDiversityIterations = "Phase diversity iterations";
+const char* g_PhaseDiversityError = "Phase diversity error";
+const char* g_PhaseDiversityCorrection = "Phase diversity correction";
+const char* g_PresetList = "Wavefront preset list";
+const char* g_Preset = "Wavefront preset";
+const char* g_PresetIndex = "Wavefront preset index";
+const char* g_StorePreset = "Store wavefront preset [input name]";
+const char* g_PresetNone = "None";
+const char* g_DepthCorrection = "Depth correction";
+const char* g_DepthTable = "Depth correction table";
+const char* g_SaveDepthTable = "Save depth correction table [input filename]";
+const char* g_StoreDepthPoint = "Store depth correction point";
+const char* g_DepthFocusDevice = "Depth correction focus device";
+const char* g_DepthInterpolation = "Depth correction interpolation";
+const char* g_DepthLinear = "Linear";
+const char* g_DepthSpline = "Spline";
+const char* g_DepthInterval = "Depth correction poll interval [ms]";
+const char* g_DepthFocus = "Depth correction focus [um]";
+const char* g_FieldCorrection = "Field correction";
+const char* g_FieldMap = "Field correction map";
+const char* g_SaveFieldMap = "Save field correction map [input filename]";
+const char* g_StoreFieldPoint = "Store field correction point";
+const char* g_FieldXYStage = "Field correction XY stage";
+const char* g_FieldInterval = "Field correction poll interval [ms]";
+const char* g_FieldPosition[2] = { "Field correction X [um]", "Field correction Y [um]" };
+const char* g_ShackHartmann = "Shack-Hartmann";
+const char* g_ShackHartmannFrames = "Shack-Hartmann frame file";
+const char* g_ShackHartmannPixelSize = "Shack-Hartmann pixel size [um]";
+const char* g_ShackHartmannFocalLength = "Shack-Hartmann microlens focal length [mm]";
+const char* g_ShackHartmannOrigin[2] = { "Shack-Hartmann origin X [pixels]", "Shack-Hartmann origin Y [pixels]" };
+const char* g_ShackHartmannThreshold = "Shack-Hartmann threshold [counts]";
+const char* g_ShackHartmannThreads = "Shack-Hartmann threads";
+const char* g_ShackHartmannInterval = "Shack-Hartmann frame interval [ms]";
+const char* g_ShackHartmannStoreReference = "Shack-Hartmann store reference";
+const char* g_ShackHartmannMeasured = "Shack-Hartmann frames measured";
+const char* g_ShackHartmannRate = "Shack-Hartmann frame rate [Hz]";
+const char* g_ShackHartmannTime = "Shack-Hartmann centroiding time [us]";
+const char* g_ShackHartmannLit = "Shack-Hartmann lit subapertures";
+const char* g_ShackHartmannSlopeRms = "Shack-Hartmann slope RMS [mrad]";
+const char* g_Loop = "Closed loop";
+const char* g_LoopRate = "Closed loop rate [Hz]";
+const char* g_LoopGains = "Closed loop gains";
+const char* g_LoopLeak = "Closed loop leak";
+const char* g_LoopMeasuredRate = "Closed loop measured rate [Hz]";
+const char* g_LoopJitter = "Closed loop jitter [us]";
+const char* g_LoopResidual = "Closed loop residual RMS [um]";
+const char* g_LoopCycles = "Closed loop cycles";
+const char* g_LoopHeld = "Closed loop held cycles";
+const char* g_On = "On";
+const char* g_Off = "Off";
 
 
 inline bool fileexists (const std::string& name) {
@@ -76,19 +207,108 @@ inline bool fileexists (const std::string& name) {
     }   
 }
 
+// Zernike vector as "a1 a2 ... aN", modes in SDK order starting at tip.
+// Separators may be spaces, commas or semicolons; trailing modes may be omitted.
+inline bool parsezernikes (const std::string& values, int nbModes, std::vector<float>& coefs) {
+    std::string text = values;
+    for (size_t i = 0; i < text.size(); i++)
+        if (text[i] == ',' || text[i] == ';')
+            text[i] = ' ';
+    std::istringstream stream(text);
+    float coef;
+    coefs.clear();
+    while (stream >> coef)
+        coefs.push_back(coef);
+    return stream.eof() && (int)coefs.size() <= nbModes;
+}
+
+inline std::string formatzernikes (const float* zernikes, int nbModes) {
+    std::ostringstream stream;
+    for (int j = 1; j <= nbModes; j++)
+        stream << (j > 1 ? " " : "") << zernikes[j];
+    return stream.str();
+}
+
+// Actuator vector as one command per actuator, actuator 1 first, separated as a Zernike vector
+inline bool parseactuators (const std::string& values, std::vector<float>& actuators) {
+    return parsezernikes(values, MIRAO_NB_ACTUATORS, actuators) && actuators.size() == MIRAO_NB_ACTUATORS;
+}
+
+inline std::string formatactuators (const float* actuators) {
+    std::ostringstream stream;
+    for (int i = 0; i < MIRAO_NB_ACTUATORS; i++)
+        stream << (i > 0 ? " " : "") << actuators[i];
+    return stream.str();
+}
+
+// Optimiser modes as SDK mode numbers (1 is tip), separated as a Zernike vector
+inline bool parsemodes (const std::string& values, int nbModes, std::vector<int>& modes) {
+    std::string text = values;
+    for (size_t i = 0; i < text.size(); i++)
+        if (text[i] == ',' || text[i] == ';')
+            text[i] = ' ';
+    std::istringstream stream(text);
+    int mode;
+    modes.clear();
+    while (stream >> mode)
+    {
+        if (mode < 1 || mode > nbModes)
+            return false;
+        modes.push_back(mode);
+    }
+    return stream.eof() && !modes.empty();
+}
+
+inline std::string formatmodes (const std::vector<int>& modes) {
+    std::ostringstream stream;
+    for (size_t i = 0; i < modes.size(); i++)
+        stream << (i > 0 ? " " : "") << modes[i];
+    return stream.str();
+}
+
+// Optimiser ROI as "x y width height"; empty for the full image
+inline bool parseroi (const std::string& values, MiraoOptimiserSettings& settings) {
+    std::istringstream stream(values);
+    int roi[4] = {0, 0, 0, 0};
+    int count = 0;
+    while (count < 4 && stream >> roi[count])
+        count++;
+    if (!(stream >> std::ws).eof() || (count != 0 && count != 4) || roi[0] < 0 || roi[1] < 0 || roi[2] < 0 || roi[3] < 0)
+        return false;
+    settings.roiX = roi[0];
+    settings.roiY = roi[1];
+    settings.roiWidth = roi[2];
+    settings.roiHeight = roi[3];
+    return true;
+}
+
+inline std::string formatroi (const MiraoOptimiserSettings& settings) {
+    if (settings.roiX == 0 && settings.roiY == 0 && settings.roiWidth == 0 && settings.roiHeight == 0)
+        return "";
+    std::ostringstream stream;
+    stream << settings.roiX << " " << settings.roiY << " " << settings.roiWidth << " " << settings.roiHeight;
+    return stream.str();
+}
+
 
 MODULE_API void InitializeModuleData()
 {
+#ifdef MIRAO_HAVE_SDK
 	RegisterDevice(g_DMname, MM::GenericDevice, "Mirao-52e");
+#endif
 	RegisterDevice(g_DMfakename, MM::GenericDevice, "Fake Mirao-52e");
+	RegisterDevice(g_PSFcameraname, MM::CameraDevice, "Simulated camera behind the fake Mirao-52e");
 }
 
 
 MODULE_API MM::Device* CreateDevice(const char* deviceName)                  
 {
    if (deviceName == 0) return 0;
-   if (strcmp(deviceName, g_DMname)  == 0) return new Mirao52e();
-   if (strcmp(deviceName, g_DMfakename)  == 0) return new Mirao52e_FAKE();
+#ifdef MIRAO_HAVE_SDK
+   if (strcmp(deviceName, g_DMname)  == 0) return new Mirao52e(g_DMname, "MIRAO-52E device adapter", g_mirrorinit_path);
+#endif
+   if (strcmp(deviceName, g_DMfakename)  == 0) return new Mirao52e_FAKE(g_DMfakename, "MIRAO-52E fake mirror", g_fakemirrorinit_path);
+   if (strcmp(deviceName, g_PSFcameraname)  == 0) return new MiraoPsfCamera();
    return 0;
 }
 
@@ -97,57 +317,166 @@ MODULE_API void DeleteDevice(MM::Device* pDevice)
    delete pDevice;
 }
 
-Mirao52e::Mirao52e() :
-   port_("Undefined"),
-   initialized_(false),
-   mirrorinitpath_(g_mirrorinit_path),
+template <class TBackend>
+Mirao52eDevice<TBackend>::Mirao52eDevice(const char* name, const char* description, const char* mirrorinitpath) :
+   pending_(0),
+   actuatorsknown_(false),
+   saturatedwrite_(false),
+   projectiontime_us_(0),
+   projectionresidual_(0),
+   saturatedactuators_(0),
+   settletime_ms_(0),
+   settletimeperstep_ms_(0),
+   dacresolution_(2.0 / 65536),
+   writedeadband_(0),
+   nbzernikes_(MIRAO_SDK_ZERNIKES),
+   deferdiversity_(true),
+   sequenceinterval_ms_(10),
+   sequencepresets_(false),
+   diversitythreads_(3),
+   preset_(-1),
+   depthspline_(false),
+   depthinterval_ms_(5),
+   depthz_(0),
+   fieldinterval_ms_(20),
+   fieldx_(0),
+   fieldy_(0),
+   shthreads_(2),
+   shinterval_ms_(1),
+   loopgains_("0.3"),
+   name_(name),
+   description_(description),
+   mirrorinitpath_(mirrorinitpath),
    calibpath_(g_calib_initpath),
    calibparamspath_(g_calibparams_initpath),
    divprefpath_(g_divpref_initpath),
    wfcpath_(g_wfc_initpath),
-   savepath_(g_savepath)
+   savepath_(g_savepath),
+   presetlistpath_(g_presets_initpath),
+   depthpath_(g_depth_initpath),
+   fieldpath_(g_field_initpath),
+   telemetrypath_(g_telemetry_path),
+   shpath_(g_shframes_path),
+   initialized_(false),
+   port_("Undefined")
 {
-   InitializeDefaultErrorMessages();
+   for (int i = 0; i < MIRAO_NB_ACTUATORS; i++)
+      actuators_[i] = 0;
+   for (int i = 0; i < MIRAO_INIT_PHASES; i++)
+      inittime_ms_[i] = 0;
+   for (int j = 0; j <= MIRAO_MAX_ZERNIKES; j++)
+   {
+      zer_store[j] = zer_rel[j] = zer_applied_[j] = zer_depth_[j] = zer_field_[j] = zer_loop_[j] = 0;
+      headroomup_[j] = headroomdown_[j] = 0;
+   }
+
+   this->InitializeDefaultErrorMessages();
    // add custom messages
    std::string error_mirrorinit_file = "Mirror initialization file does not exist. Looking for: ";	error_mirrorinit_file.append(mirrorinitpath_.c_str());
-   SetErrorText(ERR_MIRRORINIT_FILE_NONEXIST, error_mirrorinit_file.c_str());
+   this->SetErrorText(ERR_MIRRORINIT_FILE_NONEXIST, error_mirrorinit_file.c_str());
 
    std::string error_divinit_file = "Diversity initialization file does not exist. Looking for: ";	error_divinit_file.append(calibpath_.c_str());
-   SetErrorText(ERR_DIVINIT_FILE_NONEXIST, error_divinit_file.c_str());
+   this->SetErrorText(ERR_DIVINIT_FILE_NONEXIST, error_divinit_file.c_str());
 
    std::string error_cal_file = "Calibration parameter file does not exist. Looking for: ";	error_cal_file.append(calibparamspath_.c_str());
-   SetErrorText(ERR_CAL_FILE_NONEXIST, error_cal_file.c_str());
+   this->SetErrorText(ERR_CAL_FILE_NONEXIST, error_cal_file.c_str());
 
    std::string error_divpref_file = "Diversity preferences file does not exist. Looking for: ";	error_divpref_file.append(divprefpath_.c_str());
-   SetErrorText(ERR_DIVPREF_FILE_NONEXIST, error_divpref_file.c_str());
-
-   SetErrorText(ERR_FILE_NONEXIST, "File does not exist");
+   this->SetErrorText(ERR_DIVPREF_FILE_NONEXIST, error_divpref_file.c_str());
+
+   this->SetErrorText(ERR_FILE_NONEXIST, "File does not exist");
+   this->SetErrorText(ERR_INVALID_ZERNIKE_VECTOR, "Zernike vector should hold at most one number per Zernike mode, separated by spaces or commas");
+   this->SetErrorText(ERR_ZERNIKE_ORDER, "More than 19 Zernike modes need a calibration the adapter can read itself (.aomi)");
+   this->SetErrorText(ERR_INVALID_ACTUATOR_VECTOR, "Actuator vector should hold one command per actuator (52), separated by spaces or commas");
+   this->SetErrorText(ERR_OPTIMISER_CAMERA, "Optimiser camera not found, or its images are not 8 or 16 bit");
+   this->SetErrorText(ERR_OPTIMISER_MODES, "Optimiser modes should be Zernike mode numbers (1 is tip) up to the number of Zernike modes, separated by spaces or commas");
+   this->SetErrorText(ERR_OPTIMISER_BUSY, "An optimisation or phase diversity measurement is already running");
+   this->SetErrorText(ERR_OPTIMISER_ROI, "Optimiser ROI should be empty (full image) or \"x y width height\" in camera pixels");
+   this->SetErrorText(ERR_DIVERSITY_SETTINGS, "Phase diversity preferences or calibration parameters could not be read or used");
+   this->SetErrorText(ERR_PRESET, "Wavefront preset not found, the preset table is full, or a preset's wavefront file could not be read or written");
+   this->SetErrorText(ERR_DEPTH_TABLE, "Depth correction table is empty, or its file could not be read or written");
+   this->SetErrorText(ERR_DEPTH_FOCUS, "Depth correction focus device not found or not a stage, or no focus device is set in the core");
+   this->SetErrorText(ERR_FIELD_MAP, "Field correction map is empty, or its file could not be read or written");
+   this->SetErrorText(ERR_FIELD_STAGE, "Field correction XY stage not set, not found or not an XY stage");
+   this->SetErrorText(ERR_SH_FRAMES, "Shack-Hartmann frame file could not be read");
+   this->SetErrorText(ERR_LOOP_SLOPES, "Closed loop needs the Shack-Hartmann measurement on, on the current calibration, and a calibration the adapter can read itself (.aomi)");
+   this->SetErrorText(ERR_MIRROR_UPDATE, "A mirror update failed and the mirror was not moved; see the log");
+   this->SetErrorText(ERR_MIRROR_OPEN, "The mirror driver could not be initialised");
+   this->SetErrorText(ERR_MIRROR_READBACK, "The actuator commands could not be read back from the mirror");
+   this->SetErrorText(ERR_LOOP_GAINS, "Closed loop gains should be one gain per Zernike mode from tip, separated by spaces or commas; modes after the last one take its gain");
+   this->SetErrorText(ERR_SH_GEOMETRY, "Shack-Hartmann subapertures do not fit on the frames: check the pixel size, origin and calibration, or a subaperture is larger than 64 pixels");
 
    // create pre-initialization properties
    // ------------------------------------
    // Name
-   CreateProperty(MM::g_Keyword_Name, g_DMname, MM::String, true);
+   this->CreateProperty(MM::g_Keyword_Name, name_.c_str(), MM::String, true);
    // Description
-   CreateProperty(MM::g_Keyword_Description, "MIRAO-52E device adapter", MM::String, true);
+   this->CreateProperty(MM::g_Keyword_Description, description_.c_str(), MM::String, true);
    // Port
-   CPropertyAction* pAct = new CPropertyAction (this, &Mirao52e::OnPort);
-   CreateProperty(MM::g_Keyword_Port, "Undefined", MM::String, false, pAct, true);  
+   CPropertyAction* pAct = new CPropertyAction (this, &Mirao52eDevice::OnPort);
+   this->CreateProperty(MM::g_Keyword_Port, "Undefined", MM::String, false, pAct, true);  
+   // Phase diversity setup is slow; on first use it runs on the worker thread
+   // before the first mirror update instead of with the startup loads
+   pAct = new CPropertyAction (this, &Mirao52eDevice::OnDiversitySetup);
+   this->CreateProperty(g_DiversitySetup, g_DiversityOnFirstUse, MM::String, false, pAct, true);
+   this->AddAllowedValue(g_DiversitySetup, g_DiversityOnFirstUse);
+   this->AddAllowedValue(g_DiversitySetup, g_DiversityAtStartup);
+   // Zernike modes exposed as properties, in SDK order
+   pAct = new CPropertyAction (this, &Mirao52eDevice::OnNbZernikes);
+   this->CreateProperty(g_NbZernikes, CDeviceUtils::ConvertToString(nbzernikes_), MM::Integer, false, pAct, true);
+   this->SetPropertyLimits(g_NbZernikes, 1, MIRAO_MAX_ZERNIKES);
+   // Named wavefront corrections, parsed once at startup
+   pAct = new CPropertyAction (this, &Mirao52eDevice::OnPresetList);
+   this->CreateProperty(g_PresetList, presetlistpath_.c_str(), MM::String, false, pAct, true);
+
+   sequencethread_ = new MiraoSequenceThread<Mirao52eDevice>(this);
+   worker_ = new MiraoMirrorWorker<Mirao52eDevice>(this);
+   optimiser_ = new MiraoOptimiser<Mirao52eDevice>(this);
+   diversitymeasurement_ = new MiraoDiversityMeasurement<Mirao52eDevice>(this);
+   focustracker_ = new MiraoFocusTracker<Mirao52eDevice>(this);
+   xytracker_ = new MiraoXYTracker<Mirao52eDevice>(this);
+   shackhartmann_ = new MiraoShackHartmann();
+   framereplay_ = new MiraoFrameReplay(shackhartmann_);
+   loop_ = new MiraoLoop<Mirao52eDevice>(this, shackhartmann_);
 }
 
-Mirao52e::~Mirao52e()
+template <class TBackend>
+Mirao52eDevice<TBackend>::~Mirao52eDevice()
 {
    if (initialized_)
       Shutdown();
+   delete loop_;
+   delete framereplay_;
+   delete shackhartmann_;
+   delete xytracker_;
+   delete focustracker_;
+   delete diversitymeasurement_;
+   delete optimiser_;
+   delete sequencethread_;
+   delete worker_;
+}
+
+template <class TBackend>
+bool Mirao52eDevice<TBackend>::Busy()
+{
+      if (optimiser_->IsRunning() || diversitymeasurement_->IsRunning() || !worker_->IsIdle())
+         return true;
+      MMThreadGuard guard(statelock_);
+      return this->GetCurrentMMTime() < settleend_;
 }
 
-bool Mirao52e::Busy()
+template <class TBackend>
+MM::MMTime Mirao52eDevice<TBackend>::GetCurrentMMTime()
 {
-      return false;
+   if (this->GetCoreCallback() == 0)
+      return MM::MMTime(MiraoClock());
+   return CGenericBase<Mirao52eDevice>::GetCurrentMMTime();
 }
 
-void Mirao52e::GetName(char* name) const
+template <class TBackend>
+void Mirao52eDevice<TBackend>::GetName(char* name) const
 {
-   CDeviceUtils::CopyLimitedString(name, g_DMname);
+   CDeviceUtils::CopyLimitedString(name, name_.c_str());
 }
 
 // General utility function:
@@ -168,7 +497,8 @@ int ClearPort(MM::Device& device, MM::Core& core, std::string port)
 } 
 
 // initialize function
-int Mirao52e::Initialize()
+template <class TBackend>
+int Mirao52eDevice<TBackend>::Initialize()
 {
 	if (initialized_)
     return DEVICE_OK;
@@ -191,1726 +521,3827 @@ int Mirao52e::Initialize()
 		return ERR_DIVPREF_FILE_NONEXIST;
 	}
 
-	//init Mirror HW driver
-    mirrorhandle = new imop::microscopy::Mirror(g_mirrorinit_path);
-	mirrorhandle->init_hardware();
+	MM::MMTime start = this->GetCurrentMMTime();
 
-	//Load calibration file
-	diversityhandle = new imop::microscopy::Diversity(calibpath_, *mirrorhandle );
-
-    calibparamshandle = new imop::microscopy::CalibrationParams;
-	calibparamshandle->Load(calibparamspath_);
+	//Tables that do not need the mirror, so a bad file fails before anything runs
+	int ret = LoadPresets();
+	if (ret!=DEVICE_OK)
+	   return ret;
+	if (fileexists(depthpath_))
+	{
+		ret = LoadDepthTable(depthpath_);
+		if (ret!=DEVICE_OK)
+		   return ret;
+	}
+	if (fileexists(fieldpath_))
+	{
+		ret = LoadFieldMap(fieldpath_);
+		if (ret!=DEVICE_OK)
+		   return ret;
+	}
 
-    divprefshandle = new imop::microscopy::DiversityPreferences;
-    divprefshandle->Load(divprefpath_);
+	//init Mirror HW driver and load the calibration files
+	ret = LoadCalibrationSet(calibpath_, calibparamspath_, divprefpath_, true);
+	if (ret!=DEVICE_OK)
+	   return ret;
 
-    diversityhandle->Init_Diversity(*calibparamshandle,*divprefshandle);
+	//All mirror updates from here on go through the worker thread; from here
+	//on a failure shuts it down again
+	worker_->Start();
 
-	//Apply initial wavefront correction if WFC file exists
+	//Apply initial wavefront correction if WFC file exists. It is an absolute
+	//write, so deferred phase diversity stays deferred.
 	if (fileexists(g_wfc_initpath))
 	{
-		Mirao52e::LoadWavefront(g_wfc_initpath);
+		LoadWavefront(g_wfc_initpath);
+		//Settling time and actuator state of the initial wavefront, the only
+		//command queued so far
+		worker_->Flush();
+		ret = worker_->GetResult(worker_->GetSubmitted());
+		if (ret!=DEVICE_OK)
+		{
+			Shutdown();
+			return ret;
+		}
+	}
+	// One DAC step over the full command range, assuming 16-bit drive electronics
+	if (calib_.maxCommand > calib_.minCommand)
+		dacresolution_ = (calib_.maxCommand - calib_.minCommand) / 65536.0;
+
+	ret = CreateDeviceProperties();
+	if (ret!=DEVICE_OK)
+	{
+		Shutdown();
+		return ret;
 	}
 
+	inittime_ms_[MIRAO_INIT_TOTAL] = (this->GetCurrentMMTime() - start).getMsec();
+	initialized_ = true;
+
+	return DEVICE_OK;
+}
+
+// Properties that need the mirror, created once it is up
+template <class TBackend>
+int Mirao52eDevice<TBackend>::CreateDeviceProperties()
+{
 	// Create action properties
-	CPropertyAction* pAct = new CPropertyAction(this, &Mirao52e::OnSetCalibration);
-	int ret = CreateProperty(g_SetCalibration, g_calib_initpath, MM::String, false, pAct);
+	CPropertyAction* pAct = new CPropertyAction(this, &Mirao52eDevice::OnSetCalibration);
+	int ret = this->CreateProperty(g_SetCalibration, g_calib_initpath, MM::String, false, pAct);
 	if (ret!=DEVICE_OK)
 	   return ret;
 
-	pAct = new CPropertyAction(this, &Mirao52e::OnSetCalibrationParams);
-	ret = CreateProperty(g_SetCalibrationParams, g_calibparams_initpath, MM::String, false, pAct);
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnSetCalibrationParams);
+	ret = this->CreateProperty(g_SetCalibrationParams, g_calibparams_initpath, MM::String, false, pAct);
 	if (ret!=DEVICE_OK)
 	   return ret;
 
-	pAct = new CPropertyAction(this, &Mirao52e::OnSetDiversityPref);
-	ret = CreateProperty(g_SetDiversityPref, g_divpref_initpath, MM::String, false, pAct);
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnSetDiversityPref);
+	ret = this->CreateProperty(g_SetDiversityPref, g_divpref_initpath, MM::String, false, pAct);
 	if (ret!=DEVICE_OK)
 	   return ret;
 
-	pAct = new CPropertyAction(this, &Mirao52e::OnLoadWavefront);
-	ret = CreateProperty(g_LoadWavefront, g_wfc_initpath, MM::String, false, pAct);
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnLoadWavefront);
+	ret = this->CreateProperty(g_LoadWavefront, g_wfc_initpath, MM::String, false, pAct);
 	if (ret!=DEVICE_OK)
 	   return ret;
 
-	pAct = new CPropertyAction(this, &Mirao52e::OnSaveCurrentPosition);
-	ret = CreateProperty(g_SaveCurrentPosition, g_savepath, MM::String, false, pAct);
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnSaveCurrentPosition);
+	ret = this->CreateProperty(g_SaveCurrentPosition, g_savepath, MM::String, false, pAct);
 	if (ret!=DEVICE_OK)
 	   return ret;
 
-	// Zernike Modes
-    pAct = new CPropertyAction(this, &Mirao52e::OnSetZernMode_Tip);
-    ret = CreateProperty(g_SetZernMode_Tip, "0", MM::Float, false, pAct);
-    if (ret!=DEVICE_OK)
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnProjectionTime);
+	ret = this->CreateProperty(g_ProjectionTime, "0", MM::Float, true, pAct);
+	if (ret!=DEVICE_OK)
 	   return ret;
-	SetPropertyLimits(g_SetZernMode_Tip, -1, 1);
-
 
-    pAct = new CPropertyAction(this, &Mirao52e::OnSetZernMode_Tilt);
-    ret = CreateProperty(g_SetZernMode_Tilt, "0", MM::Float, false, pAct);
-    if (ret!=DEVICE_OK)
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnProjectionResidual);
+	ret = this->CreateProperty(g_ProjectionResidual, "0", MM::Float, true, pAct);
+	if (ret!=DEVICE_OK)
 	   return ret;
-	SetPropertyLimits(g_SetZernMode_Tilt, -1, 1);
-
 
-	pAct = new CPropertyAction(this, &Mirao52e::OnSetZernMode_Defocus);
-	ret = CreateProperty(g_SetZernMode_Defocus, "0", MM::Float, false, pAct);
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnSaturatedActuators);
+	ret = this->CreateProperty(g_SaturatedActuators, "0", MM::Integer, true, pAct);
 	if (ret!=DEVICE_OK)
 	   return ret;
-	SetPropertyLimits(g_SetZernMode_Defocus, -1, 1);
 
-	pAct = new CPropertyAction(this, &Mirao52e::OnSetZernMode_Astig0deg);
-	ret = CreateProperty(g_SetZernMode_Astig0deg, "0", MM::Float, false, pAct);
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnSettleTime);
+	ret = this->CreateProperty(g_SettleTime, CDeviceUtils::ConvertToString(settletime_ms_), MM::Float, false, pAct);
 	if (ret!=DEVICE_OK)
 	   return ret;
-	SetPropertyLimits(g_SetZernMode_Astig0deg, -1, 1);
 
-	pAct = new CPropertyAction(this, &Mirao52e::OnSetZernMode_Astig45deg);
-	ret = CreateProperty(g_SetZernMode_Astig45deg, "0", MM::Float, false, pAct);
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnSettleTimePerStep);
+	ret = this->CreateProperty(g_SettleTimePerStep, "0", MM::Float, false, pAct);
 	if (ret!=DEVICE_OK)
 	   return ret;
-	SetPropertyLimits(g_SetZernMode_Astig45deg, -1, 1);
 
-	pAct = new CPropertyAction(this, &Mirao52e::OnSetZernMode_Coma0deg);
-	ret = CreateProperty(g_SetZernMode_Coma0deg, "0", MM::Float, false, pAct);
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnZernikeVector);
+	ret = this->CreateProperty(g_ZernikeVector, "", MM::String, false, pAct);
 	if (ret!=DEVICE_OK)
 	   return ret;
-	SetPropertyLimits(g_SetZernMode_Coma0deg, -1, 1);
 
-	pAct = new CPropertyAction(this, &Mirao52e::OnSetZernMode_Coma90deg);
-	ret = CreateProperty(g_SetZernMode_Coma90deg, "0", MM::Float, false, pAct);
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnSequenceInterval);
+	ret = this->CreateProperty(g_SequenceInterval, "10", MM::Float, false, pAct);
 	if (ret!=DEVICE_OK)
 	   return ret;
-	SetPropertyLimits(g_SetZernMode_Coma90deg, -1, 1);
 
-	pAct = new CPropertyAction(this, &Mirao52e::OnSetZernMode_PrimSpherical);
-	ret = CreateProperty(g_SetZernMode_PrimSpherical, "0", MM::Float, false, pAct);
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnQueueDepth);
+	ret = this->CreateProperty(g_QueueDepth, "0", MM::Integer, true, pAct);
 	if (ret!=DEVICE_OK)
 	   return ret;
-	SetPropertyLimits(g_SetZernMode_PrimSpherical, -1, 1);
 
-	pAct = new CPropertyAction(this, &Mirao52e::OnSetZernMode_Trefoil0deg);
-	ret = CreateProperty(g_SetZernMode_Trefoil0deg, "0", MM::Float, false, pAct);
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnCommandsSubmitted);
+	ret = this->CreateProperty(g_CommandsSubmitted, "0", MM::Integer, true, pAct);
 	if (ret!=DEVICE_OK)
 	   return ret;
-	SetPropertyLimits(g_SetZernMode_Trefoil0deg, -1, 1);
 
-	pAct = new CPropertyAction(this, &Mirao52e::OnSetZernMode_Trefoil90deg);
-	ret = CreateProperty(g_SetZernMode_Trefoil90deg, "0", MM::Float, false, pAct);
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnCommandsCompleted);
+	ret = this->CreateProperty(g_CommandsCompleted, "0", MM::Integer, true, pAct);
 	if (ret!=DEVICE_OK)
 	   return ret;
-	SetPropertyLimits(g_SetZernMode_Trefoil90deg, -1, 1);
 
-	pAct = new CPropertyAction(this, &Mirao52e::OnSetZernMode_SecondAstig0deg);
-	ret = CreateProperty(g_SetZernMode_SecondAstig0deg, "0", MM::Float, false, pAct);
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnCommandsCoalesced);
+	ret = this->CreateProperty(g_CommandsCoalesced, "0", MM::Integer, true, pAct);
 	if (ret!=DEVICE_OK)
 	   return ret;
-	SetPropertyLimits(g_SetZernMode_SecondAstig0deg, -1, 1);
 
-	pAct = new CPropertyAction(this, &Mirao52e::OnSetZernMode_SecondAstig45deg);
-	ret = CreateProperty(g_SetZernMode_SecondAstig45deg, "0", MM::Float, false, pAct);
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnCommandsFailed);
+	ret = this->CreateProperty(g_CommandsFailed, "0", MM::Integer, true, pAct);
 	if (ret!=DEVICE_OK)
 	   return ret;
-	SetPropertyLimits(g_SetZernMode_SecondAstig45deg, -1, 1);
 
-	pAct = new CPropertyAction(this, &Mirao52e::OnSetZernMode_Quadrafoil0deg);
-	ret = CreateProperty(g_SetZernMode_Quadrafoil0deg, "0", MM::Float, false, pAct);
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnLastMirrorError);
+	ret = this->CreateProperty(g_LastMirrorError, "0", MM::Integer, true, pAct);
 	if (ret!=DEVICE_OK)
 	   return ret;
-	SetPropertyLimits(g_SetZernMode_Quadrafoil0deg, -1, 1);
 
-	pAct = new CPropertyAction(this, &Mirao52e::OnSetZernMode_Quadrafoil45deg);
-	ret = CreateProperty(g_SetZernMode_Quadrafoil45deg, "0", MM::Float, false, pAct);
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnDacResolution);
+	ret = this->CreateProperty(g_DacResolution, CDeviceUtils::ConvertToString(dacresolution_), MM::Float, false, pAct);
 	if (ret!=DEVICE_OK)
 	   return ret;
-	SetPropertyLimits(g_SetZernMode_Quadrafoil45deg, -1, 1);
 
-	pAct = new CPropertyAction(this, &Mirao52e::OnSetZernMode_SecondComa0deg);
-	ret = CreateProperty(g_SetZernMode_SecondComa0deg, "0", MM::Float, false, pAct);
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnWriteDeadband);
+	ret = this->CreateProperty(g_WriteDeadband, "0", MM::Integer, false, pAct);
 	if (ret!=DEVICE_OK)
 	   return ret;
-	SetPropertyLimits(g_SetZernMode_SecondComa0deg, -1, 1);
+	this->SetPropertyLimits(g_WriteDeadband, 0, 100);
 
-	pAct = new CPropertyAction(this, &Mirao52e::OnSetZernMode_SecondComa90deg);
-	ret = CreateProperty(g_SetZernMode_SecondComa90deg, "0", MM::Float, false, pAct);
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnWritesSuppressed);
+	ret = this->CreateProperty(g_WritesSuppressed, "0", MM::Integer, true, pAct);
 	if (ret!=DEVICE_OK)
 	   return ret;
-	SetPropertyLimits(g_SetZernMode_SecondComa90deg, -1, 1);
 
-	pAct = new CPropertyAction(this, &Mirao52e::OnSetZernMode_SecondTrefoil0deg);
-	ret = CreateProperty(g_SetZernMode_SecondTrefoil0deg, "0", MM::Float, false, pAct);
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnDiversityState);
+	ret = this->CreateProperty(g_DiversityState, "", MM::String, true, pAct);
 	if (ret!=DEVICE_OK)
 	   return ret;
-	SetPropertyLimits(g_SetZernMode_SecondTrefoil0deg, -1, 1);
 
-	pAct = new CPropertyAction(this, &Mirao52e::OnSetZernMode_SecondTrefoil90deg);
-	ret = CreateProperty(g_SetZernMode_SecondTrefoil90deg, "0", MM::Float, false, pAct);
+	for (long phase = 0; phase < MIRAO_INIT_PHASES; phase++)
+	{
+		CPropertyActionEx* pActEx = new CPropertyActionEx(this, &Mirao52eDevice::OnInitTime, phase);
+		ret = this->CreateProperty(g_InitTime[phase], "0", MM::Float, true, pActEx);
+		if (ret!=DEVICE_OK)
+		   return ret;
+	}
+
+	for (long index = 0; index < MIRAO_NB_LATENCIES * 3; index++)
+	{
+		CPropertyActionEx* pActEx = new CPropertyActionEx(this, &Mirao52eDevice::OnLatency, index);
+		ret = this->CreateProperty(g_Latency[index], "0", MM::Float, true, pActEx);
+		if (ret!=DEVICE_OK)
+		   return ret;
+	}
+
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnAppliesPerSecond);
+	ret = this->CreateProperty(g_AppliesPerSecond, "0", MM::Float, true, pAct);
 	if (ret!=DEVICE_OK)
 	   return ret;
-	SetPropertyLimits(g_SetZernMode_SecondTrefoil90deg, -1, 1);
 
-	pAct = new CPropertyAction(this, &Mirao52e::OnSetZernMode_SecondSpherical);
-	ret = CreateProperty(g_SetZernMode_SecondSpherical, "0", MM::Float, false, pAct);
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnTelemetryRecorded);
+	ret = this->CreateProperty(g_TelemetryRecorded, "0", MM::Integer, true, pAct);
 	if (ret!=DEVICE_OK)
 	   return ret;
-	SetPropertyLimits(g_SetZernMode_SecondSpherical, -1, 1);
 
-	pAct = new CPropertyAction(this, &Mirao52e::OnApplyZernmodes);
-	ret = CreateProperty(g_ApplyZernmodes, "0", MM::Integer, false, pAct);
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnTelemetryReset);
+	ret = this->CreateProperty(g_TelemetryReset, "0", MM::Integer, false, pAct);
 	if (ret!=DEVICE_OK)
 	   return ret;
+	this->SetPropertyLimits(g_TelemetryReset, 0, 1);
 
-	initialized_ = true;
-
-	return DEVICE_OK;
-}
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnTelemetryDump);
+	ret = this->CreateProperty(g_TelemetryDump, telemetrypath_.c_str(), MM::String, false, pAct);
+	if (ret!=DEVICE_OK)
+	   return ret;
 
-// Shut down function
-int Mirao52e::Shutdown()
-{
-   initialized_    = false;
-   return DEVICE_OK;
-}
+	ret = CreateBackendProperties();
+	if (ret!=DEVICE_OK)
+	   return ret;
 
-int Mirao52e::OnPort(MM::PropertyBase* pProp, MM::ActionType eAct)
-{
-   if (eAct == MM::BeforeGet)
+	// Zernike Modes
+	for (long j = 1; j <= nbzernikes_; j++)
 	{
-      pProp->Set(port_.c_str());
+		const MiraoMode& mode = g_miraoModes[j - 1];
+		CPropertyActionEx* pActEx = new CPropertyActionEx(this, &Mirao52eDevice::OnZernMode, j);
+		ret = this->CreateProperty(mode.name, "0", MM::Float, false, pActEx);
+		if (ret!=DEVICE_OK)
+		   return ret;
+		this->SetPropertyLimits(mode.name, mode.min, mode.max);
 	}
-   else if (eAct == MM::AfterSet)
-   {
-      if (initialized_)
-      {
-         // revert
-         pProp->Set(port_.c_str());
-         return ERR_PORT_CHANGE_FORBIDDEN;
-      }
-      pProp->Get(port_);
-   }
-   return DEVICE_OK;
-}
-
 
-// load new calibration files
-int Mirao52e::SetCalibration(const std::string   path)
-{
-	if (fileexists(path))
-	{
-		calibpath_ = path;
-		diversityhandle = new imop::microscopy::Diversity(calibpath_, *mirrorhandle);
-		diversityhandle->Init_Diversity(*calibparamshandle,*divprefshandle);
-	}
-	else
+	// Amplitude each mode can still move before an actuator saturates
+	for (long j = 1; j <= nbzernikes_; j++)
 	{
-		return ERR_FILE_NONEXIST;
+		std::string name = std::string(g_miraoModes[j - 1].name) + g_HeadroomUp;
+		CPropertyActionEx* pActEx = new CPropertyActionEx(this, &Mirao52eDevice::OnHeadroom, j);
+		ret = this->CreateProperty(name.c_str(), "0", MM::Float, true, pActEx);
+		if (ret!=DEVICE_OK)
+		   return ret;
+		name = std::string(g_miraoModes[j - 1].name) + g_HeadroomDown;
+		pActEx = new CPropertyActionEx(this, &Mirao52eDevice::OnHeadroom, -j);
+		ret = this->CreateProperty(name.c_str(), "0", MM::Float, true, pActEx);
+		if (ret!=DEVICE_OK)
+		   return ret;
 	}
-	return DEVICE_OK;
-}
 
-int Mirao52e::SetDiversityPref(const std::string   path)
-{
-	if (fileexists(path))
-	{
-		divprefpath_ = path;
-		divprefshandle->Load(divprefpath_);
-		diversityhandle->Init_Diversity(*calibparamshandle,*divprefshandle);
-	}
-		else
-	{
-		return ERR_FILE_NONEXIST;
-	}
-	return DEVICE_OK;
-}
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnApplyZernmodes);
+	ret = this->CreateProperty(g_ApplyZernmodes, "0", MM::Integer, false, pAct);
+	if (ret!=DEVICE_OK)
+	   return ret;
 
-int Mirao52e::SetCalibrationParams(const std::string  path)
-{
-	if (fileexists(path))
-	{
-		calibparamspath_ = path;
-		calibparamshandle->Load(calibparamspath_);
-		diversityhandle->Init_Diversity(*calibparamshandle,*divprefshandle);
-	}
-		else
-	{
-		return ERR_FILE_NONEXIST;
-	}
-	return DEVICE_OK;
-}
+	// Actuator commands, limited as in the wavefront correction file
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnActuatorVector);
+	ret = this->CreateProperty(g_ActuatorVector, "", MM::String, false, pAct);
+	if (ret!=DEVICE_OK)
+	   return ret;
 
-int Mirao52e::LoadWavefront(std::basic_string<char>  path)
-{
-	if (fileexists(path))
+	for (long i = 0; i < MIRAO_NB_ACTUATORS; i++)
 	{
-		wfcpath_ = path;
-		diversityhandle->Apply_Absolute_Commands_From_File(wfcpath_);
-		zer_store.zernike_coefficients[1] = 0;
-		zer_store.zernike_coefficients[2] = 0;
-		zer_store.zernike_coefficients[3] = 0;
-		zer_store.zernike_coefficients[4] = 0;
-		zer_store.zernike_coefficients[5] = 0;
-		zer_store.zernike_coefficients[6] = 0;
-		zer_store.zernike_coefficients[7] = 0;
-		zer_store.zernike_coefficients[8] = 0;
-		zer_store.zernike_coefficients[9] = 0;
-		zer_store.zernike_coefficients[10] = 0;
-		zer_store.zernike_coefficients[11] = 0;
-		zer_store.zernike_coefficients[12] = 0;
-		zer_store.zernike_coefficients[13] = 0;
-		zer_store.zernike_coefficients[14] = 0;
-		zer_store.zernike_coefficients[15] = 0;
-		zer_store.zernike_coefficients[16] = 0;
-		zer_store.zernike_coefficients[17] = 0;
-		zer_store.zernike_coefficients[18] = 0;
-		zer_store.zernike_coefficients[19] = 0;
-
-		zer_rel.zernike_coefficients[1] = 0;
-		zer_rel.zernike_coefficients[2] = 0;
-		zer_rel.zernike_coefficients[3] = 0;
-		zer_rel.zernike_coefficients[4] = 0;
-		zer_rel.zernike_coefficients[5] = 0;
-		zer_rel.zernike_coefficients[6] = 0;
-		zer_rel.zernike_coefficients[7] = 0;
-		zer_rel.zernike_coefficients[8] = 0;
-		zer_rel.zernike_coefficients[9] = 0;
-		zer_rel.zernike_coefficients[10] = 0;
-		zer_rel.zernike_coefficients[11] = 0;
-		zer_rel.zernike_coefficients[12] = 0;
-		zer_rel.zernike_coefficients[13] = 0;
-		zer_rel.zernike_coefficients[14] = 0;
-		zer_rel.zernike_coefficients[15] = 0;
-		zer_rel.zernike_coefficients[16] = 0;
-		zer_rel.zernike_coefficients[17] = 0;
-		zer_rel.zernike_coefficients[18] = 0;
-		zer_rel.zernike_coefficients[19] = 0;
-		Sleep(10);
+		char name[MM::MaxStrLength];
+		sprintf(name, "%s%02ld", g_Actuator, i + 1);
+		CPropertyActionEx* pActEx = new CPropertyActionEx(this, &Mirao52eDevice::OnActuator, i);
+		ret = this->CreateProperty(name, "0", MM::Float, !wfcstate_.valid[i], pActEx);
+		if (ret!=DEVICE_OK)
+		   return ret;
+		if (wfcstate_.valid[i])
+			this->SetPropertyLimits(name, wfcstate_.minCommand[i], wfcstate_.maxCommand[i]);
 	}
-	else
+
+	// Sensorless optimisation on images from a camera
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnOptimise);
+	ret = this->CreateProperty(g_Optimise, "0", MM::Integer, false, pAct);
+	if (ret!=DEVICE_OK)
+	   return ret;
+	this->AddAllowedValue(g_Optimise, "0");
+	this->AddAllowedValue(g_Optimise, "1");
+
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnOptimiserCamera);
+	ret = this->CreateProperty(g_OptimiserCamera, "", MM::String, false, pAct);
+	if (ret!=DEVICE_OK)
+	   return ret;
+
+	optimisersettings_.modes.clear();
+	for (int j = 4; j <= nbzernikes_; j++)
+		optimisersettings_.modes.push_back(j);
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnOptimiserModes);
+	ret = this->CreateProperty(g_OptimiserModes, formatmodes(optimisersettings_.modes).c_str(), MM::String, false, pAct);
+	if (ret!=DEVICE_OK)
+	   return ret;
+
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnOptimiserBias);
+	ret = this->CreateProperty(g_OptimiserBias, CDeviceUtils::ConvertToString(optimisersettings_.bias), MM::Float, false, pAct);
+	if (ret!=DEVICE_OK)
+	   return ret;
+	this->SetPropertyLimits(g_OptimiserBias, 0, 1);
+
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnOptimiserScheme);
+	ret = this->CreateProperty(g_OptimiserScheme, g_OptimiserScheme3N, MM::String, false, pAct);
+	if (ret!=DEVICE_OK)
+	   return ret;
+	this->AddAllowedValue(g_OptimiserScheme, g_OptimiserScheme3N);
+	this->AddAllowedValue(g_OptimiserScheme, g_OptimiserScheme2N1);
+
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnOptimiserMetric);
+	ret = this->CreateProperty(g_OptimiserMetric, g_miraoMetrics[optimisersettings_.metric], MM::String, false, pAct);
+	if (ret!=DEVICE_OK)
+	   return ret;
+	for (int i = 0; i < MIRAO_NB_METRICS; i++)
+		this->AddAllowedValue(g_OptimiserMetric, g_miraoMetrics[i]);
+
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnOptimiserRounds);
+	ret = this->CreateProperty(g_OptimiserRounds, "1", MM::Integer, false, pAct);
+	if (ret!=DEVICE_OK)
+	   return ret;
+	this->SetPropertyLimits(g_OptimiserRounds, 1, 10);
+
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnOptimiserPipelining);
+	ret = this->CreateProperty(g_OptimiserPipelining, g_On, MM::String, false, pAct);
+	if (ret!=DEVICE_OK)
+	   return ret;
+	this->AddAllowedValue(g_OptimiserPipelining, g_On);
+	this->AddAllowedValue(g_OptimiserPipelining, g_Off);
+
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnOptimiserThreads);
+	ret = this->CreateProperty(g_OptimiserThreads, CDeviceUtils::ConvertToString(optimisersettings_.threads), MM::Integer, false, pAct);
+	if (ret!=DEVICE_OK)
+	   return ret;
+	this->SetPropertyLimits(g_OptimiserThreads, 1, 16);
+
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnOptimiserRoi);
+	ret = this->CreateProperty(g_OptimiserRoi, "", MM::String, false, pAct);
+	if (ret!=DEVICE_OK)
+	   return ret;
+
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnOptimiserStatus);
+	ret = this->CreateProperty(g_OptimiserStatus, "Idle", MM::String, true, pAct);
+	if (ret!=DEVICE_OK)
+	   return ret;
+
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnOptimiserTime);
+	ret = this->CreateProperty(g_OptimiserTime, "0", MM::Float, true, pAct);
+	if (ret!=DEVICE_OK)
+	   return ret;
+
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnOptimiserMerit);
+	ret = this->CreateProperty(g_OptimiserMerit, "0", MM::Float, true, pAct);
+	if (ret!=DEVICE_OK)
+	   return ret;
+
+	// Phase diversity measurement and correction with the optimiser camera
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnPhaseDiversity);
+	ret = this->CreateProperty(g_PhaseDiversity, "0", MM::Integer, false, pAct);
+	if (ret!=DEVICE_OK)
+	   return ret;
+	this->AddAllowedValue(g_PhaseDiversity, "0");
+	this->AddAllowedValue(g_PhaseDiversity, "1");
+
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnPhaseDiversityThreads);
+	ret = this->CreateProperty(g_PhaseDiversityThreads, CDeviceUtils::ConvertToString(diversitythreads_), MM::Integer, false, pAct);
+	if (ret!=DEVICE_OK)
+	   return ret;
+	this->SetPropertyLimits(g_PhaseDiversityThreads, 1, MIRAO_DIVERSITY_MAX_IMAGES);
+
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnPhaseDiversityStatus);
+	ret = this->CreateProperty(g_PhaseDiversityStatus, "Idle", MM::String, true, pAct);
+	if (ret!=DEVICE_OK)
+	   return ret;
+
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnPhaseDiversityTime);
+	ret = this->CreateProperty(g_PhaseDiversityTime, "0", MM::Float, true, pAct);
+	if (ret!=DEVICE_OK)
+	   return ret;
+
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnPhaseDiversityRetrievalTime);
+	ret = this->CreateProperty(g_PhaseDiversityRetrievalTime, "0", MM::Float, true, pAct);
+	if (ret!=DEVICE_OK)
+	   return ret;
+
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnPhaseDiversityIterations);
+	ret = this->CreateProperty(g_PhaseDiversityIterations, "0", MM::Integer, true, pAct);
+	if (ret!=DEVICE_OK)
+	   return ret;
+
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnPhaseDiversityError);
+	ret = this->CreateProperty(g_PhaseDiversityError, "0", MM::Float, true, pAct);
+	if (ret!=DEVICE_OK)
+	   return ret;
+
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnPhaseDiversityCorrection);
+	ret = this->CreateProperty(g_PhaseDiversityCorrection, "", MM::String, true, pAct);
+	if (ret!=DEVICE_OK)
+	   return ret;
+
+	// Wavefront presets, switched between without parsing their files again
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnPreset);
+	ret = this->CreateProperty(g_Preset, g_PresetNone, MM::String, false, pAct);
+	if (ret!=DEVICE_OK)
+	   return ret;
+
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnPresetIndex);
+	ret = this->CreateProperty(g_PresetIndex, "-1", MM::Integer, false, pAct);
+	if (ret!=DEVICE_OK)
+	   return ret;
+
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnStorePreset);
+	ret = this->CreateProperty(g_StorePreset, "", MM::String, false, pAct);
+	if (ret!=DEVICE_OK)
+	   return ret;
+	UpdatePresetValues();
+
+	// Zernike correction following the focus position
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnDepthCorrection);
+	ret = this->CreateProperty(g_DepthCorrection, g_Off, MM::String, false, pAct);
+	if (ret!=DEVICE_OK)
+	   return ret;
+	this->AddAllowedValue(g_DepthCorrection, g_Off);
+	this->AddAllowedValue(g_DepthCorrection, g_On);
+
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnDepthTable);
+	ret = this->CreateProperty(g_DepthTable, depthpath_.c_str(), MM::String, false, pAct);
+	if (ret!=DEVICE_OK)
+	   return ret;
+
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnSaveDepthTable);
+	ret = this->CreateProperty(g_SaveDepthTable, depthpath_.c_str(), MM::String, false, pAct);
+	if (ret!=DEVICE_OK)
+	   return ret;
+
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnStoreDepthPoint);
+	ret = this->CreateProperty(g_StoreDepthPoint, "0", MM::Integer, false, pAct);
+	if (ret!=DEVICE_OK)
+	   return ret;
+	this->AddAllowedValue(g_StoreDepthPoint, "0");
+	this->AddAllowedValue(g_StoreDepthPoint, "1");
+
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnDepthFocusDevice);
+	ret = this->CreateProperty(g_DepthFocusDevice, "", MM::String, false, pAct);
+	if (ret!=DEVICE_OK)
+	   return ret;
+
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnDepthInterpolation);
+	ret = this->CreateProperty(g_DepthInterpolation, g_DepthLinear, MM::String, false, pAct);
+	if (ret!=DEVICE_OK)
+	   return ret;
+	this->AddAllowedValue(g_DepthInterpolation, g_DepthLinear);
+	this->AddAllowedValue(g_DepthInterpolation, g_DepthSpline);
+
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnDepthInterval);
+	ret = this->CreateProperty(g_DepthInterval, CDeviceUtils::ConvertToString(depthinterval_ms_), MM::Float, false, pAct);
+	if (ret!=DEVICE_OK)
+	   return ret;
+	this->SetPropertyLimits(g_DepthInterval, 1, 1000);
+
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnDepthFocus);
+	ret = this->CreateProperty(g_DepthFocus, "0", MM::Float, true, pAct);
+	if (ret!=DEVICE_OK)
+	   return ret;
+
+	// Zernike correction following the XY stage
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnFieldCorrection);
+	ret = this->CreateProperty(g_FieldCorrection, g_Off, MM::String, false, pAct);
+	if (ret!=DEVICE_OK)
+	   return ret;
+	this->AddAllowedValue(g_FieldCorrection, g_Off);
+	this->AddAllowedValue(g_FieldCorrection, g_On);
+
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnFieldMap);
+	ret = this->CreateProperty(g_FieldMap, fieldpath_.c_str(), MM::String, false, pAct);
+	if (ret!=DEVICE_OK)
+	   return ret;
+
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnSaveFieldMap);
+	ret = this->CreateProperty(g_SaveFieldMap, fieldpath_.c_str(), MM::String, false, pAct);
+	if (ret!=DEVICE_OK)
+	   return ret;
+
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnStoreFieldPoint);
+	ret = this->CreateProperty(g_StoreFieldPoint, "0", MM::Integer, false, pAct);
+	if (ret!=DEVICE_OK)
+	   return ret;
+	this->AddAllowedValue(g_StoreFieldPoint, "0");
+	this->AddAllowedValue(g_StoreFieldPoint, "1");
+
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnFieldXYStage);
+	ret = this->CreateProperty(g_FieldXYStage, "", MM::String, false, pAct);
+	if (ret!=DEVICE_OK)
+	   return ret;
+
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnFieldInterval);
+	ret = this->CreateProperty(g_FieldInterval, CDeviceUtils::ConvertToString(fieldinterval_ms_), MM::Float, false, pAct);
+	if (ret!=DEVICE_OK)
+	   return ret;
+	this->SetPropertyLimits(g_FieldInterval, 1, 1000);
+
+	for (long axis = 0; axis < 2; axis++)
 	{
-		return ERR_FILE_NONEXIST;
+		CPropertyActionEx* pActEx = new CPropertyActionEx(this, &Mirao52eDevice::OnFieldPosition, axis);
+		ret = this->CreateProperty(g_FieldPosition[axis], "0", MM::Float, true, pActEx);
+		if (ret!=DEVICE_OK)
+		   return ret;
 	}
-	return DEVICE_OK;
-}
 
-int Mirao52e::SaveCurrentPosition(std::basic_string<char> path)
-{
-	savepath_ = path;
-	diversityhandle->Save_Current_Positions_ToFile(savepath_);
-	return DEVICE_OK;
-}
+	// Slopes of the calibration pupil from Shack-Hartmann frames
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnShackHartmann);
+	ret = this->CreateProperty(g_ShackHartmann, g_Off, MM::String, false, pAct);
+	if (ret!=DEVICE_OK)
+	   return ret;
+	this->AddAllowedValue(g_ShackHartmann, g_Off);
+	this->AddAllowedValue(g_ShackHartmann, g_On);
 
-/*
-// Get Actuator positions //
-int Mirao52e::GetActuatorPos(std::vector<float> pos)
-{
-	pos = mirrorhandle->Get_Current_Position();
-	return DEVICE_OK;
-}
-*/
-
-// Set Zernike modes
-int Mirao52e::ApplyZernmodes()
-{
-	diversityhandle->Apply_Relative_Commands(zer_rel);
-
-	zer_store.zernike_coefficients[1] = zer_store.zernike_coefficients[1] + zer_rel.zernike_coefficients[1];
-	zer_store.zernike_coefficients[2] = zer_store.zernike_coefficients[2] + zer_rel.zernike_coefficients[2];
-	zer_store.zernike_coefficients[3] = zer_store.zernike_coefficients[3] + zer_rel.zernike_coefficients[3];
-	zer_store.zernike_coefficients[4] = zer_store.zernike_coefficients[4] + zer_rel.zernike_coefficients[4];
-	zer_store.zernike_coefficients[5] = zer_store.zernike_coefficients[5] + zer_rel.zernike_coefficients[5];
-	zer_store.zernike_coefficients[6] = zer_store.zernike_coefficients[6] + zer_rel.zernike_coefficients[6];
-	zer_store.zernike_coefficients[7] = zer_store.zernike_coefficients[7] + zer_rel.zernike_coefficients[7];
-	zer_store.zernike_coefficients[8] = zer_store.zernike_coefficients[8] + zer_rel.zernike_coefficients[8];
-	zer_store.zernike_coefficients[9] = zer_store.zernike_coefficients[9] + zer_rel.zernike_coefficients[9];
-	zer_store.zernike_coefficients[10] = zer_store.zernike_coefficients[10] + zer_rel.zernike_coefficients[10];
-	zer_store.zernike_coefficients[11] = zer_store.zernike_coefficients[11] + zer_rel.zernike_coefficients[11];
-	zer_store.zernike_coefficients[12] = zer_store.zernike_coefficients[12] + zer_rel.zernike_coefficients[12];
-	zer_store.zernike_coefficients[13] = zer_store.zernike_coefficients[13] + zer_rel.zernike_coefficients[13];
-	zer_store.zernike_coefficients[14] = zer_store.zernike_coefficients[14] + zer_rel.zernike_coefficients[14];
-	zer_store.zernike_coefficients[15] = zer_store.zernike_coefficients[15] + zer_rel.zernike_coefficients[15];
-	zer_store.zernike_coefficients[16] = zer_store.zernike_coefficients[16] + zer_rel.zernike_coefficients[16];
-	zer_store.zernike_coefficients[17] = zer_store.zernike_coefficients[17] + zer_rel.zernike_coefficients[17];
-	zer_store.zernike_coefficients[18] = zer_store.zernike_coefficients[18] + zer_rel.zernike_coefficients[18];
-	zer_store.zernike_coefficients[19] = zer_store.zernike_coefficients[19] + zer_rel.zernike_coefficients[19];
-
-	zer_rel.zernike_coefficients[1] = 0;
-	zer_rel.zernike_coefficients[2] = 0;
-	zer_rel.zernike_coefficients[3] = 0;
-	zer_rel.zernike_coefficients[4] = 0;
-	zer_rel.zernike_coefficients[5] = 0;
-	zer_rel.zernike_coefficients[6] = 0;
-	zer_rel.zernike_coefficients[7] = 0;
-	zer_rel.zernike_coefficients[8] = 0;
-	zer_rel.zernike_coefficients[9] = 0;
-	zer_rel.zernike_coefficients[10] = 0;
-	zer_rel.zernike_coefficients[11] = 0;
-	zer_rel.zernike_coefficients[12] = 0;
-	zer_rel.zernike_coefficients[13] = 0;
-	zer_rel.zernike_coefficients[14] = 0;
-	zer_rel.zernike_coefficients[15] = 0;
-	zer_rel.zernike_coefficients[16] = 0;
-	zer_rel.zernike_coefficients[17] = 0;
-	zer_rel.zernike_coefficients[18] = 0;
-	zer_rel.zernike_coefficients[19] = 0;
-	Sleep(10);
-	return DEVICE_OK;
-}
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnShackHartmannFrames);
+	ret = this->CreateProperty(g_ShackHartmannFrames, shpath_.c_str(), MM::String, false, pAct);
+	if (ret!=DEVICE_OK)
+	   return ret;
 
-int Mirao52e::SetZernMode_Tip(float Acoef)
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnShackHartmannPixelSize);
+	ret = this->CreateProperty(g_ShackHartmannPixelSize, CDeviceUtils::ConvertToString(shsettings_.pixelSize_um), MM::Float, false, pAct);
+	if (ret!=DEVICE_OK)
+	   return ret;
+
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnShackHartmannFocalLength);
+	ret = this->CreateProperty(g_ShackHartmannFocalLength, CDeviceUtils::ConvertToString(shsettings_.focalLength_mm), MM::Float, false, pAct);
+	if (ret!=DEVICE_OK)
+	   return ret;
+
+	for (long axis = 0; axis < 2; axis++)
+	{
+		CPropertyActionEx* pActEx = new CPropertyActionEx(this, &Mirao52eDevice::OnShackHartmannOrigin, axis);
+		ret = this->CreateProperty(g_ShackHartmannOrigin[axis], "0", MM::Float, false, pActEx);
+		if (ret!=DEVICE_OK)
+		   return ret;
+	}
+
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnShackHartmannThreshold);
+	ret = this->CreateProperty(g_ShackHartmannThreshold, "0", MM::Integer, false, pAct);
+	if (ret!=DEVICE_OK)
+	   return ret;
+	this->SetPropertyLimits(g_ShackHartmannThreshold, 0, 65535);
+
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnShackHartmannThreads);
+	ret = this->CreateProperty(g_ShackHartmannThreads, CDeviceUtils::ConvertToString(shthreads_), MM::Integer, false, pAct);
+	if (ret!=DEVICE_OK)
+	   return ret;
+	this->SetPropertyLimits(g_ShackHartmannThreads, 1, 16);
+
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnShackHartmannInterval);
+	ret = this->CreateProperty(g_ShackHartmannInterval, CDeviceUtils::ConvertToString(shinterval_ms_), MM::Float, false, pAct);
+	if (ret!=DEVICE_OK)
+	   return ret;
+	this->SetPropertyLimits(g_ShackHartmannInterval, 0, 1000);
+
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnShackHartmannStoreReference);
+	ret = this->CreateProperty(g_ShackHartmannStoreReference, "0", MM::Integer, false, pAct);
+	if (ret!=DEVICE_OK)
+	   return ret;
+	this->AddAllowedValue(g_ShackHartmannStoreReference, "0");
+	this->AddAllowedValue(g_ShackHartmannStoreReference, "1");
+
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnShackHartmannMeasured);
+	ret = this->CreateProperty(g_ShackHartmannMeasured, "0", MM::Integer, true, pAct);
+	if (ret!=DEVICE_OK)
+	   return ret;
+
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnShackHartmannRate);
+	ret = this->CreateProperty(g_ShackHartmannRate, "0", MM::Float, true, pAct);
+	if (ret!=DEVICE_OK)
+	   return ret;
+
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnShackHartmannTime);
+	ret = this->CreateProperty(g_ShackHartmannTime, "0", MM::Float, true, pAct);
+	if (ret!=DEVICE_OK)
+	   return ret;
+
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnShackHartmannLit);
+	ret = this->CreateProperty(g_ShackHartmannLit, "0", MM::Integer, true, pAct);
+	if (ret!=DEVICE_OK)
+	   return ret;
+
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnShackHartmannSlopeRms);
+	ret = this->CreateProperty(g_ShackHartmannSlopeRms, "0", MM::Float, true, pAct);
+	if (ret!=DEVICE_OK)
+	   return ret;
+
+	// Modal integrator on the Shack-Hartmann slopes
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnLoop);
+	ret = this->CreateProperty(g_Loop, g_Off, MM::String, false, pAct);
+	if (ret!=DEVICE_OK)
+	   return ret;
+	this->AddAllowedValue(g_Loop, g_Off);
+	this->AddAllowedValue(g_Loop, g_On);
+
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnLoopRate);
+	ret = this->CreateProperty(g_LoopRate, CDeviceUtils::ConvertToString(loopsettings_.rate_hz), MM::Float, false, pAct);
+	if (ret!=DEVICE_OK)
+	   return ret;
+	this->SetPropertyLimits(g_LoopRate, 1, 5000);
+
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnLoopGains);
+	ret = this->CreateProperty(g_LoopGains, loopgains_.c_str(), MM::String, false, pAct);
+	if (ret!=DEVICE_OK)
+	   return ret;
+
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnLoopLeak);
+	ret = this->CreateProperty(g_LoopLeak, CDeviceUtils::ConvertToString(loopsettings_.leak), MM::Float, false, pAct);
+	if (ret!=DEVICE_OK)
+	   return ret;
+	this->SetPropertyLimits(g_LoopLeak, 0, 1);
+
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnLoopMeasuredRate);
+	ret = this->CreateProperty(g_LoopMeasuredRate, "0", MM::Float, true, pAct);
+	if (ret!=DEVICE_OK)
+	   return ret;
+
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnLoopJitter);
+	ret = this->CreateProperty(g_LoopJitter, "0", MM::Float, true, pAct);
+	if (ret!=DEVICE_OK)
+	   return ret;
+
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnLoopResidual);
+	ret = this->CreateProperty(g_LoopResidual, "0", MM::Float, true, pAct);
+	if (ret!=DEVICE_OK)
+	   return ret;
+
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnLoopCycles);
+	ret = this->CreateProperty(g_LoopCycles, "0", MM::Integer, true, pAct);
+	if (ret!=DEVICE_OK)
+	   return ret;
+
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnLoopHeld);
+	ret = this->CreateProperty(g_LoopHeld, "0", MM::Integer, true, pAct);
+	if (ret!=DEVICE_OK)
+	   return ret;
+
+	return DEVICE_OK;
+}
+
+// Shut down function
+template <class TBackend>
+int Mirao52eDevice<TBackend>::Shutdown()
+{
+   loop_->Stop();
+   StopShackHartmann();
+   xytracker_->Stop();
+   focustracker_->Stop();
+   diversitymeasurement_->Stop();
+   optimiser_->Stop();
+   sequencethread_->Stop();
+   worker_->Stop();
+   calibrations_.Publish(0);
+   initialized_    = false;
+   return DEVICE_OK;
+}
+
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnPort(MM::PropertyBase* pProp, MM::ActionType eAct)
+{
+   if (eAct == MM::BeforeGet)
+	{
+      pProp->Set(port_.c_str());
+	}
+   else if (eAct == MM::AfterSet)
+   {
+      if (initialized_)
+      {
+         // revert
+         pProp->Set(port_.c_str());
+         return ERR_PORT_CHANGE_FORBIDDEN;
+      }
+      pProp->Get(port_);
+   }
+   return DEVICE_OK;
+}
+
+
+// load new calibration files
+template <class TBackend>
+int Mirao52eDevice<TBackend>::SetCalibration(const std::string   path)
+{
+	if (fileexists(path))
+	{
+		int ret = LoadCalibrationSet(path, calibparamspath_, divprefpath_, false);
+		if (ret == DEVICE_OK)
+			calibpath_ = path;
+		return ret;
+	}
+	else
+	{
+		return ERR_FILE_NONEXIST;
+	}
+	return DEVICE_OK;
+}
+
+template <class TBackend>
+int Mirao52eDevice<TBackend>::SetDiversityPref(const std::string   path)
+{
+	if (fileexists(path))
+	{
+		int ret = LoadCalibrationSet(calibpath_, calibparamspath_, path, false);
+		if (ret == DEVICE_OK)
+			divprefpath_ = path;
+		return ret;
+	}
+		else
+	{
+		return ERR_FILE_NONEXIST;
+	}
+	return DEVICE_OK;
+}
+
+template <class TBackend>
+int Mirao52eDevice<TBackend>::SetCalibrationParams(const std::string  path)
+{
+	if (fileexists(path))
+	{
+		int ret = LoadCalibrationSet(calibpath_, path, divprefpath_, false);
+		if (ret == DEVICE_OK)
+			calibparamspath_ = path;
+		return ret;
+	}
+		else
+	{
+		return ERR_FILE_NONEXIST;
+	}
+	return DEVICE_OK;
+}
+
+template <class TBackend>
+int Mirao52eDevice<TBackend>::LoadWavefront(std::basic_string<char>  path)
+{
+	if (fileexists(path))
+	{
+		MMThreadGuard guard(mirrorlock_);
+		wfcpath_ = path;
+		preset_ = -1;
+		for (int j = 1; j <= MIRAO_MAX_ZERNIKES; j++)
+			zer_store[j] = zer_rel[j] = 0;
+
+		MiraoCommand command;
+		command.type = MiraoCommand::LoadWavefront;
+		command.path = wfcpath_;
+		worker_->Submit(command);
+		return DEVICE_OK;
+	}
+	else
+	{
+		return ERR_FILE_NONEXIST;
+	}
+	return DEVICE_OK;
+}
+
+template <class TBackend>
+int Mirao52eDevice<TBackend>::SaveCurrentPosition(std::basic_string<char> path)
+{
+	worker_->Flush();
+	MMThreadGuard guard(sdklock_);
+	savepath_ = path;
+	CalibrationRef set(calibrations_);
+	if (set.get() == 0)
+		return DEVICE_NOT_CONNECTED;
+	EnsureDiversity(set.get());
+	set->backend.SavePositions(savepath_);
+	return DEVICE_OK;
+}
+
+// Loads a complete calibration set next to the one in use and swaps it in.
+// Mirror updates carry on with the previous set while the files are loaded,
+// only the swap itself waits for the update in progress. With inithardware
+// the mirror driver is initialised in parallel with the loads.
+template <class TBackend>
+int Mirao52eDevice<TBackend>::LoadCalibrationSet(const std::string& calib, const std::string& calibparams, const std::string& divprefs, bool inithardware)
+{
+	MMThreadGuard guard(loadlock_);
+	pending_ = new CalibrationSet(mirror_, calib, calibparams, divprefs);
+
+	//Loads that do not need the mirror run in parallel
+	MiraoTask<Mirao52eDevice> paramstask(this, &Mirao52eDevice::LoadCalibrationParams);
+	MiraoTask<Mirao52eDevice> prefstask(this, &Mirao52eDevice::LoadDiversityPrefs);
+	MiraoTask<Mirao52eDevice> projectortask(this, &Mirao52eDevice::LoadProjector);
+	paramstask.Start();
+	prefstask.Start();
+	projectortask.Start();
+
+	MM::MMTime start = this->GetCurrentMMTime();
+	bool opened = true;
+	if (inithardware)
+	{
+		//init Mirror HW driver
+		opened = mirror_.Open(mirrorinitpath_);
+	}
+
+	//Load calibration file. It builds the SDK's diversity object on the mirror
+	//driver the worker may be using for the current set.
+	bool loaded = false;
+	if (opened)
+	{
+		MMThreadGuard sdkguard(sdklock_);
+		loaded = pending_->backend.LoadCalibration(calib);
+	}
+	if (inithardware)
+		inittime_ms_[MIRAO_INIT_HARDWARE] = (this->GetCurrentMMTime() - start).getMsec();
+
+	int paramsresult = paramstask.Join();
+	int prefsresult = prefstask.Join();
+	projectortask.Join();
+	inittime_ms_[MIRAO_INIT_CALIBPARAMS] = paramstask.GetElapsedMs();
+	inittime_ms_[MIRAO_INIT_DIVPREFS] = prefstask.GetElapsedMs();
+	inittime_ms_[MIRAO_INIT_PROJECTION] = projectortask.GetElapsedMs();
+
+	CalibrationSet* set = pending_;
+	pending_ = 0;
+	if (!opened)
+	{
+		set->Release();
+		return ERR_MIRROR_OPEN;
+	}
+	if (!loaded)
+	{
+		set->Release();
+		return ERR_CAL_FILE_NONEXIST;
+	}
+	if (paramsresult != DEVICE_OK || prefsresult != DEVICE_OK)
+	{
+		set->Release();
+		return ERR_DIVERSITY_SETTINGS;
+	}
+	if (nbzernikes_ > MIRAO_SDK_ZERNIKES && !set->projector.IsReady())
+	{
+		set->Release();
+		return ERR_ZERNIKE_ORDER;
+	}
+	//At startup phase diversity is set up on first use, unless asked for at
+	//startup. A swapped in set has it set up here, so that the mirror updates
+	//after the swap do not wait for it. It runs on the mirror driver the worker
+	//may be using for the current set.
+	if (!deferdiversity_ || !inithardware)
+	{
+		MMThreadGuard sdkguard(sdklock_);
+		InitDiversity(set);
+	}
+	PublishCalibration(set);
+	return DEVICE_OK;
+}
+
+template <class TBackend>
+int Mirao52eDevice<TBackend>::LoadCalibrationParams()
+{
+	if (!pending_->backend.LoadCalibrationParams(pending_->calibparamspath))
+		return ERR_DIVERSITY_SETTINGS;
+	return DEVICE_OK;
+}
+
+template <class TBackend>
+int Mirao52eDevice<TBackend>::LoadDiversityPrefs()
+{
+	if (!pending_->backend.LoadDiversityPrefs(pending_->divprefpath))
+		return ERR_DIVERSITY_SETTINGS;
+	return DEVICE_OK;
+}
+
+template <class TBackend>
+int Mirao52eDevice<TBackend>::LoadProjector()
+{
+	BuildProjector(pending_);
+	return DEVICE_OK;
+}
+
+// Swaps in a new calibration set between two mirror updates. The previous set
+// is deleted as soon as nothing uses it any more.
+template <class TBackend>
+void Mirao52eDevice<TBackend>::PublishCalibration(CalibrationSet* set)
+{
+	MMThreadGuard guard(sdklock_);
+	calib_ = set->calib;
+	projector_ = set->projector;
+	projector_.SetBase(wfcstate_.position);
+	projector_.SetLimits(wfcstate_.minCommand, wfcstate_.maxCommand);
+	UpdateSettleTime();
+	calibrations_.Publish(set);
+	float target[MIRAO_NB_ACTUATORS];
+	bool known = ProjectActuators(zer_applied_, target);
+	UpdateActuators(zer_applied_, target, known);
+}
+
+// Unless it was set up at startup, phase diversity is initialised when the SDK
+// first converts Zernikes or reads the mirror through the calibration set of
+// startup, as the SDK has it initialised before any of its relative updates.
+// Absolute writes hand the SDK actuator commands and do not need it.
+// Call with sdklock_ held.
+template <class TBackend>
+void Mirao52eDevice<TBackend>::EnsureDiversity(CalibrationSet* set)
+{
+	if (set->diversityready)
+		return;
+	this->LogMessage("Setting up phase diversity for " + set->calibpath, true);
+	InitDiversity(set);
+}
+
+// Call with sdklock_ held
+template <class TBackend>
+void Mirao52eDevice<TBackend>::InitDiversity(CalibrationSet* set)
+{
+	if (set->diversityready)
+		return;
+	MM::MMTime start = this->GetCurrentMMTime();
+	set->backend.InitDiversity();
+	inittime_ms_[MIRAO_INIT_DIVERSITY] = (this->GetCurrentMMTime() - start).getMsec();
+	set->diversityready = true;
+}
+
+// Native projection engine for the calibration file of a set.
+// The SDK conversion keeps driving the mirror if the file cannot be parsed (e.g. .aoc).
+// The parsed calibration and control matrix are cached next to the file and
+// reused for as long as its content hash does not change.
+template <class TBackend>
+void Mirao52eDevice<TBackend>::BuildProjector(CalibrationSet* set)
+{
+	std::string cachepath = set->calibpath + g_calibcache_ext;
+	unsigned long long hash = MiraoFileHash(set->calibpath);
+	if (hash != 0 && set->projector.LoadCache(cachepath, hash, set->calib, nbzernikes_))
+	{
+		this->LogMessage("Calibration loaded from cache " + cachepath, true);
+	}
+	else
+	{
+		if (!set->calib.Load(set->calibpath) || !set->projector.Build(set->calib, nbzernikes_))
+		{
+			this->LogMessage("Native Zernike projection unavailable for " + set->calibpath);
+			return;
+		}
+		if (!set->projector.SaveCache(cachepath, hash, set->calib))
+			this->LogMessage("Could not write calibration cache " + cachepath);
+	}
+}
+
+// Actuator commands for the loaded wavefront plus the given Zernikes. Without
+// the native projection they are only known while no Zernikes are applied;
+// returns false if they are not. Call with sdklock_ held.
+template <class TBackend>
+bool Mirao52eDevice<TBackend>::ProjectActuators(const float* zernikes, float* target)
+{
+	if (projector_.IsReady())
+	{
+		MM::MMTime start = this->GetCurrentMMTime();
+		projector_.Project(zernikes, nbzernikes_, target);
+		projectiontime_us_ = (this->GetCurrentMMTime() - start).getUsec();
+		return true;
+	}
+	memcpy(target, wfcstate_.position, sizeof(float) * MIRAO_NB_ACTUATORS);
+	for (int j = 1; j <= nbzernikes_; j++)
+		if (zernikes[j] != 0)
+			return false;
+	return true;
+}
+
+// Records target, from ProjectActuators() on the given Zernikes, as the
+// commanded actuator positions. Returns the largest actuator step with
+// respect to the previous command.
+template <class TBackend>
+float Mirao52eDevice<TBackend>::UpdateActuators(const float* zernikes, const float* target, bool known)
+{
+	MMThreadGuard guard(statelock_);
+	if (projector_.IsReady())
+	{
+		projectionresidual_ = projector_.GetResidual();
+		saturatedactuators_ = projector_.GetSaturated();
+	}
+	float step = 0;
+	if (known && actuatorsknown_)
+	{
+		for (int i = 0; i < MIRAO_NB_ACTUATORS; i++)
+		{
+			float d = target[i] > actuators_[i] ? target[i] - actuators_[i] : actuators_[i] - target[i];
+			if (d > step)
+				step = d;
+		}
+	}
+	if (known)
+		memcpy(actuators_, target, sizeof(actuators_));
+	actuatorsknown_ = known;
+
+	// Headroom within the mode limits, and within the actuator limits when the
+	// native projection is available
+	float up[MIRAO_MAX_ZERNIKES + 1];
+	float down[MIRAO_MAX_ZERNIKES + 1];
+	if (projector_.IsReady())
+		projector_.Headroom(target, nbzernikes_, up, down);
+	for (int j = 1; j <= nbzernikes_; j++)
+	{
+		const MiraoMode& mode = g_miraoModes[j - 1];
+		headroomup_[j] = (float)mode.max - zernikes[j];
+		headroomdown_[j] = zernikes[j] - (float)mode.min;
+		if (projector_.IsReady())
+		{
+			if (up[j] < headroomup_[j])
+				headroomup_[j] = up[j];
+			if (down[j] < headroomdown_[j])
+				headroomdown_[j] = down[j];
+		}
+		if (headroomup_[j] < 0)
+			headroomup_[j] = 0;
+		if (headroomdown_[j] < 0)
+			headroomdown_[j] = 0;
+	}
+	return step;
+}
+
+// Settle time after a mirror update as given by the calibration and wavefront
+// in use, the default if neither gives one. Called with sdklock_ held whenever
+// either changes, replacing a settle time set by hand.
+template <class TBackend>
+void Mirao52eDevice<TBackend>::UpdateSettleTime()
+{
+	double settle_ms = calib_.sleepAfterApplyMs > wfcstate_.minSleepAfterMovementMs ? calib_.sleepAfterApplyMs : wfcstate_.minSleepAfterMovementMs;
+	if (settle_ms <= 0)
+		settle_ms = g_defaultSettleTime;
+	MMThreadGuard guard(statelock_);
+	settletime_ms_ = settle_ms;
+}
+
+// The mirror reports Busy() until it has settled, instead of blocking the caller
+template <class TBackend>
+void Mirao52eDevice<TBackend>::StartSettling(float step)
+{
+	MMThreadGuard guard(statelock_);
+	double settle_ms = settletime_ms_ + settletimeperstep_ms_ * step;
+	settleend_ = this->GetCurrentMMTime() + MM::MMTime(settle_ms * 1000.0);
+}
+
+// End of the settling time of the last mirror write, for the telemetry
+template <class TBackend>
+MM::MMTime Mirao52eDevice<TBackend>::GetSettleEnd()
+{
+	MMThreadGuard guard(statelock_);
+	return settleend_;
+}
+
+// True if moving to the given Zernikes, projected to target, would not change
+// any actuator by more than the deadband once quantised to the DAC. The write
+// is then skipped and zer_applied_ left alone, so small changes add up until
+// they reach the mirror.
+template <class TBackend>
+bool Mirao52eDevice<TBackend>::IsRedundantWrite(const float* zernikes, const float* target)
+{
+	if (!projector_.IsReady())
+	{
+		for (int j = 1; j <= nbzernikes_; j++)
+			if (zernikes[j] != zer_applied_[j])
+				return false;
+		return true;
+	}
+	MMThreadGuard guard(statelock_);
+	return MiraoCommandSteps(target, actuators_, dacresolution_) <= writedeadband_;
+}
+
+// Queue the current zer_store, plus the depth, field and closed-loop
+// corrections, as the new absolute Zernike target
+template <class TBackend>
+int Mirao52eDevice<TBackend>::SubmitZernikes(double requested_us)
+{
+	MMThreadGuard guard(mirrorlock_);
+	MiraoCommand command;
+	command.type = MiraoCommand::ApplyZernikes;
+	command.requested_us = requested_us;
+	for (int j = 0; j <= MIRAO_MAX_ZERNIKES; j++)
+		command.zernikes[j] = zer_store[j] + zer_depth_[j] + zer_field_[j] + zer_loop_[j];
+	worker_->Submit(command);
+	return DEVICE_OK;
+}
+
+// Runs on the worker thread, which is the only thread moving the mirror
+template <class TBackend>
+int Mirao52eDevice<TBackend>::ExecuteCommand(const MiraoCommand& command)
+{
+	MMThreadGuard guard(sdklock_);
+	CalibrationRef set(calibrations_);
+	// Actuator commands for zer_applied_ after the command; Zernike targets are
+	// projected once for the whole command
+	float applied[MIRAO_NB_ACTUATORS];
+	bool known = true;
+	if (command.type == MiraoCommand::LoadWavefront)
+	{
+		// A file the adapter cannot parse is still handed to the backend as is
+		MiraoWavefrontState state;
+		bool parsed = state.Load(command.path);
+		MM::MMTime sdkstart = this->GetCurrentMMTime();
+		bool ok = parsed ? set->backend.ApplyAbsolute(state, command.path) : set->backend.ApplyAbsolute(command.path);
+		worker_->SdkCalled(sdkstart.getUsec(), this->GetCurrentMMTime().getUsec());
+		if (!ok)
+		{
+			this->LogMessage("Mirror update failed, could not apply " + command.path);
+			return ERR_MIRROR_UPDATE;
+		}
+		for (int j = 1; j <= MIRAO_MAX_ZERNIKES; j++)
+			zer_applied_[j] = 0;
+		saturatedwrite_ = false;
+		if (parsed)
+		{
+			wfcstate_ = state;
+			projector_.SetBase(wfcstate_.position);
+			projector_.SetLimits(wfcstate_.minCommand, wfcstate_.maxCommand);
+			UpdateSettleTime();
+		}
+	}
+	else if (command.type == MiraoCommand::ApplyPreset)
+	{
+		// Parsed when the preset was added; only the SDK reads its file
+		const MiraoPreset& preset = presets_.Get(command.preset);
+		MM::MMTime sdkstart = this->GetCurrentMMTime();
+		bool ok = set->backend.ApplyAbsolute(preset.state, preset.path);
+		worker_->SdkCalled(sdkstart.getUsec(), this->GetCurrentMMTime().getUsec());
+		if (!ok)
+		{
+			this->LogMessage("Mirror update failed, could not apply preset " + preset.name);
+			return ERR_MIRROR_UPDATE;
+		}
+		for (int j = 1; j <= MIRAO_MAX_ZERNIKES; j++)
+			zer_applied_[j] = 0;
+		saturatedwrite_ = false;
+		wfcstate_ = preset.state;
+		projector_.SetBase(wfcstate_.position);
+		projector_.SetLimits(wfcstate_.minCommand, wfcstate_.maxCommand);
+		UpdateSettleTime();
+	}
+	else if (command.type == MiraoCommand::ApplyActuators)
+	{
+		float target[MIRAO_NB_ACTUATORS];
+		wfcstate_.Limit(command.actuators, target);
+		bool redundant;
+		{
+			MMThreadGuard guard(statelock_);
+			redundant = actuatorsknown_ && MiraoCommandSteps(target, actuators_, dacresolution_) <= writedeadband_;
+			// the mirror stays where it is, so that is the new reference
+			if (redundant)
+				memcpy(target, actuators_, sizeof(target));
+		}
+		if (redundant)
+		{
+			writessuppressed_.Increment();
+		}
+		else
+		{
+			int ret = ApplyActuators(set.get(), target);
+			if (ret != DEVICE_OK)
+				return ret;
+		}
+		for (int j = 1; j <= MIRAO_MAX_ZERNIKES; j++)
+			zer_applied_[j] = 0;
+		saturatedwrite_ = false;
+		memcpy(wfcstate_.position, target, sizeof(target));
+		projector_.SetBase(wfcstate_.position);
+	}
+	else
+	{
+		known = ProjectActuators(command.zernikes, applied);
+		if (IsRedundantWrite(command.zernikes, applied))
+		{
+			writessuppressed_.Increment();
+			return DEVICE_OK;
+		}
+		// The SDK conversion clips every actuator on its own. Beyond its order, when
+		// the request is out of range and on the write after that, the constrained
+		// native projection is applied as absolute commands instead.
+		bool absolute = nbzernikes_ > MIRAO_SDK_ZERNIKES;
+		bool saturated = false;
+		if (projector_.IsReady())
+		{
+			saturated = projector_.GetSaturated() > 0;
+			absolute = absolute || saturated || saturatedwrite_;
+		}
+		if (!absolute)
+		{
+			float delta[MIRAO_MAX_ZERNIKES + 1];
+			for (int j = 1; j <= nbzernikes_; j++)
+				delta[j] = command.zernikes[j] - zer_applied_[j];
+			EnsureDiversity(set.get());
+			MM::MMTime sdkstart = this->GetCurrentMMTime();
+			set->backend.ApplyRelative(delta, nbzernikes_);
+			worker_->SdkCalled(sdkstart.getUsec(), this->GetCurrentMMTime().getUsec());
+		}
+		else
+		{
+			int ret = ApplyActuators(set.get(), applied);
+			if (ret != DEVICE_OK)
+				return ret;
+		}
+		saturatedwrite_ = saturated;
+		memcpy(zer_applied_, command.zernikes, sizeof(zer_applied_));
+	}
+	if (command.type != MiraoCommand::ApplyZernikes)
+		known = ProjectActuators(zer_applied_, applied);
+	StartSettling(UpdateActuators(zer_applied_, applied, known));
+	return DEVICE_OK;
+}
+
+// Writes an absolute actuator vector with the limits of the wavefront in use.
+// Call with sdklock_ held. On failure the mirror has not moved and the caller
+// keeps its state.
+template <class TBackend>
+int Mirao52eDevice<TBackend>::ApplyActuators(CalibrationSet* set, const float* actuators)
+{
+	MM::MMTime sdkstart = this->GetCurrentMMTime();
+	MiraoWavefrontState state = wfcstate_;
+	memcpy(state.position, actuators, sizeof(state.position));
+	bool applied = set->backend.ApplyAbsolute(state, "");
+	worker_->SdkCalled(sdkstart.getUsec(), this->GetCurrentMMTime().getUsec());
+	if (!applied)
+	{
+		this->LogMessage("Mirror update failed, could not apply the actuator commands");
+		return ERR_MIRROR_UPDATE;
+	}
+	return DEVICE_OK;
+}
+
+// Current actuator commands, from the adapter's own bookkeeping when it knows
+// them and read back from the mirror otherwise
+template <class TBackend>
+int Mirao52eDevice<TBackend>::ReadActuators(float* actuators)
+{
+	{
+		MMThreadGuard guard(statelock_);
+		if (actuatorsknown_)
+		{
+			memcpy(actuators, actuators_, sizeof(actuators_));
+			return DEVICE_OK;
+		}
+	}
+	worker_->Flush();
+	MMThreadGuard guard(sdklock_);
+	CalibrationRef set(calibrations_);
+	if (set.get() == 0)
+		return DEVICE_NOT_CONNECTED;
+	EnsureDiversity(set.get());
+	if (!set->backend.ReadPositions(actuators))
+		return ERR_MIRROR_READBACK;
+	return DEVICE_OK;
+}
+
+// Set one actuator, the others stay where they are
+template <class TBackend>
+int Mirao52eDevice<TBackend>::SetActuator(int index, float value)
+{
+	MMThreadGuard guard(mirrorlock_);
+	worker_->Flush();
+	float actuators[MIRAO_NB_ACTUATORS];
+	int ret = ReadActuators(actuators);
+	if (ret != DEVICE_OK)
+		return ret;
+	actuators[index] = value;
+	return SubmitActuators(actuators);
+}
+
+// Set all actuators at once and apply them as a single mirror update
+template <class TBackend>
+int Mirao52eDevice<TBackend>::SetActuatorVector(const std::string& values)
+{
+	std::vector<float> actuators;
+	if (!parseactuators(values, actuators))
+		return ERR_INVALID_ACTUATOR_VECTOR;
+	return SubmitActuators(&actuators[0]);
+}
+
+// Queue actuator commands as the new absolute mirror state. As after loading a
+// wavefront, the Zernike modes are relative to this state from then on.
+template <class TBackend>
+int Mirao52eDevice<TBackend>::SubmitActuators(const float* actuators)
+{
+	MMThreadGuard guard(mirrorlock_);
+	preset_ = -1;
+	for (int j = 1; j <= MIRAO_MAX_ZERNIKES; j++)
+		zer_store[j] = zer_rel[j] = 0;
+	MiraoCommand command;
+	command.type = MiraoCommand::ApplyActuators;
+	memcpy(command.actuators, actuators, sizeof(command.actuators));
+	worker_->Submit(command);
+	return DEVICE_OK;
+}
+
+// Pre-parse a Zernike vector sequence loaded by MMCore
+template <class TBackend>
+int Mirao52eDevice<TBackend>::LoadZernikeSequence(const std::vector<std::string>& sequence)
+{
+	std::vector< std::vector<float> > parsed(sequence.size());
+	for (size_t i = 0; i < sequence.size(); i++)
+	{
+		if (!parsezernikes(sequence[i], nbzernikes_, parsed[i]))
+			return ERR_INVALID_ZERNIKE_VECTOR;
+	}
+	sequencethread_->Stop();
+	sequence_.swap(parsed);
+	return DEVICE_OK;
+}
+
+// Called from the sequence thread for every step of a running sequence
+template <class TBackend>
+int Mirao52eDevice<TBackend>::SequenceStep(int index)
+{
+	if (sequencepresets_)
+		return SelectPreset(presetsequence_[index]);
+	return ApplyZernikeVector(sequence_[index]);
+}
+
+// Set all Zernike modes at once and apply them as a single mirror update
+template <class TBackend>
+int Mirao52eDevice<TBackend>::SetZernikeVector(const std::string& values)
+{
+	std::vector<float> coefs;
+	if (!parsezernikes(values, nbzernikes_, coefs))
+		return ERR_INVALID_ZERNIKE_VECTOR;
+	return ApplyZernikeVector(coefs);
+}
+
+template <class TBackend>
+int Mirao52eDevice<TBackend>::ApplyZernikeVector(const std::vector<float>& coefs)
+{
+	MM::MMTime requested = this->GetCurrentMMTime();
+	MMThreadGuard guard(mirrorlock_);
+	for (int j = 1; j <= (int)coefs.size(); j++)
+		zer_rel[j] = coefs[j - 1] - zer_store[j];
+	return ApplyZernmodes(requested.getUsec());
+}
+
+// Set Zernike modes. requested_us is when the request came in, now if 0.
+template <class TBackend>
+int Mirao52eDevice<TBackend>::ApplyZernmodes(double requested_us)
+{
+	if (requested_us == 0)
+		requested_us = this->GetCurrentMMTime().getUsec();
+	MMThreadGuard guard(mirrorlock_);
+
+	for (int j = 1; j <= MIRAO_MAX_ZERNIKES; j++)
+	{
+		zer_store[j] += zer_rel[j];
+		zer_rel[j] = 0;
+	}
+	return SubmitZernikes(requested_us);
+}
+
+template <class TBackend>
+int Mirao52eDevice<TBackend>::SetZernMode(int mode, float Acoef)
+{
+	MMThreadGuard guard(mirrorlock_);
+	zer_rel[mode] = Acoef - zer_store[mode];
+	return DEVICE_OK;
+}
+
+// Zernike state as stored by ApplyZernikes, for the optimiser
+template <class TBackend>
+int Mirao52eDevice<TBackend>::GetZernikes(float* zernikes)
+{
+	MMThreadGuard guard(mirrorlock_);
+	memcpy(zernikes, zer_store, sizeof(zer_store));
+	return DEVICE_OK;
+}
+
+// Move to an optimiser probe without changing the Zernike state, and return
+// once the mirror has settled
+template <class TBackend>
+int Mirao52eDevice<TBackend>::MoveZernikes(const float* zernikes)
+{
+	long sequence;
+	{
+		MMThreadGuard guard(mirrorlock_);
+		MiraoCommand command;
+		command.type = MiraoCommand::ApplyZernikes;
+		for (int j = 0; j <= MIRAO_MAX_ZERNIKES; j++)
+			command.zernikes[j] = zernikes[j] + zer_depth_[j] + zer_field_[j] + zer_loop_[j];
+		sequence = worker_->Submit(command);
+	}
+	worker_->Flush();
+	int ret = worker_->GetResult(sequence);
+	if (ret != DEVICE_OK)
+		return ret;
+
+	double remaining_ms = (GetSettleEnd() - this->GetCurrentMMTime()).getMsec();
+	if (remaining_ms > 0)
+		CDeviceUtils::SleepMs((long)remaining_ms + 1);
+	return DEVICE_OK;
+}
+
+// Store the optimiser result as the Zernike state and apply it
+template <class TBackend>
+int Mirao52eDevice<TBackend>::SetZernikes(const float* zernikes)
+{
+	MMThreadGuard guard(mirrorlock_);
+	for (int j = 1; j <= MIRAO_MAX_ZERNIKES; j++)
+	{
+		zer_store[j] = zernikes[j];
+		zer_rel[j] = 0;
+	}
+	return SubmitZernikes();
+}
+
+// The optimiser camera, if it exists and gives 8 or 16-bit images
+template <class TBackend>
+int Mirao52eDevice<TBackend>::GetOptimiserCamera(MM::Camera*& camera)
+{
+	MM::Device* device = this->GetCoreCallback()->GetDevice(this, optimisercamera_.c_str());
+	if (device == 0 || device->GetType() != MM::CameraDevice)
+		return ERR_OPTIMISER_CAMERA;
+	camera = static_cast<MM::Camera*>(device);
+	unsigned bytes = camera->GetImageBytesPerPixel();
+	if (bytes != 1 && bytes != 2)
+		return ERR_OPTIMISER_CAMERA;
+	return DEVICE_OK;
+}
+
+template <class TBackend>
+int Mirao52eDevice<TBackend>::StartOptimiser()
+{
+	int ret = GetOptimiserCamera(optimisersettings_.camera);
+	if (ret != DEVICE_OK)
+		return ret;
+	if (optimisersettings_.modes.empty())
+		return ERR_OPTIMISER_MODES;
+	if (diversitymeasurement_->IsRunning() || !optimiser_->Start(optimisersettings_))
+		return ERR_OPTIMISER_BUSY;
+	return DEVICE_OK;
+}
+
+// Phase diversity with the preferences and calibration parameters in use by the SDK
+template <class TBackend>
+int Mirao52eDevice<TBackend>::StartDiversity()
+{
+	MM::Camera* camera;
+	int ret = GetOptimiserCamera(camera);
+	if (ret != DEVICE_OK)
+		return ret;
+	if (optimiser_->IsRunning() || diversitymeasurement_->IsRunning())
+		return ERR_OPTIMISER_BUSY;
+	MiraoDiversitySettings settings;
+	if (!settings.Load(divprefpath_, calibparamspath_))
+		return ERR_DIVERSITY_SETTINGS;
+	if (!diversitymeasurement_->Start(camera, settings, (int)diversitythreads_))
+		return ERR_DIVERSITY_SETTINGS;
+	return DEVICE_OK;
+}
+
+// Parses the wavefront files of the preset list; without a list the table
+// stays empty
+template <class TBackend>
+int Mirao52eDevice<TBackend>::LoadPresets()
+{
+	MMThreadGuard guard(mirrorlock_);
+	worker_->Flush();
+	presets_.Clear();
+	preset_ = -1;
+	if (!fileexists(presetlistpath_))
+		return DEVICE_OK;
+	return presets_.Load(presetlistpath_) ? DEVICE_OK : ERR_PRESET;
+}
+
+// Queue a preset as the new absolute mirror state. Its file was parsed when
+// the preset was added, so the worker only hands it to the SDK.
+template <class TBackend>
+int Mirao52eDevice<TBackend>::SelectPreset(int index)
+{
+	MMThreadGuard guard(mirrorlock_);
+	if (index < 0 || index >= presets_.Size())
+		return ERR_PRESET;
+	preset_ = index;
+	for (int j = 1; j <= MIRAO_MAX_ZERNIKES; j++)
+		zer_store[j] = zer_rel[j] = 0;
+	MiraoCommand command;
+	command.type = MiraoCommand::ApplyPreset;
+	command.preset = index;
+	worker_->Submit(command);
+	return DEVICE_OK;
+}
+
+// Store the current actuator commands, with the limits of the wavefront in
+// use, as a preset. Its file is written here, once.
+template <class TBackend>
+int Mirao52eDevice<TBackend>::StorePreset(const std::string& name)
+{
+	// The worker reads the table under sdklock_; with mirrorlock_ held nothing
+	// new is queued once it is flushed, and the actuators are those last queued
+	MMThreadGuard guard(mirrorlock_);
+	worker_->Flush();
+	float actuators[MIRAO_NB_ACTUATORS];
+	int ret = ReadActuators(actuators);
+	if (ret != DEVICE_OK)
+		return ret;
+	{
+		MMThreadGuard guard(sdklock_);
+		MiraoWavefrontState state = wfcstate_;
+		memcpy(state.position, actuators, sizeof(state.position));
+		int index = presets_.Find(name);
+		if (index < 0)
+			index = presets_.Size();
+		std::string path = std::string(g_preset_path) + CDeviceUtils::ConvertToString(index) + ".wcs";
+		if (presets_.Add(name, path, state) < 0)
+			return ERR_PRESET;
+	}
+	UpdatePresetValues();
+	return DEVICE_OK;
+}
+
+// Allowed values of the preset properties after the table changed
+template <class TBackend>
+void Mirao52eDevice<TBackend>::UpdatePresetValues()
+{
+	this->ClearAllowedValues(g_Preset);
+	this->AddAllowedValue(g_Preset, g_PresetNone);
+	for (int i = 0; i < presets_.Size(); i++)
+		this->AddAllowedValue(g_Preset, presets_.Get(i).name.c_str());
+	this->SetPropertyLimits(g_PresetIndex, -1, presets_.Size() - 1);
+	this->OnPropertiesChanged();
+}
+
+// Replaces the depth table with the points in path; a running depth
+// correction continues with the new table at the next focus move
+template <class TBackend>
+int Mirao52eDevice<TBackend>::LoadDepthTable(const std::string& path)
+{
+	MMThreadGuard guard(mirrorlock_);
+	if (!depthtable_.Load(path))
+		return ERR_DEPTH_TABLE;
+	depthpath_ = path;
+	return DEVICE_OK;
+}
+
+// Store the current correction at the current focus position as a point of
+// the depth table. With depth correction on, the Zernike state is folded into
+// the table, so the mirror stays where it is.
+template <class TBackend>
+int Mirao52eDevice<TBackend>::StoreDepthPoint()
+{
+	double z;
+	int ret = ReadFocus(z);
+	if (ret != DEVICE_OK)
+		return ret;
+	MMThreadGuard guard(mirrorlock_);
+	float total[MIRAO_MAX_ZERNIKES + 1];
+	for (int j = 0; j <= MIRAO_MAX_ZERNIKES; j++)
+		total[j] = zer_store[j] + zer_depth_[j];
+	depthtable_.Add(z, total);
+	if (focustracker_->IsRunning())
+	{
+		for (int j = 0; j <= MIRAO_MAX_ZERNIKES; j++)
+			zer_store[j] = zer_rel[j] = 0;
+		depthtable_.Interpolate(z, depthspline_, zer_depth_);
+		depthz_ = z;
+		this->OnPropertiesChanged();
+	}
+	return DEVICE_OK;
+}
+
+// Position of the depth correction focus device, or of the core's focus
+// device if none is set
+template <class TBackend>
+int Mirao52eDevice<TBackend>::ReadFocus(double& z)
+{
+	if (focusdevice_.empty())
+		return this->GetCoreCallback()->GetFocusPosition(z) == DEVICE_OK ? DEVICE_OK : ERR_DEPTH_FOCUS;
+	MM::Device* device = this->GetCoreCallback()->GetDevice(this, focusdevice_.c_str());
+	if (device == 0 || device->GetType() != MM::StageDevice)
+		return ERR_DEPTH_FOCUS;
+	return static_cast<MM::Stage*>(device)->GetPositionUm(z);
+}
+
+// Called from the focus tracker once the focus has moved: the correction
+// interpolated at z replaces the previous one in a single mirror update
+template <class TBackend>
+int Mirao52eDevice<TBackend>::ApplyDepth(double z)
+{
+	MMThreadGuard guard(mirrorlock_);
+	if (!depthtable_.Interpolate(z, depthspline_, zer_depth_))
+		return ERR_DEPTH_TABLE;
+	depthz_ = z;
+	return SubmitZernikes();
+}
+
+template <class TBackend>
+int Mirao52eDevice<TBackend>::StartDepthCorrection()
+{
+	if (depthtable_.Size() == 0)
+		return ERR_DEPTH_TABLE;
+	double z;
+	int ret = ReadFocus(z);
+	if (ret != DEVICE_OK)
+		return ret;
+	focustracker_->Start(depthinterval_ms_, g_depthTolerance);
+	return DEVICE_OK;
+}
+
+// Stops following the focus and removes the depth correction from the mirror
+template <class TBackend>
+int Mirao52eDevice<TBackend>::StopDepthCorrection()
+{
+	focustracker_->Stop();
+	MMThreadGuard guard(mirrorlock_);
+	for (int j = 0; j <= MIRAO_MAX_ZERNIKES; j++)
+		zer_depth_[j] = 0;
+	return SubmitZernikes();
+}
+
+// Replaces the field map with the one in path; a running field correction
+// continues with the new map at the next stage move
+template <class TBackend>
+int Mirao52eDevice<TBackend>::LoadFieldMap(const std::string& path)
+{
+	MMThreadGuard guard(mirrorlock_);
+	if (!fieldmap_.Load(path))
+		return ERR_FIELD_MAP;
+	fieldpath_ = path;
+	return DEVICE_OK;
+}
+
+// Store the current correction at the current stage position as a point of
+// the field map. With field correction on, the Zernike state is folded into
+// the map, so the mirror stays where it is.
+template <class TBackend>
+int Mirao52eDevice<TBackend>::StoreFieldPoint()
+{
+	double x, y;
+	int ret = ReadXY(x, y);
+	if (ret != DEVICE_OK)
+		return ret;
+	MMThreadGuard guard(mirrorlock_);
+	float total[MIRAO_MAX_ZERNIKES + 1];
+	for (int j = 0; j <= MIRAO_MAX_ZERNIKES; j++)
+		total[j] = zer_store[j] + zer_field_[j];
+	fieldmap_.Add(x, y, total);
+	if (xytracker_->IsRunning())
+	{
+		for (int j = 0; j <= MIRAO_MAX_ZERNIKES; j++)
+			zer_store[j] = zer_rel[j] = 0;
+		fieldmap_.Interpolate(x, y, zer_field_);
+		fieldx_ = x;
+		fieldy_ = y;
+		this->OnPropertiesChanged();
+	}
+	return DEVICE_OK;
+}
+
+template <class TBackend>
+int Mirao52eDevice<TBackend>::ReadXY(double& x, double& y)
+{
+	if (xystage_.empty())
+		return ERR_FIELD_STAGE;
+	MM::Device* device = this->GetCoreCallback()->GetDevice(this, xystage_.c_str());
+	if (device == 0 || device->GetType() != MM::XYStageDevice)
+		return ERR_FIELD_STAGE;
+	return static_cast<MM::XYStage*>(device)->GetPositionUm(x, y);
+}
+
+// Called from the XY tracker once the stage has moved: the correction
+// interpolated at (x, y) replaces the previous one in a single mirror update
+template <class TBackend>
+int Mirao52eDevice<TBackend>::ApplyField(double x, double y)
+{
+	MMThreadGuard guard(mirrorlock_);
+	if (!fieldmap_.Interpolate(x, y, zer_field_))
+		return ERR_FIELD_MAP;
+	fieldx_ = x;
+	fieldy_ = y;
+	return SubmitZernikes();
+}
+
+template <class TBackend>
+int Mirao52eDevice<TBackend>::StartFieldCorrection()
+{
+	if (fieldmap_.Size() == 0)
+		return ERR_FIELD_MAP;
+	double x, y;
+	int ret = ReadXY(x, y);
+	if (ret != DEVICE_OK)
+		return ret;
+	xytracker_->Start(fieldinterval_ms_, g_fieldTolerance);
+	return DEVICE_OK;
+}
+
+// Stops following the stage and removes the field correction from the mirror
+template <class TBackend>
+int Mirao52eDevice<TBackend>::StopFieldCorrection()
+{
+	xytracker_->Stop();
+	MMThreadGuard guard(mirrorlock_);
+	for (int j = 0; j <= MIRAO_MAX_ZERNIKES; j++)
+		zer_field_[j] = 0;
+	return SubmitZernikes();
+}
+
+// Replaces the replayed frames; a running measurement restarts on them
+template <class TBackend>
+int Mirao52eDevice<TBackend>::LoadShackHartmannFrames(const std::string& path)
+{
+	const bool running = framereplay_->IsRunning();
+	StopShackHartmann();
+	if (!framereplay_->Load(path))
+		return ERR_SH_FRAMES;
+	shpath_ = path;
+	return running ? StartShackHartmann() : DEVICE_OK;
+}
+
+// Lays the subapertures of the current calibration on the frames and starts
+// replaying them into the slope pipeline
+template <class TBackend>
+int Mirao52eDevice<TBackend>::StartShackHartmann()
+{
+	StopShackHartmann();
+	if (framereplay_->GetNbFrames() == 0 && !framereplay_->Load(shpath_))
+		return ERR_SH_FRAMES;
+	MiraoCalibration calib;
+	{
+		MMThreadGuard guard(sdklock_);
+		calib = calib_;
+	}
+	if (!shackhartmann_->Configure(shsettings_, calib, framereplay_->GetWidth(), framereplay_->GetHeight()))
+		return ERR_SH_GEOMETRY;
+	shackhartmann_->Start(shthreads_);
+	framereplay_->Start(shinterval_ms_);
+	return DEVICE_OK;
+}
+
+template <class TBackend>
+int Mirao52eDevice<TBackend>::StopShackHartmann()
+{
+	framereplay_->Stop();
+	shackhartmann_->Stop();
+	return DEVICE_OK;
+}
+
+// Geometry and threads take effect by restarting, which clears the reference
+template <class TBackend>
+int Mirao52eDevice<TBackend>::RestartShackHartmann()
+{
+	return framereplay_->IsRunning() ? StartShackHartmann() : DEVICE_OK;
+}
+
+// Called by the closed loop every cycle it has a new correction
+template <class TBackend>
+int Mirao52eDevice<TBackend>::ApplyLoop(const float* zernikes)
+{
+	MMThreadGuard guard(mirrorlock_);
+	memcpy(zer_loop_, zernikes, sizeof(zer_loop_));
+	return SubmitZernikes();
+}
+
+// Headroom of every mode at the last executed command
+template <class TBackend>
+void Mirao52eDevice<TBackend>::GetHeadroom(float* up, float* down)
+{
+	MMThreadGuard guard(statelock_);
+	memcpy(up, headroomup_, sizeof(headroomup_));
+	memcpy(down, headroomdown_, sizeof(headroomdown_));
+}
+
+// The reconstructor is built from the calibration in use; load a calibration
+// before starting the loop, not while it runs
+template <class TBackend>
+int Mirao52eDevice<TBackend>::StartLoop()
+{
+	loop_->Stop();
+	if (!framereplay_->IsRunning())
+		return ERR_LOOP_SLOPES;
+	MiraoCalibration calib;
+	MiraoProjector projector;
+	{
+		MMThreadGuard guard(sdklock_);
+		calib = calib_;
+		projector = projector_;
+	}
+	MiraoReconstructor reconstructor;
+	if (!reconstructor.Build(calib, projector, nbzernikes_) || reconstructor.GetNbSubap() != shackhartmann_->GetNbSubap())
+		return ERR_LOOP_SLOPES;
+	loop_->Start(loopsettings_, reconstructor);
+	return DEVICE_OK;
+}
+
+// Stops the loop and folds its correction into the Zernike state, so the
+// mirror holds it and it shows in the Zernike properties
+template <class TBackend>
+int Mirao52eDevice<TBackend>::StopLoop()
+{
+	loop_->Stop();
+	MMThreadGuard guard(mirrorlock_);
+	for (int j = 0; j <= MIRAO_MAX_ZERNIKES; j++)
+	{
+		zer_store[j] += zer_loop_[j];
+		zer_loop_[j] = 0;
+	}
+	this->OnPropertiesChanged();
+	return DEVICE_OK;
+}
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Action handlers
+// Handle changes and updates to property values.
+///////////////////////////////////////////////////////////////////////////////
+
+
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnSetCalibration(MM::PropertyBase* pProp, MM::ActionType eAct)
+{
+   if (eAct == MM::BeforeGet)
+   {
+		pProp->Set(calibpath_.c_str()); 
+   }
+   else if (eAct == MM::AfterSet)
+   {
+      std::basic_string<char> path;;
+      pProp->Get(path);
+      return SetCalibration(path);
+   }
+   return DEVICE_OK;
+}
+
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnSetCalibrationParams(MM::PropertyBase* pProp, MM::ActionType eAct)
+{
+   if (eAct == MM::BeforeGet)
+   {
+	   pProp->Set(calibparamspath_.c_str()); 
+   }
+   else if (eAct == MM::AfterSet)
+   {
+      std::basic_string<char> path;;
+      pProp->Get(path);
+      return SetCalibrationParams(path);
+   }
+   return DEVICE_OK;
+}
+
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnSetDiversityPref(MM::PropertyBase* pProp, MM::ActionType eAct)
+{
+   if (eAct == MM::BeforeGet)
+   {
+	// string val;
+    pProp->Set(divprefpath_.c_str()); 
+   }
+   else if (eAct == MM::AfterSet)
+   {
+      std::basic_string<char> path;;
+      pProp->Get(path);
+      return SetDiversityPref(path);
+   }
+   return DEVICE_OK;
+}
+
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnLoadWavefront(MM::PropertyBase* pProp, MM::ActionType eAct)
+{
+   if (eAct == MM::BeforeGet)
+   {
+    pProp->Set(wfcpath_.c_str()); 
+   }
+   else if (eAct == MM::AfterSet)
+   {
+      std::basic_string<char> path;;
+      pProp->Get(path);
+      return LoadWavefront(path);
+   }
+   return DEVICE_OK;
+}
+
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnSaveCurrentPosition(MM::PropertyBase* pProp, MM::ActionType eAct)
+{
+   if (eAct == MM::BeforeGet)
+   {
+   pProp->Set(savepath_.c_str()); 
+   }
+   else if (eAct == MM::AfterSet)
+   {
+      std::basic_string<char> path;;
+      pProp->Get(path);
+      return SaveCurrentPosition(path);
+   }
+   return DEVICE_OK;
+}
+
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnProjectionTime(MM::PropertyBase* pProp, MM::ActionType eAct)
+{
+   if (eAct == MM::BeforeGet)
+   {
+      pProp->Set(projectiontime_us_);
+   }
+   return DEVICE_OK;
+}
+
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnProjectionResidual(MM::PropertyBase* pProp, MM::ActionType eAct)
+{
+   if (eAct == MM::BeforeGet)
+   {
+      pProp->Set(projectionresidual_);
+   }
+   return DEVICE_OK;
+}
+
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnSaturatedActuators(MM::PropertyBase* pProp, MM::ActionType eAct)
+{
+   if (eAct == MM::BeforeGet)
+   {
+      pProp->Set(saturatedactuators_);
+   }
+   return DEVICE_OK;
+}
+
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnZernikeVector(MM::PropertyBase* pProp, MM::ActionType eAct)
+{
+   if (eAct == MM::BeforeGet)
+   {
+      float zernikes[MIRAO_MAX_ZERNIKES + 1];
+      zernikes[0] = 0;
+      {
+         MMThreadGuard guard(mirrorlock_);
+         for (int j = 1; j <= nbzernikes_; j++)
+            zernikes[j] = zer_store[j] + zer_rel[j];
+      }
+      pProp->Set(formatzernikes(zernikes, nbzernikes_).c_str());
+   }
+   else if (eAct == MM::AfterSet)
+   {
+      std::string values;
+      pProp->Get(values);
+      return SetZernikeVector(values);
+   }
+   else if (eAct == MM::IsSequenceable)
+   {
+      pProp->SetSequenceable(g_maxSequenceLength);
+   }
+   else if (eAct == MM::AfterLoadSequence)
+   {
+      return LoadZernikeSequence(pProp->GetSequence());
+   }
+   else if (eAct == MM::StartSequence)
+   {
+      if (sequence_.empty())
+         return ERR_INVALID_ZERNIKE_VECTOR;
+      sequencethread_->Stop();
+      sequencepresets_ = false;
+      sequencethread_->Start((int)sequence_.size(), sequenceinterval_ms_);
+   }
+   else if (eAct == MM::StopSequence)
+   {
+      sequencethread_->Stop();
+   }
+   return DEVICE_OK;
+}
+
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnActuatorVector(MM::PropertyBase* pProp, MM::ActionType eAct)
+{
+   if (eAct == MM::BeforeGet)
+   {
+      float actuators[MIRAO_NB_ACTUATORS];
+      int ret = ReadActuators(actuators);
+      if (ret != DEVICE_OK)
+         return ret;
+      pProp->Set(formatactuators(actuators).c_str());
+   }
+   else if (eAct == MM::AfterSet)
+   {
+      std::string values;
+      pProp->Get(values);
+      return SetActuatorVector(values);
+   }
+   return DEVICE_OK;
+}
+
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnActuator(MM::PropertyBase* pProp, MM::ActionType eAct, long index)
+{
+   if (eAct == MM::BeforeGet)
+   {
+      float actuators[MIRAO_NB_ACTUATORS];
+      int ret = ReadActuators(actuators);
+      if (ret != DEVICE_OK)
+         return ret;
+      pProp->Set((double)actuators[index]);
+   }
+   else if (eAct == MM::AfterSet)
+   {
+      double value;
+      pProp->Get(value);
+      return SetActuator(index, (float)value);
+   }
+   return DEVICE_OK;
+}
+
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnQueueDepth(MM::PropertyBase* pProp, MM::ActionType eAct)
+{
+   if (eAct == MM::BeforeGet)
+   {
+      pProp->Set((long)worker_->GetQueueDepth());
+   }
+   return DEVICE_OK;
+}
+
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnCommandsSubmitted(MM::PropertyBase* pProp, MM::ActionType eAct)
+{
+   if (eAct == MM::BeforeGet)
+   {
+      pProp->Set(worker_->GetSubmitted());
+   }
+   return DEVICE_OK;
+}
+
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnCommandsCompleted(MM::PropertyBase* pProp, MM::ActionType eAct)
+{
+   if (eAct == MM::BeforeGet)
+   {
+      pProp->Set(worker_->GetCompleted());
+   }
+   return DEVICE_OK;
+}
+
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnCommandsCoalesced(MM::PropertyBase* pProp, MM::ActionType eAct)
+{
+   if (eAct == MM::BeforeGet)
+   {
+      pProp->Set(worker_->GetCoalesced());
+   }
+   return DEVICE_OK;
+}
+
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnCommandsFailed(MM::PropertyBase* pProp, MM::ActionType eAct)
+{
+   if (eAct == MM::BeforeGet)
+   {
+      pProp->Set(worker_->GetFailed());
+   }
+   return DEVICE_OK;
+}
+
+// Error code of the last mirror update that failed on the worker thread, 0 if none
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnLastMirrorError(MM::PropertyBase* pProp, MM::ActionType eAct)
+{
+   if (eAct == MM::BeforeGet)
+   {
+      pProp->Set((long)worker_->GetLastError());
+   }
+   return DEVICE_OK;
+}
+
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnSequenceInterval(MM::PropertyBase* pProp, MM::ActionType eAct)
+{
+   if (eAct == MM::BeforeGet)
+   {
+      pProp->Set(sequenceinterval_ms_);
+   }
+   else if (eAct == MM::AfterSet)
+   {
+      pProp->Get(sequenceinterval_ms_);
+   }
+   return DEVICE_OK;
+}
+
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnSettleTime(MM::PropertyBase* pProp, MM::ActionType eAct)
+{
+   if (eAct == MM::BeforeGet)
+   {
+      pProp->Set(settletime_ms_);
+   }
+   else if (eAct == MM::AfterSet)
+   {
+      MMThreadGuard guard(statelock_);
+      pProp->Get(settletime_ms_);
+   }
+   return DEVICE_OK;
+}
+
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnSettleTimePerStep(MM::PropertyBase* pProp, MM::ActionType eAct)
+{
+   if (eAct == MM::BeforeGet)
+   {
+      pProp->Set(settletimeperstep_ms_);
+   }
+   else if (eAct == MM::AfterSet)
+   {
+      MMThreadGuard guard(statelock_);
+      pProp->Get(settletimeperstep_ms_);
+   }
+   return DEVICE_OK;
+}
+
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnDacResolution(MM::PropertyBase* pProp, MM::ActionType eAct)
+{
+   if (eAct == MM::BeforeGet)
+   {
+      pProp->Set(dacresolution_);
+   }
+   else if (eAct == MM::AfterSet)
+   {
+      double resolution;
+      pProp->Get(resolution);
+      if (resolution <= 0)
+         return DEVICE_INVALID_PROPERTY_VALUE;
+      MMThreadGuard guard(statelock_);
+      dacresolution_ = resolution;
+   }
+   return DEVICE_OK;
+}
+
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnWriteDeadband(MM::PropertyBase* pProp, MM::ActionType eAct)
+{
+   if (eAct == MM::BeforeGet)
+   {
+      pProp->Set(writedeadband_);
+   }
+   else if (eAct == MM::AfterSet)
+   {
+      MMThreadGuard guard(statelock_);
+      pProp->Get(writedeadband_);
+   }
+   return DEVICE_OK;
+}
+
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnWritesSuppressed(MM::PropertyBase* pProp, MM::ActionType eAct)
+{
+   if (eAct == MM::BeforeGet)
+   {
+      pProp->Set(writessuppressed_.Get());
+   }
+   return DEVICE_OK;
+}
+
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnDiversitySetup(MM::PropertyBase* pProp, MM::ActionType eAct)
+{
+   if (eAct == MM::BeforeGet)
+   {
+      pProp->Set(deferdiversity_ ? g_DiversityOnFirstUse : g_DiversityAtStartup);
+   }
+   else if (eAct == MM::AfterSet)
+   {
+      std::string setup;
+      pProp->Get(setup);
+      deferdiversity_ = setup != g_DiversityAtStartup;
+   }
+   return DEVICE_OK;
+}
+
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnDiversityState(MM::PropertyBase* pProp, MM::ActionType eAct)
+{
+   if (eAct == MM::BeforeGet)
+   {
+      CalibrationRef set(calibrations_);
+      pProp->Set(set.get() && set->diversityready ? "Ready" : "Deferred");
+   }
+   return DEVICE_OK;
+}
+
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnInitTime(MM::PropertyBase* pProp, MM::ActionType eAct, long phase)
+{
+   if (eAct == MM::BeforeGet)
+   {
+      pProp->Set(inittime_ms_[phase]);
+   }
+   return DEVICE_OK;
+}
+
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnLatency(MM::PropertyBase* pProp, MM::ActionType eAct, long index)
+{
+   if (eAct == MM::BeforeGet)
+   {
+      const MiraoLatencyHistogram& latency = worker_->GetTelemetry().GetLatency(index / 3);
+      if (index % 3 == 0)
+         pProp->Set(latency.Percentile(0.5));
+      else if (index % 3 == 1)
+         pProp->Set(latency.Percentile(0.99));
+      else
+         pProp->Set(latency.Max());
+   }
+   return DEVICE_OK;
+}
+
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnAppliesPerSecond(MM::PropertyBase* pProp, MM::ActionType eAct)
+{
+   if (eAct == MM::BeforeGet)
+   {
+      pProp->Set(worker_->GetTelemetry().GetAppliesPerSecond(this->GetCurrentMMTime().getUsec()));
+   }
+   return DEVICE_OK;
+}
+
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnTelemetryRecorded(MM::PropertyBase* pProp, MM::ActionType eAct)
+{
+   if (eAct == MM::BeforeGet)
+   {
+      pProp->Set(worker_->GetTelemetry().GetRecorded());
+   }
+   return DEVICE_OK;
+}
+
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnTelemetryReset(MM::PropertyBase* pProp, MM::ActionType eAct)
+{
+   if (eAct == MM::BeforeGet)
+   {
+      pProp->Set(0L);
+   }
+   else if (eAct == MM::AfterSet)
+   {
+      long reset;
+      pProp->Get(reset);
+      if (reset)
+      {
+         worker_->ResetTelemetry();
+         writessuppressed_.Set(0);
+      }
+   }
+   return DEVICE_OK;
+}
+
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnTelemetryDump(MM::PropertyBase* pProp, MM::ActionType eAct)
+{
+   if (eAct == MM::AfterSet)
+   {
+      std::string path;
+      pProp->Get(path);
+      if (!worker_->GetTelemetry().Dump(path))
+         return ERR_FILE_NONEXIST;
+      telemetrypath_ = path;
+   }
+   return DEVICE_OK;
+}
+
+// Properties of the backend itself, none unless specialised below
+template <class TBackend>
+int Mirao52eDevice<TBackend>::CreateBackendProperties()
 {
-	zer_rel.zernike_coefficients[1] = Acoef - zer_store.zernike_coefficients[1];
 	return DEVICE_OK;
 }
 
-int Mirao52e::SetZernMode_Tilt(float Acoef)
+template <>
+int Mirao52eDevice<MiraoSimBackend>::CreateBackendProperties()
 {
-	zer_rel.zernike_coefficients[2] = Acoef - zer_store.zernike_coefficients[2];
+	CPropertyAction* pAct;
+	int ret;
+
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnSimLatency);
+	ret = CreateProperty(g_SimLatency, CDeviceUtils::ConvertToString(mirror_.GetSettings().latency_ms), MM::Float, false, pAct);
+	if (ret!=DEVICE_OK)
+	   return ret;
+	SetPropertyLimits(g_SimLatency, 0, 100);
+
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnSimSettling);
+	ret = CreateProperty(g_SimSettling, CDeviceUtils::ConvertToString(mirror_.GetSettings().settle_ms), MM::Float, false, pAct);
+	if (ret!=DEVICE_OK)
+	   return ret;
+	SetPropertyLimits(g_SimSettling, 0, 100);
+
+	pAct = new CPropertyAction(this, &Mirao52eDevice::OnSimResolution);
+	ret = CreateProperty(g_SimResolution, CDeviceUtils::ConvertToString(mirror_.GetSettings().resolution), MM::Float, false, pAct);
+	if (ret!=DEVICE_OK)
+	   return ret;
 	return DEVICE_OK;
 }
 
-int Mirao52e::SetZernMode_Defocus(float Acoef)
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnSimLatency(MM::PropertyBase* pProp, MM::ActionType eAct)
+{
+   MiraoSimSettings settings = mirror_.GetSettings();
+   if (eAct == MM::BeforeGet)
+   {
+      pProp->Set(settings.latency_ms);
+   }
+   else if (eAct == MM::AfterSet)
+   {
+      pProp->Get(settings.latency_ms);
+      mirror_.SetSettings(settings);
+   }
+   return DEVICE_OK;
+}
+
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnSimSettling(MM::PropertyBase* pProp, MM::ActionType eAct)
+{
+   MiraoSimSettings settings = mirror_.GetSettings();
+   if (eAct == MM::BeforeGet)
+   {
+      pProp->Set(settings.settle_ms);
+   }
+   else if (eAct == MM::AfterSet)
+   {
+      pProp->Get(settings.settle_ms);
+      mirror_.SetSettings(settings);
+   }
+   return DEVICE_OK;
+}
+
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnSimResolution(MM::PropertyBase* pProp, MM::ActionType eAct)
+{
+   MiraoSimSettings settings = mirror_.GetSettings();
+   if (eAct == MM::BeforeGet)
+   {
+      pProp->Set(settings.resolution);
+   }
+   else if (eAct == MM::AfterSet)
+   {
+      pProp->Get(settings.resolution);
+      mirror_.SetSettings(settings);
+   }
+   return DEVICE_OK;
+}
+
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnNbZernikes(MM::PropertyBase* pProp, MM::ActionType eAct)
+{
+   if (eAct == MM::BeforeGet)
+   {
+      pProp->Set((long)nbzernikes_);
+   }
+   else if (eAct == MM::AfterSet)
+   {
+      long nbzernikes;
+      pProp->Get(nbzernikes);
+      nbzernikes_ = (int)nbzernikes;
+   }
+   return DEVICE_OK;
+}
+
+// Zernike modes
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnApplyZernmodes(MM::PropertyBase* pProp, MM::ActionType eAct)
+{
+   if (eAct == MM::BeforeGet)
+   {
+ //     pProp->Set(false); 
+   }
+   else if (eAct == MM::AfterSet)
+   {
+      return ApplyZernmodes();
+   }
+   return DEVICE_OK;
+}
+
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnZernMode(MM::PropertyBase* pProp, MM::ActionType eAct, long mode)
+{
+   if (eAct == MM::BeforeGet)
+   {
+      MMThreadGuard guard(mirrorlock_);
+      double Acoef = zer_store[mode] + zer_rel[mode];
+      pProp->Set(Acoef);
+   }
+   else if (eAct == MM::AfterSet)
+   {
+      double Acoef;
+      pProp->Get(Acoef);
+      return SetZernMode(mode, (float)Acoef);
+   }
+   return DEVICE_OK;
+}
+
+// Positive mode for the headroom upwards, negative for downwards
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnHeadroom(MM::PropertyBase* pProp, MM::ActionType eAct, long mode)
+{
+   if (eAct == MM::BeforeGet)
+   {
+      MMThreadGuard guard(statelock_);
+      pProp->Set(mode > 0 ? (double)headroomup_[mode] : (double)headroomdown_[-mode]);
+   }
+   return DEVICE_OK;
+}
+
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnOptimise(MM::PropertyBase* pProp, MM::ActionType eAct)
+{
+   if (eAct == MM::BeforeGet)
+   {
+      pProp->Set(optimiser_->IsRunning() ? 1L : 0L);
+   }
+   else if (eAct == MM::AfterSet)
+   {
+      long run;
+      pProp->Get(run);
+      if (run)
+         return StartOptimiser();
+      optimiser_->Stop();
+   }
+   return DEVICE_OK;
+}
+
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnOptimiserCamera(MM::PropertyBase* pProp, MM::ActionType eAct)
+{
+   if (eAct == MM::BeforeGet)
+   {
+      pProp->Set(optimisercamera_.c_str());
+   }
+   else if (eAct == MM::AfterSet)
+   {
+      pProp->Get(optimisercamera_);
+   }
+   return DEVICE_OK;
+}
+
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnOptimiserModes(MM::PropertyBase* pProp, MM::ActionType eAct)
+{
+   if (eAct == MM::BeforeGet)
+   {
+      pProp->Set(formatmodes(optimisersettings_.modes).c_str());
+   }
+   else if (eAct == MM::AfterSet)
+   {
+      std::string values;
+      pProp->Get(values);
+      std::vector<int> modes;
+      if (!parsemodes(values, nbzernikes_, modes))
+         return ERR_OPTIMISER_MODES;
+      optimisersettings_.modes.swap(modes);
+   }
+   return DEVICE_OK;
+}
+
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnOptimiserBias(MM::PropertyBase* pProp, MM::ActionType eAct)
+{
+   if (eAct == MM::BeforeGet)
+   {
+      pProp->Set(optimisersettings_.bias);
+   }
+   else if (eAct == MM::AfterSet)
+   {
+      pProp->Get(optimisersettings_.bias);
+   }
+   return DEVICE_OK;
+}
+
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnOptimiserScheme(MM::PropertyBase* pProp, MM::ActionType eAct)
+{
+   if (eAct == MM::BeforeGet)
+   {
+      pProp->Set(optimisersettings_.scheme == MiraoOptimiserSettings::TwoNPlusOne ? g_OptimiserScheme2N1 : g_OptimiserScheme3N);
+   }
+   else if (eAct == MM::AfterSet)
+   {
+      std::string scheme;
+      pProp->Get(scheme);
+      optimisersettings_.scheme = scheme == g_OptimiserScheme2N1 ? MiraoOptimiserSettings::TwoNPlusOne : MiraoOptimiserSettings::ThreeN;
+   }
+   return DEVICE_OK;
+}
+
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnOptimiserMetric(MM::PropertyBase* pProp, MM::ActionType eAct)
+{
+   if (eAct == MM::BeforeGet)
+   {
+      pProp->Set(g_miraoMetrics[optimisersettings_.metric]);
+   }
+   else if (eAct == MM::AfterSet)
+   {
+      std::string metric;
+      pProp->Get(metric);
+      for (int i = 0; i < MIRAO_NB_METRICS; i++)
+         if (metric == g_miraoMetrics[i])
+            optimisersettings_.metric = i;
+   }
+   return DEVICE_OK;
+}
+
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnOptimiserRounds(MM::PropertyBase* pProp, MM::ActionType eAct)
+{
+   if (eAct == MM::BeforeGet)
+   {
+      pProp->Set((long)optimisersettings_.rounds);
+   }
+   else if (eAct == MM::AfterSet)
+   {
+      long rounds;
+      pProp->Get(rounds);
+      optimisersettings_.rounds = (int)rounds;
+   }
+   return DEVICE_OK;
+}
+
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnOptimiserPipelining(MM::PropertyBase* pProp, MM::ActionType eAct)
+{
+   if (eAct == MM::BeforeGet)
+   {
+      pProp->Set(optimisersettings_.pipelined ? g_On : g_Off);
+   }
+   else if (eAct == MM::AfterSet)
+   {
+      std::string pipelining;
+      pProp->Get(pipelining);
+      optimisersettings_.pipelined = pipelining == g_On;
+   }
+   return DEVICE_OK;
+}
+
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnOptimiserThreads(MM::PropertyBase* pProp, MM::ActionType eAct)
+{
+   if (eAct == MM::BeforeGet)
+   {
+      pProp->Set((long)optimisersettings_.threads);
+   }
+   else if (eAct == MM::AfterSet)
+   {
+      long threads;
+      pProp->Get(threads);
+      optimisersettings_.threads = (int)threads;
+   }
+   return DEVICE_OK;
+}
+
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnOptimiserRoi(MM::PropertyBase* pProp, MM::ActionType eAct)
+{
+   if (eAct == MM::BeforeGet)
+   {
+      pProp->Set(formatroi(optimisersettings_).c_str());
+   }
+   else if (eAct == MM::AfterSet)
+   {
+      std::string values;
+      pProp->Get(values);
+      if (!parseroi(values, optimisersettings_))
+         return ERR_OPTIMISER_ROI;
+   }
+   return DEVICE_OK;
+}
+
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnOptimiserStatus(MM::PropertyBase* pProp, MM::ActionType eAct)
+{
+   if (eAct == MM::BeforeGet)
+   {
+      if (optimiser_->IsRunning())
+         pProp->Set("Running");
+      else if (optimiser_->GetResult() != DEVICE_OK)
+         pProp->Set((std::string("Failed, error ") + CDeviceUtils::ConvertToString(optimiser_->GetResult())).c_str());
+      else
+         pProp->Set("Idle");
+   }
+   return DEVICE_OK;
+}
+
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnOptimiserTime(MM::PropertyBase* pProp, MM::ActionType eAct)
+{
+   if (eAct == MM::BeforeGet)
+   {
+      pProp->Set(optimiser_->GetElapsedMs());
+   }
+   return DEVICE_OK;
+}
+
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnOptimiserMerit(MM::PropertyBase* pProp, MM::ActionType eAct)
 {
-	zer_rel.zernike_coefficients[3] = Acoef - zer_store.zernike_coefficients[3];
-	return DEVICE_OK;
+   if (eAct == MM::BeforeGet)
+   {
+      pProp->Set(optimiser_->GetMerit());
+   }
+   return DEVICE_OK;
 }
 
-int Mirao52e::SetZernMode_Astig0deg(float Acoef)
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnPhaseDiversity(MM::PropertyBase* pProp, MM::ActionType eAct)
 {
-	zer_rel.zernike_coefficients[4] = Acoef - zer_store.zernike_coefficients[4];
-	return DEVICE_OK;
+   if (eAct == MM::BeforeGet)
+   {
+      pProp->Set(diversitymeasurement_->IsRunning() ? 1L : 0L);
+   }
+   else if (eAct == MM::AfterSet)
+   {
+      long run;
+      pProp->Get(run);
+      if (run)
+         return StartDiversity();
+      diversitymeasurement_->Stop();
+   }
+   return DEVICE_OK;
 }
 
-int Mirao52e::SetZernMode_Astig45deg(float Acoef)
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnPhaseDiversityThreads(MM::PropertyBase* pProp, MM::ActionType eAct)
 {
-	zer_rel.zernike_coefficients[5] = Acoef - zer_store.zernike_coefficients[5];
-	return DEVICE_OK;
+   if (eAct == MM::BeforeGet)
+   {
+      pProp->Set(diversitythreads_);
+   }
+   else if (eAct == MM::AfterSet)
+   {
+      pProp->Get(diversitythreads_);
+   }
+   return DEVICE_OK;
 }
 
-int Mirao52e::SetZernMode_Coma0deg(float Acoef)
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnPhaseDiversityStatus(MM::PropertyBase* pProp, MM::ActionType eAct)
 {
-	zer_rel.zernike_coefficients[6] = Acoef - zer_store.zernike_coefficients[6];
-	return DEVICE_OK;
+   if (eAct == MM::BeforeGet)
+   {
+      if (diversitymeasurement_->IsRunning())
+         pProp->Set("Running");
+      else if (diversitymeasurement_->GetResult() != DEVICE_OK)
+         pProp->Set((std::string("Failed, error ") + CDeviceUtils::ConvertToString(diversitymeasurement_->GetResult())).c_str());
+      else
+         pProp->Set("Idle");
+   }
+   return DEVICE_OK;
 }
 
-int Mirao52e::SetZernMode_Coma90deg(float Acoef)
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnPhaseDiversityTime(MM::PropertyBase* pProp, MM::ActionType eAct)
 {
-	zer_rel.zernike_coefficients[7] = Acoef - zer_store.zernike_coefficients[7];
-	return DEVICE_OK;
+   if (eAct == MM::BeforeGet)
+   {
+      pProp->Set(diversitymeasurement_->GetElapsedMs());
+   }
+   return DEVICE_OK;
 }
 
-int Mirao52e::SetZernMode_PrimSpherical(float Acoef)
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnPhaseDiversityRetrievalTime(MM::PropertyBase* pProp, MM::ActionType eAct)
 {
-	zer_rel.zernike_coefficients[8] = Acoef - zer_store.zernike_coefficients[8];
-	return DEVICE_OK;
+   if (eAct == MM::BeforeGet)
+   {
+      pProp->Set(diversitymeasurement_->GetRetrievalMs());
+   }
+   return DEVICE_OK;
 }
 
-int Mirao52e::SetZernMode_Trefoil0deg(float Acoef)
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnPhaseDiversityIterations(MM::PropertyBase* pProp, MM::ActionType eAct)
 {
-	zer_rel.zernike_coefficients[9] = Acoef - zer_store.zernike_coefficients[9];
-	return DEVICE_OK;
+   if (eAct == MM::BeforeGet)
+   {
+      pProp->Set((long)diversitymeasurement_->GetIterations());
+   }
+   return DEVICE_OK;
 }
 
-int Mirao52e::SetZernMode_Trefoil90deg(float Acoef)
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnPhaseDiversityError(MM::PropertyBase* pProp, MM::ActionType eAct)
 {
-	zer_rel.zernike_coefficients[10] = Acoef - zer_store.zernike_coefficients[10];
-	return DEVICE_OK;
+   if (eAct == MM::BeforeGet)
+   {
+      pProp->Set(diversitymeasurement_->GetError());
+   }
+   return DEVICE_OK;
 }
 
-int Mirao52e::SetZernMode_SecondAstig0deg(float Acoef)
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnPhaseDiversityCorrection(MM::PropertyBase* pProp, MM::ActionType eAct)
 {
-	zer_rel.zernike_coefficients[11] = Acoef - zer_store.zernike_coefficients[11];
-	return DEVICE_OK;
+   if (eAct == MM::BeforeGet)
+   {
+      pProp->Set(formatzernikes(diversitymeasurement_->GetCorrection(), nbzernikes_).c_str());
+   }
+   return DEVICE_OK;
 }
 
-int Mirao52e::SetZernMode_SecondAstig45deg(float Acoef)
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnPresetList(MM::PropertyBase* pProp, MM::ActionType eAct)
 {
-	zer_rel.zernike_coefficients[12] = Acoef - zer_store.zernike_coefficients[12];
-	return DEVICE_OK;
+   if (eAct == MM::BeforeGet)
+   {
+      pProp->Set(presetlistpath_.c_str());
+   }
+   else if (eAct == MM::AfterSet)
+   {
+      pProp->Get(presetlistpath_);
+   }
+   return DEVICE_OK;
 }
 
-int Mirao52e::SetZernMode_SecondComa0deg(float Acoef)
+// Sequenceable by name: the sequence is resolved to table indices when loaded
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnPreset(MM::PropertyBase* pProp, MM::ActionType eAct)
 {
-	zer_rel.zernike_coefficients[13] = Acoef - zer_store.zernike_coefficients[13];
-	return DEVICE_OK;
+   if (eAct == MM::BeforeGet)
+   {
+      pProp->Set(preset_ >= 0 ? presets_.Get(preset_).name.c_str() : g_PresetNone);
+   }
+   else if (eAct == MM::AfterSet)
+   {
+      std::string name;
+      pProp->Get(name);
+      if (name == g_PresetNone)
+         return DEVICE_OK;
+      return SelectPreset(presets_.Find(name));
+   }
+   else if (eAct == MM::IsSequenceable)
+   {
+      pProp->SetSequenceable(g_maxSequenceLength);
+   }
+   else if (eAct == MM::AfterLoadSequence)
+   {
+      std::vector<std::string> sequence = pProp->GetSequence();
+      std::vector<int> indices(sequence.size());
+      for (size_t i = 0; i < sequence.size(); i++)
+      {
+         indices[i] = presets_.Find(sequence[i]);
+         if (indices[i] < 0)
+            return ERR_PRESET;
+      }
+      sequencethread_->Stop();
+      presetsequence_.swap(indices);
+   }
+   else if (eAct == MM::StartSequence)
+   {
+      if (presetsequence_.empty())
+         return ERR_PRESET;
+      sequencethread_->Stop();
+      sequencepresets_ = true;
+      sequencethread_->Start((int)presetsequence_.size(), sequenceinterval_ms_);
+   }
+   else if (eAct == MM::StopSequence)
+   {
+      sequencethread_->Stop();
+   }
+   return DEVICE_OK;
 }
 
-int Mirao52e::SetZernMode_SecondComa90deg(float Acoef)
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnPresetIndex(MM::PropertyBase* pProp, MM::ActionType eAct)
 {
-	zer_rel.zernike_coefficients[14] = Acoef - zer_store.zernike_coefficients[14];
-	return DEVICE_OK;
+   if (eAct == MM::BeforeGet)
+   {
+      pProp->Set((long)preset_);
+   }
+   else if (eAct == MM::AfterSet)
+   {
+      long index;
+      pProp->Get(index);
+      if (index < 0)
+         return DEVICE_OK;
+      return SelectPreset((int)index);
+   }
+   return DEVICE_OK;
 }
 
-int Mirao52e::SetZernMode_SecondSpherical(float Acoef)
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnStorePreset(MM::PropertyBase* pProp, MM::ActionType eAct)
 {
-	zer_rel.zernike_coefficients[15] = Acoef - zer_store.zernike_coefficients[15];
-	return DEVICE_OK;
+   if (eAct == MM::AfterSet)
+   {
+      std::string name;
+      pProp->Get(name);
+      if (name.empty())
+         return DEVICE_OK;
+      return StorePreset(name);
+   }
+   return DEVICE_OK;
 }
 
-int Mirao52e::SetZernMode_Quadrafoil0deg(float Acoef)
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnDepthCorrection(MM::PropertyBase* pProp, MM::ActionType eAct)
 {
-	zer_rel.zernike_coefficients[16] = Acoef - zer_store.zernike_coefficients[16];
-	return DEVICE_OK;
+   if (eAct == MM::BeforeGet)
+   {
+      pProp->Set(focustracker_->IsRunning() ? g_On : g_Off);
+   }
+   else if (eAct == MM::AfterSet)
+   {
+      std::string state;
+      pProp->Get(state);
+      if (state == g_On)
+         return StartDepthCorrection();
+      if (focustracker_->IsRunning())
+         return StopDepthCorrection();
+   }
+   return DEVICE_OK;
 }
 
-int Mirao52e::SetZernMode_Quadrafoil45deg(float Acoef)
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnDepthTable(MM::PropertyBase* pProp, MM::ActionType eAct)
 {
-	zer_rel.zernike_coefficients[17] = Acoef - zer_store.zernike_coefficients[17];
-	return DEVICE_OK;
+   if (eAct == MM::BeforeGet)
+   {
+      pProp->Set(depthpath_.c_str());
+   }
+   else if (eAct == MM::AfterSet)
+   {
+      std::string path;
+      pProp->Get(path);
+      return LoadDepthTable(path);
+   }
+   return DEVICE_OK;
 }
 
-int Mirao52e::SetZernMode_SecondTrefoil0deg(float Acoef)
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnSaveDepthTable(MM::PropertyBase* pProp, MM::ActionType eAct)
 {
-	zer_rel.zernike_coefficients[18] = Acoef - zer_store.zernike_coefficients[18];
-	return DEVICE_OK;
+   if (eAct == MM::AfterSet)
+   {
+      std::string path;
+      pProp->Get(path);
+      MMThreadGuard guard(mirrorlock_);
+      if (!depthtable_.Save(path))
+         return ERR_DEPTH_TABLE;
+      depthpath_ = path;
+   }
+   return DEVICE_OK;
 }
 
-int Mirao52e::SetZernMode_SecondTrefoil90deg(float Acoef)
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnStoreDepthPoint(MM::PropertyBase* pProp, MM::ActionType eAct)
 {
-	zer_rel.zernike_coefficients[19] = Acoef - zer_store.zernike_coefficients[19];
-	return DEVICE_OK;
+   if (eAct == MM::BeforeGet)
+   {
+      pProp->Set(0L);
+   }
+   else if (eAct == MM::AfterSet)
+   {
+      long store;
+      pProp->Get(store);
+      if (store)
+         return StoreDepthPoint();
+   }
+   return DEVICE_OK;
 }
 
-
-
-///////////////////////////////////////////////////////////////////////////////
-// Action handlers
-// Handle changes and updates to property values.
-///////////////////////////////////////////////////////////////////////////////
-
-
-int Mirao52e::OnSetCalibration(MM::PropertyBase* pProp, MM::ActionType eAct)
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnDepthFocusDevice(MM::PropertyBase* pProp, MM::ActionType eAct)
 {
    if (eAct == MM::BeforeGet)
    {
-		pProp->Set(calibpath_.c_str()); 
+      pProp->Set(focusdevice_.c_str());
    }
    else if (eAct == MM::AfterSet)
    {
-      std::basic_string<char> path;;
-      pProp->Get(path);
-      return SetCalibration(path);
+      pProp->Get(focusdevice_);
    }
    return DEVICE_OK;
 }
 
-int Mirao52e::OnSetCalibrationParams(MM::PropertyBase* pProp, MM::ActionType eAct)
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnDepthInterpolation(MM::PropertyBase* pProp, MM::ActionType eAct)
 {
    if (eAct == MM::BeforeGet)
    {
-	   pProp->Set(calibparamspath_.c_str()); 
+      pProp->Set(depthspline_ ? g_DepthSpline : g_DepthLinear);
    }
    else if (eAct == MM::AfterSet)
    {
-      std::basic_string<char> path;;
-      pProp->Get(path);
-      return SetCalibrationParams(path);
+      std::string interpolation;
+      pProp->Get(interpolation);
+      depthspline_ = interpolation == g_DepthSpline;
    }
    return DEVICE_OK;
 }
 
-int Mirao52e::OnSetDiversityPref(MM::PropertyBase* pProp, MM::ActionType eAct)
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnDepthInterval(MM::PropertyBase* pProp, MM::ActionType eAct)
 {
    if (eAct == MM::BeforeGet)
    {
-	// string val;
-    pProp->Set(divprefpath_.c_str()); 
+      pProp->Set(depthinterval_ms_);
    }
    else if (eAct == MM::AfterSet)
    {
-      std::basic_string<char> path;;
-      pProp->Get(path);
-      return SetDiversityPref(path);
+      pProp->Get(depthinterval_ms_);
+      if (focustracker_->IsRunning())
+         focustracker_->Start(depthinterval_ms_, g_depthTolerance);
    }
    return DEVICE_OK;
 }
 
-int Mirao52e::OnLoadWavefront(MM::PropertyBase* pProp, MM::ActionType eAct)
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnDepthFocus(MM::PropertyBase* pProp, MM::ActionType eAct)
 {
    if (eAct == MM::BeforeGet)
    {
-    pProp->Set(wfcpath_.c_str()); 
+      pProp->Set(depthz_);
+   }
+   return DEVICE_OK;
+}
+
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnFieldCorrection(MM::PropertyBase* pProp, MM::ActionType eAct)
+{
+   if (eAct == MM::BeforeGet)
+   {
+      pProp->Set(xytracker_->IsRunning() ? g_On : g_Off);
    }
    else if (eAct == MM::AfterSet)
    {
-      std::basic_string<char> path;;
-      pProp->Get(path);
-      return LoadWavefront(path);
+      std::string state;
+      pProp->Get(state);
+      if (state == g_On)
+         return StartFieldCorrection();
+      if (xytracker_->IsRunning())
+         return StopFieldCorrection();
    }
    return DEVICE_OK;
 }
 
-int Mirao52e::OnSaveCurrentPosition(MM::PropertyBase* pProp, MM::ActionType eAct)
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnFieldMap(MM::PropertyBase* pProp, MM::ActionType eAct)
 {
    if (eAct == MM::BeforeGet)
    {
-   pProp->Set(savepath_.c_str()); 
+      pProp->Set(fieldpath_.c_str());
    }
    else if (eAct == MM::AfterSet)
    {
-      std::basic_string<char> path;;
+      std::string path;
       pProp->Get(path);
-      return SaveCurrentPosition(path);
+      return LoadFieldMap(path);
    }
    return DEVICE_OK;
 }
 
-// Zernike modes
-int Mirao52e::OnApplyZernmodes(MM::PropertyBase* pProp, MM::ActionType eAct)
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnSaveFieldMap(MM::PropertyBase* pProp, MM::ActionType eAct)
+{
+   if (eAct == MM::AfterSet)
+   {
+      std::string path;
+      pProp->Get(path);
+      MMThreadGuard guard(mirrorlock_);
+      if (!fieldmap_.Save(path))
+         return ERR_FIELD_MAP;
+      fieldpath_ = path;
+   }
+   return DEVICE_OK;
+}
+
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnStoreFieldPoint(MM::PropertyBase* pProp, MM::ActionType eAct)
 {
    if (eAct == MM::BeforeGet)
    {
- //     pProp->Set(false); 
+      pProp->Set(0L);
    }
    else if (eAct == MM::AfterSet)
    {
-      return ApplyZernmodes();
+      long store;
+      pProp->Get(store);
+      if (store)
+         return StoreFieldPoint();
    }
    return DEVICE_OK;
 }
 
-int Mirao52e::OnSetZernMode_Tip(MM::PropertyBase* pProp, MM::ActionType eAct)
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnFieldXYStage(MM::PropertyBase* pProp, MM::ActionType eAct)
 {
    if (eAct == MM::BeforeGet)
    {
-	  double Acoef;
-	  Acoef = zer_store.zernike_coefficients[1] + zer_rel.zernike_coefficients[1] ;
-      pProp->Set(Acoef); 
+      pProp->Set(xystage_.c_str());
    }
    else if (eAct == MM::AfterSet)
    {
-      double Acoef;
-      pProp->Get(Acoef);
-      return SetZernMode_Tip(Acoef);
+      pProp->Get(xystage_);
    }
    return DEVICE_OK;
 }
 
-int Mirao52e::OnSetZernMode_Tilt(MM::PropertyBase* pProp, MM::ActionType eAct)
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnFieldInterval(MM::PropertyBase* pProp, MM::ActionType eAct)
 {
    if (eAct == MM::BeforeGet)
    {
-	  double Acoef;
-	  Acoef = zer_store.zernike_coefficients[2] + zer_rel.zernike_coefficients[2];
-      pProp->Set(Acoef); 
+      pProp->Set(fieldinterval_ms_);
    }
    else if (eAct == MM::AfterSet)
    {
-      double Acoef;
-      pProp->Get(Acoef);
-      return SetZernMode_Tilt(Acoef);
+      pProp->Get(fieldinterval_ms_);
+      if (xytracker_->IsRunning())
+         xytracker_->Start(fieldinterval_ms_, g_fieldTolerance);
+   }
+   return DEVICE_OK;
+}
+
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnFieldPosition(MM::PropertyBase* pProp, MM::ActionType eAct, long axis)
+{
+   if (eAct == MM::BeforeGet)
+   {
+      pProp->Set(axis == 0 ? fieldx_ : fieldy_);
    }
    return DEVICE_OK;
 }
 
-int Mirao52e::OnSetZernMode_Defocus(MM::PropertyBase* pProp, MM::ActionType eAct)
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnShackHartmann(MM::PropertyBase* pProp, MM::ActionType eAct)
 {
    if (eAct == MM::BeforeGet)
    {
-	  double Acoef;
-	  Acoef = zer_store.zernike_coefficients[3] + zer_rel.zernike_coefficients[3];
-      pProp->Set(Acoef); 
+      pProp->Set(framereplay_->IsRunning() ? g_On : g_Off);
    }
    else if (eAct == MM::AfterSet)
    {
-      double Acoef;
-      pProp->Get(Acoef);
-      return SetZernMode_Defocus(Acoef);
+      std::string state;
+      pProp->Get(state);
+      if (state == g_On)
+         return StartShackHartmann();
+      return StopShackHartmann();
    }
    return DEVICE_OK;
 }
 
-int Mirao52e::OnSetZernMode_Astig0deg(MM::PropertyBase* pProp, MM::ActionType eAct)
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnShackHartmannFrames(MM::PropertyBase* pProp, MM::ActionType eAct)
 {
    if (eAct == MM::BeforeGet)
    {
-	  double Acoef;
-	  Acoef = zer_store.zernike_coefficients[4] + zer_rel.zernike_coefficients[4];
-      pProp->Set(Acoef); 
+      pProp->Set(shpath_.c_str());
    }
    else if (eAct == MM::AfterSet)
    {
-      double Acoef;
-      pProp->Get(Acoef);
-      return SetZernMode_Astig0deg(Acoef);
+      std::string path;
+      pProp->Get(path);
+      return LoadShackHartmannFrames(path);
    }
    return DEVICE_OK;
 }
 
-int Mirao52e::OnSetZernMode_Astig45deg(MM::PropertyBase* pProp, MM::ActionType eAct)
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnShackHartmannPixelSize(MM::PropertyBase* pProp, MM::ActionType eAct)
 {
    if (eAct == MM::BeforeGet)
    {
-	  double Acoef;
-	  Acoef = zer_store.zernike_coefficients[5] + zer_rel.zernike_coefficients[5];
-      pProp->Set(Acoef); 
+      pProp->Set(shsettings_.pixelSize_um);
    }
    else if (eAct == MM::AfterSet)
    {
-      double Acoef;
-      pProp->Get(Acoef);
-      return SetZernMode_Astig45deg(Acoef);
+      pProp->Get(shsettings_.pixelSize_um);
+      return RestartShackHartmann();
    }
    return DEVICE_OK;
 }
 
-int Mirao52e::OnSetZernMode_Coma0deg(MM::PropertyBase* pProp, MM::ActionType eAct)
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnShackHartmannFocalLength(MM::PropertyBase* pProp, MM::ActionType eAct)
 {
    if (eAct == MM::BeforeGet)
    {
-	  double Acoef;
-	  Acoef = zer_store.zernike_coefficients[6] + zer_rel.zernike_coefficients[6];
-      pProp->Set(Acoef); 
+      pProp->Set(shsettings_.focalLength_mm);
    }
    else if (eAct == MM::AfterSet)
    {
-      double Acoef;
-      pProp->Get(Acoef);
-      return SetZernMode_Coma0deg(Acoef);
+      pProp->Get(shsettings_.focalLength_mm);
+      return RestartShackHartmann();
    }
    return DEVICE_OK;
 }
 
-int Mirao52e::OnSetZernMode_Coma90deg(MM::PropertyBase* pProp, MM::ActionType eAct)
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnShackHartmannOrigin(MM::PropertyBase* pProp, MM::ActionType eAct, long axis)
 {
+   double& origin = axis == 0 ? shsettings_.originX : shsettings_.originY;
    if (eAct == MM::BeforeGet)
    {
-	  double Acoef;
-	  Acoef = zer_store.zernike_coefficients[7] +  zer_rel.zernike_coefficients[7];
-      pProp->Set(Acoef); 
+      pProp->Set(origin);
    }
    else if (eAct == MM::AfterSet)
    {
-      double Acoef;
-      pProp->Get(Acoef);
-      return SetZernMode_Coma90deg(Acoef);
+      pProp->Get(origin);
+      return RestartShackHartmann();
    }
    return DEVICE_OK;
 }
 
-int Mirao52e::OnSetZernMode_PrimSpherical(MM::PropertyBase* pProp, MM::ActionType eAct)
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnShackHartmannThreshold(MM::PropertyBase* pProp, MM::ActionType eAct)
 {
    if (eAct == MM::BeforeGet)
    {
-	  double Acoef;
-	  Acoef = zer_store.zernike_coefficients[8] + zer_rel.zernike_coefficients[8];
-      pProp->Set(Acoef); 
+      pProp->Set((long)shsettings_.threshold);
    }
    else if (eAct == MM::AfterSet)
    {
-      double Acoef;
-      pProp->Get(Acoef);
-      return SetZernMode_PrimSpherical(Acoef);
+      long threshold;
+      pProp->Get(threshold);
+      shsettings_.threshold = (int)threshold;
+      return RestartShackHartmann();
    }
    return DEVICE_OK;
 }
 
-int Mirao52e::OnSetZernMode_Trefoil0deg(MM::PropertyBase* pProp, MM::ActionType eAct)
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnShackHartmannThreads(MM::PropertyBase* pProp, MM::ActionType eAct)
 {
    if (eAct == MM::BeforeGet)
    {
-	  double Acoef;
-	  Acoef = zer_store.zernike_coefficients[9] + zer_rel.zernike_coefficients[9];
-      pProp->Set(Acoef); 
+      pProp->Set(shthreads_);
    }
    else if (eAct == MM::AfterSet)
    {
-      double Acoef;
-      pProp->Get(Acoef);
-      return SetZernMode_Trefoil0deg(Acoef);
+      pProp->Get(shthreads_);
+      return RestartShackHartmann();
    }
    return DEVICE_OK;
 }
 
-int Mirao52e::OnSetZernMode_Trefoil90deg(MM::PropertyBase* pProp, MM::ActionType eAct)
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnShackHartmannInterval(MM::PropertyBase* pProp, MM::ActionType eAct)
 {
    if (eAct == MM::BeforeGet)
    {
-	  double Acoef;
-	  Acoef = zer_store.zernike_coefficients[10] + zer_rel.zernike_coefficients[10];
-      pProp->Set(Acoef); 
+      pProp->Set(shinterval_ms_);
    }
    else if (eAct == MM::AfterSet)
    {
-      double Acoef;
-      pProp->Get(Acoef);
-      return SetZernMode_Trefoil90deg(Acoef);
+      pProp->Get(shinterval_ms_);
+      return RestartShackHartmann();
    }
    return DEVICE_OK;
 }
 
-int Mirao52e::OnSetZernMode_SecondAstig0deg(MM::PropertyBase* pProp, MM::ActionType eAct)
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnShackHartmannStoreReference(MM::PropertyBase* pProp, MM::ActionType eAct)
 {
    if (eAct == MM::BeforeGet)
    {
-	  double Acoef;
-	  Acoef = zer_store.zernike_coefficients[11] + zer_rel.zernike_coefficients[11];
-      pProp->Set(Acoef); 
+      pProp->Set(0L);
    }
    else if (eAct == MM::AfterSet)
    {
-      double Acoef;
-      pProp->Get(Acoef);
-      return SetZernMode_SecondAstig0deg(Acoef);
+      long store;
+      pProp->Get(store);
+      if (store)
+         shackhartmann_->StoreReference();
    }
    return DEVICE_OK;
 }
 
-int Mirao52e::OnSetZernMode_SecondAstig45deg(MM::PropertyBase* pProp, MM::ActionType eAct)
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnShackHartmannMeasured(MM::PropertyBase* pProp, MM::ActionType eAct)
 {
    if (eAct == MM::BeforeGet)
    {
-	  double Acoef;
-	  Acoef = zer_store.zernike_coefficients[12] + zer_rel.zernike_coefficients[12];
-      pProp->Set(Acoef); 
+      pProp->Set(shackhartmann_->GetPublished());
    }
-   else if (eAct == MM::AfterSet)
+   return DEVICE_OK;
+}
+
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnShackHartmannRate(MM::PropertyBase* pProp, MM::ActionType eAct)
+{
+   if (eAct == MM::BeforeGet)
    {
-      double Acoef;
-      pProp->Get(Acoef);
-      return SetZernMode_SecondAstig45deg(Acoef);
+      pProp->Set(shackhartmann_->GetRate());
    }
    return DEVICE_OK;
 }
 
-int Mirao52e::OnSetZernMode_SecondComa0deg(MM::PropertyBase* pProp, MM::ActionType eAct)
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnShackHartmannTime(MM::PropertyBase* pProp, MM::ActionType eAct)
 {
    if (eAct == MM::BeforeGet)
    {
-	  double Acoef;
-	  Acoef = zer_store.zernike_coefficients[13] + zer_rel.zernike_coefficients[13];
-      pProp->Set(Acoef); 
+      pProp->Set(shackhartmann_->GetMeasureTime().Mean());
    }
-   else if (eAct == MM::AfterSet)
+   return DEVICE_OK;
+}
+
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnShackHartmannLit(MM::PropertyBase* pProp, MM::ActionType eAct)
+{
+   if (eAct == MM::BeforeGet)
    {
-      double Acoef;
-      pProp->Get(Acoef);
-      return SetZernMode_SecondComa0deg(Acoef);
+      MiraoSlopes slopes;
+      pProp->Set(shackhartmann_->GetLatest(slopes) ? (long)slopes.nbLit : 0L);
+   }
+   return DEVICE_OK;
+}
+
+// Over the x and y slopes of the subapertures with signal
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnShackHartmannSlopeRms(MM::PropertyBase* pProp, MM::ActionType eAct)
+{
+   if (eAct == MM::BeforeGet)
+   {
+      MiraoSlopes slopes;
+      double sum = 0;
+      if (shackhartmann_->GetLatest(slopes) && slopes.nbLit > 0)
+      {
+         for (int s = 0; s < slopes.nbSubap; s++)
+            if (slopes.flux[s] > 0)
+               sum += slopes.slopes[s] * slopes.slopes[s] + slopes.slopes[slopes.nbSubap + s] * slopes.slopes[slopes.nbSubap + s];
+         sum /= 2 * slopes.nbLit;
+      }
+      pProp->Set(sqrt(sum));
    }
    return DEVICE_OK;
 }
 
-int Mirao52e::OnSetZernMode_SecondComa90deg(MM::PropertyBase* pProp, MM::ActionType eAct)
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnLoop(MM::PropertyBase* pProp, MM::ActionType eAct)
 {
    if (eAct == MM::BeforeGet)
    {
-	  double Acoef;
-	  Acoef = zer_store.zernike_coefficients[14] +  zer_rel.zernike_coefficients[14];
-      pProp->Set(Acoef); 
+      pProp->Set(loop_->IsRunning() ? g_On : g_Off);
    }
    else if (eAct == MM::AfterSet)
    {
-      double Acoef;
-      pProp->Get(Acoef);
-      return SetZernMode_SecondComa90deg(Acoef);
+      std::string state;
+      pProp->Get(state);
+      if (state == g_On)
+         return StartLoop();
+      if (loop_->IsRunning())
+         return StopLoop();
    }
    return DEVICE_OK;
 }
 
-int Mirao52e::OnSetZernMode_SecondSpherical(MM::PropertyBase* pProp, MM::ActionType eAct)
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnLoopRate(MM::PropertyBase* pProp, MM::ActionType eAct)
 {
    if (eAct == MM::BeforeGet)
    {
-	  double Acoef;
-	  Acoef = zer_store.zernike_coefficients[15] + zer_rel.zernike_coefficients[15];
-      pProp->Set(Acoef); 
+      pProp->Set(loopsettings_.rate_hz);
    }
    else if (eAct == MM::AfterSet)
    {
-      double Acoef;
-      pProp->Get(Acoef);
-      return SetZernMode_SecondSpherical(Acoef);
+      pProp->Get(loopsettings_.rate_hz);
+      loop_->SetSettings(loopsettings_);
    }
    return DEVICE_OK;
 }
 
-int Mirao52e::OnSetZernMode_Quadrafoil0deg(MM::PropertyBase* pProp, MM::ActionType eAct)
+// Gains per mode from tip; modes after the last gain given take that gain
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnLoopGains(MM::PropertyBase* pProp, MM::ActionType eAct)
 {
    if (eAct == MM::BeforeGet)
    {
-	  double Acoef;
-	  Acoef = zer_store.zernike_coefficients[16] + zer_rel.zernike_coefficients[16];
-      pProp->Set(Acoef); 
+      pProp->Set(loopgains_.c_str());
    }
    else if (eAct == MM::AfterSet)
    {
-      double Acoef;
-      pProp->Get(Acoef);
-      return SetZernMode_Quadrafoil0deg(Acoef);
+      std::string values;
+      pProp->Get(values);
+      std::vector<float> gains;
+      if (!parsezernikes(values, nbzernikes_, gains) || gains.empty())
+         return ERR_LOOP_GAINS;
+      for (int j = 1; j <= MIRAO_MAX_ZERNIKES; j++)
+         loopsettings_.gains[j] = gains[j <= (int)gains.size() ? j - 1 : gains.size() - 1];
+      loopgains_ = values;
+      loop_->SetSettings(loopsettings_);
    }
    return DEVICE_OK;
 }
 
-int Mirao52e::OnSetZernMode_Quadrafoil45deg(MM::PropertyBase* pProp, MM::ActionType eAct)
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnLoopLeak(MM::PropertyBase* pProp, MM::ActionType eAct)
 {
    if (eAct == MM::BeforeGet)
    {
-	  double Acoef;
-	  Acoef = zer_store.zernike_coefficients[17] + zer_rel.zernike_coefficients[17];
-      pProp->Set(Acoef); 
+      pProp->Set(loopsettings_.leak);
    }
    else if (eAct == MM::AfterSet)
    {
-      double Acoef;
-      pProp->Get(Acoef);
-      return SetZernMode_Quadrafoil45deg(Acoef);
+      pProp->Get(loopsettings_.leak);
+      loop_->SetSettings(loopsettings_);
    }
    return DEVICE_OK;
 }
 
-int Mirao52e::OnSetZernMode_SecondTrefoil0deg(MM::PropertyBase* pProp, MM::ActionType eAct)
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnLoopMeasuredRate(MM::PropertyBase* pProp, MM::ActionType eAct)
 {
    if (eAct == MM::BeforeGet)
    {
-	  double Acoef;
-	  Acoef = zer_store.zernike_coefficients[18] + zer_rel.zernike_coefficients[18];
-      pProp->Set(Acoef); 
+      pProp->Set(loop_->GetRate());
    }
-   else if (eAct == MM::AfterSet)
+   return DEVICE_OK;
+}
+
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnLoopJitter(MM::PropertyBase* pProp, MM::ActionType eAct)
+{
+   if (eAct == MM::BeforeGet)
    {
-      double Acoef;
-      pProp->Get(Acoef);
-      return SetZernMode_SecondTrefoil0deg(Acoef);
+      pProp->Set(loop_->GetJitter());
    }
    return DEVICE_OK;
 }
 
-int Mirao52e::OnSetZernMode_SecondTrefoil90deg(MM::PropertyBase* pProp, MM::ActionType eAct)
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnLoopResidual(MM::PropertyBase* pProp, MM::ActionType eAct)
 {
    if (eAct == MM::BeforeGet)
    {
-	  double Acoef;
-	  Acoef = zer_store.zernike_coefficients[19] + zer_rel.zernike_coefficients[19];
-      pProp->Set(Acoef); 
+      pProp->Set(loop_->GetResidual());
    }
-   else if (eAct == MM::AfterSet)
+   return DEVICE_OK;
+}
+
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnLoopCycles(MM::PropertyBase* pProp, MM::ActionType eAct)
+{
+   if (eAct == MM::BeforeGet)
    {
-      double Acoef;
-      pProp->Get(Acoef);
-      return SetZernMode_SecondTrefoil90deg(Acoef);
+      pProp->Set(loop_->GetCycles());
    }
    return DEVICE_OK;
 }
 
-// FAKE MIRROR class
-
-Mirao52e_FAKE::Mirao52e_FAKE() :
-   port_("Undefined"),
-   initialized_(false),
-   mirrorinitpath_(g_mirrorinit_path),
-   calibpath_(g_calib_initpath),
-   calibparamspath_(g_calibparams_initpath),
-   divprefpath_(g_divpref_initpath),
-   wfcpath_(g_wfc_initpath),
-   savepath_(g_savepath)
+template <class TBackend>
+int Mirao52eDevice<TBackend>::OnLoopHeld(MM::PropertyBase* pProp, MM::ActionType eAct)
 {
-   InitializeDefaultErrorMessages();
-   // add custom messages
-   std::string error_mirrorinit_file = "Mirror initialization file does not exist. Looking for: ";	error_mirrorinit_file.append(mirrorinitpath_.c_str());
-   SetErrorText(ERR_MIRRORINIT_FILE_NONEXIST, error_mirrorinit_file.c_str());
+   if (eAct == MM::BeforeGet)
+   {
+      pProp->Set(loop_->GetHeld());
+   }
+   return DEVICE_OK;
+}
 
-   std::string error_divinit_file = "Diversity initialization file does not exist. Looking for: ";	error_divinit_file.append(calibpath_.c_str());
-   SetErrorText(ERR_DIVINIT_FILE_NONEXIST, error_divinit_file.c_str());
 
-   std::string error_cal_file = "Calibration parameter file does not exist. Looking for: ";	error_cal_file.append(calibparamspath_.c_str());
-   SetErrorText(ERR_CAL_FILE_NONEXIST, error_cal_file.c_str());
+///////////////////////////////////////////////////////////////////////////////
+// MiraoPsfCamera
+///////////////////////////////////////////////////////////////////////////////
 
-   std::string error_divpref_file = "Diversity preferences file does not exist. Looking for: ";	error_divpref_file.append(divprefpath_.c_str());
-   SetErrorText(ERR_DIVPREF_FILE_NONEXIST, error_divpref_file.c_str());
+MiraoPsfCamera::MiraoPsfCamera() :
+   initialized_(false),
+   roix_(0),
+   roiy_(0),
+   roiwidth_(g_psfSensorSize),
+   roiheight_(g_psfSensorSize),
+   exposure_ms_(10),
+   threads_(4),
+   rendertime_ms_(0),
+   frames_(0)
+{
+   for (int j = 0; j <= MIRAO_MAX_ZERNIKES; j++)
+      aberration_[j] = 0;
 
-   SetErrorText(ERR_FILE_NONEXIST, "File does not exist");
+   InitializeDefaultErrorMessages();
+   SetErrorText(ERR_PSF_SETUP, "Simulated camera needs the diversity preferences and calibration parameters, and a mirror calibration the adapter can read itself (.aomi)");
+   SetErrorText(ERR_PSF_MIRROR, "Mirror device of the simulated camera not found, or not a fake MIRAO-52E");
+   SetErrorText(ERR_INVALID_ZERNIKE_VECTOR, "Zernike vector should hold at most one number per Zernike mode, separated by spaces or commas");
 
-   // create pre-initialization properties
-   // ------------------------------------
-   // Name
-   CreateProperty(MM::g_Keyword_Name, g_DMname, MM::String, true);
-   // Description
-   CreateProperty(MM::g_Keyword_Description, "MIRAO-52E fake mirror", MM::String, true);
-   // Port
-   CPropertyAction* pAct = new CPropertyAction (this, &Mirao52e_FAKE::OnPort);
-   CreateProperty(MM::g_Keyword_Port, "Undefined", MM::String, false, pAct, true);  
+   CreateProperty(MM::g_Keyword_Name, g_PSFcameraname, MM::String, true);
+   CreateProperty(MM::g_Keyword_Description, "MIRAO-52E simulated PSF camera", MM::String, true);
 }
 
-Mirao52e_FAKE::~Mirao52e_FAKE()
+MiraoPsfCamera::~MiraoPsfCamera()
 {
    if (initialized_)
       Shutdown();
 }
 
-bool Mirao52e_FAKE::Busy()
+void MiraoPsfCamera::GetName(char* name) const
 {
-      return false;
+   CDeviceUtils::CopyLimitedString(name, g_PSFcameraname);
 }
 
-void Mirao52e_FAKE::GetName(char* name) const
+bool MiraoPsfCamera::Busy()
 {
-   CDeviceUtils::CopyLimitedString(name, g_DMname);
+   return false;
 }
 
-// initialize function
-int Mirao52e_FAKE::Initialize()
+int MiraoPsfCamera::Initialize()
 {
-	if (initialized_)
-    return DEVICE_OK;
-
-	//Check if mirror initialization files exist
-	if (!fileexists(mirrorinitpath_))
-	{
-		return ERR_MIRRORINIT_FILE_NONEXIST;
-	}
-	else if(!fileexists(calibpath_))
-	{
-		return ERR_DIVINIT_FILE_NONEXIST;
-	}
-	else if(!fileexists(calibparamspath_))
-	{
-		return ERR_CAL_FILE_NONEXIST;
-	}
-	else if(!fileexists(divprefpath_))
-	{
-		return ERR_DIVPREF_FILE_NONEXIST;
-	}
-
-	//init Mirror HW driver
-    mirrorhandle = new imop::microscopy::Mirror(g_fakemirrorinit_path);
-	mirrorhandle->init_hardware();
-
-	//Load calibration file
-	diversityhandle = new imop::microscopy::Diversity(calibpath_, *mirrorhandle );
-
-    calibparamshandle = new imop::microscopy::CalibrationParams;
-	calibparamshandle->Load(calibparamspath_);
-
-    divprefshandle = new imop::microscopy::DiversityPreferences;
-    divprefshandle->Load(divprefpath_);
-
-    diversityhandle->Init_Diversity(*calibparamshandle,*divprefshandle);
-
-	//Apply initial wavefront correction if WFC file exists
-	if (fileexists(g_wfc_initpath))
-	{
-		Mirao52e_FAKE::LoadWavefront(g_wfc_initpath);
-	}
-
-	// Create action properties
-	CPropertyAction* pAct = new CPropertyAction(this, &Mirao52e_FAKE::OnSetCalibration);
-	int ret = CreateProperty(g_SetCalibration, g_calib_initpath, MM::String, false, pAct);
-	if (ret!=DEVICE_OK)
-	   return ret;
-
-	pAct = new CPropertyAction(this, &Mirao52e_FAKE::OnSetCalibrationParams);
-	ret = CreateProperty(g_SetCalibrationParams, g_calibparams_initpath, MM::String, false, pAct);
-	if (ret!=DEVICE_OK)
-	   return ret;
-
-	pAct = new CPropertyAction(this, &Mirao52e_FAKE::OnSetDiversityPref);
-	ret = CreateProperty(g_SetDiversityPref, g_divpref_initpath, MM::String, false, pAct);
+   if (initialized_)
+      return DEVICE_OK;
+
+   // Pupil from the diversity files, mirror response from its calibration.
+   // The stored wavefront correction is taken as the flat mirror.
+   MiraoDiversitySettings settings;
+   MiraoCalibration calib;
+   MiraoProjector projector;
+   if (!settings.Load(g_divpref_initpath, g_calibparams_initpath) || !calib.Load(g_calib_initpath)
+      || !projector.Build(calib, MIRAO_MAX_ZERNIKES) || !simulator_.Configure(settings, calib, projector))
+      return ERR_PSF_SETUP;
+   MiraoWavefrontState reference;
+   if (reference.Load(g_wfc_initpath))
+      simulator_.SetReference(reference.position);
+   simulator_.SetAberration(aberration_);
+   UpdateSample();
+   simulator_.Start((int)threads_);
+
+   CPropertyAction* pAct;
+   int ret;
+
+	pAct = new CPropertyAction(this, &MiraoPsfCamera::OnBinning);
+	ret = CreateProperty(MM::g_Keyword_Binning, "1", MM::Integer, false, pAct);
 	if (ret!=DEVICE_OK)
 	   return ret;
+	AddAllowedValue(MM::g_Keyword_Binning, "1");
 
-	pAct = new CPropertyAction(this, &Mirao52e_FAKE::OnLoadWavefront);
-	ret = CreateProperty(g_LoadWavefront, g_wfc_initpath, MM::String, false, pAct);
+	pAct = new CPropertyAction(this, &MiraoPsfCamera::OnExposure);
+	ret = CreateProperty(MM::g_Keyword_Exposure, CDeviceUtils::ConvertToString(exposure_ms_), MM::Float, false, pAct);
 	if (ret!=DEVICE_OK)
 	   return ret;
+	SetPropertyLimits(MM::g_Keyword_Exposure, 0, 10000);
 
-	pAct = new CPropertyAction(this, &Mirao52e_FAKE::OnSaveCurrentPosition);
-	ret = CreateProperty(g_SaveCurrentPosition, g_savepath, MM::String, false, pAct);
+	pAct = new CPropertyAction(this, &MiraoPsfCamera::OnMirror);
+	ret = CreateProperty(g_PsfMirror, mirror_.c_str(), MM::String, false, pAct);
 	if (ret!=DEVICE_OK)
 	   return ret;
 
-	// Zernike Modes
-    pAct = new CPropertyAction(this, &Mirao52e_FAKE::OnSetZernMode_Tip);
-    ret = CreateProperty(g_SetZernMode_Tip, "0", MM::Float, false, pAct);
-    if (ret!=DEVICE_OK)
-	   return ret;
-	SetPropertyLimits(g_SetZernMode_Tip, -1, 1);
-
-
-    pAct = new CPropertyAction(this, &Mirao52e_FAKE::OnSetZernMode_Tilt);
-    ret = CreateProperty(g_SetZernMode_Tilt, "0", MM::Float, false, pAct);
-    if (ret!=DEVICE_OK)
-	   return ret;
-	SetPropertyLimits(g_SetZernMode_Tilt, -1, 1);
-
-
-	pAct = new CPropertyAction(this, &Mirao52e_FAKE::OnSetZernMode_Defocus);
-	ret = CreateProperty(g_SetZernMode_Defocus, "0", MM::Float, false, pAct);
+	pAct = new CPropertyAction(this, &MiraoPsfCamera::OnAberration);
+	ret = CreateProperty(g_PsfAberration, "", MM::String, false, pAct);
 	if (ret!=DEVICE_OK)
 	   return ret;
-	SetPropertyLimits(g_SetZernMode_Defocus, -1, 1);
 
-	pAct = new CPropertyAction(this, &Mirao52e_FAKE::OnSetZernMode_Astig0deg);
-	ret = CreateProperty(g_SetZernMode_Astig0deg, "0", MM::Float, false, pAct);
+	pAct = new CPropertyAction(this, &MiraoPsfCamera::OnSample);
+	ret = CreateProperty(g_PsfSample, g_miraoPsfSamples[sample_.type], MM::String, false, pAct);
 	if (ret!=DEVICE_OK)
 	   return ret;
-	SetPropertyLimits(g_SetZernMode_Astig0deg, -1, 1);
+	for (int i = 0; i < MIRAO_NB_PSF_SAMPLES; i++)
+		AddAllowedValue(g_PsfSample, g_miraoPsfSamples[i]);
 
-	pAct = new CPropertyAction(this, &Mirao52e_FAKE::OnSetZernMode_Astig45deg);
-	ret = CreateProperty(g_SetZernMode_Astig45deg, "0", MM::Float, false, pAct);
+	pAct = new CPropertyAction(this, &MiraoPsfCamera::OnEmitters);
+	ret = CreateProperty(g_PsfEmitters, CDeviceUtils::ConvertToString((long)sample_.nbEmitters), MM::Integer, false, pAct);
 	if (ret!=DEVICE_OK)
 	   return ret;
-	SetPropertyLimits(g_SetZernMode_Astig45deg, -1, 1);
+	SetPropertyLimits(g_PsfEmitters, 1, 10000);
 
-	pAct = new CPropertyAction(this, &Mirao52e_FAKE::OnSetZernMode_Coma0deg);
-	ret = CreateProperty(g_SetZernMode_Coma0deg, "0", MM::Float, false, pAct);
+	pAct = new CPropertyAction(this, &MiraoPsfCamera::OnDutyCycle);
+	ret = CreateProperty(g_PsfDutyCycle, CDeviceUtils::ConvertToString(sample_.dutyCycle), MM::Float, false, pAct);
 	if (ret!=DEVICE_OK)
 	   return ret;
-	SetPropertyLimits(g_SetZernMode_Coma0deg, -1, 1);
+	SetPropertyLimits(g_PsfDutyCycle, 0, 1);
 
-	pAct = new CPropertyAction(this, &Mirao52e_FAKE::OnSetZernMode_Coma90deg);
-	ret = CreateProperty(g_SetZernMode_Coma90deg, "0", MM::Float, false, pAct);
+	pAct = new CPropertyAction(this, &MiraoPsfCamera::OnPhotons);
+	ret = CreateProperty(g_PsfPhotons, CDeviceUtils::ConvertToString(sample_.photons), MM::Float, false, pAct);
 	if (ret!=DEVICE_OK)
 	   return ret;
-	SetPropertyLimits(g_SetZernMode_Coma90deg, -1, 1);
+	SetPropertyLimits(g_PsfPhotons, 0, 1e7);
 
-	pAct = new CPropertyAction(this, &Mirao52e_FAKE::OnSetZernMode_PrimSpherical);
-	ret = CreateProperty(g_SetZernMode_PrimSpherical, "0", MM::Float, false, pAct);
+	pAct = new CPropertyAction(this, &MiraoPsfCamera::OnBackground);
+	ret = CreateProperty(g_PsfBackground, CDeviceUtils::ConvertToString(sample_.background), MM::Float, false, pAct);
 	if (ret!=DEVICE_OK)
 	   return ret;
-	SetPropertyLimits(g_SetZernMode_PrimSpherical, -1, 1);
+	SetPropertyLimits(g_PsfBackground, 0, 10000);
 
-	pAct = new CPropertyAction(this, &Mirao52e_FAKE::OnSetZernMode_Trefoil0deg);
-	ret = CreateProperty(g_SetZernMode_Trefoil0deg, "0", MM::Float, false, pAct);
+	pAct = new CPropertyAction(this, &MiraoPsfCamera::OnReadNoise);
+	ret = CreateProperty(g_PsfReadNoise, CDeviceUtils::ConvertToString(sample_.readNoise), MM::Float, false, pAct);
 	if (ret!=DEVICE_OK)
 	   return ret;
-	SetPropertyLimits(g_SetZernMode_Trefoil0deg, -1, 1);
+	SetPropertyLimits(g_PsfReadNoise, 0, 100);
 
-	pAct = new CPropertyAction(this, &Mirao52e_FAKE::OnSetZernMode_Trefoil90deg);
-	ret = CreateProperty(g_SetZernMode_Trefoil90deg, "0", MM::Float, false, pAct);
+	pAct = new CPropertyAction(this, &MiraoPsfCamera::OnOffset);
+	ret = CreateProperty(g_PsfOffset, CDeviceUtils::ConvertToString(sample_.offset), MM::Float, false, pAct);
 	if (ret!=DEVICE_OK)
 	   return ret;
-	SetPropertyLimits(g_SetZernMode_Trefoil90deg, -1, 1);
+	SetPropertyLimits(g_PsfOffset, 0, 1000);
 
-	pAct = new CPropertyAction(this, &Mirao52e_FAKE::OnSetZernMode_SecondAstig0deg);
-	ret = CreateProperty(g_SetZernMode_SecondAstig0deg, "0", MM::Float, false, pAct);
+	pAct = new CPropertyAction(this, &MiraoPsfCamera::OnSeed);
+	ret = CreateProperty(g_PsfSeed, CDeviceUtils::ConvertToString((long)sample_.seed), MM::Integer, false, pAct);
 	if (ret!=DEVICE_OK)
 	   return ret;
-	SetPropertyLimits(g_SetZernMode_SecondAstig0deg, -1, 1);
 
-	pAct = new CPropertyAction(this, &Mirao52e_FAKE::OnSetZernMode_SecondAstig45deg);
-	ret = CreateProperty(g_SetZernMode_SecondAstig45deg, "0", MM::Float, false, pAct);
+	pAct = new CPropertyAction(this, &MiraoPsfCamera::OnThreads);
+	ret = CreateProperty(g_PsfThreads, CDeviceUtils::ConvertToString(threads_), MM::Integer, false, pAct);
 	if (ret!=DEVICE_OK)
 	   return ret;
-	SetPropertyLimits(g_SetZernMode_SecondAstig45deg, -1, 1);
+	SetPropertyLimits(g_PsfThreads, 1, 16);
 
-	pAct = new CPropertyAction(this, &Mirao52e_FAKE::OnSetZernMode_Quadrafoil0deg);
-	ret = CreateProperty(g_SetZernMode_Quadrafoil0deg, "0", MM::Float, false, pAct);
+	pAct = new CPropertyAction(this, &MiraoPsfCamera::OnRenderTime);
+	ret = CreateProperty(g_PsfRenderTime, "0", MM::Float, true, pAct);
 	if (ret!=DEVICE_OK)
 	   return ret;
-	SetPropertyLimits(g_SetZernMode_Quadrafoil0deg, -1, 1);
 
-	pAct = new CPropertyAction(this, &Mirao52e_FAKE::OnSetZernMode_Quadrafoil45deg);
-	ret = CreateProperty(g_SetZernMode_Quadrafoil45deg, "0", MM::Float, false, pAct);
+	pAct = new CPropertyAction(this, &MiraoPsfCamera::OnFrames);
+	ret = CreateProperty(g_PsfFrames, "0", MM::Integer, true, pAct);
 	if (ret!=DEVICE_OK)
 	   return ret;
-	SetPropertyLimits(g_SetZernMode_Quadrafoil45deg, -1, 1);
-
-	initialized_ = true;
 
-	return DEVICE_OK;
+   image_.assign((size_t)roiwidth_ * roiheight_, 0);
+   initialized_ = true;
+   return DEVICE_OK;
 }
 
-// Shut down function
-int Mirao52e_FAKE::Shutdown()
+int MiraoPsfCamera::Shutdown()
 {
-   initialized_    = false;
+   simulator_.Stop();
+   initialized_ = false;
    return DEVICE_OK;
 }
 
-int Mirao52e_FAKE::OnPort(MM::PropertyBase* pProp, MM::ActionType eAct)
+// Renders with the mirror shape at the start of the exposure and waits out
+// the rest of it, so an exposure of 0 gives the rendering throughput
+int MiraoPsfCamera::SnapImage()
 {
-   if (eAct == MM::BeforeGet)
-	{
-      pProp->Set(port_.c_str());
-	}
-   else if (eAct == MM::AfterSet)
+   MM::MMTime start = GetCurrentMMTime();
+   float actuators[MIRAO_NB_ACTUATORS];
+   bool flat = mirror_.empty();
+   if (!flat)
    {
-      if (initialized_)
-      {
-         // revert
-         pProp->Set(port_.c_str());
-         return ERR_PORT_CHANGE_FORBIDDEN;
-      }
-      pProp->Get(port_);
+      Mirao52e_FAKE* mirror = dynamic_cast<Mirao52e_FAKE*>(GetCoreCallback()->GetDevice(this, mirror_.c_str()));
+      if (mirror == 0)
+         return ERR_PSF_MIRROR;
+      mirror->mirror_.GetShape(actuators);
    }
-   return DEVICE_OK;
-}
-
-
-// load new calibration files
-int Mirao52e_FAKE::SetCalibration(const std::string   path)
-{
-	if (fileexists(path))
-	{
-		calibpath_ = path;
-		diversityhandle = new imop::microscopy::Diversity(calibpath_, *mirrorhandle);
-		diversityhandle->Init_Diversity(*calibparamshandle,*divprefshandle);
-	}
-	else
-	{
-		return ERR_FILE_NONEXIST;
-	}
-	return DEVICE_OK;
-}
-
-int Mirao52e_FAKE::SetDiversityPref(const std::string   path)
-{
-	if (fileexists(path))
-	{
-		divprefpath_ = path;
-		divprefshandle->Load(divprefpath_);
-		diversityhandle->Init_Diversity(*calibparamshandle,*divprefshandle);
-	}
-		else
-	{
-		return ERR_FILE_NONEXIST;
-	}
-	return DEVICE_OK;
-}
-
-int Mirao52e_FAKE::SetCalibrationParams(const std::string  path)
-{
-	if (fileexists(path))
-	{
-		calibparamspath_ = path;
-		calibparamshandle->Load(calibparamspath_);
-		diversityhandle->Init_Diversity(*calibparamshandle,*divprefshandle);
-	}
-		else
-	{
-		return ERR_FILE_NONEXIST;
-	}
-	return DEVICE_OK;
-}
-
-int Mirao52e_FAKE::LoadWavefront(std::basic_string<char>  path)
-{
-	if (fileexists(path))
-	{
-		wfcpath_ = path;
-		diversityhandle->Apply_Absolute_Commands_From_File(wfcpath_);
-		zer_store.zernike_coefficients[1] = 0;
-		zer_store.zernike_coefficients[2] = 0;
-		zer_store.zernike_coefficients[3] = 0;
-		zer_store.zernike_coefficients[4] = 0;
-		zer_store.zernike_coefficients[5] = 0;
-		zer_store.zernike_coefficients[6] = 0;
-		zer_store.zernike_coefficients[7] = 0;
-		zer_store.zernike_coefficients[8] = 0;
-		zer_store.zernike_coefficients[9] = 0;
-		zer_store.zernike_coefficients[10] = 0;
-		zer_store.zernike_coefficients[11] = 0;
-		zer_store.zernike_coefficients[12] = 0;
-		zer_store.zernike_coefficients[13] = 0;
-		zer_store.zernike_coefficients[14] = 0;
-		zer_store.zernike_coefficients[15] = 0;
-		zer_store.zernike_coefficients[16] = 0;
-		zer_store.zernike_coefficients[17] = 0;
-		zer_store.zernike_coefficients[18] = 0;
-		zer_store.zernike_coefficients[19] = 0;
-
-		zer_rel.zernike_coefficients[1] = 0;
-		zer_rel.zernike_coefficients[2] = 0;
-		zer_rel.zernike_coefficients[3] = 0;
-		zer_rel.zernike_coefficients[4] = 0;
-		zer_rel.zernike_coefficients[5] = 0;
-		zer_rel.zernike_coefficients[6] = 0;
-		zer_rel.zernike_coefficients[7] = 0;
-		zer_rel.zernike_coefficients[8] = 0;
-		zer_rel.zernike_coefficients[9] = 0;
-		zer_rel.zernike_coefficients[10] = 0;
-		zer_rel.zernike_coefficients[11] = 0;
-		zer_rel.zernike_coefficients[12] = 0;
-		zer_rel.zernike_coefficients[13] = 0;
-		zer_rel.zernike_coefficients[14] = 0;
-		zer_rel.zernike_coefficients[15] = 0;
-		zer_rel.zernike_coefficients[16] = 0;
-		zer_rel.zernike_coefficients[17] = 0;
-		zer_rel.zernike_coefficients[18] = 0;
-		zer_rel.zernike_coefficients[19] = 0;
-		Sleep(10);
-	}
-	else
-	{
-		return ERR_FILE_NONEXIST;
-	}
-	return DEVICE_OK;
-}
-
-int Mirao52e_FAKE::SaveCurrentPosition(std::basic_string<char> path)
-{
-	savepath_ = path;
-	diversityhandle->Save_Current_Positions_ToFile(savepath_);
-	return DEVICE_OK;
-}
-
-/*
-// Get Actuator positions //
-int Mirao52e_FAKE::GetActuatorPos(std::vector<float> pos)
-{
-	pos = mirrorhandle->Get_Current_Position();
-	return DEVICE_OK;
-}
-*/
-
-// Set Zernike modes
-int Mirao52e_FAKE::SetZernMode_Tip(float Acoef)
-{
-	zer_rel.zernike_coefficients[1] = Acoef - zer_store.zernike_coefficients[1];
-	diversityhandle->Apply_Relative_Commands(zer_rel);
-	zer_store.zernike_coefficients[1] = Acoef;
-	zer_rel.zernike_coefficients[1] = 0;
-	Sleep(10);
-	return DEVICE_OK;
-}
 
-int Mirao52e_FAKE::SetZernMode_Tilt(float Acoef)
-{
-	zer_rel.zernike_coefficients[2] = Acoef - zer_store.zernike_coefficients[2];
-	diversityhandle->Apply_Relative_Commands(zer_rel);
-	zer_store.zernike_coefficients[2] = Acoef;
-	zer_rel.zernike_coefficients[2] = 0;
-	Sleep(10);
-	return DEVICE_OK;
-}
+   {
+      MMThreadGuard guard(renderlock_);
+      simulator_.Render(flat ? 0 : actuators, roix_, roiy_, roiwidth_, roiheight_, &image_[0]);
+      rendertime_ms_ = (GetCurrentMMTime() - start).getMsec();
+      frames_++;
+   }
 
-int Mirao52e_FAKE::SetZernMode_Defocus(float Acoef)
-{
-	zer_rel.zernike_coefficients[3] = Acoef - zer_store.zernike_coefficients[3];
-	diversityhandle->Apply_Relative_Commands(zer_rel);
-	zer_store.zernike_coefficients[3] = Acoef;
-	zer_rel.zernike_coefficients[3] = 0;
-	Sleep(10);
-	return DEVICE_OK;
+   double left_ms = exposure_ms_ - (GetCurrentMMTime() - start).getMsec();
+   if (left_ms >= 1)
+      CDeviceUtils::SleepMs((long)left_ms);
+   return DEVICE_OK;
 }
 
-int Mirao52e_FAKE::SetZernMode_Astig0deg(float Acoef)
+const unsigned char* MiraoPsfCamera::GetImageBuffer()
 {
-	zer_rel.zernike_coefficients[4] = Acoef - zer_store.zernike_coefficients[4];
-	diversityhandle->Apply_Relative_Commands(zer_rel);
-	zer_store.zernike_coefficients[4] = Acoef;
-	zer_rel.zernike_coefficients[4] = 0;
-	Sleep(10);
-	return DEVICE_OK;
+   return reinterpret_cast<const unsigned char*>(&image_[0]);
 }
 
-int Mirao52e_FAKE::SetZernMode_Astig45deg(float Acoef)
+unsigned MiraoPsfCamera::GetImageWidth() const
 {
-	zer_rel.zernike_coefficients[5] = Acoef - zer_store.zernike_coefficients[5];
-	diversityhandle->Apply_Relative_Commands(zer_rel);
-	zer_store.zernike_coefficients[5] = Acoef;
-	zer_rel.zernike_coefficients[5] = 0;
-	Sleep(10);
-	return DEVICE_OK;
+   return roiwidth_;
 }
 
-int Mirao52e_FAKE::SetZernMode_Coma0deg(float Acoef)
+unsigned MiraoPsfCamera::GetImageHeight() const
 {
-	zer_rel.zernike_coefficients[6] = Acoef - zer_store.zernike_coefficients[6];
-	diversityhandle->Apply_Relative_Commands(zer_rel);
-	zer_store.zernike_coefficients[6] = Acoef;
-	zer_rel.zernike_coefficients[6] = 0;
-	Sleep(10);
-	return DEVICE_OK;
+   return roiheight_;
 }
 
-int Mirao52e_FAKE::SetZernMode_Coma90deg(float Acoef)
+unsigned MiraoPsfCamera::GetImageBytesPerPixel() const
 {
-	zer_rel.zernike_coefficients[7] = Acoef - zer_store.zernike_coefficients[7];
-	diversityhandle->Apply_Relative_Commands(zer_rel);
-	zer_store.zernike_coefficients[7] = Acoef;
-	zer_rel.zernike_coefficients[7] = 0;
-	Sleep(10);
-	return DEVICE_OK;
+   return 2;
 }
 
-int Mirao52e_FAKE::SetZernMode_PrimSpherical(float Acoef)
+unsigned MiraoPsfCamera::GetBitDepth() const
 {
-	zer_rel.zernike_coefficients[8] = Acoef - zer_store.zernike_coefficients[8];
-	diversityhandle->Apply_Relative_Commands(zer_rel);
-	zer_store.zernike_coefficients[8] = Acoef;
-	zer_rel.zernike_coefficients[8] = 0;
-	Sleep(10);
-	return DEVICE_OK;
+   return 16;
 }
 
-int Mirao52e_FAKE::SetZernMode_Trefoil0deg(float Acoef)
+long MiraoPsfCamera::GetImageBufferSize() const
 {
-	zer_rel.zernike_coefficients[9] = Acoef - zer_store.zernike_coefficients[9];
-	diversityhandle->Apply_Relative_Commands(zer_rel);
-	zer_store.zernike_coefficients[9] = Acoef;
-	zer_rel.zernike_coefficients[9] = 0;
-	Sleep(10);
-	return DEVICE_OK;
+   return (long)(roiwidth_ * roiheight_ * GetImageBytesPerPixel());
 }
 
-int Mirao52e_FAKE::SetZernMode_Trefoil90deg(float Acoef)
+double MiraoPsfCamera::GetExposure() const
 {
-	zer_rel.zernike_coefficients[10] = Acoef - zer_store.zernike_coefficients[10];
-	diversityhandle->Apply_Relative_Commands(zer_rel);
-	zer_store.zernike_coefficients[10] = Acoef;
-	zer_rel.zernike_coefficients[10] = 0;
-	Sleep(10);
-	return DEVICE_OK;
+   return exposure_ms_;
 }
 
-int Mirao52e_FAKE::SetZernMode_SecondAstig0deg(float Acoef)
+void MiraoPsfCamera::SetExposure(double exp)
 {
-	zer_rel.zernike_coefficients[11] = Acoef - zer_store.zernike_coefficients[11];
-	diversityhandle->Apply_Relative_Commands(zer_rel);
-	zer_store.zernike_coefficients[11] = Acoef;
-	zer_rel.zernike_coefficients[11] = 0;
-	Sleep(10);
-	return DEVICE_OK;
+   exposure_ms_ = exp < 0 ? 0 : exp;
 }
 
-int Mirao52e_FAKE::SetZernMode_SecondAstig45deg(float Acoef)
+int MiraoPsfCamera::SetROI(unsigned x, unsigned y, unsigned xSize, unsigned ySize)
 {
-	zer_rel.zernike_coefficients[12] = Acoef - zer_store.zernike_coefficients[12];
-	diversityhandle->Apply_Relative_Commands(zer_rel);
-	zer_store.zernike_coefficients[12] = Acoef;
-	zer_rel.zernike_coefficients[12] = 0;
-	Sleep(10);
-	return DEVICE_OK;
+   if (xSize == 0 || ySize == 0 || x + xSize > g_psfSensorSize || y + ySize > g_psfSensorSize)
+      return DEVICE_INVALID_PROPERTY_VALUE;
+   MMThreadGuard guard(renderlock_);
+   roix_ = x;
+   roiy_ = y;
+   roiwidth_ = xSize;
+   roiheight_ = ySize;
+   image_.assign((size_t)roiwidth_ * roiheight_, 0);
+   return DEVICE_OK;
 }
 
-int Mirao52e_FAKE::SetZernMode_Quadrafoil0deg(float Acoef)
+int MiraoPsfCamera::GetROI(unsigned& x, unsigned& y, unsigned& xSize, unsigned& ySize)
 {
-	zer_rel.zernike_coefficients[16] = Acoef - zer_store.zernike_coefficients[16];
-	diversityhandle->Apply_Relative_Commands(zer_rel);
-	zer_store.zernike_coefficients[16] = Acoef;
-	zer_rel.zernike_coefficients[16] = 0;
-	Sleep(10);
-	return DEVICE_OK;
+   x = roix_;
+   y = roiy_;
+   xSize = roiwidth_;
+   ySize = roiheight_;
+   return DEVICE_OK;
 }
 
-int Mirao52e_FAKE::SetZernMode_Quadrafoil45deg(float Acoef)
+int MiraoPsfCamera::ClearROI()
 {
-	zer_rel.zernike_coefficients[17] = Acoef - zer_store.zernike_coefficients[17];
-	diversityhandle->Apply_Relative_Commands(zer_rel);
-	zer_store.zernike_coefficients[17] = Acoef;
-	zer_rel.zernike_coefficients[17] = 0;
-	Sleep(10);
-	return DEVICE_OK;
+   return SetROI(0, 0, g_psfSensorSize, g_psfSensorSize);
 }
 
-
-///////////////////////////////////////////////////////////////////////////////
-// Action handlers
-// Handle changes and updates to property values.
-///////////////////////////////////////////////////////////////////////////////
-
-
-int Mirao52e_FAKE::OnSetCalibration(MM::PropertyBase* pProp, MM::ActionType eAct)
+int MiraoPsfCamera::GetBinning() const
 {
-   if (eAct == MM::BeforeGet)
-   {
-		pProp->Set(calibpath_.c_str()); 
-   }
-   else if (eAct == MM::AfterSet)
-   {
-      std::basic_string<char> path;;
-      pProp->Get(path);
-      return SetCalibration(path);
-   }
-   return DEVICE_OK;
+   return 1;
 }
 
-int Mirao52e_FAKE::OnSetCalibrationParams(MM::PropertyBase* pProp, MM::ActionType eAct)
+int MiraoPsfCamera::SetBinning(int binSize)
 {
-   if (eAct == MM::BeforeGet)
-   {
-	   pProp->Set(calibparamspath_.c_str()); 
-   }
-   else if (eAct == MM::AfterSet)
-   {
-      std::basic_string<char> path;;
-      pProp->Get(path);
-      return SetCalibrationParams(path);
-   }
-   return DEVICE_OK;
+   return binSize == 1 ? DEVICE_OK : DEVICE_INVALID_PROPERTY_VALUE;
 }
 
-int Mirao52e_FAKE::OnSetDiversityPref(MM::PropertyBase* pProp, MM::ActionType eAct)
+int MiraoPsfCamera::IsExposureSequenceable(bool& isSequenceable) const
 {
-   if (eAct == MM::BeforeGet)
-   {
-	// string val;
-    pProp->Set(divprefpath_.c_str()); 
-   }
-   else if (eAct == MM::AfterSet)
-   {
-      std::basic_string<char> path;;
-      pProp->Get(path);
-      return SetDiversityPref(path);
-   }
+   isSequenceable = false;
    return DEVICE_OK;
 }
 
-int Mirao52e_FAKE::OnLoadWavefront(MM::PropertyBase* pProp, MM::ActionType eAct)
+// Places the emitters again; the same seed gives the same sample
+void MiraoPsfCamera::UpdateSample()
 {
-   if (eAct == MM::BeforeGet)
-   {
-    pProp->Set(wfcpath_.c_str()); 
-   }
-   else if (eAct == MM::AfterSet)
-   {
-      std::basic_string<char> path;;
-      pProp->Get(path);
-      return LoadWavefront(path);
-   }
-   return DEVICE_OK;
+   MMThreadGuard guard(renderlock_);
+   simulator_.SetSample(sample_, g_psfSensorSize, g_psfSensorSize);
 }
 
-int Mirao52e_FAKE::OnSaveCurrentPosition(MM::PropertyBase* pProp, MM::ActionType eAct)
+int MiraoPsfCamera::OnBinning(MM::PropertyBase* pProp, MM::ActionType eAct)
 {
    if (eAct == MM::BeforeGet)
    {
-   pProp->Set(savepath_.c_str()); 
-   }
-   else if (eAct == MM::AfterSet)
-   {
-      std::basic_string<char> path;;
-      pProp->Get(path);
-      return SaveCurrentPosition(path);
+      pProp->Set(1L);
    }
    return DEVICE_OK;
 }
 
-// Zernike modes
-int Mirao52e_FAKE::OnSetZernMode_Tip(MM::PropertyBase* pProp, MM::ActionType eAct)
+int MiraoPsfCamera::OnExposure(MM::PropertyBase* pProp, MM::ActionType eAct)
 {
    if (eAct == MM::BeforeGet)
    {
-	  double Acoef;
-	  Acoef = zer_store.zernike_coefficients[1];
-      pProp->Set(Acoef); 
+      pProp->Set(exposure_ms_);
    }
    else if (eAct == MM::AfterSet)
    {
-      double Acoef;
-      pProp->Get(Acoef);
-      return SetZernMode_Tip(Acoef);
+      double exposure;
+      pProp->Get(exposure);
+      SetExposure(exposure);
    }
    return DEVICE_OK;
 }
 
-int Mirao52e_FAKE::OnSetZernMode_Tilt(MM::PropertyBase* pProp, MM::ActionType eAct)
+int MiraoPsfCamera::OnMirror(MM::PropertyBase* pProp, MM::ActionType eAct)
 {
    if (eAct == MM::BeforeGet)
    {
-	  double Acoef;
-	  Acoef = zer_store.zernike_coefficients[2];
-      pProp->Set(Acoef); 
+      pProp->Set(mirror_.c_str());
    }
    else if (eAct == MM::AfterSet)
    {
-      double Acoef;
-      pProp->Get(Acoef);
-      return SetZernMode_Tilt(Acoef);
+      pProp->Get(mirror_);
    }
    return DEVICE_OK;
 }
 
-int Mirao52e_FAKE::OnSetZernMode_Defocus(MM::PropertyBase* pProp, MM::ActionType eAct)
+int MiraoPsfCamera::OnAberration(MM::PropertyBase* pProp, MM::ActionType eAct)
 {
    if (eAct == MM::BeforeGet)
    {
-	  double Acoef;
-	  Acoef = zer_store.zernike_coefficients[3];
-      pProp->Set(Acoef); 
+      pProp->Set(formatzernikes(aberration_, MIRAO_MAX_ZERNIKES).c_str());
    }
    else if (eAct == MM::AfterSet)
    {
-      double Acoef;
-      pProp->Get(Acoef);
-      return SetZernMode_Defocus(Acoef);
+      std::string values;
+      pProp->Get(values);
+      std::vector<float> coefs;
+      if (!parsezernikes(values, MIRAO_MAX_ZERNIKES, coefs))
+         return ERR_INVALID_ZERNIKE_VECTOR;
+      for (int j = 1; j <= MIRAO_MAX_ZERNIKES; j++)
+         aberration_[j] = j <= (int)coefs.size() ? coefs[j - 1] : 0;
+      MMThreadGuard guard(renderlock_);
+      simulator_.SetAberration(aberration_);
    }
    return DEVICE_OK;
 }
 
-int Mirao52e_FAKE::OnSetZernMode_Astig0deg(MM::PropertyBase* pProp, MM::ActionType eAct)
+int MiraoPsfCamera::OnSample(MM::PropertyBase* pProp, MM::ActionType eAct)
 {
    if (eAct == MM::BeforeGet)
    {
-	  double Acoef;
-	  Acoef = zer_store.zernike_coefficients[4];
-      pProp->Set(Acoef); 
+      pProp->Set(g_miraoPsfSamples[sample_.type]);
    }
    else if (eAct == MM::AfterSet)
    {
-      double Acoef;
-      pProp->Get(Acoef);
-      return SetZernMode_Astig0deg(Acoef);
+      std::string value;
+      pProp->Get(value);
+      for (int i = 0; i < MIRAO_NB_PSF_SAMPLES; i++)
+         if (value == g_miraoPsfSamples[i])
+            sample_.type = i;
+      UpdateSample();
    }
    return DEVICE_OK;
 }
 
-int Mirao52e_FAKE::OnSetZernMode_Astig45deg(MM::PropertyBase* pProp, MM::ActionType eAct)
+int MiraoPsfCamera::OnEmitters(MM::PropertyBase* pProp, MM::ActionType eAct)
 {
    if (eAct == MM::BeforeGet)
    {
-	  double Acoef;
-	  Acoef = zer_store.zernike_coefficients[5];
-      pProp->Set(Acoef); 
+      pProp->Set((long)sample_.nbEmitters);
    }
    else if (eAct == MM::AfterSet)
    {
-      double Acoef;
-      pProp->Get(Acoef);
-      return SetZernMode_Astig45deg(Acoef);
+      long emitters;
+      pProp->Get(emitters);
+      sample_.nbEmitters = (int)emitters;
+      UpdateSample();
    }
    return DEVICE_OK;
 }
 
-int Mirao52e_FAKE::OnSetZernMode_Coma0deg(MM::PropertyBase* pProp, MM::ActionType eAct)
+int MiraoPsfCamera::OnDutyCycle(MM::PropertyBase* pProp, MM::ActionType eAct)
 {
    if (eAct == MM::BeforeGet)
    {
-	  double Acoef;
-	  Acoef = zer_store.zernike_coefficients[6];
-      pProp->Set(Acoef); 
+      pProp->Set(sample_.dutyCycle);
    }
    else if (eAct == MM::AfterSet)
    {
-      double Acoef;
-      pProp->Get(Acoef);
-      return SetZernMode_Coma0deg(Acoef);
+      pProp->Get(sample_.dutyCycle);
+      UpdateSample();
    }
    return DEVICE_OK;
 }
 
-int Mirao52e_FAKE::OnSetZernMode_Coma90deg(MM::PropertyBase* pProp, MM::ActionType eAct)
+int MiraoPsfCamera::OnPhotons(MM::PropertyBase* pProp, MM::ActionType eAct)
 {
    if (eAct == MM::BeforeGet)
    {
-	  double Acoef;
-	  Acoef = zer_store.zernike_coefficients[7];
-      pProp->Set(Acoef); 
+      pProp->Set(sample_.photons);
    }
    else if (eAct == MM::AfterSet)
    {
-      double Acoef;
-      pProp->Get(Acoef);
-      return SetZernMode_Coma90deg(Acoef);
+      pProp->Get(sample_.photons);
+      UpdateSample();
    }
    return DEVICE_OK;
 }
 
-int Mirao52e_FAKE::OnSetZernMode_PrimSpherical(MM::PropertyBase* pProp, MM::ActionType eAct)
+int MiraoPsfCamera::OnBackground(MM::PropertyBase* pProp, MM::ActionType eAct)
 {
    if (eAct == MM::BeforeGet)
    {
-	  double Acoef;
-	  Acoef = zer_store.zernike_coefficients[8];
-      pProp->Set(Acoef); 
+      pProp->Set(sample_.background);
    }
    else if (eAct == MM::AfterSet)
    {
-      double Acoef;
-      pProp->Get(Acoef);
-      return SetZernMode_PrimSpherical(Acoef);
+      pProp->Get(sample_.background);
+      UpdateSample();
    }
    return DEVICE_OK;
 }
 
-int Mirao52e_FAKE::OnSetZernMode_Trefoil0deg(MM::PropertyBase* pProp, MM::ActionType eAct)
+int MiraoPsfCamera::OnReadNoise(MM::PropertyBase* pProp, MM::ActionType eAct)
 {
    if (eAct == MM::BeforeGet)
    {
-	  double Acoef;
-	  Acoef = zer_store.zernike_coefficients[9];
-      pProp->Set(Acoef); 
+      pProp->Set(sample_.readNoise);
    }
    else if (eAct == MM::AfterSet)
    {
-      double Acoef;
-      pProp->Get(Acoef);
-      return SetZernMode_Trefoil0deg(Acoef);
+      pProp->Get(sample_.readNoise);
+      UpdateSample();
    }
    return DEVICE_OK;
 }
 
-int Mirao52e_FAKE::OnSetZernMode_Trefoil90deg(MM::PropertyBase* pProp, MM::ActionType eAct)
+int MiraoPsfCamera::OnOffset(MM::PropertyBase* pProp, MM::ActionType eAct)
 {
    if (eAct == MM::BeforeGet)
    {
-	  double Acoef;
-	  Acoef = zer_store.zernike_coefficients[10];
-      pProp->Set(Acoef); 
+      pProp->Set(sample_.offset);
    }
    else if (eAct == MM::AfterSet)
    {
-      double Acoef;
-      pProp->Get(Acoef);
-      return SetZernMode_Trefoil90deg(Acoef);
+      pProp->Get(sample_.offset);
+      UpdateSample();
    }
    return DEVICE_OK;
 }
 
-int Mirao52e_FAKE::OnSetZernMode_SecondAstig0deg(MM::PropertyBase* pProp, MM::ActionType eAct)
+int MiraoPsfCamera::OnSeed(MM::PropertyBase* pProp, MM::ActionType eAct)
 {
    if (eAct == MM::BeforeGet)
    {
-	  double Acoef;
-	  Acoef = zer_store.zernike_coefficients[11];
-      pProp->Set(Acoef); 
+      pProp->Set((long)sample_.seed);
    }
    else if (eAct == MM::AfterSet)
    {
-      double Acoef;
-      pProp->Get(Acoef);
-      return SetZernMode_SecondAstig0deg(Acoef);
+      long seed;
+      pProp->Get(seed);
+      sample_.seed = (unsigned long)seed;
+      UpdateSample();
    }
    return DEVICE_OK;
 }
 
-int Mirao52e_FAKE::OnSetZernMode_SecondAstig45deg(MM::PropertyBase* pProp, MM::ActionType eAct)
+int MiraoPsfCamera::OnThreads(MM::PropertyBase* pProp, MM::ActionType eAct)
 {
    if (eAct == MM::BeforeGet)
    {
-	  double Acoef;
-	  Acoef = zer_store.zernike_coefficients[12];
-      pProp->Set(Acoef); 
+      pProp->Set(threads_);
    }
    else if (eAct == MM::AfterSet)
    {
-      double Acoef;
-      pProp->Get(Acoef);
-      return SetZernMode_SecondAstig45deg(Acoef);
+      pProp->Get(threads_);
+      MMThreadGuard guard(renderlock_);
+      simulator_.Start((int)threads_);
    }
    return DEVICE_OK;
 }
 
-int Mirao52e_FAKE::OnSetZernMode_Quadrafoil0deg(MM::PropertyBase* pProp, MM::ActionType eAct)
+int MiraoPsfCamera::OnRenderTime(MM::PropertyBase* pProp, MM::ActionType eAct)
 {
    if (eAct == MM::BeforeGet)
    {
-	  double Acoef;
-	  Acoef = zer_store.zernike_coefficients[16];
-      pProp->Set(Acoef); 
-   }
-   else if (eAct == MM::AfterSet)
-   {
-      double Acoef;
-      pProp->Get(Acoef);
-      return SetZernMode_Quadrafoil0deg(Acoef);
+      MMThreadGuard guard(renderlock_);
+      pProp->Set(rendertime_ms_);
    }
    return DEVICE_OK;
 }
 
-int Mirao52e_FAKE::OnSetZernMode_Quadrafoil45deg(MM::PropertyBase* pProp, MM::ActionType eAct)
+int MiraoPsfCamera::OnFrames(MM::PropertyBase* pProp, MM::ActionType eAct)
 {
    if (eAct == MM::BeforeGet)
    {
-	  double Acoef;
-	  Acoef = zer_store.zernike_coefficients[17];
-      pProp->Set(Acoef); 
-   }
-   else if (eAct == MM::AfterSet)
-   {
-      double Acoef;
-      pProp->Get(Acoef);
-      return SetZernMode_Quadrafoil45deg(Acoef);
+      MMThreadGuard guard(renderlock_);
+      pProp->Set(frames_);
    }
    return DEVICE_OK;
 }
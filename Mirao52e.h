@@ -10,18 +10,26 @@
 #pragma once
 
 #define NOMINMAX
-#define IMPORT_IMOP_WAVEKITBIO_FROM_LIBRARY
 
 #include "../../MMDevice/MMDevice.h"
 #include "../../MMDevice/DeviceBase.h"
 #include <string>
 #include <sstream>
-#include "Mirror.hpp"
-#include "Model.h"
-#include "PhaseDiversity.h"
-#include "3NAlgorithm.h"
-#include "merit_functions.hpp"
-#include "conversion.hpp"
+#include "MiraoCalibrationSet.h"
+#include "MiraoDepth.h"
+#include "MiraoDiversity.h"
+#include "MiraoField.h"
+#include "MiraoLoop.h"
+#include "MiraoModes.h"
+#include "MiraoOptimiser.h"
+#include "MiraoPresets.h"
+#include "MiraoProjector.h"
+#include "MiraoPsf.h"
+#include "MiraoSdkBackend.h"
+#include "MiraoSequence.h"
+#include "MiraoShackHartmann.h"
+#include "MiraoSimBackend.h"
+#include "MiraoWorker.h"
 
 //////////////////////////////////////////////////////////////////////////////
 // Error codes
@@ -32,12 +40,57 @@
 #define ERR_CAL_FILE_NONEXIST			10203
 #define ERR_DIVPREF_FILE_NONEXIST		10204
 #define ERR_FILE_NONEXIST				10205
+#define ERR_INVALID_ZERNIKE_VECTOR		10206
+#define ERR_ZERNIKE_ORDER				10207
+#define ERR_INVALID_ACTUATOR_VECTOR		10208
+#define ERR_OPTIMISER_CAMERA			10209
+#define ERR_OPTIMISER_MODES				10210
+#define ERR_OPTIMISER_BUSY				10211
+#define ERR_OPTIMISER_ROI				10212
+#define ERR_DIVERSITY_SETTINGS			10213
+#define ERR_PRESET						10214
+#define ERR_DEPTH_TABLE					10215
+#define ERR_DEPTH_FOCUS					10216
+#define ERR_FIELD_MAP					10217
+#define ERR_FIELD_STAGE					10218
+#define ERR_PSF_SETUP					10219
+#define ERR_PSF_MIRROR					10220
+#define ERR_SH_FRAMES					10221
+#define ERR_SH_GEOMETRY					10222
+#define ERR_LOOP_SLOPES					10223
+#define ERR_LOOP_GAINS					10224
+#define ERR_MIRROR_UPDATE				10225
+#define ERR_MIRROR_OPEN					10226
+#define ERR_MIRROR_READBACK				10227
 
-class Mirao52e : public	CGenericBase<Mirao52e>
+//////////////////////////////////////////////////////////////////////////////
+// Timed startup phases
+//
+#define MIRAO_INIT_HARDWARE				0
+#define MIRAO_INIT_CALIBPARAMS			1
+#define MIRAO_INIT_DIVPREFS				2
+#define MIRAO_INIT_PROJECTION			3
+#define MIRAO_INIT_DIVERSITY			4
+#define MIRAO_INIT_TOTAL				5
+#define MIRAO_INIT_PHASES				6
+
+//////////////////////////////////////////////////////////////////////////////
+// The MIRAO-52E on a mirror backend (see MiraoBackend.h). The real and the
+// fake mirror differ in their backend only; properties and the mirror update
+// path are the same code.
+//
+template <class TBackend>
+class Mirao52eDevice : public	CGenericBase< Mirao52eDevice<TBackend> >
 {
+   // Members of the dependent base are not found unqualified
+   typedef typename CGenericBase<Mirao52eDevice>::CPropertyAction CPropertyAction;
+   typedef typename CGenericBase<Mirao52eDevice>::CPropertyActionEx CPropertyActionEx;
+   typedef MiraoCalibrationSet<TBackend> CalibrationSet;
+   typedef MiraoCalibrationRef<TBackend> CalibrationRef;
+
 public:
-	Mirao52e(void);
-	~Mirao52e(void);
+	Mirao52eDevice(const char* name, const char* description, const char* mirrorinitpath);
+	~Mirao52eDevice(void);
 
    // Device API
    // ----------
@@ -45,43 +98,133 @@ public:
    int Shutdown();
    void GetName(char* name) const; 
    bool Busy();
+   // The core's clock, or MiraoClock() while no core is attached
+   MM::MMTime GetCurrentMMTime();
    
    // Deformable mirror API
    // ---------
-   imop::microscopy::Mirror * mirrorhandle;
-   imop::microscopy::Diversity * diversityhandle;
-   imop::microscopy::CalibrationParams * calibparamshandle;
-   imop::microscopy::DiversityPreferences * divprefshandle;
-   imop::microscopy::Zernikes zer_store;
-   imop::microscopy::Zernikes zer_rel;
+   typename TBackend::Mirror mirror_;
+   float zer_store[MIRAO_MAX_ZERNIKES + 1];
+   float zer_rel[MIRAO_MAX_ZERNIKES + 1];
+   MiraoCalibrationSlot<TBackend> calibrations_;
+   CalibrationSet* pending_;
+   MMThreadLock loadlock_;
+   MiraoCalibration calib_;
+   MiraoWavefrontState wfcstate_;
+   MiraoProjector projector_;
+   float actuators_[MIRAO_NB_ACTUATORS];
+   bool actuatorsknown_;
+   bool saturatedwrite_;
+   double projectiontime_us_;
+   double projectionresidual_;
+   long saturatedactuators_;
+   double settletime_ms_;
+   double settletimeperstep_ms_;
+   double dacresolution_;
+   long writedeadband_;
+   int nbzernikes_;
+   MiraoAtomicLong writessuppressed_;
+   bool deferdiversity_;
+   double inittime_ms_[MIRAO_INIT_PHASES];
+   MM::MMTime settleend_;
+   std::vector< std::vector<float> > sequence_;
+   double sequenceinterval_ms_;
+   std::vector<int> presetsequence_;
+   bool sequencepresets_;
+   MMThreadLock mirrorlock_;
+   MMThreadLock sdklock_;
+   MMThreadLock statelock_;
+   float zer_applied_[MIRAO_MAX_ZERNIKES + 1];
+   float headroomup_[MIRAO_MAX_ZERNIKES + 1];
+   float headroomdown_[MIRAO_MAX_ZERNIKES + 1];
+   MiraoOptimiserSettings optimisersettings_;
+   std::string optimisercamera_;
+   long diversitythreads_;
+   MiraoPresetLibrary presets_;
+   int preset_;
+   MiraoDepthTable depthtable_;
+   float zer_depth_[MIRAO_MAX_ZERNIKES + 1];
+   std::string focusdevice_;
+   bool depthspline_;
+   double depthinterval_ms_;
+   double depthz_;
+   MiraoFieldMap fieldmap_;
+   float zer_field_[MIRAO_MAX_ZERNIKES + 1];
+   std::string xystage_;
+   double fieldinterval_ms_;
+   double fieldx_;
+   double fieldy_;
+   MiraoShackHartmannSettings shsettings_;
+   long shthreads_;
+   double shinterval_ms_;
+   float zer_loop_[MIRAO_MAX_ZERNIKES + 1];
+   MiraoLoopSettings loopsettings_;
+   std::string loopgains_;
 
- //  int GetActuatorPos(std::vector<float> pos);
    int SetCalibration(std::basic_string<char> path);
    int SetDiversityPref(std::basic_string<char> path);
    int SetCalibrationParams(std::basic_string<char> path);
    int LoadWavefront(std::basic_string<char> path);
    int SaveCurrentPosition(std::basic_string<char> path);
-   int ApplyZernmodes();
-
-   int SetZernMode_Tip(float Acoef);
-   int SetZernMode_Tilt(float Acoef);
-   int SetZernMode_Defocus(float Acoef);
-   int SetZernMode_Astig0deg(float Acoef);
-   int SetZernMode_Astig45deg(float Acoef);
-   int SetZernMode_Coma0deg(float Acoef);
-   int SetZernMode_Coma90deg(float Acoef);
-   int SetZernMode_PrimSpherical(float Acoef);
-   int SetZernMode_Trefoil0deg(float Acoef);
-   int SetZernMode_Trefoil90deg(float Acoef);
-   int SetZernMode_SecondAstig0deg(float Acoef);
-   int SetZernMode_SecondAstig45deg(float Acoef);
-   int SetZernMode_Quadrafoil0deg(float Acoef);
-   int SetZernMode_Quadrafoil45deg(float Acoef);
-   int SetZernMode_SecondComa0deg(float Acoef);
-   int SetZernMode_SecondComa90deg(float Acoef);
-   int SetZernMode_SecondTrefoil0deg(float Acoef);
-   int SetZernMode_SecondTrefoil90deg(float Acoef);
-   int SetZernMode_SecondSpherical(float Acoef);
+   int SetZernikeVector(const std::string& values);
+   int ApplyZernikeVector(const std::vector<float>& coefs);
+   int LoadZernikeSequence(const std::vector<std::string>& sequence);
+   int SequenceStep(int index);
+   int LoadCalibrationParams();
+   int LoadDiversityPrefs();
+   int LoadProjector();
+   void EnsureDiversity(CalibrationSet* set);
+   void InitDiversity(CalibrationSet* set);
+   int LoadCalibrationSet(const std::string& calib, const std::string& calibparams, const std::string& divprefs, bool inithardware);
+   void PublishCalibration(CalibrationSet* set);
+   void BuildProjector(CalibrationSet* set);
+   bool ProjectActuators(const float* zernikes, float* target);
+   float UpdateActuators(const float* zernikes, const float* target, bool known);
+   void UpdateSettleTime();
+   void StartSettling(float step);
+   MM::MMTime GetSettleEnd();
+   bool IsRedundantWrite(const float* zernikes, const float* target);
+   int SubmitZernikes(double requested_us = 0);
+   int ExecuteCommand(const MiraoCommand& command);
+   int ApplyZernmodes(double requested_us = 0);
+   int SetZernMode(int mode, float Acoef);
+   int ApplyActuators(CalibrationSet* set, const float* actuators);
+   int ReadActuators(float* actuators);
+   int SetActuator(int index, float value);
+   int SetActuatorVector(const std::string& values);
+   int SubmitActuators(const float* actuators);
+   int GetZernikes(float* zernikes);
+   int MoveZernikes(const float* zernikes);
+   int SetZernikes(const float* zernikes);
+   int GetOptimiserCamera(MM::Camera*& camera);
+   int StartOptimiser();
+   int StartDiversity();
+   int LoadPresets();
+   int SelectPreset(int index);
+   int StorePreset(const std::string& name);
+   void UpdatePresetValues();
+   int LoadDepthTable(const std::string& path);
+   int StoreDepthPoint();
+   int ReadFocus(double& z);
+   int ApplyDepth(double z);
+   int StartDepthCorrection();
+   int StopDepthCorrection();
+   int LoadFieldMap(const std::string& path);
+   int StoreFieldPoint();
+   int ReadXY(double& x, double& y);
+   int ApplyField(double x, double y);
+   int StartFieldCorrection();
+   int StopFieldCorrection();
+   int LoadShackHartmannFrames(const std::string& path);
+   int StartShackHartmann();
+   int StopShackHartmann();
+   int RestartShackHartmann();
+   int ApplyLoop(const float* zernikes);
+   void GetHeadroom(float* up, float* down);
+   int StartLoop();
+   int StopLoop();
+   int CreateDeviceProperties();
+   int CreateBackendProperties();
 
    // action interface
    // ----------------
@@ -91,122 +234,214 @@ public:
    int OnSetDiversityPref    (MM::PropertyBase* pProp, MM::ActionType eAct);
    int OnLoadWavefront    (MM::PropertyBase* pProp, MM::ActionType eAct);
    int OnSaveCurrentPosition    (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnProjectionTime    (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnProjectionResidual   (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnSaturatedActuators   (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnZernikeVector    (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnActuatorVector       (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnActuator             (MM::PropertyBase* pProp, MM::ActionType eAct, long index);
+   int OnSequenceInterval    (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnQueueDepth    (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnCommandsSubmitted    (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnCommandsCompleted    (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnCommandsCoalesced    (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnCommandsFailed    (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnLastMirrorError      (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnDacResolution        (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnWriteDeadband        (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnWritesSuppressed     (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnDiversitySetup       (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnDiversityState       (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnInitTime             (MM::PropertyBase* pProp, MM::ActionType eAct, long phase);
+   int OnLatency              (MM::PropertyBase* pProp, MM::ActionType eAct, long index);
+   int OnAppliesPerSecond     (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnTelemetryRecorded    (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnTelemetryReset       (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnTelemetryDump        (MM::PropertyBase* pProp, MM::ActionType eAct);
+   // simulated mirror only
+   int OnSimLatency           (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnSimSettling          (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnSimResolution        (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnNbZernikes           (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnSettleTime    (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnSettleTimePerStep    (MM::PropertyBase* pProp, MM::ActionType eAct);
    int OnApplyZernmodes (MM::PropertyBase* pProp, MM::ActionType eAct);
 
-   int OnSetZernMode_Tip    (MM::PropertyBase* pProp, MM::ActionType eAct);
-   int OnSetZernMode_Tilt    (MM::PropertyBase* pProp, MM::ActionType eAct);
-   int OnSetZernMode_Defocus    (MM::PropertyBase* pProp, MM::ActionType eAct);
-   int OnSetZernMode_Astig0deg    (MM::PropertyBase* pProp, MM::ActionType eAct);
-   int OnSetZernMode_Astig45deg    (MM::PropertyBase* pProp, MM::ActionType eAct);
-   int OnSetZernMode_Coma0deg    (MM::PropertyBase* pProp, MM::ActionType eAct);
-   int OnSetZernMode_Coma90deg    (MM::PropertyBase* pProp, MM::ActionType eAct);
-   int OnSetZernMode_PrimSpherical    (MM::PropertyBase* pProp, MM::ActionType eAct);
-   int OnSetZernMode_Trefoil0deg    (MM::PropertyBase* pProp, MM::ActionType eAct);
-   int OnSetZernMode_Trefoil90deg    (MM::PropertyBase* pProp, MM::ActionType eAct);
-   int OnSetZernMode_SecondAstig0deg    (MM::PropertyBase* pProp, MM::ActionType eAct);
-   int OnSetZernMode_SecondAstig45deg    (MM::PropertyBase* pProp, MM::ActionType eAct);
-   int OnSetZernMode_Quadrafoil0deg    (MM::PropertyBase* pProp, MM::ActionType eAct);
-   int OnSetZernMode_Quadrafoil45deg    (MM::PropertyBase* pProp, MM::ActionType eAct);
-   int OnSetZernMode_SecondComa0deg    (MM::PropertyBase* pProp, MM::ActionType eAct);
-   int OnSetZernMode_SecondComa90deg    (MM::PropertyBase* pProp, MM::ActionType eAct);
-   int OnSetZernMode_SecondTrefoil0deg    (MM::PropertyBase* pProp, MM::ActionType eAct);
-   int OnSetZernMode_SecondTrefoil90deg    (MM::PropertyBase* pProp, MM::ActionType eAct);
-   int OnSetZernMode_SecondSpherical    (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnZernMode             (MM::PropertyBase* pProp, MM::ActionType eAct, long mode);
+   int OnHeadroom             (MM::PropertyBase* pProp, MM::ActionType eAct, long mode);
+   int OnOptimise             (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnOptimiserCamera      (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnOptimiserModes       (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnOptimiserBias        (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnOptimiserScheme      (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnOptimiserMetric      (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnOptimiserRounds      (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnOptimiserPipelining  (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnOptimiserThreads     (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnOptimiserRoi         (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnOptimiserStatus      (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnOptimiserTime        (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnOptimiserMerit       (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnPhaseDiversity       (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnPhaseDiversityThreads (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnPhaseDiversityStatus (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnPhaseDiversityTime   (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnPhaseDiversityRetrievalTime (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnPhaseDiversityIterations (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnPhaseDiversityError  (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnPhaseDiversityCorrection (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnPresetList           (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnPreset               (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnPresetIndex          (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnStorePreset          (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnDepthCorrection      (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnDepthTable           (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnSaveDepthTable       (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnStoreDepthPoint      (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnDepthFocusDevice     (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnDepthInterpolation   (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnDepthInterval        (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnDepthFocus           (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnFieldCorrection      (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnFieldMap             (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnSaveFieldMap         (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnStoreFieldPoint      (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnFieldXYStage         (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnFieldInterval        (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnFieldPosition        (MM::PropertyBase* pProp, MM::ActionType eAct, long axis);
+   int OnShackHartmann        (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnShackHartmannFrames  (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnShackHartmannPixelSize (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnShackHartmannFocalLength (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnShackHartmannOrigin  (MM::PropertyBase* pProp, MM::ActionType eAct, long axis);
+   int OnShackHartmannThreshold (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnShackHartmannThreads (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnShackHartmannInterval (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnShackHartmannStoreReference (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnShackHartmannMeasured (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnShackHartmannRate    (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnShackHartmannTime    (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnShackHartmannLit     (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnShackHartmannSlopeRms (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnLoop                 (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnLoopRate             (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnLoopGains            (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnLoopLeak             (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnLoopMeasuredRate     (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnLoopJitter           (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnLoopResidual         (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnLoopCycles           (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnLoopHeld             (MM::PropertyBase* pProp, MM::ActionType eAct);
 
+   std::string name_;
+   std::string description_;
    std::string mirrorinitpath_;
    std::string calibpath_;
    std::string calibparamspath_;
    std::string divprefpath_;
    std::string wfcpath_;
    std::string savepath_;
+   std::string presetlistpath_;
+   std::string depthpath_;
+   std::string fieldpath_;
+   std::string telemetrypath_;
+   std::string shpath_;
 
 protected:
    bool initialized_;
    std::string port_;
    MM::Device *device_;
    MM::Core *core_;
+   MiraoSequenceThread<Mirao52eDevice>* sequencethread_;
+   MiraoMirrorWorker<Mirao52eDevice>* worker_;
+   MiraoOptimiser<Mirao52eDevice>* optimiser_;
+   MiraoDiversityMeasurement<Mirao52eDevice>* diversitymeasurement_;
+   MiraoFocusTracker<Mirao52eDevice>* focustracker_;
+   MiraoXYTracker<Mirao52eDevice>* xytracker_;
+   MiraoShackHartmann* shackhartmann_;
+   MiraoFrameReplay* framereplay_;
+   MiraoLoop<Mirao52eDevice>* loop_;
 };
-
-
-class Mirao52e_FAKE : public	CGenericBase<Mirao52e_FAKE>
-{
-public:
-	Mirao52e_FAKE(void);
-	~Mirao52e_FAKE(void);
-
-   // Device API
-   // ----------
-   int Initialize();
-   int Shutdown();
-   void GetName(char* name) const; 
-   bool Busy();
-   
-   // Deformable mirror API
-   // ---------
-   imop::microscopy::Mirror * mirrorhandle;
-   imop::microscopy::Diversity * diversityhandle;
-   imop::microscopy::CalibrationParams * calibparamshandle;
-   imop::microscopy::DiversityPreferences * divprefshandle;
-   imop::microscopy::Zernikes zer_store;
-   imop::microscopy::Zernikes zer_rel;
 
- //  int GetActuatorPos(std::vector<float> pos);
-   int SetCalibration(std::basic_string<char> path);
-   int SetDiversityPref(std::basic_string<char> path);
-   int SetCalibrationParams(std::basic_string<char> path);
-   int LoadWavefront(std::basic_string<char> path);
-   int SaveCurrentPosition(std::basic_string<char> path);
+// The simulated mirror exposes its timing and resolution as properties
+template <>
+int Mirao52eDevice<MiraoSimBackend>::CreateBackendProperties();
 
-   int SetZernMode_Tip(float Acoef);
-   int SetZernMode_Tilt(float Acoef);
-   int SetZernMode_Defocus(float Acoef);
-   int SetZernMode_Astig0deg(float Acoef);
-   int SetZernMode_Astig45deg(float Acoef);
-   int SetZernMode_Coma0deg(float Acoef);
-   int SetZernMode_Coma90deg(float Acoef);
-   int SetZernMode_PrimSpherical(float Acoef);
-   int SetZernMode_Trefoil0deg(float Acoef);
-   int SetZernMode_Trefoil90deg(float Acoef);
-   int SetZernMode_SecondAstig0deg(float Acoef);
-   int SetZernMode_SecondAstig45deg(float Acoef);
-   int SetZernMode_Quadrafoil0deg(float Acoef);
-   int SetZernMode_Quadrafoil45deg(float Acoef);
+#ifdef MIRAO_HAVE_SDK
+typedef Mirao52eDevice<MiraoSdkBackend> Mirao52e;
+#endif
+typedef Mirao52eDevice<MiraoSimBackend> Mirao52e_FAKE;
+
+//////////////////////////////////////////////////////////////////////////////
+// Camera that images point emitters through the simulated mirror (see
+// MiraoPsf.h), for benchmarking the optimiser and phase diversity offline
+//
+class MiraoPsfCamera : public CCameraBase<MiraoPsfCamera>
+{
+public:
+   MiraoPsfCamera();
+   ~MiraoPsfCamera();
+
+   // Device API
+   // ----------
+   int Initialize();
+   int Shutdown();
+   void GetName(char* name) const;
+   bool Busy();
+
+   // Camera API
+   // ----------
+   int SnapImage();
+   const unsigned char* GetImageBuffer();
+   unsigned GetImageWidth() const;
+   unsigned GetImageHeight() const;
+   unsigned GetImageBytesPerPixel() const;
+   unsigned GetBitDepth() const;
+   long GetImageBufferSize() const;
+   double GetExposure() const;
+   void SetExposure(double exp);
+   int SetROI(unsigned x, unsigned y, unsigned xSize, unsigned ySize);
+   int GetROI(unsigned& x, unsigned& y, unsigned& xSize, unsigned& ySize);
+   int ClearROI();
+   int GetBinning() const;
+   int SetBinning(int binSize);
+   int IsExposureSequenceable(bool& isSequenceable) const;
 
    // action interface
    // ----------------
-   int OnPort     (MM::PropertyBase* pProp, MM::ActionType eAct);
-   int OnSetCalibration    (MM::PropertyBase* pProp, MM::ActionType eAct);
-   int OnSetCalibrationParams    (MM::PropertyBase* pProp, MM::ActionType eAct);
-   int OnSetDiversityPref    (MM::PropertyBase* pProp, MM::ActionType eAct);
-   int OnLoadWavefront    (MM::PropertyBase* pProp, MM::ActionType eAct);
-   int OnSaveCurrentPosition    (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnBinning              (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnExposure             (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnMirror               (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnAberration           (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnSample               (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnEmitters             (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnDutyCycle            (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnPhotons              (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnBackground           (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnReadNoise            (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnOffset               (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnSeed                 (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnThreads              (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnRenderTime           (MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnFrames               (MM::PropertyBase* pProp, MM::ActionType eAct);
+
+private:
+   void UpdateSample();
 
-   int OnSetZernMode_Tip    (MM::PropertyBase* pProp, MM::ActionType eAct);
-   int OnSetZernMode_Tilt    (MM::PropertyBase* pProp, MM::ActionType eAct);
-   int OnSetZernMode_Defocus    (MM::PropertyBase* pProp, MM::ActionType eAct);
-   int OnSetZernMode_Astig0deg    (MM::PropertyBase* pProp, MM::ActionType eAct);
-   int OnSetZernMode_Astig45deg    (MM::PropertyBase* pProp, MM::ActionType eAct);
-   int OnSetZernMode_Coma0deg    (MM::PropertyBase* pProp, MM::ActionType eAct);
-   int OnSetZernMode_Coma90deg    (MM::PropertyBase* pProp, MM::ActionType eAct);
-   int OnSetZernMode_PrimSpherical    (MM::PropertyBase* pProp, MM::ActionType eAct);
-   int OnSetZernMode_Trefoil0deg    (MM::PropertyBase* pProp, MM::ActionType eAct);
-   int OnSetZernMode_Trefoil90deg    (MM::PropertyBase* pProp, MM::ActionType eAct);
-   int OnSetZernMode_SecondAstig0deg    (MM::PropertyBase* pProp, MM::ActionType eAct);
-   int OnSetZernMode_SecondAstig45deg    (MM::PropertyBase* pProp, MM::ActionType eAct);
-   int OnSetZernMode_Quadrafoil0deg    (MM::PropertyBase* pProp, MM::ActionType eAct);
-   int OnSetZernMode_Quadrafoil45deg    (MM::PropertyBase* pProp, MM::ActionType eAct);
-
-   std::string mirrorinitpath_;
-   std::string calibpath_;
-   std::string calibparamspath_;
-   std::string divprefpath_;
-   std::string wfcpath_;
-   std::string savepath_;
-
-protected:
    bool initialized_;
-   std::string port_;
-   MM::Device *device_;
-   MM::Core *core_;
-};
+   MiraoPsfSimulator simulator_;
+   MiraoPsfSample sample_;
+   MMThreadLock renderlock_;
+   std::vector<unsigned short> image_;
+   unsigned roix_;
+   unsigned roiy_;
+   unsigned roiwidth_;
+   unsigned roiheight_;
+   double exposure_ms_;
+   std::string mirror_;
+   float aberration_[MIRAO_MAX_ZERNIKES + 1];
+   long threads_;
+   double rendertime_ms_;
+   long frames_;
+};
 
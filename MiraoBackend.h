@@ -0,0 +1,61 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          MiraoBackend.h
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     DeviceAdapters
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Mirror backends of the MIRAO-52E adapter: what the device
+//                needs from the mirror driver, and whether the vendor SDK
+//                is available to provide it
+//
+// AUTHOR:        Marijn Siemons
+
+#pragma once
+
+// The Imagine Optic SDK only exists for Windows. Without it only the
+// simulated mirror is built; define MIRAO_NO_SDK to leave the SDK out on
+// Windows as well.
+#if defined(_WIN32) && !defined(MIRAO_NO_SDK)
+#define MIRAO_HAVE_SDK
+#endif
+
+//////////////////////////////////////////////////////////////////////////////
+// A backend is a class with the interface below. It is a template argument
+// of the calibration set and the device, so the mirror update path makes no
+// virtual calls.
+//
+//   class Backend
+//   {
+//   public:
+//      // The mirror driver, one per device; outlives every calibration set
+//      class Mirror
+//      {
+//      public:
+//         bool Open(const std::string& initpath);
+//      };
+//
+//      // One per calibration set, constructed before Mirror::Open()
+//      Backend(Mirror& mirror);
+//
+//      // After Mirror::Open(). The three loads touch separate state and may
+//      // run in parallel; each returns false if its file cannot be used.
+//      // LoadCalibration() is called with the device's SDK lock held.
+//      bool LoadCalibration(const std::string& path);
+//      bool LoadCalibrationParams(const std::string& path);
+//      bool LoadDiversityPrefs(const std::string& path);
+//      void InitDiversity();
+//
+//      // Mirror updates, called with the device's SDK lock held.
+//      // ApplyRelative() adds dzernikes[1..nbzernikes] to the current shape
+//      // and clips every actuator on its own. ApplyAbsolute() moves to the
+//      // actuator commands and limits of a parsed wavefront state; wcspath
+//      // is a .wcs file holding the same state, or empty if there is none
+//      // and a backend that only applies files has to write one. The file
+//      // variant is for .wcs files the adapter cannot parse. Both return
+//      // false if the mirror was not moved.
+//      void ApplyRelative(const float* dzernikes, int nbzernikes);
+//      bool ApplyAbsolute(const MiraoWavefrontState& state, const std::string& wcspath);
+//      bool ApplyAbsolute(const std::string& wcspath);
+//      void SavePositions(const std::string& wcspath);
+//      bool ReadPositions(float* actuators);
+//   };
+//
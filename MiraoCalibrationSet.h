@@ -0,0 +1,119 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          MiraoCalibrationSet.h
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     DeviceAdapters
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Reference-counted calibration sets of the MIRAO-52E, so a new
+//                calibration can be built while the current one is in use
+//
+// AUTHOR:        Marijn Siemons
+
+#pragma once
+
+#include <string>
+#include "../../MMDevice/DeviceThreads.h"
+#include "MiraoBackend.h"
+#include "MiraoProjector.h"
+#include "MiraoSync.h"
+
+//////////////////////////////////////////////////////////////////////////////
+// Everything loaded from one calibration, calibration params and diversity
+// prefs triple: the backend objects and the native projection. A set is
+// filled in by one thread before it is published and owns its backend.
+//
+template <class TBackend>
+class MiraoCalibrationSet
+{
+public:
+	MiraoCalibrationSet(typename TBackend::Mirror& mirror, const std::string& calib, const std::string& calibparams, const std::string& divprefs) :
+		calibpath(calib),
+		calibparamspath(calibparams),
+		divprefpath(divprefs),
+		backend(mirror),
+		diversityready(false),
+		refs_(1)
+	{
+	}
+
+	void AddRef() { refs_.Increment(); }
+
+	void Release()
+	{
+		if (refs_.Add(-1) == 0)
+			delete this;
+	}
+
+	std::string calibpath;
+	std::string calibparamspath;
+	std::string divprefpath;
+	TBackend backend;
+	bool diversityready;
+	MiraoCalibration calib;
+	MiraoProjector projector;
+
+private:
+	~MiraoCalibrationSet() {}
+
+	MiraoAtomicLong refs_;
+};
+
+
+//////////////////////////////////////////////////////////////////////////////
+// The calibration set in use. Readers take a reference with Acquire(),
+// Publish() replaces the set and the previous one is deleted when its last
+// reader releases it.
+//
+template <class TBackend>
+class MiraoCalibrationSlot
+{
+public:
+	MiraoCalibrationSlot() : current_(0) {}
+	~MiraoCalibrationSlot() { Publish(0); }
+
+	// Current set with a reference taken for the caller, or 0
+	MiraoCalibrationSet<TBackend>* Acquire()
+	{
+		MMThreadGuard guard(lock_);
+		if (current_)
+			current_->AddRef();
+		return current_;
+	}
+
+	// Takes over the caller's reference to set
+	void Publish(MiraoCalibrationSet<TBackend>* set)
+	{
+		MiraoCalibrationSet<TBackend>* previous;
+		{
+			MMThreadGuard guard(lock_);
+			previous = current_;
+			current_ = set;
+		}
+		if (previous)
+			previous->Release();
+	}
+
+private:
+	MMThreadLock lock_;
+	MiraoCalibrationSet<TBackend>* current_;
+};
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Holds a reference to the current set for the lifetime of the object
+//
+template <class TBackend>
+class MiraoCalibrationRef
+{
+public:
+	MiraoCalibrationRef(MiraoCalibrationSlot<TBackend>& slot) : set_(slot.Acquire()) {}
+	~MiraoCalibrationRef() { if (set_) set_->Release(); }
+
+	MiraoCalibrationSet<TBackend>* get() const { return set_; }
+	MiraoCalibrationSet<TBackend>* operator->() const { return set_; }
+
+private:
+	MiraoCalibrationRef(const MiraoCalibrationRef&);
+	MiraoCalibrationRef& operator=(const MiraoCalibrationRef&);
+
+	MiraoCalibrationSet<TBackend>* set_;
+};
@@ -0,0 +1,170 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          MiraoDepth.cpp
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     DeviceAdapters
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Depth-dependent Zernike correction for the MIRAO-52E: a
+//                table of corrections over focus position and the thread
+//                that follows the focus stage with it
+//
+// AUTHOR:        Marijn Siemons
+
+#include "MiraoDepth.h"
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+#define MIRAO_DEPTH_STRIDE	(MIRAO_MAX_ZERNIKES + 1)
+
+bool MiraoDepthTable::Load(const std::string& path)
+{
+	std::string xml;
+	if (!MiraoReadFile(path, xml))
+		return false;
+
+	MiraoDepthTable table;
+	size_t pos = 0;
+	std::string point;
+	while (MiraoTagText(xml, "point", point, pos))
+	{
+		std::string z;
+		std::string text;
+		size_t at = 0;
+		if (!MiraoTagText(point, "z", z, at))
+			return false;
+		at = 0;
+		if (!MiraoTagText(point, "zernikes", text, at))
+			return false;
+		for (size_t i = 0; i < text.size(); i++)
+			if (text[i] == ',' || text[i] == ';')
+				text[i] = ' ';
+		float zernikes[MIRAO_DEPTH_STRIDE] = { 0 };
+		std::istringstream stream(text);
+		int j = 1;
+		while (j <= MIRAO_MAX_ZERNIKES && stream >> zernikes[j])
+			++j;
+		table.Add(atof(z.c_str()), zernikes);
+	}
+	if (table.Size() == 0)
+		return false;
+	*this = table;
+	return true;
+}
+
+bool MiraoDepthTable::Save(const std::string& path) const
+{
+	std::ofstream file(path.c_str(), std::ios::out | std::ios::trunc);
+	if (!file)
+		return false;
+	file.precision(9);
+	file << "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n<depth_correction>\n";
+	for (int i = 0; i < Size(); ++i)
+	{
+		const float* zernikes = &values_[i * MIRAO_DEPTH_STRIDE];
+		int last = MIRAO_MAX_ZERNIKES;
+		while (last > 1 && zernikes[last] == 0)
+			--last;
+		file << "\t<point>\n\t\t<z>" << z_[i] << "</z>\n\t\t<zernikes>";
+		for (int j = 1; j <= last; ++j)
+			file << (j > 1 ? " " : "") << zernikes[j];
+		file << "</zernikes>\n\t</point>\n";
+	}
+	file << "</depth_correction>\n";
+	return !file.fail();
+}
+
+void MiraoDepthTable::Add(double z, const float* zernikes)
+{
+	size_t i = std::lower_bound(z_.begin(), z_.end(), z) - z_.begin();
+	if (i == z_.size() || z_[i] != z)
+	{
+		z_.insert(z_.begin() + i, z);
+		values_.insert(values_.begin() + i * MIRAO_DEPTH_STRIDE, MIRAO_DEPTH_STRIDE, 0.0f);
+	}
+	float* point = &values_[i * MIRAO_DEPTH_STRIDE];
+	point[0] = 0;
+	for (int j = 1; j <= MIRAO_MAX_ZERNIKES; ++j)
+		point[j] = zernikes[j];
+	Prepare();
+}
+
+void MiraoDepthTable::Clear()
+{
+	z_.clear();
+	values_.clear();
+	curvature_.clear();
+}
+
+// Natural cubic spline through every mode: tridiagonal system for the second
+// derivatives at the points, zero at both ends
+void MiraoDepthTable::Prepare()
+{
+	const int n = Size();
+	curvature_.assign(values_.size(), 0.0);
+	if (n < 3)
+		return;
+	std::vector<double> diagonal(n);
+	std::vector<double> rhs(n);
+	for (int j = 1; j <= MIRAO_MAX_ZERNIKES; ++j)
+	{
+		// forward elimination
+		for (int i = 1; i < n - 1; ++i)
+		{
+			double h0 = z_[i] - z_[i - 1];
+			double h1 = z_[i + 1] - z_[i];
+			double y0 = values_[(i - 1) * MIRAO_DEPTH_STRIDE + j];
+			double y1 = values_[i * MIRAO_DEPTH_STRIDE + j];
+			double y2 = values_[(i + 1) * MIRAO_DEPTH_STRIDE + j];
+			diagonal[i] = 2 * (h0 + h1);
+			rhs[i] = 6 * ((y2 - y1) / h1 - (y1 - y0) / h0);
+			if (i > 1)
+			{
+				double factor = h0 / diagonal[i - 1];
+				diagonal[i] -= factor * h0;
+				rhs[i] -= factor * rhs[i - 1];
+			}
+		}
+		// back substitution
+		for (int i = n - 2; i >= 1; --i)
+		{
+			double next = i + 1 < n - 1 ? curvature_[(i + 1) * MIRAO_DEPTH_STRIDE + j] : 0;
+			curvature_[i * MIRAO_DEPTH_STRIDE + j] = (rhs[i] - (z_[i + 1] - z_[i]) * next) / diagonal[i];
+		}
+	}
+}
+
+bool MiraoDepthTable::Interpolate(double z, bool spline, float* zernikes) const
+{
+	const int n = Size();
+	if (n == 0)
+		return false;
+	zernikes[0] = 0;
+	if (n == 1 || z <= z_[0] || z >= z_[n - 1])
+	{
+		const float* point = &values_[(z <= z_[0] ? 0 : n - 1) * MIRAO_DEPTH_STRIDE];
+		for (int j = 1; j <= MIRAO_MAX_ZERNIKES; ++j)
+			zernikes[j] = point[j];
+		return true;
+	}
+
+	int i = (int)(std::upper_bound(z_.begin(), z_.end(), z) - z_.begin()) - 1;
+	const double h = z_[i + 1] - z_[i];
+	const double b = (z - z_[i]) / h;
+	const double a = 1 - b;
+	const float* y0 = &values_[i * MIRAO_DEPTH_STRIDE];
+	const float* y1 = y0 + MIRAO_DEPTH_STRIDE;
+	if (!spline)
+	{
+		for (int j = 1; j <= MIRAO_MAX_ZERNIKES; ++j)
+			zernikes[j] = (float)(a * y0[j] + b * y1[j]);
+		return true;
+	}
+	const double* c0 = &curvature_[i * MIRAO_DEPTH_STRIDE];
+	const double* c1 = c0 + MIRAO_DEPTH_STRIDE;
+	const double ca = (a * a * a - a) * h * h / 6;
+	const double cb = (b * b * b - b) * h * h / 6;
+	for (int j = 1; j <= MIRAO_MAX_ZERNIKES; ++j)
+		zernikes[j] = (float)(a * y0[j] + b * y1[j] + ca * c0[j] + cb * c1[j]);
+	return true;
+}
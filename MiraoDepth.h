@@ -0,0 +1,128 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          MiraoDepth.h
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     DeviceAdapters
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Depth-dependent Zernike correction for the MIRAO-52E: a
+//                table of corrections over focus position and the thread
+//                that follows the focus stage with it
+//
+// AUTHOR:        Marijn Siemons
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include "../../MMDevice/MMDevice.h"
+#include "../../MMDevice/DeviceThreads.h"
+#include "../../MMDevice/DeviceUtils.h"
+#include "MiraoProjector.h"
+#include "MiraoSync.h"
+
+//////////////////////////////////////////////////////////////////////////////
+// Zernike corrections [um] at a set of focus positions [um], interpolated
+// linearly or with a natural cubic spline in between and held constant
+// beyond the first and last point
+//
+class MiraoDepthTable
+{
+public:
+	MiraoDepthTable() {}
+
+	// <point><z>...</z><zernikes>...</zernikes></point> per focus position,
+	// the Zernikes in SDK order starting at tip. False if the file cannot be
+	// read or holds no valid point; the table is then left as it was.
+	bool Load(const std::string& path);
+	bool Save(const std::string& path) const;
+	// Adds the correction at z, replacing a point at the same position
+	void Add(double z, const float* zernikes);
+	void Clear();
+
+	int Size() const { return (int)z_.size(); }
+	// Correction at z in zernikes[0..MIRAO_MAX_ZERNIKES], piston 0. False if
+	// the table is empty.
+	bool Interpolate(double z, bool spline, float* zernikes) const;
+
+private:
+	// Spline second derivatives, recomputed whenever a point changes
+	void Prepare();
+
+	std::vector<double> z_;					// ascending
+	std::vector<float> values_;				// MIRAO_MAX_ZERNIKES + 1 per point
+	std::vector<double> curvature_;			// same layout
+};
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Follows the focus position: reads device->ReadFocus(z) every interval and
+// calls device->ApplyDepth(z) when it has moved. MMDevice gives adapters no
+// notification of other devices' moves, so the position is polled; a read
+// costs one call into the stage adapter.
+//
+template <class TDevice>
+class MiraoFocusTracker : public MMDeviceThreadBase
+{
+public:
+	MiraoFocusTracker(TDevice* device) :
+		device_(device),
+		interval_ms_(5),
+		tolerance_um_(0.01),
+		stop_(1),
+		active_(false)
+	{
+	}
+
+	~MiraoFocusTracker()
+	{
+		Stop();
+	}
+
+	void Start(double interval_ms, double tolerance_um)
+	{
+		Stop();
+		interval_ms_ = interval_ms;
+		tolerance_um_ = tolerance_um;
+		stop_.Set(0);
+		active_ = true;
+		activate();
+	}
+
+	void Stop()
+	{
+		if (!active_)
+			return;
+		stop_.Set(1);
+		wait();
+		active_ = false;
+	}
+
+	bool IsRunning() const { return stop_.Get() == 0; }
+
+	int svc()
+	{
+		bool applied = false;
+		double last = 0;
+		while (!stop_.Get())
+		{
+			double z;
+			if (device_->ReadFocus(z) == DEVICE_OK &&
+				(!applied || z - last > tolerance_um_ || last - z > tolerance_um_))
+			{
+				if (device_->ApplyDepth(z) == DEVICE_OK)
+				{
+					last = z;
+					applied = true;
+				}
+			}
+			CDeviceUtils::SleepMs((long)interval_ms_);
+		}
+		return 0;
+	}
+
+private:
+	TDevice* device_;
+	double interval_ms_;
+	double tolerance_um_;
+	MiraoAtomicLong stop_;
+	bool active_;
+};
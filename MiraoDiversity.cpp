@@ -0,0 +1,545 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          MiraoDiversity.cpp
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     DeviceAdapters
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Native phase diversity for the MIRAO-52E: iterative phase
+//                retrieval from defocus-diverse images and the thread that
+//                measures and corrects with it
+//
+// AUTHOR:        Marijn Siemons
+
+#include "MiraoDiversity.h"
+#include "MiraoModes.h"
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+
+namespace {
+
+const double pi = 3.14159265358979323846;
+
+template <typename T>
+bool TagValue(const std::string& xml, const char* tag, T& value)
+{
+	std::string text;
+	size_t pos = 0;
+	if (!MiraoTagText(xml, tag, text, pos))
+		return false;
+	std::istringstream stream(text);
+	return !!(stream >> value);
+}
+
+double Wrap(double phase)
+{
+	return phase - 2.0 * pi * std::floor((phase + pi) / (2.0 * pi));
+}
+
+// Separable Gaussian smoothing of an n by n image, edges extended
+void Smooth(std::vector<double>& image, int n, int size, double sigma)
+{
+	if (size < 2 || sigma <= 0)
+		return;
+	const int half = size / 2;
+	std::vector<double> kernel(2 * half + 1);
+	double total = 0;
+	for (int i = -half; i <= half; ++i)
+		total += kernel[i + half] = std::exp(-0.5 * i * i / (sigma * sigma));
+	for (size_t i = 0; i < kernel.size(); ++i)
+		kernel[i] /= total;
+
+	std::vector<double> temp(image.size());
+	for (int y = 0; y < n; ++y)
+		for (int x = 0; x < n; ++x)
+		{
+			double s = 0;
+			for (int i = -half; i <= half; ++i)
+			{
+				const int xi = x + i < 0 ? 0 : (x + i >= n ? n - 1 : x + i);
+				s += kernel[i + half] * image[y * n + xi];
+			}
+			temp[y * n + x] = s;
+		}
+	for (int y = 0; y < n; ++y)
+		for (int x = 0; x < n; ++x)
+		{
+			double s = 0;
+			for (int i = -half; i <= half; ++i)
+			{
+				const int yi = y + i < 0 ? 0 : (y + i >= n ? n - 1 : y + i);
+				s += kernel[i + half] * temp[yi * n + x];
+			}
+			image[y * n + x] = s;
+		}
+}
+
+} // namespace
+
+
+MiraoDiversitySettings::MiraoDiversitySettings() :
+	nbZernikes(10),
+	defocus(0.14),
+	iterationMax(5),
+	relativeDiff(0.001),
+	iterationMaxAlgo(200),
+	kernelSize(9),
+	kernelSigma(1.6),
+	wavelength_nm(675),
+	targetRadius(10),
+	zernikeRadius(10),
+	supportSize(128),
+	transpose(false),
+	flipX(false),
+	flipY(false)
+{
+	for (int j = 0; j <= MIRAO_MAX_ZERNIKES; j++)
+	{
+		thresholdMin[j] = 0;
+		thresholdMax[j] = 1;
+	}
+}
+
+bool MiraoDiversitySettings::Load(const std::string& prefsPath, const std::string& calibParamsPath)
+{
+	return LoadPreferences(prefsPath) && LoadCalibrationParams(calibParamsPath);
+}
+
+bool MiraoDiversitySettings::LoadPreferences(const std::string& path)
+{
+	std::string xml;
+	if (!MiraoReadFile(path, xml))
+		return false;
+	if (!TagValue(xml, "nb_zernikes", nbZernikes) || !TagValue(xml, "defocus", defocus))
+		return false;
+	if (nbZernikes < 1 || nbZernikes > MIRAO_MAX_ZERNIKES)
+		return false;
+	TagValue(xml, "iteration_max", iterationMax);
+	TagValue(xml, "relative_diff", relativeDiff);
+	TagValue(xml, "iteration_max_algo_diversite", iterationMaxAlgo);
+	TagValue(xml, "kernel_size", kernelSize);
+	TagValue(xml, "kernel_sigma", kernelSigma);
+
+	std::string list;
+	std::string value;
+	size_t pos = 0;
+	if (MiraoTagText(xml, "zernikes_threshold_list", list, pos))
+	{
+		size_t item = 0;
+		while (MiraoTagText(list, "index_zernike", value, item))
+		{
+			const int j = atoi(value.c_str());
+			std::string min, max;
+			if (!MiraoTagText(list, "min", min, item) || !MiraoTagText(list, "max", max, item))
+				break;
+			if (j >= 1 && j <= MIRAO_MAX_ZERNIKES)
+			{
+				thresholdMin[j] = (float)atof(min.c_str());
+				thresholdMax[j] = (float)atof(max.c_str());
+			}
+		}
+	}
+
+	// An image set of the optional list starts at its <image_0>
+	diversities.clear();
+	int optional = 0;
+	TagValue(xml, "optional_zernikes", optional);
+	pos = 0;
+	if (optional > 0 && MiraoTagText(xml, "optional_zernikes_list", list, pos))
+	{
+		size_t start = std::string::npos;
+		for (int i = 0; i < optional; ++i)
+			start = list.find("<image_0>", start == std::string::npos ? 0 : start + 1);
+		const size_t next = start == std::string::npos ? start : list.find("<image_0>", start + 1);
+		for (int k = 0; start != std::string::npos && k < MIRAO_DIVERSITY_MAX_IMAGES; ++k)
+		{
+			std::ostringstream tag;
+			tag << "image_" << k;
+			std::string image;
+			size_t end = start;
+			if (!MiraoTagText(list, tag.str(), image, end) || (next != std::string::npos && end > next))
+				break;
+			std::vector<float> offsets(MIRAO_MAX_ZERNIKES + 1, 0.0f);
+			std::string first, second;
+			size_t coef = 0;
+			while (MiraoTagText(image, "first", first, coef) && MiraoTagText(image, "second", second, coef))
+			{
+				const int j = atoi(first.c_str());
+				if (j >= 1 && j <= MIRAO_MAX_ZERNIKES)
+					offsets[j] = (float)atof(second.c_str());
+			}
+			diversities.push_back(offsets);
+		}
+	}
+	if (diversities.size() < 2)
+	{
+		// In focus, then defocused to either side (mode 3 is defocus)
+		diversities.assign(3, std::vector<float>(MIRAO_MAX_ZERNIKES + 1, 0.0f));
+		diversities[1][3] = (float)defocus;
+		diversities[2][3] = (float)-defocus;
+	}
+	return true;
+}
+
+bool MiraoDiversitySettings::LoadCalibrationParams(const std::string& path)
+{
+	std::string xml;
+	if (!MiraoReadFile(path, xml))
+		return false;
+	int support = 0;
+	if (!TagValue(xml, "wavelength", wavelength_nm) || !TagValue(xml, "target_radius", targetRadius) || !TagValue(xml, "fft_support_size", support))
+		return false;
+	zernikeRadius = targetRadius;
+	TagValue(xml, "average_zer_radius", zernikeRadius);
+	int flag = 0;
+	transpose = TagValue(xml, "do_transpose", flag) && flag != 0;
+	flipX = TagValue(xml, "do_flip_x", flag) && flag != 0;
+	flipY = TagValue(xml, "do_flip_y", flag) && flag != 0;
+	supportSize = 16;
+	while (supportSize < support)
+		supportSize *= 2;
+	return wavelength_nm > 0 && targetRadius > 0 && zernikeRadius > 0 && 2 * targetRadius < supportSize;
+}
+
+
+void MiraoDiversitySettings::Pupil(std::vector<int>& pixels, int& rowBegin, int& rowEnd) const
+{
+	const int n = supportSize;
+	const int centre = n / 2;
+	const double radius = targetRadius;
+	pixels.clear();
+	for (int v = 0; v < n; ++v)
+		for (int u = 0; u < n; ++u)
+			if ((u - centre) * (u - centre) + (v - centre) * (v - centre) <= radius * radius)
+				pixels.push_back(v * n + u);
+	rowBegin = centre - (int)std::ceil(radius);
+	rowEnd = centre + (int)std::ceil(radius) + 1;
+	if (rowBegin < 0)
+		rowBegin = 0;
+	if (rowEnd > n)
+		rowEnd = n;
+}
+
+double MiraoDiversitySettings::PupilMode(int j, int pixel) const
+{
+	const int centre = supportSize / 2;
+	const double x = (pixel % supportSize - centre) / zernikeRadius;
+	const double y = (pixel / supportSize - centre) / zernikeRadius;
+	return 2.0 * pi / (wavelength_nm * 1e-3) * MiraoZernike(g_miraoModes[j - 1].n, g_miraoModes[j - 1].m, x, y);
+}
+
+MiraoPhaseRetrieval::MiraoPhaseRetrieval() :
+	n_(0),
+	nbImages_(0),
+	nbModes_(0),
+	plan_(0),
+	pupilRowBegin_(0),
+	pupilRowEnd_(0),
+	iterations_(0),
+	error_(0)
+{
+}
+
+MiraoPhaseRetrieval::~MiraoPhaseRetrieval()
+{
+}
+
+bool MiraoPhaseRetrieval::Configure(const MiraoDiversitySettings& settings)
+{
+	settings_ = settings;
+	n_ = settings.supportSize;
+	plan_ = &MiraoFftPlan::Get(n_);
+	nbImages_ = (int)settings.diversities.size();
+	if (nbImages_ > MIRAO_DIVERSITY_MAX_IMAGES)
+		nbImages_ = MIRAO_DIVERSITY_MAX_IMAGES;
+	nbModes_ = settings.nbZernikes;
+	if (nbImages_ < 2)
+		return false;
+
+	settings.Pupil(pupil_, pupilRowBegin_, pupilRowEnd_);
+	const int size = (int)pupil_.size();
+
+	// Piston and Zernike modes in radians of phase per um of wavefront
+	const int nbBasis = nbModes_ + 1;
+	modes_.assign((size_t)nbBasis * size, 0.0);
+	for (int s = 0; s < size; ++s)
+	{
+		modes_[s] = 1.0;
+		for (int j = 1; j <= nbModes_; ++j)
+			modes_[(size_t)j * size + s] = settings.PupilMode(j, pupil_[s]);
+	}
+	normal_.assign(nbBasis * nbBasis, 0.0);
+	for (int i = 0; i < nbBasis; ++i)
+		for (int j = 0; j <= i; ++j)
+		{
+			double d = 0;
+			for (int s = 0; s < size; ++s)
+				d += modes_[(size_t)i * size + s] * modes_[(size_t)j * size + s];
+			normal_[i * nbBasis + j] = normal_[j * nbBasis + i] = d;
+		}
+	if (!MiraoCholeskyFactor(normal_, nbBasis))
+		return false;
+
+	diversity_.assign(nbImages_, std::vector<double>(size, 0.0));
+	for (int k = 0; k < nbImages_; ++k)
+		for (int j = 1; j <= MIRAO_MAX_ZERNIKES; ++j)
+		{
+			const double offset = settings.diversities[k][j];
+			if (offset == 0)
+				continue;
+			for (int s = 0; s < size; ++s)
+				diversity_[k][s] += offset * settings.PupilMode(j, pupil_[s]);
+		}
+
+	amplitude_.assign(nbImages_, std::vector<double>((size_t)n_ * n_, 0.0));
+	field_.assign(nbImages_, std::vector<double>((size_t)2 * n_ * n_, 0.0));
+	back_.assign(nbImages_, std::vector<double>((size_t)2 * size, 0.0));
+	residual_.assign(nbImages_, 0.0);
+	phase_.assign(size, 0.0);
+	return true;
+}
+
+void MiraoPhaseRetrieval::SetImages(const std::vector<MiraoFrame>& frames)
+{
+	// Brightest 3 by 3 spot of the first image
+	const MiraoFrame& first = frames[0];
+	int peakX = first.width / 2;
+	int peakY = first.height / 2;
+	double peak = -1;
+	for (int y = 1; y + 1 < first.height; ++y)
+	{
+		const unsigned short* row = &first.pixels[(size_t)y * first.width];
+		const int w = first.width;
+		for (int x = 1; x + 1 < w; ++x)
+		{
+			const double s = (double)row[x - 1 - w] + row[x - w] + row[x + 1 - w]
+				+ row[x - 1] + row[x] + row[x + 1]
+				+ row[x - 1 + w] + row[x + w] + row[x + 1 + w];
+			if (s > peak)
+			{
+				peak = s;
+				peakX = x;
+				peakY = y;
+			}
+		}
+	}
+
+	const int size = (int)pupil_.size();
+	std::vector<double> crop((size_t)n_ * n_);
+	std::vector<unsigned char> inside((size_t)n_ * n_);
+	for (int k = 0; k < nbImages_ && k < (int)frames.size(); ++k)
+	{
+		const MiraoFrame& frame = frames[k];
+		// Pupil orientation: flipped, then transposed, with the peak at the
+		// centre of the crop
+		int centreX = settings_.flipX ? n_ - 1 - n_ / 2 : n_ / 2;
+		int centreY = settings_.flipY ? n_ - 1 - n_ / 2 : n_ / 2;
+		if (settings_.transpose)
+		{
+			const int t = centreX;
+			centreX = centreY;
+			centreY = t;
+		}
+		double border = 0;
+		int nbBorder = 0;
+		for (int v = 0; v < n_; ++v)
+			for (int u = 0; u < n_; ++u)
+			{
+				int a = settings_.flipX ? n_ - 1 - u : u;
+				int b = settings_.flipY ? n_ - 1 - v : v;
+				if (settings_.transpose)
+				{
+					const int t = a;
+					a = b;
+					b = t;
+				}
+				const int x = peakX - centreX + a;
+				const int y = peakY - centreY + b;
+				const size_t i = (size_t)v * n_ + u;
+				inside[i] = x >= 0 && y >= 0 && x < frame.width && y < frame.height;
+				crop[i] = inside[i] ? frame.pixels[(size_t)y * frame.width + x] : 0.0;
+				if (inside[i] && (u == 0 || v == 0 || u == n_ - 1 || v == n_ - 1))
+				{
+					border += crop[i];
+					++nbBorder;
+				}
+			}
+		const double background = nbBorder > 0 ? border / nbBorder : 0.0;
+		for (size_t i = 0; i < crop.size(); ++i)
+			crop[i] = inside[i] && crop[i] > background ? crop[i] - background : 0.0;
+		Smooth(crop, n_, settings_.kernelSize, settings_.kernelSigma);
+
+		// Scaled as the far field of a unit amplitude pupil, centre moved to pixel 0
+		double total = 0;
+		for (size_t i = 0; i < crop.size(); ++i)
+			total += crop[i];
+		const double scale = total > 0 ? (double)n_ * n_ * size / total : 0.0;
+		for (int v = 0; v < n_; ++v)
+			for (int u = 0; u < n_; ++u)
+				amplitude_[k][((v + n_ / 2) % n_) * n_ + (u + n_ / 2) % n_] = std::sqrt(crop[(size_t)v * n_ + u] * scale);
+	}
+}
+
+// 2D FFT of an n by n complex field. Rows outside the pupil are zero going
+// forward and not needed coming back, so only the pupil rows are transformed.
+void MiraoPhaseRetrieval::Transform(double* field, bool inverse, bool pupilRows) const
+{
+	const int rowBegin = pupilRows ? pupilRowBegin_ : 0;
+	const int rowEnd = pupilRows ? pupilRowEnd_ : n_;
+	const size_t count = (size_t)n_ * n_;
+	if (inverse)
+	{
+		// inverse(x) = conj(forward(conj(x))) / n^2
+		for (size_t i = 0; i < count; ++i)
+			field[2 * i + 1] = -field[2 * i + 1];
+		for (int x = 0; x < n_; ++x)
+			plan_->Transform(field + 2 * x, n_);
+		const double scale = 1.0 / count;
+		for (int y = rowBegin; y < rowEnd; ++y)
+		{
+			double* row = field + 2 * (size_t)y * n_;
+			plan_->Transform(row, 1);
+			for (int x = 0; x < n_; ++x)
+			{
+				row[2 * x] *= scale;
+				row[2 * x + 1] *= -scale;
+			}
+		}
+	}
+	else
+	{
+		for (int y = rowBegin; y < rowEnd; ++y)
+			plan_->Transform(field + 2 * (size_t)y * n_, 1);
+		for (int x = 0; x < n_; ++x)
+			plan_->Transform(field + 2 * x, n_);
+	}
+}
+
+// One image plane: pupil field with the image's diversity to the image plane,
+// measured amplitude imposed, back to the pupil without the diversity
+void MiraoPhaseRetrieval::Propagate(int image)
+{
+	const int size = (int)pupil_.size();
+	double* field = &field_[image][0];
+	const double* diversity = &diversity_[image][0];
+	memset(field, 0, field_[image].size() * sizeof(double));
+	for (int s = 0; s < size; ++s)
+	{
+		const double a = phase_[s] + diversity[s];
+		field[2 * pupil_[s]] = std::cos(a);
+		field[2 * pupil_[s] + 1] = std::sin(a);
+	}
+	Transform(field, false, true);
+
+	const double* amplitude = &amplitude_[image][0];
+	const size_t count = (size_t)n_ * n_;
+	double residual = 0;
+	for (size_t i = 0; i < count; ++i)
+	{
+		double& re = field[2 * i];
+		double& im = field[2 * i + 1];
+		const double modulus = std::sqrt(re * re + im * im);
+		const double d = modulus - amplitude[i];
+		residual += d * d;
+		if (modulus > 0)
+		{
+			const double scale = amplitude[i] / modulus;
+			re *= scale;
+			im *= scale;
+		}
+		else
+		{
+			re = amplitude[i];
+			im = 0;
+		}
+	}
+	residual_[image] = residual;
+	Transform(field, true, true);
+
+	double* back = &back_[image][0];
+	for (int s = 0; s < size; ++s)
+	{
+		const double re = field[2 * pupil_[s]];
+		const double im = field[2 * pupil_[s] + 1];
+		const double c = std::cos(diversity[s]);
+		const double d = -std::sin(diversity[s]);
+		back[2 * s] = re * c - im * d;
+		back[2 * s + 1] = re * d + im * c;
+	}
+}
+
+void MiraoPhaseRetrieval::Retrieve(int nbThreads, float* zernikes)
+{
+	const int size = (int)pupil_.size();
+	const int threads = nbThreads < 1 ? 1 : (nbThreads > nbImages_ ? nbImages_ : nbThreads);
+	phase_.assign(size, 0.0);
+	pool_.Start(threads);
+
+	iterations_ = 0;
+	error_ = 0;
+	double previous = -1;
+	for (int it = 0; it < settings_.iterationMaxAlgo; ++it)
+	{
+		pool_.Run(this, &MiraoPhaseRetrieval::PropagateImages);
+
+		// Average of the back-propagated fields
+		double residual = 0;
+		for (int k = 0; k < nbImages_; ++k)
+			residual += residual_[k];
+		for (int s = 0; s < size; ++s)
+		{
+			double re = 0;
+			double im = 0;
+			for (int k = 0; k < nbImages_; ++k)
+			{
+				re += back_[k][2 * s];
+				im += back_[k][2 * s + 1];
+			}
+			phase_[s] = std::atan2(im, re);
+		}
+		++iterations_;
+		// The measured amplitudes hold n^2 * size energy per image
+		error_ = std::sqrt(residual / ((double)nbImages_ * n_ * n_ * size));
+		if (previous >= 0 && std::fabs(previous - error_) <= settings_.relativeDiff * error_)
+			break;
+		previous = error_;
+	}
+
+	pool_.Stop();
+	Fit(phase_, zernikes);
+}
+
+// Least-squares Zernike fit of a wrapped phase: each pass fits the wrapped
+// residual of the previous, so phase jumps of 2 pi do not enter the fit
+void MiraoPhaseRetrieval::Fit(const std::vector<double>& phase, float* zernikes) const
+{
+	const int size = (int)pupil_.size();
+	const int nbBasis = nbModes_ + 1;
+	std::vector<double> coefs(nbBasis, 0.0);
+	std::vector<double> step(nbBasis);
+	for (int pass = 0; pass < 3; ++pass)
+	{
+		step.assign(nbBasis, 0.0);
+		for (int s = 0; s < size; ++s)
+		{
+			double model = 0;
+			for (int j = 0; j < nbBasis; ++j)
+				model += coefs[j] * modes_[(size_t)j * size + s];
+			const double r = Wrap(phase[s] - model);
+			for (int j = 0; j < nbBasis; ++j)
+				step[j] += modes_[(size_t)j * size + s] * r;
+		}
+		MiraoCholeskySolve(normal_, nbBasis, step);
+		for (int j = 0; j < nbBasis; ++j)
+			coefs[j] += step[j];
+	}
+	zernikes[0] = 0;
+	for (int j = 1; j <= MIRAO_MAX_ZERNIKES; ++j)
+		zernikes[j] = j <= nbModes_ ? (float)coefs[j] : 0.0f;
+}
+
+void MiraoPhaseRetrieval::PropagateImages(int first, int step)
+{
+	for (int k = first; k < nbImages_; k += step)
+		Propagate(k);
+}
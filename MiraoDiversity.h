@@ -0,0 +1,278 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          MiraoDiversity.h
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     DeviceAdapters
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Native phase diversity for the MIRAO-52E: iterative phase
+//                retrieval from defocus-diverse images and the thread that
+//                measures and corrects with it
+//
+// AUTHOR:        Marijn Siemons
+
+#pragma once
+
+#include <cmath>
+#include <string>
+#include <vector>
+#include "../../MMDevice/MMDevice.h"
+#include "../../MMDevice/DeviceThreads.h"
+#include "MiraoMetric.h"
+#include "MiraoProjector.h"
+#include "MiraoSync.h"
+
+#define MIRAO_DIVERSITY_MAX_IMAGES	8
+
+//////////////////////////////////////////////////////////////////////////////
+// Settings from the diversity preferences and calibration parameter files
+// that the SDK reads (Diversity_prefs.xml, Diversity_calibration.xml)
+//
+class MiraoDiversitySettings
+{
+public:
+	MiraoDiversitySettings();
+
+	bool Load(const std::string& prefsPath, const std::string& calibParamsPath);
+	// Each file on its own; false if it cannot be read or lacks a required value
+	bool LoadPreferences(const std::string& path);
+	bool LoadCalibrationParams(const std::string& path);
+
+	// Pixels of the pupil in the centre of the support, and the rows
+	// [rowBegin, rowEnd) they lie in
+	void Pupil(std::vector<int>& pixels, int& rowBegin, int& rowEnd) const;
+	// Zernike mode j (1 is tip) at a pixel of the support, in radians of
+	// phase per um of wavefront
+	double PupilMode(int j, int pixel) const;
+
+	// preferences
+	int nbZernikes;
+	double defocus;					// [um] on the defocus mode, for the default image set
+	int iterationMax;				// measure-and-correct rounds
+	double relativeDiff;			// retrieval stops once the error changes less than this, relatively
+	int iterationMaxAlgo;			// retrieval iterations per round
+	int kernelSize;					// Gaussian smoothing of the images
+	double kernelSigma;
+	float thresholdMin[MIRAO_MAX_ZERNIKES + 1];	// corrections below min are dropped,
+	float thresholdMax[MIRAO_MAX_ZERNIKES + 1];	// larger ones limited to max [um]
+	// Zernike offsets [um] per image, indexed as the Zernike state. The default
+	// set is 0, +defocus and -defocus; optional_zernikes = n selects the n-th
+	// image set of optional_zernikes_list instead.
+	std::vector< std::vector<float> > diversities;
+
+	// calibration parameters
+	double wavelength_nm;
+	double targetRadius;			// pupil radius in pixels of the FFT support
+	double zernikeRadius;			// normalisation radius of the Zernike modes, same unit
+	int supportSize;				// FFT support, rounded up to a power of two
+	bool transpose;					// camera image to pupil orientation
+	bool flipX;
+	bool flipY;
+};
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Phase retrieval from a set of images taken with known Zernike diversities
+// (Misell / Gerchberg-Saxton): the pupil field is propagated to every image
+// plane, given the measured amplitude and propagated back, and the pupil
+// phase is taken from the average. The images of one iteration are
+// propagated on separate threads, all sharing one cached FFT plan.
+//
+class MiraoPhaseRetrieval
+{
+public:
+	MiraoPhaseRetrieval();
+	~MiraoPhaseRetrieval();
+
+	// Builds the pupil, Zernike and diversity phase maps; false if the settings
+	// cannot be used
+	bool Configure(const MiraoDiversitySettings& settings);
+	// Crops one image per diversity around the brightest spot of the first,
+	// orients, smooths and normalises them
+	void SetImages(const std::vector<MiraoFrame>& frames);
+	// Retrieves the pupil phase and returns the aberration [um] in
+	// zernikes[1..nbZernikes], zernikes[0] (piston) is 0
+	void Retrieve(int nbThreads, float* zernikes);
+
+	int GetIterations() const { return iterations_; }
+	// Relative RMS difference between the modelled and measured amplitudes
+	double GetError() const { return error_; }
+
+private:
+	void Transform(double* field, bool inverse, bool pupilRows) const;
+	void Propagate(int image);
+	void PropagateImages(int first, int step);
+	void Fit(const std::vector<double>& phase, float* zernikes) const;
+
+	MiraoDiversitySettings settings_;
+	int n_;
+	int nbImages_;
+	int nbModes_;
+	const MiraoFftPlan* plan_;
+	int pupilRowBegin_;
+	int pupilRowEnd_;
+	std::vector<int> pupil_;						// pixel indices inside the pupil
+	std::vector<double> modes_;						// piston and Zernike modes [rad/um], one pupil map per mode
+	std::vector<double> normal_;					// Cholesky factor of the modes' normal matrix
+	std::vector< std::vector<double> > diversity_;	// diversity phase per image on the pupil [rad]
+	std::vector< std::vector<double> > amplitude_;	// measured amplitude per image, centred at pixel 0
+	std::vector< std::vector<double> > field_;		// FFT work area per image
+	std::vector< std::vector<double> > back_;		// back-propagated pupil field per image
+	std::vector<double> residual_;					// amplitude error per image
+	std::vector<double> phase_;
+
+	MiraoForkJoinPool<MiraoPhaseRetrieval> pool_;
+	int iterations_;
+	double error_;
+};
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Measures the aberration by phase diversity and corrects it, on its own
+// thread, for up to iterationMax rounds or until no mode needs correcting.
+// The device moves the mirror as for MiraoOptimiser: GetZernikes(),
+// MoveZernikes() (returns once settled) and SetZernikes().
+//
+template <class TDevice>
+class MiraoDiversityMeasurement : public MMDeviceThreadBase
+{
+public:
+	MiraoDiversityMeasurement(TDevice* device) :
+		device_(device),
+		camera_(0),
+		threads_(1),
+		running_(0),
+		abort_(0),
+		active_(false),
+		result_(DEVICE_OK),
+		elapsed_ms_(0),
+		retrieval_ms_(0)
+	{
+		for (int j = 0; j <= MIRAO_MAX_ZERNIKES; j++)
+			correction_[j] = 0;
+	}
+
+	~MiraoDiversityMeasurement()
+	{
+		Stop();
+	}
+
+	// False if a measurement is still running or the settings cannot be used
+	bool Start(MM::Camera* camera, const MiraoDiversitySettings& settings, int threads)
+	{
+		if (IsRunning())
+			return false;
+		Join();
+		if (!engine_.Configure(settings))
+			return false;
+		camera_ = camera;
+		settings_ = settings;
+		threads_ = threads;
+		abort_.Set(0);
+		running_.Set(1);
+		active_ = true;
+		activate();
+		return true;
+	}
+
+	// Aborts at the next round; corrections applied so far are kept
+	void Stop()
+	{
+		abort_.Set(1);
+		Join();
+	}
+
+	bool IsRunning() const { return running_.Get() != 0; }
+	int GetResult() const { return result_; }
+	double GetElapsedMs() const { return elapsed_ms_; }
+	double GetRetrievalMs() const { return retrieval_ms_; }
+	int GetIterations() const { return engine_.GetIterations(); }
+	double GetError() const { return engine_.GetError(); }
+	// Total correction applied by the last measurement [um]
+	const float* GetCorrection() const { return correction_; }
+
+	int svc()
+	{
+		MM::MMTime start = device_->GetCurrentMMTime();
+		result_ = Run();
+		elapsed_ms_ = (device_->GetCurrentMMTime() - start).getMsec();
+		running_.Set(0);
+		return 0;
+	}
+
+private:
+	void Join()
+	{
+		if (active_)
+		{
+			wait();
+			active_ = false;
+		}
+	}
+
+	int Run()
+	{
+		float zernikes[MIRAO_MAX_ZERNIKES + 1];
+		float probe[MIRAO_MAX_ZERNIKES + 1];
+		float measured[MIRAO_MAX_ZERNIKES + 1];
+		device_->GetZernikes(zernikes);
+		for (int j = 0; j <= MIRAO_MAX_ZERNIKES; j++)
+			correction_[j] = 0;
+		frames_.resize(settings_.diversities.size());
+
+		int ret = DEVICE_OK;
+		for (int round = 0; round < settings_.iterationMax && !abort_.Get(); ++round)
+		{
+			for (size_t k = 0; k < frames_.size() && ret == DEVICE_OK; ++k)
+			{
+				for (int j = 0; j <= MIRAO_MAX_ZERNIKES; j++)
+					probe[j] = zernikes[j] + settings_.diversities[k][j];
+				ret = device_->MoveZernikes(probe);
+				if (ret == DEVICE_OK)
+					ret = camera_->SnapImage();
+				if (ret == DEVICE_OK)
+					MiraoCopyFrame(camera_->GetImageBuffer(), (int)camera_->GetImageWidth(), (int)camera_->GetImageHeight(),
+						(int)camera_->GetImageBytesPerPixel(), 0, 0, 0, 0, frames_[k]);
+			}
+			if (ret != DEVICE_OK)
+				break;
+
+			MM::MMTime start = device_->GetCurrentMMTime();
+			engine_.SetImages(frames_);
+			engine_.Retrieve(threads_, measured);
+			retrieval_ms_ = (device_->GetCurrentMMTime() - start).getMsec();
+
+			// The correction is the opposite of the measured aberration
+			bool corrected = false;
+			for (int j = 1; j <= settings_.nbZernikes; j++)
+			{
+				float step = -measured[j];
+				if (fabs(step) < settings_.thresholdMin[j])
+					step = 0;
+				else if (step > settings_.thresholdMax[j])
+					step = settings_.thresholdMax[j];
+				else if (step < -settings_.thresholdMax[j])
+					step = -settings_.thresholdMax[j];
+				zernikes[j] += step;
+				correction_[j] += step;
+				corrected = corrected || step != 0;
+			}
+			if (!corrected)
+				break;
+		}
+		int applied = device_->SetZernikes(zernikes);
+		return ret != DEVICE_OK ? ret : applied;
+	}
+
+	TDevice* device_;
+	MM::Camera* camera_;
+	MiraoDiversitySettings settings_;
+	MiraoPhaseRetrieval engine_;
+	std::vector<MiraoFrame> frames_;
+	int threads_;
+	MiraoAtomicLong running_;
+	MiraoAtomicLong abort_;
+	bool active_;
+	int result_;
+	double elapsed_ms_;
+	double retrieval_ms_;
+	float correction_[MIRAO_MAX_ZERNIKES + 1];
+};
@@ -0,0 +1,283 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          MiraoField.cpp
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     DeviceAdapters
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Field-dependent Zernike correction for the MIRAO-52E: a map
+//                of corrections over XY stage position and the thread that
+//                follows the stage with it
+//
+// AUTHOR:        Marijn Siemons
+
+#include "MiraoField.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+#define MIRAO_FIELD_STRIDE	(MIRAO_MAX_ZERNIKES + 1)
+
+namespace {
+
+// Map file layout: magic, version, number of modes stored per point, number
+// of points, then x, y [um] and the modes from tip on for every point. Host
+// byte order, as the calibration cache.
+const char fieldMagic[8] = { 'M', 'I', 'R', 'A', 'O', 'F', 'L', 'D' };
+const int fieldVersion = 1;
+
+// Positions closer than this [um] lie on the same grid line
+const double gridTolerance = 1.0;
+
+// Grid lines through the sorted positions, and each position's line
+void GridLines(const std::vector<double>& positions, std::vector<double>& lines)
+{
+	std::vector<double> sorted(positions);
+	std::sort(sorted.begin(), sorted.end());
+	lines.clear();
+	for (size_t i = 0; i < sorted.size(); ++i)
+		if (lines.empty() || sorted[i] - lines.back() > gridTolerance)
+			lines.push_back(sorted[i]);
+}
+
+int GridLine(const std::vector<double>& lines, double position)
+{
+	int i = (int)(std::lower_bound(lines.begin(), lines.end(), position - gridTolerance) - lines.begin());
+	return i < (int)lines.size() && lines[i] - position <= gridTolerance ? i : -1;
+}
+
+// Cell of the grid lines holding position and the fraction across it, held
+// at the first and last line beyond the grid
+void GridCell(const std::vector<double>& lines, double position, int& i, double& t)
+{
+	const int n = (int)lines.size();
+	if (n == 1 || position <= lines[0])
+	{
+		i = 0;
+		t = 0;
+	}
+	else if (position >= lines[n - 1])
+	{
+		i = n - 2;
+		t = 1;
+	}
+	else
+	{
+		i = (int)(std::upper_bound(lines.begin(), lines.end(), position) - lines.begin()) - 1;
+		t = (position - lines[i]) / (lines[i + 1] - lines[i]);
+	}
+}
+
+struct AxisLess
+{
+	AxisLess(const std::vector<double>& coordinates) : coordinates_(coordinates) {}
+	bool operator()(int a, int b) const { return coordinates_[a] < coordinates_[b]; }
+	const std::vector<double>& coordinates_;
+};
+
+} // namespace
+
+
+bool MiraoFieldMap::Load(const std::string& path)
+{
+	std::ifstream in(path.c_str(), std::ios::in | std::ios::binary);
+	if (!in)
+		return false;
+
+	char magic[sizeof(fieldMagic)];
+	int version = 0;
+	int nbModes = 0;
+	int nbPoints = 0;
+	in.read(magic, sizeof(magic));
+	if (!MiraoReadValue(in, version) || !MiraoReadValue(in, nbModes) || !MiraoReadValue(in, nbPoints))
+		return false;
+	if (memcmp(magic, fieldMagic, sizeof(magic)) != 0 || version != fieldVersion ||
+		nbModes < 1 || nbModes > MIRAO_MAX_ZERNIKES || nbPoints < 0)
+		return false;
+
+	MiraoFieldMap map;
+	for (int p = 0; p < nbPoints; ++p)
+	{
+		double x, y;
+		float zernikes[MIRAO_FIELD_STRIDE] = { 0 };
+		if (!MiraoReadValue(in, x) || !MiraoReadValue(in, y))
+			return false;
+		in.read((char*)&zernikes[1], nbModes * sizeof(float));
+		if (!in)
+			return false;
+		map.Add(x, y, zernikes);
+	}
+	*this = map;
+	return true;
+}
+
+bool MiraoFieldMap::Save(const std::string& path) const
+{
+	std::ofstream out(path.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!out)
+		return false;
+
+	// Only the modes up to the highest one in use are stored
+	int nbModes = 1;
+	for (size_t i = 0; i < values_.size(); ++i)
+		if (values_[i] != 0 && (int)(i % MIRAO_FIELD_STRIDE) > nbModes)
+			nbModes = (int)(i % MIRAO_FIELD_STRIDE);
+	const int nbPoints = Size();
+	out.write(fieldMagic, sizeof(fieldMagic));
+	MiraoWriteValue(out, fieldVersion);
+	MiraoWriteValue(out, nbModes);
+	MiraoWriteValue(out, nbPoints);
+	for (int p = 0; p < nbPoints; ++p)
+	{
+		MiraoWriteValue(out, x_[p]);
+		MiraoWriteValue(out, y_[p]);
+		out.write((const char*)&values_[p * MIRAO_FIELD_STRIDE + 1], nbModes * sizeof(float));
+	}
+	return !out.fail();
+}
+
+void MiraoFieldMap::Add(double x, double y, const float* zernikes)
+{
+	int p = 0;
+	while (p < Size() && (x_[p] != x || y_[p] != y))
+		++p;
+	if (p == Size())
+	{
+		x_.push_back(x);
+		y_.push_back(y);
+		values_.resize(values_.size() + MIRAO_FIELD_STRIDE);
+	}
+	float* point = &values_[p * MIRAO_FIELD_STRIDE];
+	point[0] = 0;
+	for (int j = 1; j <= MIRAO_MAX_ZERNIKES; ++j)
+		point[j] = zernikes[j];
+	Prepare();
+}
+
+void MiraoFieldMap::Clear()
+{
+	x_.clear();
+	y_.clear();
+	values_.clear();
+	Prepare();
+}
+
+void MiraoFieldMap::Prepare()
+{
+	const int n = Size();
+	GridLines(x_, gridX_);
+	GridLines(y_, gridY_);
+	grid_.assign(gridX_.size() * gridY_.size(), -1);
+	bool complete = n > 0 && (int)grid_.size() == n;
+	for (int p = 0; p < n && complete; ++p)
+	{
+		int i = GridLine(gridX_, x_[p]);
+		int j = GridLine(gridY_, y_[p]);
+		complete = i >= 0 && j >= 0 && grid_[j * gridX_.size() + i] < 0;
+		if (complete)
+			grid_[j * gridX_.size() + i] = p;
+	}
+	if (complete)
+	{
+		tree_.clear();
+		return;
+	}
+
+	grid_.clear();
+	tree_.resize(n);
+	for (int p = 0; p < n; ++p)
+		tree_[p] = p;
+	Build(0, n, 0);
+}
+
+// Orders tree_[begin, end) so that its middle element splits it on axis (0 is
+// x, 1 is y), and both halves in turn on the other axis
+void MiraoFieldMap::Build(int begin, int end, int axis)
+{
+	if (end - begin <= 1)
+		return;
+	const int middle = (begin + end) / 2;
+	std::nth_element(tree_.begin() + begin, tree_.begin() + middle, tree_.begin() + end, AxisLess(axis == 0 ? x_ : y_));
+	Build(begin, middle, 1 - axis);
+	Build(middle + 1, end, 1 - axis);
+}
+
+// Keeps the closest points found so far in nearest, by ascending squared distance
+void MiraoFieldMap::Nearest(int begin, int end, int axis, double x, double y, int* nearest, double* distance, int& found) const
+{
+	if (begin >= end)
+		return;
+	const int middle = (begin + end) / 2;
+	const int p = tree_[middle];
+	const double d = (x - x_[p]) * (x - x_[p]) + (y - y_[p]) * (y - y_[p]);
+	if (found < MIRAO_FIELD_NEIGHBOURS || d < distance[found - 1])
+	{
+		int k = found < MIRAO_FIELD_NEIGHBOURS ? found++ : found - 1;
+		for (; k > 0 && distance[k - 1] > d; --k)
+		{
+			distance[k] = distance[k - 1];
+			nearest[k] = nearest[k - 1];
+		}
+		distance[k] = d;
+		nearest[k] = p;
+	}
+
+	const double offset = axis == 0 ? x - x_[p] : y - y_[p];
+	if (offset < 0)
+		Nearest(begin, middle, 1 - axis, x, y, nearest, distance, found);
+	else
+		Nearest(middle + 1, end, 1 - axis, x, y, nearest, distance, found);
+	if (found < MIRAO_FIELD_NEIGHBOURS || offset * offset < distance[found - 1])
+	{
+		if (offset < 0)
+			Nearest(middle + 1, end, 1 - axis, x, y, nearest, distance, found);
+		else
+			Nearest(begin, middle, 1 - axis, x, y, nearest, distance, found);
+	}
+}
+
+bool MiraoFieldMap::Interpolate(double x, double y, float* zernikes) const
+{
+	if (Size() == 0)
+		return false;
+	zernikes[0] = 0;
+
+	if (IsGrid())
+	{
+		int i, j;
+		double tx, ty;
+		GridCell(gridX_, x, i, tx);
+		GridCell(gridY_, y, j, ty);
+		const int nx = (int)gridX_.size();
+		const int i1 = i + 1 < nx ? i + 1 : i;
+		const int j1 = j + 1 < (int)gridY_.size() ? j + 1 : j;
+		const float* v00 = &values_[grid_[j * nx + i] * MIRAO_FIELD_STRIDE];
+		const float* v10 = &values_[grid_[j * nx + i1] * MIRAO_FIELD_STRIDE];
+		const float* v01 = &values_[grid_[j1 * nx + i] * MIRAO_FIELD_STRIDE];
+		const float* v11 = &values_[grid_[j1 * nx + i1] * MIRAO_FIELD_STRIDE];
+		const double w00 = (1 - tx) * (1 - ty), w10 = tx * (1 - ty), w01 = (1 - tx) * ty, w11 = tx * ty;
+		for (int m = 1; m <= MIRAO_MAX_ZERNIKES; ++m)
+			zernikes[m] = (float)(w00 * v00[m] + w10 * v10[m] + w01 * v01[m] + w11 * v11[m]);
+		return true;
+	}
+
+	int nearest[MIRAO_FIELD_NEIGHBOURS];
+	double distance[MIRAO_FIELD_NEIGHBOURS];
+	int found = 0;
+	Nearest(0, Size(), 0, x, y, nearest, distance, found);
+	if (distance[0] == 0)
+	{
+		memcpy(zernikes + 1, &values_[nearest[0] * MIRAO_FIELD_STRIDE + 1], MIRAO_MAX_ZERNIKES * sizeof(float));
+		return true;
+	}
+	double weights[MIRAO_FIELD_NEIGHBOURS];
+	double total = 0;
+	for (int k = 0; k < found; ++k)
+		total += weights[k] = 1 / distance[k];
+	for (int m = 1; m <= MIRAO_MAX_ZERNIKES; ++m)
+	{
+		double value = 0;
+		for (int k = 0; k < found; ++k)
+			value += weights[k] * values_[nearest[k] * MIRAO_FIELD_STRIDE + m];
+		zernikes[m] = (float)(value / total);
+	}
+	return true;
+}
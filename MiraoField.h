@@ -0,0 +1,141 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          MiraoField.h
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     DeviceAdapters
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Field-dependent Zernike correction for the MIRAO-52E: a map
+//                of corrections over XY stage position and the thread that
+//                follows the stage with it
+//
+// AUTHOR:        Marijn Siemons
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include "../../MMDevice/MMDevice.h"
+#include "../../MMDevice/DeviceThreads.h"
+#include "../../MMDevice/DeviceUtils.h"
+#include "MiraoProjector.h"
+#include "MiraoSync.h"
+
+// Scattered maps are interpolated from this many nearest points
+#define MIRAO_FIELD_NEIGHBOURS	4
+
+//////////////////////////////////////////////////////////////////////////////
+// Zernike corrections [um] at a sparse set of XY stage positions [um]. When
+// the points form a full rectangular grid, as for a tiled acquisition, the
+// map is interpolated bilinearly and held constant beyond its edges.
+// Otherwise the nearest points, found in a 2D tree, are weighted by inverse
+// squared distance.
+//
+class MiraoFieldMap
+{
+public:
+	MiraoFieldMap() {}
+
+	// Binary map file; false if it cannot be read, in which case the map is
+	// left as it was
+	bool Load(const std::string& path);
+	bool Save(const std::string& path) const;
+	// Adds the correction at (x, y), replacing a point at the same position
+	void Add(double x, double y, const float* zernikes);
+	void Clear();
+
+	int Size() const { return (int)x_.size(); }
+	bool IsGrid() const { return !grid_.empty(); }
+	// Correction at (x, y) in zernikes[0..MIRAO_MAX_ZERNIKES], piston 0. False
+	// if the map is empty.
+	bool Interpolate(double x, double y, float* zernikes) const;
+
+private:
+	// Grid index or 2D tree, rebuilt whenever a point changes
+	void Prepare();
+	void Build(int begin, int end, int axis);
+	void Nearest(int begin, int end, int axis, double x, double y, int* nearest, double* distance, int& found) const;
+
+	std::vector<double> x_;
+	std::vector<double> y_;
+	std::vector<float> values_;		// MIRAO_MAX_ZERNIKES + 1 per point
+
+	std::vector<double> gridX_;		// ascending grid lines, when the points form a grid
+	std::vector<double> gridY_;
+	std::vector<int> grid_;			// point index per grid node, row by row
+	std::vector<int> tree_;			// point indices; the middle of every range splits it
+};
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Follows the XY stage: reads device->ReadXY(x, y) every interval and calls
+// device->ApplyField(x, y) when it has moved. Polled for the same reason as
+// MiraoFocusTracker.
+//
+template <class TDevice>
+class MiraoXYTracker : public MMDeviceThreadBase
+{
+public:
+	MiraoXYTracker(TDevice* device) :
+		device_(device),
+		interval_ms_(20),
+		tolerance_um_(0.1),
+		stop_(1),
+		active_(false)
+	{
+	}
+
+	~MiraoXYTracker()
+	{
+		Stop();
+	}
+
+	void Start(double interval_ms, double tolerance_um)
+	{
+		Stop();
+		interval_ms_ = interval_ms;
+		tolerance_um_ = tolerance_um;
+		stop_.Set(0);
+		active_ = true;
+		activate();
+	}
+
+	void Stop()
+	{
+		if (!active_)
+			return;
+		stop_.Set(1);
+		wait();
+		active_ = false;
+	}
+
+	bool IsRunning() const { return stop_.Get() == 0; }
+
+	int svc()
+	{
+		bool applied = false;
+		double lastX = 0;
+		double lastY = 0;
+		while (!stop_.Get())
+		{
+			double x, y;
+			if (device_->ReadXY(x, y) == DEVICE_OK &&
+				(!applied || (x - lastX) * (x - lastX) + (y - lastY) * (y - lastY) > tolerance_um_ * tolerance_um_))
+			{
+				if (device_->ApplyField(x, y) == DEVICE_OK)
+				{
+					lastX = x;
+					lastY = y;
+					applied = true;
+				}
+			}
+			CDeviceUtils::SleepMs((long)interval_ms_);
+		}
+		return 0;
+	}
+
+private:
+	TDevice* device_;
+	double interval_ms_;
+	double tolerance_um_;
+	MiraoAtomicLong stop_;
+	bool active_;
+};
@@ -0,0 +1,43 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          MiraoLoop.cpp
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     DeviceAdapters
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Closed-loop correction with the MIRAO-52E: modal
+//                reconstruction of Shack-Hartmann slopes and the thread that
+//                integrates it onto the mirror at a fixed rate
+//
+// AUTHOR:        Marijn Siemons
+
+#include "MiraoLoop.h"
+#include <cstring>
+
+bool MiraoReconstructor::Build(const MiraoCalibration& calib, const MiraoProjector& projector, int nbModes, double regularisation)
+{
+	const int nbSlopes = 2 * calib.nbValidSubap;
+	if (!projector.IsReady() || nbModes < 1 || nbModes > projector.GetNbModes() || calib.nbValidSubap <= 0 ||
+		calib.nbValidSubap > MIRAO_SH_MAX_SUBAPS || (int)calib.matrix.size() != nbSlopes * MIRAO_NB_ACTUATORS)
+		return false;
+
+	if (!MiraoSlopeReconstructor(calib, projector, nbModes, regularisation, matrix_))
+		return false;
+	nbModes_ = nbModes;
+	nbSlopes_ = nbSlopes;
+	return true;
+}
+
+bool MiraoReconstructor::Reconstruct(const MiraoSlopes& slopes, float* zernikes) const
+{
+	if (nbModes_ == 0 || 2 * slopes.nbSubap != nbSlopes_)
+		return false;
+	memset(zernikes, 0, (MIRAO_MAX_ZERNIKES + 1) * sizeof(float));
+	for (int j = 0; j < nbModes_; ++j)
+	{
+		const float* row = &matrix_[(size_t)j * nbSlopes_];
+		double s = 0;
+		for (int r = 0; r < nbSlopes_; ++r)
+			s += row[r] * slopes.slopes[r];
+		zernikes[j + 1] = (float)s;
+	}
+	return true;
+}
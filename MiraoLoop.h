@@ -0,0 +1,241 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          MiraoLoop.h
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     DeviceAdapters
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Closed-loop correction with the MIRAO-52E: modal
+//                reconstruction of Shack-Hartmann slopes and the thread that
+//                integrates it onto the mirror at a fixed rate
+//
+// AUTHOR:        Marijn Siemons
+
+#pragma once
+
+#include <cmath>
+#include <vector>
+#include "../../MMDevice/DeviceThreads.h"
+#include "MiraoProjector.h"
+#include "MiraoShackHartmann.h"
+#include "MiraoSync.h"
+
+// Loop rate, jitter and residual are averaged over about this many cycles
+#define MIRAO_LOOP_AVERAGE	64
+
+struct MiraoLoopSettings
+{
+	MiraoLoopSettings() :
+		rate_hz(500),
+		leak(0.01)
+	{
+		for (int j = 0; j <= MIRAO_MAX_ZERNIKES; j++)
+			gains[j] = 0.3f;
+	}
+
+	double rate_hz;
+	double leak;							// fraction of the correction dropped every cycle
+	float gains[MIRAO_MAX_ZERNIKES + 1];	// per mode from tip, gains[0] unused
+};
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Zernike modes [um] from the slopes of MiraoShackHartmann: the least-squares
+// fit of the slopes each mode makes through the mirror, which is the
+// interaction matrix times the control matrix of the projector. Modes the
+// mirror cannot make are therefore not measured either.
+//
+class MiraoReconstructor
+{
+public:
+	MiraoReconstructor() : nbModes_(0), nbSlopes_(0) {}
+
+	// false if the projector is not built, or for fewer modes
+	bool Build(const MiraoCalibration& calib, const MiraoProjector& projector, int nbModes, double regularisation = 1e-3);
+	int GetNbModes() const { return nbModes_; }
+	int GetNbSubap() const { return nbSlopes_ / 2; }
+
+	// Modes in zernikes[1..nbModes], the rest 0; false if the slopes are of
+	// another pupil
+	bool Reconstruct(const MiraoSlopes& slopes, float* zernikes) const;
+
+private:
+	int nbModes_;
+	int nbSlopes_;
+	std::vector<float> matrix_;		// one row of slopes per mode
+};
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Fixed-rate control loop. Every cycle that the sensor has published new
+// slopes, the residual modes are reconstructed and integrated into the
+// correction with a leak and per-mode gains, and device->ApplyLoop() queues
+// the correction for the mirror. Cycles without new slopes, or with fewer
+// than half of the subapertures lit, hold the correction.
+// Anti-windup: a mode does not move further than device->GetHeadroom()
+// allows, so the integrator stops where the actuators saturate instead of
+// running away. Cycles are due at fixed times, sleeping whole milliseconds
+// and spinning for the rest as the frame replay.
+//
+template <class TDevice>
+class MiraoLoop : public MMDeviceThreadBase
+{
+public:
+	MiraoLoop(TDevice* device, const MiraoShackHartmann* sensor) :
+		device_(device),
+		sensor_(sensor),
+		period_us_(0),
+		deviation_us2_(0),
+		residual_um_(0),
+		stop_(1),
+		active_(false)
+	{
+		for (int j = 0; j <= MIRAO_MAX_ZERNIKES; j++)
+			correction_[j] = 0;
+	}
+
+	~MiraoLoop()
+	{
+		Stop();
+	}
+
+	// Starts from a zero correction
+	void Start(const MiraoLoopSettings& settings, const MiraoReconstructor& reconstructor)
+	{
+		Stop();
+		SetSettings(settings);
+		reconstructor_ = reconstructor;
+		for (int j = 0; j <= MIRAO_MAX_ZERNIKES; j++)
+			correction_[j] = 0;
+		period_us_ = deviation_us2_ = residual_um_ = 0;
+		cycles_.Set(0);
+		held_.Set(0);
+		stop_.Set(0);
+		active_ = true;
+		activate();
+	}
+
+	void Stop()
+	{
+		if (!active_)
+			return;
+		stop_.Set(1);
+		wait();
+		active_ = false;
+	}
+
+	bool IsRunning() const { return stop_.Get() == 0; }
+
+	// Takes effect from the next cycle, keeping the correction
+	void SetSettings(const MiraoLoopSettings& settings)
+	{
+		MMThreadGuard guard(lock_);
+		settings_ = settings;
+	}
+
+	MiraoLoopSettings GetSettings()
+	{
+		MMThreadGuard guard(lock_);
+		return settings_;
+	}
+
+	double GetRate() const { return period_us_ > 0 ? 1e6 / period_us_ : 0; }
+	// RMS difference of the cycle period from the set one
+	double GetJitter() const { return std::sqrt(deviation_us2_); }
+	// RMS of the reconstructed modes
+	double GetResidual() const { return residual_um_; }
+	long GetCycles() const { return cycles_.Get(); }
+	long GetHeld() const { return held_.Get(); }
+
+	int svc()
+	{
+		double start = 0;
+		double rate = 0;
+		double previous = 0;
+		long cycle = 0;
+		long measured = sensor_->GetPublished();
+		while (!stop_.Get())
+		{
+			MiraoLoopSettings settings = GetSettings();
+			if (settings.rate_hz != rate)
+			{
+				rate = settings.rate_hz;
+				start = MiraoClock();
+				cycle = 0;
+			}
+			const double period = 1e6 / rate;
+			const double due = start + cycle * period;
+			MiraoWaitUntil(due, &stop_);
+
+			// More than a cycle behind: skip the missed cycles
+			const double now = MiraoClock();
+			if (now > due + period)
+			{
+				start = now;
+				cycle = 0;
+			}
+			++cycle;
+			if (previous > 0)
+			{
+				Average(period_us_, now - previous);
+				Average(deviation_us2_, (now - previous - period) * (now - previous - period));
+			}
+			previous = now;
+			cycles_.Increment();
+
+			const long published = sensor_->GetPublished();
+			if (published == measured || !Integrate(settings))
+			{
+				held_.Increment();
+				continue;
+			}
+			measured = published;
+			device_->ApplyLoop(correction_);
+		}
+		return 0;
+	}
+
+private:
+	static void Average(volatile double& average, double value)
+	{
+		average = average == 0 ? value : average + (value - average) / MIRAO_LOOP_AVERAGE;
+	}
+
+	bool Integrate(const MiraoLoopSettings& settings)
+	{
+		float residual[MIRAO_MAX_ZERNIKES + 1];
+		if (!sensor_->GetLatest(slopes_) || 2 * slopes_.nbLit < slopes_.nbSubap ||
+			!reconstructor_.Reconstruct(slopes_, residual))
+			return false;
+
+		float up[MIRAO_MAX_ZERNIKES + 1];
+		float down[MIRAO_MAX_ZERNIKES + 1];
+		device_->GetHeadroom(up, down);
+		double squares = 0;
+		for (int j = 1; j <= reconstructor_.GetNbModes(); j++)
+		{
+			squares += residual[j] * residual[j];
+			float step = (float)(-settings.leak * correction_[j] - settings.gains[j] * residual[j]);
+			if (step > up[j])
+				step = up[j];
+			else if (step < -down[j])
+				step = -down[j];
+			correction_[j] += step;
+		}
+		Average(residual_um_, std::sqrt(squares));
+		return true;
+	}
+
+	TDevice* device_;
+	const MiraoShackHartmann* sensor_;
+	MMThreadLock lock_;
+	MiraoLoopSettings settings_;
+	MiraoReconstructor reconstructor_;
+	MiraoSlopes slopes_;
+	float correction_[MIRAO_MAX_ZERNIKES + 1];
+	volatile double period_us_;
+	volatile double deviation_us2_;
+	volatile double residual_um_;
+	MiraoAtomicLong cycles_;
+	MiraoAtomicLong held_;
+	MiraoAtomicLong stop_;
+	bool active_;
+};
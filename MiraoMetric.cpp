@@ -0,0 +1,556 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          MiraoMetric.cpp
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     DeviceAdapters
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Image merit functions for sensorless optimisation with the
+//                MIRAO-52E and the thread pool that evaluates them
+//
+// AUTHOR:        Marijn Siemons
+
+#include "MiraoMetric.h"
+#include "../../MMDevice/DeviceUtils.h"
+#include <cmath>
+#include <cstring>
+
+// SSE2 is part of every x64 processor; define MIRAO_NO_SIMD to use the plain loops
+#if !defined(MIRAO_NO_SIMD) && (defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define MIRAO_SSE2
+#include <emmintrin.h>
+#endif
+
+const char* g_miraoMetrics[MIRAO_NB_METRICS] = {
+	"Sharpness",
+	"Maximum",
+	"Variance",
+	"Gradient",
+	"Low frequency band"
+};
+
+MMThreadLock MiraoFftPlan::lock_;
+std::map<int, MiraoFftPlan*> MiraoFftPlan::plans_;
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Row kernels
+//
+#ifdef MIRAO_SSE2
+
+// Per 8 pixels the 32-bit lane sums grow by at most 2 * 65535, so flush them
+// to double well before they can overflow
+#define MIRAO_SSE2_BLOCK	16384
+
+static double sumlanes(__m128d a, __m128d b)
+{
+	double values[2];
+	_mm_storeu_pd(values, _mm_add_pd(a, b));
+	return values[0] + values[1];
+}
+
+static double sumlanes(__m128i a)
+{
+	unsigned int values[4];
+	_mm_storeu_si128((__m128i*)values, a);
+	return (double)values[0] + values[1] + values[2] + values[3];
+}
+
+// Adds the squares of four 32-bit integers to two double accumulators
+static void addsquares(__m128i values, __m128d& low, __m128d& high)
+{
+	__m128 f = _mm_cvtepi32_ps(values);
+	f = _mm_mul_ps(f, f);
+	low = _mm_add_pd(low, _mm_cvtps_pd(f));
+	high = _mm_add_pd(high, _mm_cvtps_pd(_mm_movehl_ps(f, f)));
+}
+
+static double rowsum(const unsigned short* row, int count)
+{
+	const __m128i zero = _mm_setzero_si128();
+	double sum = 0;
+	int i = 0;
+	while (i + 8 <= count)
+	{
+		__m128i lanes = zero;
+		const int end = i + MIRAO_SSE2_BLOCK < count ? i + MIRAO_SSE2_BLOCK : count;
+		for (; i + 8 <= end; i += 8)
+		{
+			const __m128i v = _mm_loadu_si128((const __m128i*)(row + i));
+			lanes = _mm_add_epi32(lanes, _mm_add_epi32(_mm_unpacklo_epi16(v, zero), _mm_unpackhi_epi16(v, zero)));
+		}
+		sum += sumlanes(lanes);
+	}
+	for (; i < count; ++i)
+		sum += row[i];
+	return sum;
+}
+
+static void rowmoments(const unsigned short* row, int count, MiraoMeritSums& sums)
+{
+	const __m128i zero = _mm_setzero_si128();
+	// SSE2 only compares signed 16-bit values: flip the sign bit to compare unsigned
+	const __m128i sign = _mm_set1_epi16((short)0x8000);
+	__m128i peak = sign;
+	__m128d squaresLow = _mm_setzero_pd();
+	__m128d squaresHigh = _mm_setzero_pd();
+	double sum = 0;
+	int i = 0;
+	while (i + 8 <= count)
+	{
+		__m128i lanes = zero;
+		const int end = i + MIRAO_SSE2_BLOCK < count ? i + MIRAO_SSE2_BLOCK : count;
+		for (; i + 8 <= end; i += 8)
+		{
+			const __m128i v = _mm_loadu_si128((const __m128i*)(row + i));
+			peak = _mm_max_epi16(peak, _mm_xor_si128(v, sign));
+			const __m128i low = _mm_unpacklo_epi16(v, zero);
+			const __m128i high = _mm_unpackhi_epi16(v, zero);
+			lanes = _mm_add_epi32(lanes, _mm_add_epi32(low, high));
+			addsquares(low, squaresLow, squaresHigh);
+			addsquares(high, squaresLow, squaresHigh);
+		}
+		sum += sumlanes(lanes);
+	}
+	unsigned short peaks[8];
+	_mm_storeu_si128((__m128i*)peaks, _mm_xor_si128(peak, sign));
+	double squares = sumlanes(squaresLow, squaresHigh);
+	for (int j = 0; j < 8; ++j)
+		if (peaks[j] > sums.peak)
+			sums.peak = peaks[j];
+	for (; i < count; ++i)
+	{
+		const double v = row[i];
+		sum += v;
+		squares += v * v;
+		if (row[i] > sums.peak)
+			sums.peak = row[i];
+	}
+	sums.sum += sum;
+	sums.sumSquares += squares;
+}
+
+// Squared differences to the right neighbour and, if next is given, to the
+// pixel below
+static double rowgradient(const unsigned short* row, const unsigned short* next, int count)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128d low = _mm_setzero_pd();
+	__m128d high = _mm_setzero_pd();
+	int i = 0;
+	for (; i + 8 < count; i += 8)
+	{
+		const __m128i v = _mm_loadu_si128((const __m128i*)(row + i));
+		const __m128i right = _mm_loadu_si128((const __m128i*)(row + i + 1));
+		const __m128i vLow = _mm_unpacklo_epi16(v, zero);
+		const __m128i vHigh = _mm_unpackhi_epi16(v, zero);
+		addsquares(_mm_sub_epi32(_mm_unpacklo_epi16(right, zero), vLow), low, high);
+		addsquares(_mm_sub_epi32(_mm_unpackhi_epi16(right, zero), vHigh), low, high);
+		if (next)
+		{
+			const __m128i below = _mm_loadu_si128((const __m128i*)(next + i));
+			addsquares(_mm_sub_epi32(_mm_unpacklo_epi16(below, zero), vLow), low, high);
+			addsquares(_mm_sub_epi32(_mm_unpackhi_epi16(below, zero), vHigh), low, high);
+		}
+	}
+	double gradient = sumlanes(low, high);
+	for (; i < count; ++i)
+	{
+		if (i + 1 < count)
+		{
+			const double dx = (double)row[i + 1] - row[i];
+			gradient += dx * dx;
+		}
+		if (next)
+		{
+			const double dy = (double)next[i] - row[i];
+			gradient += dy * dy;
+		}
+	}
+	return gradient;
+}
+
+#else
+
+static double rowsum(const unsigned short* row, int count)
+{
+	double sum = 0;
+	for (int i = 0; i < count; ++i)
+		sum += row[i];
+	return sum;
+}
+
+static void rowmoments(const unsigned short* row, int count, MiraoMeritSums& sums)
+{
+	double sum = 0;
+	double squares = 0;
+	for (int i = 0; i < count; ++i)
+	{
+		const double v = row[i];
+		sum += v;
+		squares += v * v;
+		if (row[i] > sums.peak)
+			sums.peak = row[i];
+	}
+	sums.sum += sum;
+	sums.sumSquares += squares;
+}
+
+static double rowgradient(const unsigned short* row, const unsigned short* next, int count)
+{
+	double gradient = 0;
+	for (int i = 0; i < count; ++i)
+	{
+		if (i + 1 < count)
+		{
+			const double dx = (double)row[i + 1] - row[i];
+			gradient += dx * dx;
+		}
+		if (next)
+		{
+			const double dy = (double)next[i] - row[i];
+			gradient += dy * dy;
+		}
+	}
+	return gradient;
+}
+
+#endif
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Merits
+//
+
+// Side of the binned image of the band metric: a power of two, at most MIRAO_BAND_SIZE
+static int bandsize(int width, int height)
+{
+	int n = 1;
+	while (2 * n <= MIRAO_BAND_SIZE && 2 * n <= width && 2 * n <= height)
+		n *= 2;
+	return n;
+}
+
+static void accumulate(const unsigned short* pixels, int width, int height, int rowBegin, int rowEnd, int metric, MiraoMeritSums& sums)
+{
+	const int n = bandsize(width, height);
+	const int binWidth = width / n;
+	const int binHeight = height / n;
+	if (metric == MIRAO_METRIC_BAND)
+		sums.bins.assign(n * n, 0.0);
+
+	for (int r = rowBegin; r < rowEnd; ++r)
+	{
+		const unsigned short* row = pixels + (size_t)r * width;
+		rowmoments(row, width, sums);
+		if (metric == MIRAO_METRIC_GRADIENT)
+			sums.gradient += rowgradient(row, r + 1 < height ? row + width : 0, width);
+		if (metric == MIRAO_METRIC_BAND && r / binHeight < n)
+		{
+			double* bins = &sums.bins[(r / binHeight) * n];
+			for (int b = 0; b < n; ++b)
+				bins[b] += rowsum(row + b * binWidth, binWidth);
+		}
+	}
+}
+
+// Energy of the binned frame between the lowest non-zero frequency and a
+// quarter of the binned sampling frequency, relative to the DC energy
+static double bandenergy(const std::vector<double>& bins, int n)
+{
+	const MiraoFftPlan& plan = MiraoFftPlan::Get(n);
+	std::vector<double> spectrum(2 * n * n, 0.0);
+	for (int i = 0; i < n * n; ++i)
+		spectrum[2 * i] = bins[i];
+	for (int y = 0; y < n; ++y)
+		plan.Transform(&spectrum[2 * y * n], 1);
+	for (int x = 0; x < n; ++x)
+		plan.Transform(&spectrum[2 * x], n);
+
+	const double dc = spectrum[0] * spectrum[0] + spectrum[1] * spectrum[1];
+	const int limit = n / 4 > 1 ? n / 4 : 1;
+	double energy = 0;
+	for (int y = 0; y < n; ++y)
+	{
+		const int fy = y <= n / 2 ? y : y - n;
+		for (int x = 0; x < n; ++x)
+		{
+			const int fx = x <= n / 2 ? x : x - n;
+			const int radius2 = fx * fx + fy * fy;
+			if (radius2 > 0 && radius2 <= limit * limit)
+			{
+				const double* f = &spectrum[2 * (y * n + x)];
+				energy += f[0] * f[0] + f[1] * f[1];
+			}
+		}
+	}
+	return dc > 0 ? energy / dc : 0.0;
+}
+
+static double finish(const std::vector<MiraoMeritSums>& stripes, int width, int height, int metric)
+{
+	MiraoMeritSums total;
+	total.bins = stripes[0].bins;
+	for (size_t s = 0; s < stripes.size(); ++s)
+	{
+		total.sum += stripes[s].sum;
+		total.sumSquares += stripes[s].sumSquares;
+		total.gradient += stripes[s].gradient;
+		if (stripes[s].peak > total.peak)
+			total.peak = stripes[s].peak;
+		for (size_t b = 0; s > 0 && b < total.bins.size(); ++b)
+			total.bins[b] += stripes[s].bins[b];
+	}
+
+	if (total.sum <= 0)
+		return 0.0;
+	const double count = (double)width * height;
+	switch (metric)
+	{
+	case MIRAO_METRIC_MAXIMUM:
+		return total.peak;
+	case MIRAO_METRIC_VARIANCE:
+		return count * total.sumSquares / (total.sum * total.sum) - 1.0;
+	case MIRAO_METRIC_GRADIENT:
+		return total.gradient / (total.sum * total.sum);
+	case MIRAO_METRIC_BAND:
+		return bandenergy(total.bins, bandsize(width, height));
+	default:
+		return total.sumSquares / (total.sum * total.sum);
+	}
+}
+
+void MiraoCopyFrame(const unsigned char* buffer, int imageWidth, int imageHeight, int bytesPerPixel, int x, int y, int width, int height, MiraoFrame& frame)
+{
+	if (x > imageWidth)
+		x = imageWidth;
+	if (y > imageHeight)
+		y = imageHeight;
+	frame.width = width > 0 && x + width < imageWidth ? width : imageWidth - x;
+	frame.height = height > 0 && y + height < imageHeight ? height : imageHeight - y;
+	frame.pixels.resize((size_t)frame.width * frame.height);
+	for (int r = 0; r < frame.height; ++r)
+	{
+		const unsigned char* source = buffer + ((size_t)(y + r) * imageWidth + x) * bytesPerPixel;
+		unsigned short* target = &frame.pixels[(size_t)r * frame.width];
+		if (bytesPerPixel == 2)
+			memcpy(target, source, frame.width * sizeof(unsigned short));
+		else
+			for (int i = 0; i < frame.width; ++i)
+				target[i] = source[i];
+	}
+}
+
+double MiraoMerit(const unsigned short* pixels, int width, int height, int metric)
+{
+	std::vector<MiraoMeritSums> sums(1);
+	accumulate(pixels, width, height, 0, height, metric, sums[0]);
+	return finish(sums, width, height, metric);
+}
+
+double MiraoParabolicPeak(double bias, double minus, double centre, double plus)
+{
+	const double curvature = minus + plus - 2.0 * centre;
+	if (curvature < 0)
+	{
+		double peak = bias * (minus - plus) / (2.0 * curvature);
+		if (peak > bias)
+			peak = bias;
+		if (peak < -bias)
+			peak = -bias;
+		return peak;
+	}
+	if (plus > centre && plus >= minus)
+		return bias;
+	if (minus > centre && minus > plus)
+		return -bias;
+	return 0.0;
+}
+
+
+// Plans live as long as the adapter is loaded
+const MiraoFftPlan& MiraoFftPlan::Get(int n)
+{
+	MMThreadGuard guard(lock_);
+	std::map<int, MiraoFftPlan*>::iterator it = plans_.find(n);
+	if (it == plans_.end())
+		it = plans_.insert(std::make_pair(n, new MiraoFftPlan(n))).first;
+	return *it->second;
+}
+
+MiraoFftPlan::MiraoFftPlan(int n) :
+	n_(n),
+	bitreverse_(n),
+	cos_(n / 2 > 0 ? n / 2 : 1),
+	sin_(n / 2 > 0 ? n / 2 : 1)
+{
+	int bits = 0;
+	while ((1 << bits) < n)
+		++bits;
+	for (int i = 0; i < n; ++i)
+	{
+		int reversed = 0;
+		for (int b = 0; b < bits; ++b)
+			if (i & (1 << b))
+				reversed |= 1 << (bits - 1 - b);
+		bitreverse_[i] = reversed;
+	}
+	const double pi = 3.14159265358979323846;
+	for (int k = 0; k < n / 2; ++k)
+	{
+		cos_[k] = cos(2.0 * pi * k / n);
+		sin_[k] = sin(2.0 * pi * k / n);
+	}
+}
+
+void MiraoFftPlan::Transform(double* data, int stride) const
+{
+	for (int i = 0; i < n_; ++i)
+	{
+		const int j = bitreverse_[i];
+		if (j > i)
+		{
+			double* a = data + 2 * i * stride;
+			double* b = data + 2 * j * stride;
+			const double re = a[0], im = a[1];
+			a[0] = b[0]; a[1] = b[1];
+			b[0] = re; b[1] = im;
+		}
+	}
+	for (int length = 2; length <= n_; length *= 2)
+	{
+		const int step = n_ / length;
+		for (int i = 0; i < n_; i += length)
+		{
+			for (int k = 0; k < length / 2; ++k)
+			{
+				const double wr = cos_[k * step];
+				const double wi = -sin_[k * step];
+				double* a = data + 2 * (i + k) * stride;
+				double* b = data + 2 * (i + k + length / 2) * stride;
+				const double tr = wr * b[0] - wi * b[1];
+				const double ti = wr * b[1] + wi * b[0];
+				b[0] = a[0] - tr;
+				b[1] = a[1] - ti;
+				a[0] += tr;
+				a[1] += ti;
+			}
+		}
+	}
+}
+
+
+MiraoMetricPool::MiraoMetricPool() :
+	stop_(1)
+{
+}
+
+MiraoMetricPool::~MiraoMetricPool()
+{
+	Stop();
+}
+
+void MiraoMetricPool::Start(int nbThreads)
+{
+	if (!workers_.empty())
+		return;
+	stop_.Set(0);
+	for (int i = 0; i < nbThreads; ++i)
+	{
+		workers_.push_back(new Worker(this));
+		workers_.back()->activate();
+	}
+}
+
+void MiraoMetricPool::Stop()
+{
+	if (workers_.empty())
+		return;
+	stop_.Set(1);
+	for (size_t i = 0; i < workers_.size(); ++i)
+	{
+		wakeup_.Set();
+		workers_[i]->wait();
+		delete workers_[i];
+	}
+	workers_.clear();
+	MMThreadGuard guard(lock_);
+	jobs_.clear();
+	pending_.Set(0);
+}
+
+void MiraoMetricPool::Submit(MiraoFrame* frame)
+{
+	int stripes = frame->height / MIRAO_METRIC_MIN_ROWS;
+	if (stripes > (int)workers_.size())
+		stripes = (int)workers_.size();
+	if (stripes < 1)
+		stripes = 1;
+	frame->stripes.assign(stripes, MiraoMeritSums());
+	frame->remaining = stripes;
+
+	pending_.Increment();
+	{
+		MMThreadGuard guard(lock_);
+		for (int s = 0; s < stripes; ++s)
+		{
+			Job job = { frame, s };
+			jobs_.push_back(job);
+		}
+	}
+	wakeup_.Set();
+}
+
+void MiraoMetricPool::Wait()
+{
+	while (pending_.Get() > 0 && !stop_.Get())
+		CDeviceUtils::SleepMs(1);
+}
+
+bool MiraoMetricPool::Pop(Job& job)
+{
+	MMThreadGuard guard(lock_);
+	if (jobs_.empty())
+		return false;
+	job = jobs_.front();
+	jobs_.pop_front();
+	// more work queued: wake another thread for it
+	if (!jobs_.empty())
+		wakeup_.Set();
+	return true;
+}
+
+// Evaluates one stripe; the thread finishing the last stripe of a frame sets its merit
+void MiraoMetricPool::Evaluate(const Job& job)
+{
+	MiraoFrame* frame = job.frame;
+	const int stripes = (int)frame->stripes.size();
+	const int rowBegin = frame->height * job.stripe / stripes;
+	const int rowEnd = frame->height * (job.stripe + 1) / stripes;
+	if (!frame->pixels.empty())
+		accumulate(&frame->pixels[0], frame->width, frame->height, rowBegin, rowEnd, frame->metric, frame->stripes[job.stripe]);
+
+	bool last;
+	{
+		MMThreadGuard guard(lock_);
+		last = --frame->remaining == 0;
+	}
+	if (last)
+	{
+		frame->merit = frame->pixels.empty() ? 0.0 : finish(frame->stripes, frame->width, frame->height, frame->metric);
+		pending_.Add(-1);
+	}
+}
+
+int MiraoMetricPool::Worker::svc()
+{
+	while (!pool_->stop_.Get())
+	{
+		Job job;
+		if (!pool_->Pop(job))
+		{
+			pool_->wakeup_.Wait(100);
+			continue;
+		}
+		pool_->Evaluate(job);
+	}
+	return 0;
+}
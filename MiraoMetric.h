@@ -0,0 +1,146 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          MiraoMetric.h
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     DeviceAdapters
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Image merit functions for sensorless optimisation with the
+//                MIRAO-52E and the thread pool that evaluates them
+//
+// AUTHOR:        Marijn Siemons
+
+#pragma once
+
+#include <deque>
+#include <map>
+#include <vector>
+#include "../../MMDevice/DeviceThreads.h"
+#include "MiraoSync.h"
+
+#define MIRAO_METRIC_SHARPNESS	0	// sum of I^2 over (sum of I)^2
+#define MIRAO_METRIC_MAXIMUM	1	// brightest pixel
+#define MIRAO_METRIC_VARIANCE	2	// intensity variance over mean^2
+#define MIRAO_METRIC_GRADIENT	3	// sum of squared x and y differences over (sum of I)^2
+#define MIRAO_METRIC_BAND		4	// low spatial frequency energy over the DC energy
+#define MIRAO_NB_METRICS		5
+
+// The band metric bins the frame to at most this many pixels square
+#define MIRAO_BAND_SIZE			64
+// Frames are split over the pool threads in stripes of at least this many rows
+#define MIRAO_METRIC_MIN_ROWS	64
+
+// Property values of the metrics, indexed as above
+extern const char* g_miraoMetrics[MIRAO_NB_METRICS];
+
+// Partial sums of one stripe of a frame; the merit follows from their total
+struct MiraoMeritSums
+{
+	MiraoMeritSums() : sum(0), sumSquares(0), gradient(0), peak(0) {}
+
+	double sum;
+	double sumSquares;
+	double gradient;
+	unsigned short peak;
+	std::vector<double> bins;	// band metric only: binned frame, row by row
+};
+
+// One camera frame and, once evaluated, its merit
+struct MiraoFrame
+{
+	MiraoFrame() : width(0), height(0), metric(MIRAO_METRIC_SHARPNESS), merit(0), remaining(0) {}
+
+	std::vector<unsigned short> pixels;
+	int width;
+	int height;
+	int metric;
+	double merit;
+
+	// Used by MiraoMetricPool while the frame is evaluated
+	std::vector<MiraoMeritSums> stripes;
+	long remaining;
+};
+
+// Copies a region of an 8 or 16-bit camera image into frame as 16-bit pixels.
+// The region is clipped to the image; a width or height of 0 extends it to the
+// image border.
+void MiraoCopyFrame(const unsigned char* buffer, int imageWidth, int imageHeight, int bytesPerPixel, int x, int y, int width, int height, MiraoFrame& frame);
+
+// Merit of a 16-bit image, larger is better. Evaluated on the calling thread.
+double MiraoMerit(const unsigned short* pixels, int width, int height, int metric);
+
+// Offset from the centre probe to the maximum of the parabola through the merits
+// of three probes at -bias, 0 and +bias, limited to the probed range. Without a
+// maximum the best of the three probes is taken.
+double MiraoParabolicPeak(double bias, double minus, double centre, double plus);
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Radix-2 complex FFT of a fixed size. Plans are built once per size and
+// shared; Get() may be called from any thread.
+//
+class MiraoFftPlan
+{
+public:
+	static const MiraoFftPlan& Get(int n);
+
+	int Size() const { return n_; }
+	// In place transform of n complex values, interleaved real and imaginary
+	void Transform(double* data, int stride) const;
+
+private:
+	MiraoFftPlan(int n);
+
+	int n_;
+	std::vector<int> bitreverse_;
+	std::vector<double> cos_;
+	std::vector<double> sin_;
+
+	static MMThreadLock lock_;
+	static std::map<int, MiraoFftPlan*> plans_;
+};
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Threads that evaluate submitted frames, so the merit of one frame is
+// computed while the mirror moves and the camera exposes for the next.
+// Large frames are split in stripes of rows that are evaluated in parallel.
+//
+class MiraoMetricPool
+{
+public:
+	MiraoMetricPool();
+	~MiraoMetricPool();
+
+	void Start(int nbThreads);
+	void Stop();
+
+	// Sets frame->merit once evaluated; the frame must stay alive until Wait()
+	void Submit(MiraoFrame* frame);
+	// Blocks until every submitted frame has been evaluated
+	void Wait();
+
+private:
+	class Worker : public MMDeviceThreadBase
+	{
+	public:
+		Worker(MiraoMetricPool* pool) : pool_(pool) {}
+		int svc();
+	private:
+		MiraoMetricPool* pool_;
+	};
+
+	struct Job
+	{
+		MiraoFrame* frame;
+		int stripe;
+	};
+
+	bool Pop(Job& job);
+	void Evaluate(const Job& job);
+
+	MMThreadLock lock_;
+	std::deque<Job> jobs_;
+	MiraoEvent wakeup_;
+	MiraoAtomicLong pending_;
+	MiraoAtomicLong stop_;
+	std::vector<Worker*> workers_;
+};
@@ -0,0 +1,60 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          MiraoModes.cpp
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     DeviceAdapters
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Table of the Zernike modes exposed by the MIRAO-52E adapter
+//
+// AUTHOR:        Marijn Siemons
+
+#include "MiraoModes.h"
+
+const MiraoMode g_miraoModes[MIRAO_MAX_ZERNIKES] =
+{
+	// Noll ANSI n   m   name     limits
+	{  2,  2,  1,  1, "Z11",    -1.0, 1.0 },	// tip
+	{  3,  1,  1, -1, "Z1-1",   -1.0, 1.0 },	// tilt
+	{  4,  4,  2,  0, "Z20",    -1.0, 1.0 },	// defocus
+	{  6,  5,  2,  2, "Z22",    -1.0, 1.0 },	// astigmatism 0 deg
+	{  5,  3,  2, -2, "Z2-2",   -1.0, 1.0 },	// astigmatism 45 deg
+	{  8,  8,  3,  1, "Z31",    -1.0, 1.0 },	// coma 0 deg
+	{  7,  7,  3, -1, "Z3-1",   -1.0, 1.0 },	// coma 90 deg
+	{ 11, 12,  4,  0, "Z40",    -1.0, 1.0 },	// primary spherical
+	{ 10,  9,  3,  3, "Z33",    -1.0, 1.0 },	// trefoil 0 deg
+	{  9,  6,  3, -3, "Z3-3",   -1.0, 1.0 },	// trefoil 90 deg
+	{ 12, 13,  4,  2, "Z42",    -1.0, 1.0 },	// secondary astigmatism 0 deg
+	{ 13, 11,  4, -2, "Z4-2",   -1.0, 1.0 },	// secondary astigmatism 45 deg
+	{ 16, 18,  5,  1, "Z51",    -1.0, 1.0 },	// secondary coma 0 deg
+	{ 17, 17,  5, -1, "Z5-1",   -1.0, 1.0 },	// secondary coma 90 deg
+	{ 22, 24,  6,  0, "Z60",    -1.0, 1.0 },	// secondary spherical
+	{ 14, 14,  4,  4, "Z44",    -1.0, 1.0 },	// quadrafoil 0 deg
+	{ 15, 10,  4, -4, "Z4-4",   -1.0, 1.0 },	// quadrafoil 45 deg
+	{ 18, 19,  5,  3, "Z53",    -1.0, 1.0 },	// secondary trefoil 0 deg
+	{ 19, 16,  5, -3, "Z5-3",   -1.0, 1.0 },	// secondary trefoil 90 deg
+	{ 24, 25,  6,  2, "Z62",    -1.0, 1.0 },
+	{ 23, 23,  6, -2, "Z6-2",   -1.0, 1.0 },
+	{ 30, 32,  7,  1, "Z71",    -1.0, 1.0 },
+	{ 29, 31,  7, -1, "Z7-1",   -1.0, 1.0 },
+	{ 37, 40,  8,  0, "Z80",    -1.0, 1.0 },	// tertiary spherical
+	{ 20, 20,  5,  5, "Z55",    -1.0, 1.0 },
+	{ 21, 15,  5, -5, "Z5-5",   -1.0, 1.0 },
+	{ 26, 26,  6,  4, "Z64",    -1.0, 1.0 },
+	{ 25, 22,  6, -4, "Z6-4",   -1.0, 1.0 },
+	{ 32, 33,  7,  3, "Z73",    -1.0, 1.0 },
+	{ 31, 30,  7, -3, "Z7-3",   -1.0, 1.0 },
+	{ 38, 41,  8,  2, "Z82",    -1.0, 1.0 },
+	{ 39, 39,  8, -2, "Z8-2",   -1.0, 1.0 },
+	{ 46, 50,  9,  1, "Z91",    -1.0, 1.0 },
+	{ 47, 49,  9, -1, "Z9-1",   -1.0, 1.0 },
+	{ 56, 60, 10,  0, "Z10,0",  -1.0, 1.0 },	// quaternary spherical
+	{ 28, 27,  6,  6, "Z66",    -1.0, 1.0 },
+	{ 27, 21,  6, -6, "Z6-6",   -1.0, 1.0 },
+	{ 34, 34,  7,  5, "Z75",    -1.0, 1.0 },
+	{ 33, 29,  7, -5, "Z7-5",   -1.0, 1.0 },
+	{ 40, 42,  8,  4, "Z84",    -1.0, 1.0 },
+	{ 41, 38,  8, -4, "Z8-4",   -1.0, 1.0 },
+	{ 48, 51,  9,  3, "Z93",    -1.0, 1.0 },
+	{ 49, 48,  9, -3, "Z9-3",   -1.0, 1.0 },
+	{ 58, 61, 10,  2, "Z10,2",  -1.0, 1.0 },
+	{ 57, 59, 10, -2, "Z10,-2", -1.0, 1.0 },
+};
@@ -0,0 +1,31 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          MiraoModes.h
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     DeviceAdapters
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Table of the Zernike modes exposed by the MIRAO-52E adapter
+//
+// AUTHOR:        Marijn Siemons
+
+#pragma once
+
+#include "MiraoProjector.h"
+
+// Modes the SDK Zernike conversion is driven with. Higher orders are applied
+// through the native projection only.
+#define MIRAO_SDK_ZERNIKES		19
+
+struct MiraoMode
+{
+	int noll;				// Noll index (piston = 1)
+	int ansi;				// OSA/ANSI index (piston = 0)
+	int n;					// radial order
+	int m;					// azimuthal frequency, m < 0 for the sine terms
+	const char* name;		// property name
+	double min;				// property limits [um]
+	double max;
+};
+
+// Modes in the order used throughout the adapter and the SDK: Fringe ordering
+// without piston, so g_miraoModes[j - 1] describes Zernike index j.
+extern const MiraoMode g_miraoModes[MIRAO_MAX_ZERNIKES];
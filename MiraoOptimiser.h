@@ -0,0 +1,228 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          MiraoOptimiser.h
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     DeviceAdapters
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Sensorless modal optimisation with the MIRAO-52E: biased
+//                probes per mode, merit from camera frames, parabolic fit
+//
+// AUTHOR:        Marijn Siemons
+
+#pragma once
+
+#include <cstring>
+#include <string>
+#include <vector>
+#include "../../MMDevice/MMDevice.h"
+#include "../../MMDevice/DeviceThreads.h"
+#include "MiraoMetric.h"
+#include "MiraoProjector.h"
+#include "MiraoSync.h"
+
+struct MiraoOptimiserSettings
+{
+	enum Scheme
+	{
+		ThreeN,			// -bias, 0, +bias per mode, each mode from the result of the previous one
+		TwoNPlusOne		// one centre frame, then -bias and +bias for every mode around it
+	};
+
+	MiraoOptimiserSettings() :
+		camera(0),
+		bias(0.1),
+		scheme(ThreeN),
+		metric(MIRAO_METRIC_SHARPNESS),
+		rounds(1),
+		pipelined(true),
+		threads(4),
+		roiX(0),
+		roiY(0),
+		roiWidth(0),
+		roiHeight(0)
+	{
+	}
+
+	MM::Camera* camera;
+	std::vector<int> modes;
+	double bias;				// probe amplitude [um]
+	int scheme;
+	int metric;
+	int rounds;
+	bool pipelined;				// evaluate a frame while the next probe is applied
+	int threads;				// metric threads; large frames are split over them
+	int roiX;					// region of the camera image the merit is taken from,
+	int roiY;					// clipped to the image; a width or height of 0
+	int roiWidth;				// extends the region to the image border
+	int roiHeight;
+};
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Runs an optimisation on its own thread. The device moves the mirror:
+// device->GetZernikes() gives the starting point, device->MoveZernikes()
+// applies a probe and returns once the mirror has settled, and
+// device->SetZernikes() stores the result as the device's Zernike state.
+// Frames (8 or 16 bit, optionally a region of the image) are evaluated on a
+// MiraoMetricPool while the next probe is applied and exposed, so per probe
+// only the slower of the two is waited for.
+//
+template <class TDevice>
+class MiraoOptimiser : public MMDeviceThreadBase
+{
+public:
+	MiraoOptimiser(TDevice* device) :
+		device_(device),
+		running_(0),
+		abort_(0),
+		active_(false),
+		result_(DEVICE_OK),
+		elapsed_ms_(0),
+		merit_(0)
+	{
+	}
+
+	~MiraoOptimiser()
+	{
+		Stop();
+		pool_.Stop();
+	}
+
+	// False if an optimisation is still running
+	bool Start(const MiraoOptimiserSettings& settings)
+	{
+		if (IsRunning())
+			return false;
+		Join();
+		settings_ = settings;
+		abort_.Set(0);
+		running_.Set(1);
+		active_ = true;
+		activate();
+		return true;
+	}
+
+	// Aborts at the next mode; the modes optimised so far are kept
+	void Stop()
+	{
+		abort_.Set(1);
+		Join();
+	}
+
+	bool IsRunning() const { return running_.Get() != 0; }
+	int GetResult() const { return result_; }
+	double GetElapsedMs() const { return elapsed_ms_; }
+	double GetMerit() const { return merit_; }
+
+	int svc()
+	{
+		MM::MMTime start = device_->GetCurrentMMTime();
+		pool_.Start(settings_.threads);
+		result_ = Run();
+		pool_.Wait();
+		pool_.Stop();
+		elapsed_ms_ = (device_->GetCurrentMMTime() - start).getMsec();
+		running_.Set(0);
+		return 0;
+	}
+
+private:
+	void Join()
+	{
+		if (active_)
+		{
+			wait();
+			active_ = false;
+		}
+	}
+
+	int Run()
+	{
+		float zernikes[MIRAO_MAX_ZERNIKES + 1];
+		device_->GetZernikes(zernikes);
+		const int nbModes = (int)settings_.modes.size();
+		const double bias = settings_.bias;
+		int ret = DEVICE_OK;
+
+		for (int round = 0; round < settings_.rounds && ret == DEVICE_OK && !abort_.Get(); ++round)
+		{
+			if (settings_.scheme == MiraoOptimiserSettings::TwoNPlusOne)
+			{
+				frames_.resize(2 * nbModes + 1);
+				ret = Probe(zernikes, 0, 0, frames_[0]);
+				for (int m = 0; m < nbModes && ret == DEVICE_OK && !abort_.Get(); ++m)
+				{
+					ret = Probe(zernikes, settings_.modes[m], -bias, frames_[1 + 2 * m]);
+					if (ret == DEVICE_OK)
+						ret = Probe(zernikes, settings_.modes[m], bias, frames_[2 + 2 * m]);
+				}
+				pool_.Wait();
+				if (ret != DEVICE_OK || abort_.Get())
+					break;
+				for (int m = 0; m < nbModes; ++m)
+					zernikes[settings_.modes[m]] += (float)MiraoParabolicPeak(bias, frames_[1 + 2 * m].merit, frames_[0].merit, frames_[2 + 2 * m].merit);
+				merit_ = frames_[0].merit;
+			}
+			else
+			{
+				frames_.resize(3);
+				for (int m = 0; m < nbModes && ret == DEVICE_OK && !abort_.Get(); ++m)
+				{
+					const int mode = settings_.modes[m];
+					ret = Probe(zernikes, mode, -bias, frames_[0]);
+					if (ret == DEVICE_OK)
+						ret = Probe(zernikes, mode, 0, frames_[1]);
+					if (ret == DEVICE_OK)
+						ret = Probe(zernikes, mode, bias, frames_[2]);
+					pool_.Wait();
+					if (ret != DEVICE_OK)
+						break;
+					zernikes[mode] += (float)MiraoParabolicPeak(bias, frames_[0].merit, frames_[1].merit, frames_[2].merit);
+					merit_ = frames_[1].merit;
+				}
+			}
+		}
+		int applied = device_->SetZernikes(zernikes);
+		return ret != DEVICE_OK ? ret : applied;
+	}
+
+	// Applies the given Zernikes with offset added to mode, snaps a frame into
+	// frame and queues it for evaluation
+	int Probe(const float* zernikes, int mode, double offset, MiraoFrame& frame)
+	{
+		float probe[MIRAO_MAX_ZERNIKES + 1];
+		memcpy(probe, zernikes, sizeof(probe));
+		probe[mode] += (float)offset;
+		int ret = device_->MoveZernikes(probe);
+		if (ret != DEVICE_OK)
+			return ret;
+
+		ret = settings_.camera->SnapImage();
+		if (ret != DEVICE_OK)
+			return ret;
+		// Copy the region out: the camera reuses its buffer for the next probe
+		MiraoCopyFrame(settings_.camera->GetImageBuffer(), (int)settings_.camera->GetImageWidth(), (int)settings_.camera->GetImageHeight(),
+			(int)settings_.camera->GetImageBytesPerPixel(), settings_.roiX, settings_.roiY, settings_.roiWidth, settings_.roiHeight, frame);
+		if (frame.pixels.empty())
+		{
+			frame.merit = 0;
+			return DEVICE_OK;
+		}
+		frame.metric = settings_.metric;
+
+		pool_.Submit(&frame);
+		if (!settings_.pipelined)
+			pool_.Wait();
+		return DEVICE_OK;
+	}
+
+	TDevice* device_;
+	MiraoOptimiserSettings settings_;
+	MiraoMetricPool pool_;
+	std::vector<MiraoFrame> frames_;
+	MiraoAtomicLong running_;
+	MiraoAtomicLong abort_;
+	bool active_;
+	int result_;
+	double elapsed_ms_;
+	double merit_;
+};
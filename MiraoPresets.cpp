@@ -0,0 +1,97 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          MiraoPresets.cpp
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     DeviceAdapters
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Named wavefront corrections for the MIRAO-52E, parsed once
+//                and switched between from memory
+//
+// AUTHOR:        Marijn Siemons
+
+#include "MiraoPresets.h"
+
+namespace {
+
+std::string Trim(const std::string& text)
+{
+	const char* space = " \t\r\n";
+	size_t first = text.find_first_not_of(space);
+	if (first == std::string::npos)
+		return std::string();
+	return text.substr(first, text.find_last_not_of(space) - first + 1);
+}
+
+} // namespace
+
+
+MiraoPresetLibrary::MiraoPresetLibrary() :
+	size_(0)
+{
+}
+
+bool MiraoPresetLibrary::Load(const std::string& listPath)
+{
+	std::string xml;
+	if (!MiraoReadFile(listPath, xml))
+		return false;
+
+	bool ok = true;
+	size_t pos = 0;
+	std::string preset;
+	while (MiraoTagText(xml, "preset", preset, pos))
+	{
+		std::string name;
+		std::string path;
+		size_t at = 0;
+		if (!MiraoTagText(preset, "name", name, at))
+			return false;
+		at = 0;
+		if (!MiraoTagText(preset, "path", path, at))
+			return false;
+		ok = Add(Trim(name), Trim(path)) >= 0 && ok;
+	}
+	return ok;
+}
+
+int MiraoPresetLibrary::Add(const std::string& name, const std::string& path)
+{
+	MiraoWavefrontState state;
+	if (name.empty() || !state.Load(path))
+		return -1;
+	int index = Slot(name);
+	if (index < 0)
+		return -1;
+	presets_[index].path = path;
+	presets_[index].state = state;
+	return index;
+}
+
+int MiraoPresetLibrary::Add(const std::string& name, const std::string& path, const MiraoWavefrontState& state)
+{
+	if (name.empty() || (Find(name) < 0 && size_ == MIRAO_MAX_PRESETS) || !state.Save(path))
+		return -1;
+	int index = Slot(name);
+	presets_[index].path = path;
+	presets_[index].state = state;
+	return index;
+}
+
+int MiraoPresetLibrary::Find(const std::string& name) const
+{
+	for (int i = 0; i < size_; ++i)
+		if (presets_[i].name == name)
+			return i;
+	return -1;
+}
+
+// Index of the preset called name, a new entry if there is none yet
+int MiraoPresetLibrary::Slot(const std::string& name)
+{
+	int index = Find(name);
+	if (index >= 0)
+		return index;
+	if (size_ == MIRAO_MAX_PRESETS)
+		return -1;
+	presets_[size_].name = name;
+	return size_++;
+}
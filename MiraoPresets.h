@@ -0,0 +1,57 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          MiraoPresets.h
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     DeviceAdapters
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Named wavefront corrections for the MIRAO-52E, parsed once
+//                and switched between from memory
+//
+// AUTHOR:        Marijn Siemons
+
+#pragma once
+
+#include <string>
+#include "MiraoProjector.h"
+
+#define MIRAO_MAX_PRESETS		32
+
+struct MiraoPreset
+{
+	std::string name;
+	std::string path;			// .wcs file the SDK applies the commands from
+	MiraoWavefrontState state;	// its parsed actuator commands and limits
+};
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Fixed table of presets. The .wcs files are parsed when a preset is added;
+// selecting one afterwards is a table lookup. The device serialises changes
+// to the table with the mirror updates that read it.
+//
+class MiraoPresetLibrary
+{
+public:
+	MiraoPresetLibrary();
+
+	// Adds the presets of a list file, one
+	// <preset><name>...</name><path>...</path></preset> per wavefront file.
+	// Returns false if the list cannot be read or a listed file cannot be parsed.
+	bool Load(const std::string& listPath);
+	// Parses path and stores it under name, replacing a preset of that name.
+	// Returns the index, -1 if the file cannot be parsed or the table is full.
+	int Add(const std::string& name, const std::string& path);
+	// Stores an actuator state under name, written once to path for the SDK
+	int Add(const std::string& name, const std::string& path, const MiraoWavefrontState& state);
+	void Clear() { size_ = 0; }
+
+	// Index of the preset with that name, -1 if none
+	int Find(const std::string& name) const;
+	int Size() const { return size_; }
+	const MiraoPreset& Get(int index) const { return presets_[index]; }
+
+private:
+	int Slot(const std::string& name);
+
+	MiraoPreset presets_[MIRAO_MAX_PRESETS];
+	int size_;
+};
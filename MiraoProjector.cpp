@@ -0,0 +1,896 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          MiraoProjector.cpp
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     DeviceAdapters
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Native Zernike-to-actuator projection for the MIRAO-52E,
+//                built from the interaction matrix in the .aomi calibration
+//
+// AUTHOR:        Marijn Siemons
+
+#include "MiraoProjector.h"
+#include <cfloat>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#if defined(_M_X64) || defined(_M_AMD64) || defined(__SSE__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define MIRAO_USE_SSE
+#include <xmmintrin.h>
+#endif
+
+namespace {
+
+const double pi = 3.14159265358979323846;
+
+bool ReadFile(const std::string& path, std::string& content)
+{
+	std::ifstream file(path.c_str(), std::ios::in | std::ios::binary);
+	if (!file)
+		return false;
+	std::ostringstream buffer;
+	buffer << file.rdbuf();
+	content = buffer.str();
+	return true;
+}
+
+// Text between <tag...> and </tag>, searching from pos. Returns false if absent.
+bool TagText(const std::string& xml, const std::string& tag, std::string& text, size_t& pos)
+{
+	size_t start = xml.find("<" + tag, pos);
+	while (start != std::string::npos)
+	{
+		char next = xml[start + tag.size() + 1];
+		if (next == '>' || next == ' ' || next == '\t')
+			break;
+		start = xml.find("<" + tag, start + 1);
+	}
+	if (start == std::string::npos)
+		return false;
+	start = xml.find('>', start);
+	if (start == std::string::npos)
+		return false;
+	++start;
+	size_t end = xml.find("</" + tag + ">", start);
+	if (end == std::string::npos)
+		return false;
+	text = xml.substr(start, end - start);
+	pos = end + tag.size() + 3;
+	return true;
+}
+
+bool TagText(const std::string& xml, const std::string& tag, std::string& text)
+{
+	size_t pos = 0;
+	return TagText(xml, tag, text, pos);
+}
+
+bool TagAttribute(const std::string& xml, const std::string& tag, const std::string& attribute, std::string& value)
+{
+	size_t start = xml.find("<" + tag);
+	if (start == std::string::npos)
+		return false;
+	size_t end = xml.find('>', start);
+	size_t attr = xml.find(attribute + "=\"", start);
+	if (attr == std::string::npos || attr > end)
+		return false;
+	attr += attribute.size() + 2;
+	size_t close = xml.find('"', attr);
+	if (close == std::string::npos)
+		return false;
+	value = xml.substr(attr, close - attr);
+	return true;
+}
+
+template <typename T>
+void ParseNumbers(const std::string& text, std::vector<T>& values)
+{
+	std::istringstream stream(text);
+	T value;
+	while (stream >> value)
+		values.push_back(value);
+}
+
+double Factorial(int n)
+{
+	double f = 1.0;
+	for (int i = 2; i <= n; ++i)
+		f *= i;
+	return f;
+}
+
+// Calibration cache layout: magic, version, key, scalars, vectors, control matrix.
+// The cache is only read back by the build that wrote it, so raw host layout is fine.
+const char cacheMagic[8] = { 'M', 'I', 'R', 'A', 'O', 'C', 'A', 'L' };
+const int cacheVersion = 2;
+
+template <class T>
+void WriteVector(std::ostream& out, const std::vector<T>& values)
+{
+	int size = (int)values.size();
+	MiraoWriteValue(out, size);
+	if (size > 0)
+		out.write((const char*)&values[0], size * sizeof(T));
+}
+
+// Reads a vector written by WriteVector(), which must hold exactly size elements
+template <class T>
+bool ReadVector(std::istream& in, std::vector<T>& values, int size)
+{
+	int stored = 0;
+	if (!MiraoReadValue(in, stored) || stored != size)
+		return false;
+	values.resize(size);
+	if (size > 0)
+		in.read((char*)&values[0], size * sizeof(T));
+	return !in.fail();
+}
+
+} // namespace
+
+
+void MiraoFringeToNM(int index, int& n, int& m)
+{
+	// Fringe index j = index + 1; modes are grouped by k = (n + |m|) / 2
+	int j = index + 1;
+	int count = 0;
+	for (int k = 0; ; ++k)
+	{
+		for (int am = k; am >= 0; --am)
+		{
+			n = 2 * k - am;
+			m = am;
+			if (++count == j)
+				return;
+			if (am > 0)
+			{
+				m = -am;
+				if (++count == j)
+					return;
+			}
+		}
+	}
+}
+
+double MiraoZernike(int n, int m, double x, double y)
+{
+	int am = m < 0 ? -m : m;
+	double rho = std::sqrt(x * x + y * y);
+	double radial = 0.0;
+	for (int s = 0; s <= (n - am) / 2; ++s)
+	{
+		double c = Factorial(n - s) / (Factorial(s) * Factorial((n + am) / 2 - s) * Factorial((n - am) / 2 - s));
+		if (s % 2)
+			c = -c;
+		radial += c * std::pow(rho, n - 2 * s);
+	}
+	if (m == 0)
+		return std::sqrt(n + 1.0) * radial;
+	double theta = std::atan2(y, x);
+	double norm = std::sqrt(2.0 * (n + 1.0));
+	return m > 0 ? norm * radial * std::cos(am * theta) : norm * radial * std::sin(am * theta);
+}
+
+bool MiraoReadFile(const std::string& path, std::string& content)
+{
+	return ReadFile(path, content);
+}
+
+bool MiraoTagText(const std::string& xml, const std::string& tag, std::string& text, size_t& pos)
+{
+	return TagText(xml, tag, text, pos);
+}
+
+unsigned long long MiraoFileHash(const std::string& path)
+{
+	std::string content;
+	if (!ReadFile(path, content))
+		return 0;
+	unsigned long long hash = 14695981039346656037ULL;
+	for (size_t i = 0; i < content.size(); ++i)
+	{
+		hash ^= (unsigned char)content[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+int MiraoCommandSteps(const float* a, const float* b, double resolution)
+{
+	int steps = 0;
+	for (int i = 0; i < MIRAO_NB_ACTUATORS; ++i)
+	{
+		int d = (int)std::floor(a[i] / resolution + 0.5) - (int)std::floor(b[i] / resolution + 0.5);
+		if (d < 0)
+			d = -d;
+		if (d > steps)
+			steps = d;
+	}
+	return steps;
+}
+
+bool MiraoCholeskyFactor(std::vector<double>& A, int n)
+{
+	for (int j = 0; j < n; ++j)
+	{
+		double d = A[j * n + j];
+		for (int k = 0; k < j; ++k)
+			d -= A[j * n + k] * A[j * n + k];
+		if (d <= 0.0)
+			return false;
+		d = std::sqrt(d);
+		A[j * n + j] = d;
+		for (int i = j + 1; i < n; ++i)
+		{
+			double s = A[i * n + j];
+			for (int k = 0; k < j; ++k)
+				s -= A[i * n + k] * A[j * n + k];
+			A[i * n + j] = s / d;
+		}
+	}
+	return true;
+}
+
+void MiraoCholeskySolve(const std::vector<double>& L, int n, std::vector<double>& x)
+{
+	for (int i = 0; i < n; ++i)
+	{
+		double s = x[i];
+		for (int k = 0; k < i; ++k)
+			s -= L[i * n + k] * x[k];
+		x[i] = s / L[i * n + i];
+	}
+	for (int i = n - 1; i >= 0; --i)
+	{
+		double s = x[i];
+		for (int k = i + 1; k < n; ++k)
+			s -= L[k * n + i] * x[k];
+		x[i] = s / L[i * n + i];
+	}
+}
+
+
+MiraoCalibration::MiraoCalibration() :
+	nbSubapX(0),
+	nbSubapY(0),
+	stepX_um(0),
+	stepY_um(0),
+	nbActuators(0),
+	minCommand(-1),
+	maxCommand(1),
+	sleepAfterApplyMs(0),
+	nbValidSubap(0)
+{
+}
+
+bool MiraoCalibration::Load(const std::string& path)
+{
+	std::string xml;
+	if (!ReadFile(path, xml))
+		return false;
+
+	std::string text;
+	if (!TagText(xml, "number-of-subapertures", text))
+		return false;
+	std::string value;
+	if (!TagText(text, "x", value)) return false;
+	nbSubapX = atoi(value.c_str());
+	if (!TagText(text, "y", value)) return false;
+	nbSubapY = atoi(value.c_str());
+
+	if (!TagText(xml, "microlenses-step-um", text))
+		return false;
+	if (!TagText(text, "x", value)) return false;
+	stepX_um = atof(value.c_str());
+	if (!TagText(text, "y", value)) return false;
+	stepY_um = atof(value.c_str());
+
+	if (!TagText(xml, "number-of-actuators", value))
+		return false;
+	nbActuators = atoi(value.c_str());
+	if (nbActuators != MIRAO_NB_ACTUATORS)
+		return false;
+
+	if (TagText(xml, "min-commande", value))
+		minCommand = (float)atof(value.c_str());
+	if (TagText(xml, "max-commande", value))
+		maxCommand = (float)atof(value.c_str());
+	if (TagText(xml, "sleep-after-apply-ms", value))
+		sleepAfterApplyMs = atof(value.c_str());
+
+	validActuator.clear();
+	if (TagAttribute(xml, "tab-valid-actuator", "value", value))
+		ParseNumbers(value, validActuator);
+	validActuator.resize(nbActuators, 1);
+
+	offsetCommands.clear();
+	if (TagAttribute(xml, "tab-offset-commands", "value", value))
+		ParseNumbers(value, offsetCommands);
+	offsetCommands.resize(nbActuators, 0.0f);
+
+	// greatest common pupil: one <line> per row of subapertures
+	if (!TagText(xml, "greatest-common-pupil", text))
+		return false;
+	pupil.clear();
+	nbValidSubap = 0;
+	size_t pos = 0;
+	std::string line;
+	while (TagText(text, "line", line, pos))
+	{
+		std::vector<int> row;
+		ParseNumbers(line, row);
+		if ((int)row.size() != nbSubapX)
+			return false;
+		for (int i = 0; i < nbSubapX; ++i)
+		{
+			pupil.push_back(row[i] ? 1 : 0);
+			nbValidSubap += row[i] ? 1 : 0;
+		}
+	}
+	if ((int)pupil.size() != nbSubapX * nbSubapY || nbValidSubap == 0)
+		return false;
+
+	// interaction matrix: one <line> per slope with one response per actuator
+	if (!TagText(xml, "matrix", text))
+		return false;
+	matrix.clear();
+	matrix.reserve(2 * nbValidSubap * nbActuators);
+	pos = 0;
+	while (TagText(text, "line", line, pos))
+	{
+		size_t before = matrix.size();
+		ParseNumbers(line, matrix);
+		if ((int)(matrix.size() - before) != nbActuators)
+			return false;
+	}
+	return (int)matrix.size() == 2 * nbValidSubap * nbActuators;
+}
+
+
+MiraoWavefrontState::MiraoWavefrontState() :
+	minSleepAfterMovementMs(0)
+{
+	for (int i = 0; i < MIRAO_NB_ACTUATORS; ++i)
+	{
+		valid[i] = 1;
+		minCommand[i] = -1.0f;
+		maxCommand[i] = 1.0f;
+		position[i] = 0.0f;
+	}
+}
+
+bool MiraoWavefrontState::Load(const std::string& path)
+{
+	std::string xml;
+	if (!ReadFile(path, xml))
+		return false;
+
+	size_t pos = 0;
+	std::string actuator;
+	int i = 0;
+	while (i < MIRAO_NB_ACTUATORS && TagText(xml, "actuator", actuator, pos))
+	{
+		std::string value;
+		if (TagText(actuator, "validity", value))
+			valid[i] = value.find("invalid") == std::string::npos ? 1 : 0;
+		if (TagText(actuator, "min", value))
+			minCommand[i] = (float)atof(value.c_str());
+		if (TagText(actuator, "max", value))
+			maxCommand[i] = (float)atof(value.c_str());
+		++i;
+	}
+
+	std::string text;
+	if (!TagText(xml, "position", text))
+		return false;
+	std::vector<float> values;
+	ParseNumbers(text, values);
+	if ((int)values.size() != MIRAO_NB_ACTUATORS)
+		return false;
+	for (int a = 0; a < MIRAO_NB_ACTUATORS; ++a)
+		position[a] = values[a];
+
+	if (TagText(xml, "min_sleep_after_movement", text))
+		minSleepAfterMovementMs = atof(text.c_str());
+	return true;
+}
+
+bool MiraoWavefrontState::Save(const std::string& path) const
+{
+	std::ofstream file(path.c_str(), std::ios::out | std::ios::trunc);
+	if (!file)
+		return false;
+	file.precision(9);
+	file << "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n<state>\n\t<actuators>\n";
+	for (int i = 0; i < MIRAO_NB_ACTUATORS; ++i)
+	{
+		file << "\t\t<actuator number=\"" << i + 1 << "\">\n";
+		file << "\t\t\t<validity>" << (valid[i] ? "valid" : "invalid") << "</validity>\n";
+		file << "\t\t\t<min>" << minCommand[i] << "</min>\n";
+		file << "\t\t\t<max>" << maxCommand[i] << "</max>\n";
+		file << "\t\t</actuator>\n";
+	}
+	file << "\t</actuators>\n\t<position>";
+	for (int i = 0; i < MIRAO_NB_ACTUATORS; ++i)
+		file << position[i] << " ";
+	file << "</position>\n</state>\n";
+	file << "<min_sleep_after_movement>" << minSleepAfterMovementMs << "</min_sleep_after_movement>\n";
+	return !file.fail();
+}
+
+void MiraoWavefrontState::Limit(const float* actuators, float* limited) const
+{
+	for (int i = 0; i < MIRAO_NB_ACTUATORS; ++i)
+	{
+		float a = valid[i] ? actuators[i] : position[i];
+		if (a < minCommand[i]) a = minCommand[i];
+		if (a > maxCommand[i]) a = maxCommand[i];
+		limited[i] = a;
+	}
+}
+
+
+MiraoProjector::MiraoProjector() :
+	nbModes_(0),
+	regularisation_(0),
+	nbSlopes_(0),
+	residual_(0),
+	saturated_(0)
+{
+	memset(control_, 0, sizeof(control_));
+	memset(hessian_, 0, sizeof(hessian_));
+	for (int i = 0; i < MIRAO_NB_ACTUATORS; ++i)
+	{
+		valid_[i] = 1;
+		solution_[i] = 0.0;
+		base_[i] = 0.0f;
+		min_[i] = -1.0f;
+		max_[i] = 1.0f;
+	}
+}
+
+bool MiraoProjector::Build(const MiraoCalibration& calib, int nbModes, double regularisation)
+{
+	if (nbModes < 1 || nbModes > MIRAO_MAX_ZERNIKES || calib.nbValidSubap == 0)
+		return false;
+
+	const int na = MIRAO_NB_ACTUATORS;
+	const int ns = calib.nbValidSubap;
+
+	// pupil centre and area-equivalent radius in subaperture units
+	double cx = 0, cy = 0;
+	for (int iy = 0; iy < calib.nbSubapY; ++iy)
+		for (int ix = 0; ix < calib.nbSubapX; ++ix)
+			if (calib.pupil[iy * calib.nbSubapX + ix])
+			{
+				cx += ix;
+				cy += iy;
+			}
+	cx /= ns;
+	cy /= ns;
+	const double radius = std::sqrt(ns / pi);
+	const double h = 0.5 / radius;
+	const double stepX_mm = calib.stepX_um / 1000.0;
+	const double stepY_mm = calib.stepY_um / 1000.0;
+
+	// normal equations of the interaction matrix, invalid actuators masked out
+	std::vector<double> A(na * na, 0.0);
+	for (int s = 0; s < 2 * ns; ++s)
+	{
+		const double* row = &calib.matrix[s * na];
+		for (int i = 0; i < na; ++i)
+		{
+			if (!calib.validActuator[i])
+				continue;
+			for (int k = 0; k <= i; ++k)
+				if (calib.validActuator[k])
+					A[i * na + k] += row[i] * row[k];
+		}
+	}
+	double trace = 0;
+	for (int i = 0; i < na; ++i)
+		trace += A[i * na + i];
+	const double lambda = regularisation * (trace > 0 ? trace / na : 1.0);
+	for (int i = 0; i < na; ++i)
+	{
+		A[i * na + i] += lambda;
+		for (int k = 0; k < i; ++k)
+			A[k * na + i] = A[i * na + k];
+	}
+	std::vector<double> H(A);
+	if (!MiraoCholeskyFactor(A, na))
+		return false;
+
+	// per mode: slopes of the Zernike over the pupil (um/mm = mrad), then least squares
+	memset(control_, 0, sizeof(control_));
+	std::vector<double> slopes(2 * ns);
+	std::vector<double> x(na);
+	for (int j = 1; j <= nbModes; ++j)
+	{
+		int n, m;
+		MiraoFringeToNM(j, n, m);
+		int s = 0;
+		for (int iy = 0; iy < calib.nbSubapY; ++iy)
+			for (int ix = 0; ix < calib.nbSubapX; ++ix)
+			{
+				if (!calib.pupil[iy * calib.nbSubapX + ix])
+					continue;
+				double px = (ix - cx) / radius;
+				double py = (iy - cy) / radius;
+				slopes[s] = (MiraoZernike(n, m, px + h, py) - MiraoZernike(n, m, px - h, py)) / stepX_mm;
+				slopes[ns + s] = (MiraoZernike(n, m, px, py + h) - MiraoZernike(n, m, px, py - h)) / stepY_mm;
+				++s;
+			}
+
+		for (int i = 0; i < na; ++i)
+		{
+			double b = 0;
+			if (calib.validActuator[i])
+				for (int r = 0; r < 2 * ns; ++r)
+					b += calib.matrix[r * na + i] * slopes[r];
+			x[i] = b;
+		}
+		MiraoCholeskySolve(A, na, x);
+		for (int i = 0; i < na; ++i)
+			control_[j][i] = calib.validActuator[i] ? (float)x[i] : 0.0f;
+	}
+
+	memcpy(hessian_, &H[0], sizeof(hessian_));
+	for (int i = 0; i < na; ++i)
+		valid_[i] = calib.validActuator[i] ? 1 : 0;
+	nbSlopes_ = 2 * ns;
+	nbModes_ = nbModes;
+	regularisation_ = regularisation;
+	return true;
+}
+
+bool MiraoProjector::LoadCache(const std::string& path, unsigned long long hash, MiraoCalibration& calib, int nbModes, double regularisation)
+{
+	std::ifstream in(path.c_str(), std::ios::in | std::ios::binary);
+	if (!in)
+		return false;
+
+	char magic[sizeof(cacheMagic)];
+	int version = 0;
+	unsigned long long cachedHash = 0;
+	int cachedModes = 0;
+	double cachedRegularisation = 0;
+	in.read(magic, sizeof(magic));
+	if (!MiraoReadValue(in, version) || !MiraoReadValue(in, cachedHash) || !MiraoReadValue(in, cachedModes) || !MiraoReadValue(in, cachedRegularisation))
+		return false;
+	if (memcmp(magic, cacheMagic, sizeof(magic)) != 0 || version != cacheVersion || cachedHash != hash ||
+		cachedModes != nbModes || cachedRegularisation != regularisation)
+		return false;
+
+	MiraoCalibration c;
+	if (!MiraoReadValue(in, c.nbSubapX) || !MiraoReadValue(in, c.nbSubapY) || !MiraoReadValue(in, c.stepX_um) || !MiraoReadValue(in, c.stepY_um) ||
+		!MiraoReadValue(in, c.nbActuators) || !MiraoReadValue(in, c.minCommand) || !MiraoReadValue(in, c.maxCommand) ||
+		!MiraoReadValue(in, c.sleepAfterApplyMs) || !MiraoReadValue(in, c.nbValidSubap))
+		return false;
+	if (c.nbActuators != MIRAO_NB_ACTUATORS || c.nbSubapX <= 0 || c.nbSubapY <= 0 || c.nbValidSubap <= 0 ||
+		c.nbValidSubap > c.nbSubapX * c.nbSubapY)
+		return false;
+	if (!ReadVector(in, c.validActuator, c.nbActuators) || !ReadVector(in, c.offsetCommands, c.nbActuators) ||
+		!ReadVector(in, c.pupil, c.nbSubapX * c.nbSubapY) || !ReadVector(in, c.matrix, 2 * c.nbValidSubap * c.nbActuators))
+		return false;
+
+	float control[MIRAO_MAX_ZERNIKES + 1][MIRAO_NB_ACTUATORS];
+	in.read((char*)control, sizeof(control));
+	double hessian[MIRAO_NB_ACTUATORS][MIRAO_NB_ACTUATORS];
+	in.read((char*)hessian, sizeof(hessian));
+	if (!in)
+		return false;
+
+	calib = c;
+	memcpy(control_, control, sizeof(control_));
+	memcpy(hessian_, hessian, sizeof(hessian_));
+	for (int i = 0; i < MIRAO_NB_ACTUATORS; ++i)
+		valid_[i] = c.validActuator[i] ? 1 : 0;
+	nbSlopes_ = 2 * c.nbValidSubap;
+	nbModes_ = nbModes;
+	regularisation_ = regularisation;
+	return true;
+}
+
+bool MiraoProjector::SaveCache(const std::string& path, unsigned long long hash, const MiraoCalibration& calib) const
+{
+	if (!IsReady())
+		return false;
+	std::ofstream out(path.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!out)
+		return false;
+
+	out.write(cacheMagic, sizeof(cacheMagic));
+	MiraoWriteValue(out, cacheVersion);
+	MiraoWriteValue(out, hash);
+	MiraoWriteValue(out, nbModes_);
+	MiraoWriteValue(out, regularisation_);
+
+	MiraoWriteValue(out, calib.nbSubapX);
+	MiraoWriteValue(out, calib.nbSubapY);
+	MiraoWriteValue(out, calib.stepX_um);
+	MiraoWriteValue(out, calib.stepY_um);
+	MiraoWriteValue(out, calib.nbActuators);
+	MiraoWriteValue(out, calib.minCommand);
+	MiraoWriteValue(out, calib.maxCommand);
+	MiraoWriteValue(out, calib.sleepAfterApplyMs);
+	MiraoWriteValue(out, calib.nbValidSubap);
+	WriteVector(out, calib.validActuator);
+	WriteVector(out, calib.offsetCommands);
+	WriteVector(out, calib.pupil);
+	WriteVector(out, calib.matrix);
+
+	out.write((const char*)control_, sizeof(control_));
+	out.write((const char*)hessian_, sizeof(hessian_));
+	return !out.fail();
+}
+
+void MiraoProjector::SetBase(const float* actuators)
+{
+	memcpy(base_, actuators, sizeof(base_));
+}
+
+void MiraoProjector::SetLimits(const float* minCommand, const float* maxCommand)
+{
+	memcpy(min_, minCommand, sizeof(min_));
+	memcpy(max_, maxCommand, sizeof(max_));
+}
+
+void MiraoProjector::ProjectDelta(const float* dzernikes, int nbModes, float* actuators) const
+{
+	if (nbModes > nbModes_)
+		nbModes = nbModes_;
+	for (int j = 1; j <= nbModes; ++j)
+	{
+		const float a = dzernikes[j];
+		if (a == 0.0f)
+			continue;
+		const float* column = control_[j];
+#ifdef MIRAO_USE_SSE
+		const __m128 va = _mm_set1_ps(a);
+		for (int i = 0; i < MIRAO_NB_ACTUATORS; i += 4)
+			_mm_storeu_ps(actuators + i, _mm_add_ps(_mm_loadu_ps(actuators + i), _mm_mul_ps(va, _mm_loadu_ps(column + i))));
+#else
+		for (int i = 0; i < MIRAO_NB_ACTUATORS; ++i)
+			actuators[i] += a * column[i];
+#endif
+	}
+}
+
+void MiraoProjector::Project(const float* zernikes, int nbModes, float* actuators)
+{
+	memcpy(actuators, base_, sizeof(base_));
+	ProjectDelta(zernikes, nbModes, actuators);
+	residual_ = 0;
+	saturated_ = 0;
+	for (int i = 0; i < MIRAO_NB_ACTUATORS; ++i)
+	{
+		if (actuators[i] < min_[i] || actuators[i] > max_[i])
+		{
+			Constrain(actuators);
+			return;
+		}
+	}
+}
+
+// Primal active-set solution of min (x - r)' H (x - r) subject to min <= x <= max,
+// with r the unconstrained request. Every step solves for the free actuators with
+// the others held at their limit, then either stops at the first limit in the way
+// or frees the held actuator whose multiplier has the wrong sign.
+void MiraoProjector::Constrain(float* actuators)
+{
+	const int na = MIRAO_NB_ACTUATORS;
+	double r[MIRAO_NB_ACTUATORS];
+	double x[MIRAO_NB_ACTUATORS];
+	double g[MIRAO_NB_ACTUATORS];
+	int bound[MIRAO_NB_ACTUATORS];		// -1 held at min, 1 held at max, 0 free
+	int freeset[MIRAO_NB_ACTUATORS];
+	for (int i = 0; i < na; ++i)
+	{
+		r[i] = actuators[i];
+		x[i] = valid_[i] ? solution_[i] : r[i];
+		bound[i] = 0;
+		if (x[i] <= min_[i])
+		{
+			x[i] = min_[i];
+			bound[i] = valid_[i] ? -1 : 0;
+		}
+		else if (x[i] >= max_[i])
+		{
+			x[i] = max_[i];
+			bound[i] = valid_[i] ? 1 : 0;
+		}
+	}
+
+	std::vector<double> L(na * na);
+	std::vector<double> y(na);
+	for (int iteration = 0; iteration < 4 * na; ++iteration)
+	{
+		int nf = 0;
+		for (int i = 0; i < na; ++i)
+			if (valid_[i] && bound[i] == 0)
+				freeset[nf++] = i;
+
+		// free actuators at the minimum with the held ones fixed
+		bool blocked = false;
+		if (nf > 0)
+		{
+			for (int a = 0; a < nf; ++a)
+			{
+				const int i = freeset[a];
+				double s = 0;
+				for (int k = 0; k < na; ++k)
+					if (!valid_[k] || bound[k] != 0)
+						s -= hessian_[i][k] * (x[k] - r[k]);
+				y[a] = s;
+				for (int b = 0; b < nf; ++b)
+					L[a * nf + b] = hessian_[i][freeset[b]];
+			}
+			if (!MiraoCholeskyFactor(L, nf))
+				break;
+			MiraoCholeskySolve(L, nf, y);
+
+			// move towards it, up to the first limit in the way
+			double alpha = 1.0;
+			int blocking = -1;
+			for (int a = 0; a < nf; ++a)
+			{
+				const int i = freeset[a];
+				const double p = r[i] + y[a];
+				double t = 1.0;
+				if (p < min_[i])
+					t = (min_[i] - x[i]) / (p - x[i]);
+				else if (p > max_[i])
+					t = (max_[i] - x[i]) / (p - x[i]);
+				if (t < alpha)
+				{
+					alpha = t;
+					blocking = a;
+				}
+			}
+			for (int a = 0; a < nf; ++a)
+			{
+				const int i = freeset[a];
+				x[i] += alpha * (r[i] + y[a] - x[i]);
+			}
+			if (blocking >= 0)
+			{
+				const int i = freeset[blocking];
+				bound[i] = r[i] + y[blocking] < min_[i] ? -1 : 1;
+				x[i] = bound[i] < 0 ? min_[i] : max_[i];
+				blocked = true;
+			}
+		}
+		if (blocked)
+			continue;
+
+		// optimal for this set of held actuators; free the one pulling hardest inwards
+		int release = -1;
+		double worst = 0;
+		for (int i = 0; i < na; ++i)
+		{
+			if (!valid_[i] || bound[i] == 0)
+				continue;
+			double gi = 0;
+			for (int k = 0; k < na; ++k)
+				gi += hessian_[i][k] * (x[k] - r[k]);
+			const double pull = bound[i] < 0 ? -gi : gi;
+			if (pull > worst)
+			{
+				worst = pull;
+				release = i;
+			}
+		}
+		if (release < 0)
+			break;
+		bound[release] = 0;
+	}
+
+	double cost = 0;
+	for (int i = 0; i < na; ++i)
+	{
+		g[i] = 0;
+		for (int k = 0; k < na; ++k)
+			g[i] += hessian_[i][k] * (x[k] - r[k]);
+		cost += (x[i] - r[i]) * g[i];
+		if (valid_[i])
+		{
+			solution_[i] = x[i];
+			if (x[i] <= min_[i] || x[i] >= max_[i])
+				++saturated_;
+		}
+		actuators[i] = (float)x[i];
+	}
+	residual_ = nbSlopes_ > 0 && cost > 0 ? std::sqrt(cost / nbSlopes_) : 0.0;
+}
+
+void MiraoProjector::Headroom(const float* actuators, int nbModes, float* up, float* down) const
+{
+	if (nbModes > nbModes_)
+		nbModes = nbModes_;
+	for (int j = 1; j <= nbModes; ++j)
+	{
+		const float* column = control_[j];
+		float u = FLT_MAX;
+		float d = FLT_MAX;
+		for (int i = 0; i < MIRAO_NB_ACTUATORS; ++i)
+		{
+			if (!valid_[i] || column[i] == 0.0f)
+				continue;
+			const float above = (max_[i] - actuators[i]) / column[i];
+			const float below = (min_[i] - actuators[i]) / column[i];
+			if (column[i] > 0.0f)
+			{
+				if (above < u) u = above;
+				if (-below < d) d = -below;
+			}
+			else
+			{
+				if (below < u) u = below;
+				if (-above < d) d = -above;
+			}
+		}
+		up[j] = u > 0.0f ? u : 0.0f;
+		down[j] = d > 0.0f ? d : 0.0f;
+	}
+}
+
+bool MiraoSlopeReconstructor(const MiraoCalibration& calib, const MiraoProjector& projector, int nbModes,
+	double regularisation, std::vector<float>& matrix)
+{
+	const int na = MIRAO_NB_ACTUATORS;
+	const int nbSlopes = 2 * calib.nbValidSubap;
+
+	// Slopes of every mode as the mirror makes it
+	std::vector<double> G((size_t)nbSlopes * nbModes);
+	for (int r = 0; r < nbSlopes; ++r)
+	{
+		const double* row = &calib.matrix[(size_t)r * na];
+		for (int j = 0; j < nbModes; ++j)
+		{
+			const float* column = projector.GetColumn(j + 1);
+			double s = 0;
+			for (int i = 0; i < na; ++i)
+				s += row[i] * column[i];
+			G[(size_t)r * nbModes + j] = s;
+		}
+	}
+
+	// Normal matrix, regularised as the projector's
+	const int n = nbModes;
+	std::vector<double> A(n * n, 0.0);
+	for (int r = 0; r < nbSlopes; ++r)
+	{
+		const double* g = &G[(size_t)r * n];
+		for (int j = 0; j < n; ++j)
+			for (int k = 0; k <= j; ++k)
+				A[j * n + k] += g[j] * g[k];
+	}
+	double trace = 0;
+	for (int j = 0; j < n; ++j)
+		trace += A[j * n + j];
+	const double lambda = regularisation * (trace > 0 ? trace / n : 1.0);
+	for (int j = 0; j < n; ++j)
+	{
+		A[j * n + j] += lambda;
+		for (int k = 0; k < j; ++k)
+			A[k * n + j] = A[j * n + k];
+	}
+	if (!MiraoCholeskyFactor(A, n))
+		return false;
+
+	// Column r of the reconstructor is the normal matrix solved for row r of G
+	matrix.assign((size_t)n * nbSlopes, 0.0f);
+	std::vector<double> x(n);
+	for (int r = 0; r < nbSlopes; ++r)
+	{
+		for (int j = 0; j < n; ++j)
+			x[j] = G[(size_t)r * n + j];
+		MiraoCholeskySolve(A, n, x);
+		for (int j = 0; j < n; ++j)
+			matrix[(size_t)j * nbSlopes + r] = (float)x[j];
+	}
+	return true;
+}
@@ -0,0 +1,185 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          MiraoProjector.h
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     DeviceAdapters
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Native Zernike-to-actuator projection for the MIRAO-52E,
+//                built from the interaction matrix in the .aomi calibration
+//
+// AUTHOR:        Marijn Siemons
+
+#pragma once
+
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#define MIRAO_NB_ACTUATORS		52
+#define MIRAO_MAX_ZERNIKES		45
+
+// Zernike modes are numbered as in the SDK: Fringe ordering without piston,
+// so index 1 is tip (Z11), 3 is defocus (Z20), 8 is primary spherical (Z40).
+void MiraoFringeToNM(int index, int& n, int& m);
+
+// RMS normalised Zernike polynomial on the unit disk.
+double MiraoZernike(int n, int m, double x, double y);
+
+// Largest difference between two actuator vectors in DAC steps of the given
+// size, after rounding each command to the nearest step.
+int MiraoCommandSteps(const float* a, const float* b, double resolution);
+
+// 64-bit FNV-1a hash of the content of a file, 0 if it cannot be read.
+unsigned long long MiraoFileHash(const std::string& path);
+
+// Reads a whole file; false if it cannot be opened.
+bool MiraoReadFile(const std::string& path, std::string& content);
+
+// Text between <tag...> and </tag> in the SDK's XML files, searching from pos,
+// which is moved past the closing tag. Returns false if absent.
+bool MiraoTagText(const std::string& xml, const std::string& tag, std::string& text, size_t& pos);
+
+// Binary file fields in host byte order, for the adapter's own cache and data
+// files, which are only read back on the machine that wrote them
+template <class T>
+void MiraoWriteValue(std::ostream& out, const T& value)
+{
+	out.write((const char*)&value, sizeof(T));
+}
+
+template <class T>
+bool MiraoReadValue(std::istream& in, T& value)
+{
+	in.read((char*)&value, sizeof(T));
+	return !in.fail();
+}
+
+// Cholesky factorisation A = L L^T of a symmetric positive definite A (n x n,
+// row-major), in place in the lower triangle; false if A is not positive
+// definite. MiraoCholeskySolve() then solves A x = b with x holding b.
+bool MiraoCholeskyFactor(std::vector<double>& A, int n);
+void MiraoCholeskySolve(const std::vector<double>& L, int n, std::vector<double>& x);
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Interaction matrix and mirror preferences parsed from a .aomi file
+//
+class MiraoCalibration
+{
+public:
+	MiraoCalibration();
+
+	bool Load(const std::string& path);
+
+	int nbSubapX;
+	int nbSubapY;
+	double stepX_um;
+	double stepY_um;
+	int nbActuators;
+	float minCommand;
+	float maxCommand;
+	double sleepAfterApplyMs;
+	std::vector<int> validActuator;
+	std::vector<float> offsetCommands;
+	std::vector<unsigned char> pupil;	// nbSubapY lines of nbSubapX
+	std::vector<double> matrix;			// 2 * nbValidSubap slopes (x then y) by nbActuators
+	int nbValidSubap;
+};
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Actuator state parsed from a .wcs wavefront correction file
+//
+class MiraoWavefrontState
+{
+public:
+	MiraoWavefrontState();
+
+	bool Load(const std::string& path);
+	// Writes the state in .wcs format, so the SDK can apply it as absolute commands
+	bool Save(const std::string& path) const;
+	// Clamps actuator commands to the min/max range; invalid actuators keep their position
+	void Limit(const float* actuators, float* limited) const;
+
+	int valid[MIRAO_NB_ACTUATORS];
+	float minCommand[MIRAO_NB_ACTUATORS];
+	float maxCommand[MIRAO_NB_ACTUATORS];
+	float position[MIRAO_NB_ACTUATORS];
+	double minSleepAfterMovementMs;
+};
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Zernike-to-actuator control matrix and matrix-vector kernel.
+// The control matrix is stored one mode per column of 52 contiguous floats,
+// so a projection is a sequence of 13 four-wide multiply-adds per mode and
+// never allocates.
+// Requests that do not fit the actuator limits are solved as a box-constrained
+// least-squares problem on the slopes (interaction matrix normal equations),
+// instead of clipping each actuator on its own.
+//
+class MiraoProjector
+{
+public:
+	MiraoProjector();
+
+	// Computes the control matrix only; base and limits are set separately
+	bool Build(const MiraoCalibration& calib, int nbModes, double regularisation = 1e-3);
+	bool IsReady() const { return nbModes_ > 0; }
+
+	// Binary cache of the parsed calibration and the control matrix, keyed on
+	// the hash of the .aomi file and the build parameters. LoadCache() fails on
+	// any mismatch, after which the caller parses and builds again.
+	bool LoadCache(const std::string& path, unsigned long long hash, MiraoCalibration& calib, int nbModes, double regularisation = 1e-3);
+	bool SaveCache(const std::string& path, unsigned long long hash, const MiraoCalibration& calib) const;
+	int GetNbModes() const { return nbModes_; }
+
+	void SetBase(const float* actuators);
+	void SetLimits(const float* minCommand, const float* maxCommand);
+
+	// actuators = base + C * zernikes if within the limits, otherwise the actuator
+	// vector within the limits whose slopes fit those of the request best.
+	// zernikes[0] is ignored (piston). The constrained solve starts from the
+	// previous constrained solution.
+	void Project(const float* zernikes, int nbModes, float* actuators);
+	// actuators += C * dzernikes, without clamping
+	void ProjectDelta(const float* dzernikes, int nbModes, float* actuators) const;
+
+	// Largest amplitude each mode can still move up and down from the given
+	// actuator vector before an actuator reaches its limit
+	void Headroom(const float* actuators, int nbModes, float* up, float* down) const;
+
+	// Of the last Project(): RMS slope error [mrad] left by the limits and
+	// the number of actuators at a limit, both 0 if the request was in range
+	double GetResidual() const { return residual_; }
+	int GetSaturated() const { return saturated_; }
+
+	const float* GetColumn(int mode) const { return control_[mode]; }
+	const float* GetBase() const { return base_; }
+	const float* GetMin() const { return min_; }
+	const float* GetMax() const { return max_; }
+
+private:
+	void Constrain(float* actuators);
+
+	int nbModes_;
+	double regularisation_;
+	float control_[MIRAO_MAX_ZERNIKES + 1][MIRAO_NB_ACTUATORS];
+	double hessian_[MIRAO_NB_ACTUATORS][MIRAO_NB_ACTUATORS];	// regularised normal matrix
+	unsigned char valid_[MIRAO_NB_ACTUATORS];
+	int nbSlopes_;
+	double solution_[MIRAO_NB_ACTUATORS];
+	double residual_;
+	int saturated_;
+	float base_[MIRAO_NB_ACTUATORS];
+	float min_[MIRAO_NB_ACTUATORS];
+	float max_[MIRAO_NB_ACTUATORS];
+};
+
+// Modal reconstructor of the Shack-Hartmann slopes: (G^T G + lambda I)^-1 G^T,
+// with G = D C the slopes of the first nbModes modes as the mirror makes them
+// and lambda the regularisation relative to the mean diagonal. The matrix has
+// one row of 2 * nbValidSubap slopes per mode from tip; false if the normal
+// matrix is singular.
+bool MiraoSlopeReconstructor(const MiraoCalibration& calib, const MiraoProjector& projector, int nbModes,
+	double regularisation, std::vector<float>& matrix);
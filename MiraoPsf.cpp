@@ -0,0 +1,404 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          MiraoPsf.cpp
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     DeviceAdapters
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Simulated imaging path for the MIRAO-52E: camera frames of
+//                point emitters, aberrated by a sample and the mirror shape
+//
+// AUTHOR:        Marijn Siemons
+
+#include "MiraoPsf.h"
+#include <cmath>
+#include <cstring>
+
+const char* g_miraoPsfSamples[MIRAO_NB_PSF_SAMPLES] = {
+	"Single bead",
+	"Beads",
+	"Blinking emitters"
+};
+
+namespace {
+
+// SplitMix64: small, fast and seedable per row, so the noise of a frame does
+// not depend on how its rows are spread over the threads
+class Random
+{
+public:
+	Random(unsigned long long seed) : state_(seed), spare_(0), hasSpare_(false) {}
+
+	unsigned long long Next()
+	{
+		unsigned long long z = (state_ += 0x9E3779B97F4A7C15ULL);
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+		return z ^ (z >> 31);
+	}
+
+	// Uniform in (0, 1]
+	double Uniform()
+	{
+		return ((Next() >> 11) + 1) * (1.0 / 9007199254740992.0);
+	}
+
+	// Marsaglia's polar method, both values used
+	double Gauss()
+	{
+		if (hasSpare_)
+		{
+			hasSpare_ = false;
+			return spare_;
+		}
+		double u, v, r;
+		do
+		{
+			u = 2.0 * Uniform() - 1.0;
+			v = 2.0 * Uniform() - 1.0;
+			r = u * u + v * v;
+		}
+		while (r >= 1.0 || r == 0.0);
+		const double f = std::sqrt(-2.0 * std::log(r) / r);
+		spare_ = v * f;
+		hasSpare_ = true;
+		return u * f;
+	}
+
+	// Inversion of the distribution function for small means, one uniform
+	// per value; normal approximation from 30 on
+	double Poisson(double mean)
+	{
+		if (mean <= 0)
+			return 0;
+		if (mean < 30)
+		{
+			double p = std::exp(-mean);
+			double cumulative = p;
+			const double u = Uniform();
+			int k = 0;
+			while (u > cumulative && k < 200)
+			{
+				++k;
+				p *= mean / k;
+				cumulative += p;
+			}
+			return k;
+		}
+		const double k = std::floor(mean + std::sqrt(mean) * Gauss() + 0.5);
+		return k > 0 ? k : 0;
+	}
+
+private:
+	unsigned long long state_;
+	double spare_;
+	bool hasSpare_;
+};
+
+unsigned long long Seed(unsigned long seed, unsigned long frame, int row)
+{
+	return ((unsigned long long)seed << 40) ^ ((unsigned long long)frame << 20) ^ (unsigned long long)row;
+}
+
+} // namespace
+
+
+MiraoPsfSimulator::MiraoPsfSimulator() :
+	n_(0),
+	nbModes_(0),
+	plan_(0),
+	pupilRowBegin_(0),
+	pupilRowEnd_(0),
+	centreX_(0),
+	centreY_(0),
+	windowLeft_(0),
+	windowRight_(0),
+	windowTop_(0),
+	windowBottom_(0),
+	sensorWidth_(0),
+	sensorHeight_(0),
+	frame_(0),
+	x_(0),
+	y_(0),
+	width_(0),
+	height_(0),
+	pixels_(0)
+{
+	memset(aberration_, 0, sizeof(aberration_));
+	memset(reference_, 0, sizeof(reference_));
+}
+
+MiraoPsfSimulator::~MiraoPsfSimulator()
+{
+	Stop();
+}
+
+bool MiraoPsfSimulator::Configure(const MiraoDiversitySettings& settings, const MiraoCalibration& calib, const MiraoProjector& projector)
+{
+	if (!projector.IsReady() || calib.nbValidSubap == 0)
+		return false;
+	settings_ = settings;
+	n_ = settings.supportSize;
+	plan_ = &MiraoFftPlan::Get(n_);
+	nbModes_ = projector.GetNbModes();
+
+	// Pupil in the centre of the support, as for the phase retrieval
+	settings.Pupil(pupil_, pupilRowBegin_, pupilRowEnd_);
+	const int size = (int)pupil_.size();
+
+	// Every mode, so the sample aberration is not limited to those of the mirror
+	modes_.assign((size_t)MIRAO_MAX_ZERNIKES * size, 0.0);
+	for (int s = 0; s < size; ++s)
+		for (int j = 1; j <= MIRAO_MAX_ZERNIKES; ++j)
+			modes_[(size_t)(j - 1) * size + s] = settings.PupilMode(j, pupil_[s]);
+
+	// Mirror Zernikes per actuator: the slope reconstructor, unregularised,
+	// applied to the interaction matrix D
+	const int na = MIRAO_NB_ACTUATORS;
+	const int nr = 2 * calib.nbValidSubap;
+	const int nm = nbModes_;
+	std::vector<float> slopes;
+	if (!MiraoSlopeReconstructor(calib, projector, nm, 0.0, slopes))
+		return false;
+	reconstructor_.assign((size_t)nm * na, 0.0f);
+	for (int j = 0; j < nm; ++j)
+		for (int i = 0; i < na; ++i)
+		{
+			if (!calib.validActuator[i])
+				continue;
+			double s = 0;
+			for (int r = 0; r < nr; ++r)
+				s += slopes[(size_t)j * nr + r] * calib.matrix[(size_t)r * na + i];
+			reconstructor_[(size_t)j * na + i] = (float)s;
+		}
+
+	// The optical axis in camera orientation: flipped, then transposed
+	const int centre = n_ / 2;
+	centreX_ = settings.flipX ? n_ - 1 - centre : centre;
+	centreY_ = settings.flipY ? n_ - 1 - centre : centre;
+	if (settings.transpose)
+	{
+		const int t = centreX_;
+		centreX_ = centreY_;
+		centreY_ = t;
+	}
+
+	field_.assign((size_t)2 * n_ * n_, 0.0);
+	psf_.assign((size_t)n_ * n_, 0.0);
+	return true;
+}
+
+void MiraoPsfSimulator::SetSample(const MiraoPsfSample& sample, int width, int height)
+{
+	sample_ = sample;
+	sensorWidth_ = width;
+	sensorHeight_ = height;
+	emitters_.clear();
+	if (sample.type == MIRAO_PSF_SINGLE)
+	{
+		Emitter emitter;
+		emitter.x = width / 2;
+		emitter.y = height / 2;
+		emitters_.push_back(emitter);
+	}
+	else
+	{
+		Random random(Seed(sample.seed, 0, -1));
+		for (int e = 0; e < sample.nbEmitters; ++e)
+		{
+			Emitter emitter;
+			emitter.x = (int)(random.Uniform() * width);
+			emitter.y = (int)(random.Uniform() * height);
+			emitters_.push_back(emitter);
+		}
+	}
+	on_.assign(emitters_.size(), 1);
+	frame_ = 0;
+
+	// Distribution function of the background, for the pixels without emitters
+	backgroundCdf_.clear();
+	if (sample.background > 0 && sample.background < 30)
+	{
+		double p = std::exp(-sample.background);
+		double cumulative = p;
+		backgroundCdf_.push_back(cumulative);
+		for (int k = 1; cumulative < 1.0 - 1e-12 && k < 200; ++k)
+		{
+			p *= sample.background / k;
+			cumulative += p;
+			backgroundCdf_.push_back(cumulative);
+		}
+	}
+}
+
+void MiraoPsfSimulator::SetAberration(const float* zernikes)
+{
+	memcpy(aberration_, zernikes, sizeof(aberration_));
+	aberration_[0] = 0;
+}
+
+void MiraoPsfSimulator::SetReference(const float* actuators)
+{
+	memcpy(reference_, actuators, sizeof(reference_));
+}
+
+void MiraoPsfSimulator::Start(int nbThreads)
+{
+	pool_.Start(nbThreads);
+}
+
+void MiraoPsfSimulator::Stop()
+{
+	pool_.Stop();
+}
+
+void MiraoPsfSimulator::MirrorZernikes(const float* actuators, float* zernikes) const
+{
+	memset(zernikes, 0, (MIRAO_MAX_ZERNIKES + 1) * sizeof(float));
+	for (int j = 0; j < nbModes_; ++j)
+	{
+		const float* row = &reconstructor_[(size_t)j * MIRAO_NB_ACTUATORS];
+		double s = 0;
+		for (int i = 0; i < MIRAO_NB_ACTUATORS; ++i)
+			s += row[i] * (actuators[i] - reference_[i]);
+		zernikes[j + 1] = (float)s;
+	}
+}
+
+void MiraoPsfSimulator::Render(const float* actuators, int x, int y, int width, int height, unsigned short* pixels)
+{
+	float zernikes[MIRAO_MAX_ZERNIKES + 1];
+	if (actuators != 0)
+		MirrorZernikes(actuators, zernikes);
+	else
+		memset(zernikes, 0, sizeof(zernikes));
+	for (int j = 1; j <= MIRAO_MAX_ZERNIKES; ++j)
+		zernikes[j] += aberration_[j];
+	Psf(zernikes);
+
+	++frame_;
+	if (sample_.type == MIRAO_PSF_BLINKING)
+	{
+		Random random(Seed(sample_.seed, frame_, -1));
+		for (size_t e = 0; e < emitters_.size(); ++e)
+			on_[e] = random.Uniform() <= sample_.dutyCycle;
+	}
+
+	x_ = x;
+	y_ = y;
+	width_ = width;
+	height_ = height;
+	pixels_ = pixels;
+	pool_.Run(this, &MiraoPsfSimulator::RenderStripes);
+}
+
+// Intensity of the pupil field with the given aberration, in camera orientation
+void MiraoPsfSimulator::Psf(const float* zernikes)
+{
+	const int size = (int)pupil_.size();
+	double* field = &field_[0];
+	memset(field, 0, field_.size() * sizeof(double));
+	for (int s = 0; s < size; ++s)
+	{
+		double a = 0;
+		for (int j = 1; j <= MIRAO_MAX_ZERNIKES; ++j)
+			if (zernikes[j] != 0)
+				a += zernikes[j] * modes_[(size_t)(j - 1) * size + s];
+		field[2 * pupil_[s]] = std::cos(a);
+		field[2 * pupil_[s] + 1] = std::sin(a);
+	}
+	// Rows outside the pupil are zero and stay zero
+	for (int y = pupilRowBegin_; y < pupilRowEnd_; ++y)
+		plan_->Transform(field + 2 * (size_t)y * n_, 1);
+	for (int x = 0; x < n_; ++x)
+		plan_->Transform(field + 2 * x, n_);
+
+	// Centre moved from pixel 0 to n/2, then to camera orientation as the
+	// inverse of the crop of the phase retrieval
+	const double total = (double)n_ * n_ * size;
+	for (int v = 0; v < n_; ++v)
+		for (int u = 0; u < n_; ++u)
+		{
+			const size_t i = ((size_t)((v + n_ / 2) % n_) * n_ + (u + n_ / 2) % n_);
+			int a = settings_.flipX ? n_ - 1 - u : u;
+			int b = settings_.flipY ? n_ - 1 - v : v;
+			if (settings_.transpose)
+			{
+				const int t = a;
+				a = b;
+				b = t;
+			}
+			psf_[(size_t)b * n_ + a] = (field[2 * i] * field[2 * i] + field[2 * i + 1] * field[2 * i + 1]) / total;
+		}
+
+	// Emitters are only drawn where the PSF is above a millionth of its peak
+	double peak = 0;
+	for (size_t i = 0; i < psf_.size(); ++i)
+		if (psf_[i] > peak)
+			peak = psf_[i];
+	windowLeft_ = windowTop_ = n_;
+	windowRight_ = windowBottom_ = 0;
+	for (int b = 0; b < n_; ++b)
+		for (int a = 0; a < n_; ++a)
+			if (psf_[(size_t)b * n_ + a] >= 1e-6 * peak)
+			{
+				if (a < windowLeft_)
+					windowLeft_ = a;
+				if (a >= windowRight_)
+					windowRight_ = a + 1;
+				if (b < windowTop_)
+					windowTop_ = b;
+				if (b >= windowBottom_)
+					windowBottom_ = b + 1;
+			}
+}
+
+void MiraoPsfSimulator::RenderStripes(int first, int step)
+{
+	for (int row = first * MIRAO_PSF_ROWS; row < height_; row += step * MIRAO_PSF_ROWS)
+		RenderRows(row, row + MIRAO_PSF_ROWS < height_ ? row + MIRAO_PSF_ROWS : height_);
+}
+
+void MiraoPsfSimulator::RenderRows(int rowBegin, int rowEnd)
+{
+	std::vector<double> expected(width_);
+	for (int r = rowBegin; r < rowEnd; ++r)
+	{
+		const int y = y_ + r;
+		expected.assign(width_, sample_.background);
+		for (size_t e = 0; e < emitters_.size(); ++e)
+		{
+			if (!on_[e])
+				continue;
+			const int v = y - (emitters_[e].y - centreY_);
+			if (v < windowTop_ || v >= windowBottom_)
+				continue;
+			const int left = emitters_[e].x - centreX_;
+			const int begin = left + windowLeft_ > x_ ? left + windowLeft_ : x_;
+			const int end = left + windowRight_ < x_ + width_ ? left + windowRight_ : x_ + width_;
+			const double* psf = &psf_[(size_t)v * n_];
+			for (int x = begin; x < end; ++x)
+				expected[x - x_] += sample_.photons * psf[x - left];
+		}
+
+		Random random(Seed(sample_.seed, frame_, y));
+		unsigned short* pixels = pixels_ + (size_t)r * width_;
+		for (int x = 0; x < width_; ++x)
+		{
+			double photons;
+			if (expected[x] == sample_.background && !backgroundCdf_.empty())
+			{
+				const double u = random.Uniform();
+				size_t k = 0;
+				while (k + 1 < backgroundCdf_.size() && u > backgroundCdf_[k])
+					++k;
+				photons = (double)k;
+			}
+			else
+				photons = random.Poisson(expected[x]);
+			double value = sample_.offset + photons;
+			if (sample_.readNoise > 0)
+				value += sample_.readNoise * random.Gauss();
+			value = std::floor(value + 0.5);
+			pixels[x] = (unsigned short)(value < 0 ? 0 : (value > 65535 ? 65535 : value));
+		}
+	}
+}
@@ -0,0 +1,144 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          MiraoPsf.h
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     DeviceAdapters
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Simulated imaging path for the MIRAO-52E: camera frames of
+//                point emitters, aberrated by a sample and the mirror shape
+//
+// AUTHOR:        Marijn Siemons
+
+#pragma once
+
+#include <vector>
+#include "MiraoDiversity.h"
+#include "MiraoMetric.h"
+#include "MiraoProjector.h"
+#include "MiraoSync.h"
+
+#define MIRAO_PSF_SINGLE		0	// one emitter in the centre of the sensor
+#define MIRAO_PSF_BEADS			1	// emitters at fixed positions, always on
+#define MIRAO_PSF_BLINKING		2	// emitters at fixed positions, each on in a fraction of the frames
+#define MIRAO_NB_PSF_SAMPLES	3
+
+// Frames are split over the render threads in stripes of this many rows
+#define MIRAO_PSF_ROWS			32
+
+// Property values of the samples, indexed as above
+extern const char* g_miraoPsfSamples[MIRAO_NB_PSF_SAMPLES];
+
+// Sample and sensor of the simulated camera
+struct MiraoPsfSample
+{
+	MiraoPsfSample() :
+		type(MIRAO_PSF_SINGLE),
+		nbEmitters(100),
+		dutyCycle(0.05),
+		photons(5000),
+		background(10),
+		readNoise(1.5),
+		offset(100),
+		seed(1)
+	{
+	}
+
+	int type;
+	int nbEmitters;			// beads and blinking only
+	double dutyCycle;		// blinking only: chance that an emitter is on in a frame
+	double photons;			// per emitter per frame
+	double background;		// photons per pixel per frame
+	double readNoise;		// RMS [counts]
+	double offset;			// [counts], one count per photon
+	unsigned long seed;		// emitter positions and noise
+};
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Renders camera frames through the pupil of the phase diversity calibration
+// (Diversity_calibration.xml): wavelength, pupil and Zernike radius, FFT
+// support and orientation. One camera pixel is one pixel of the FFT image
+// plane, as in MiraoPhaseRetrieval, so the native phase diversity can be run
+// on the simulated frames.
+// The aberration is the sample aberration plus the mirror's, which follows
+// from the actuator vector by a least-squares fit of the slopes it causes
+// (interaction matrix) to those of the Zernike modes (interaction matrix
+// times control matrix). The PSF is computed once per frame with the shared
+// FFT plan; the emitters, background and noise are rendered in stripes on
+// separate threads. Frames are reproducible for a given seed.
+//
+class MiraoPsfSimulator
+{
+public:
+	MiraoPsfSimulator();
+	~MiraoPsfSimulator();
+
+	// Builds the pupil, the Zernike maps and the mirror reconstructor; false
+	// if the settings cannot be used or the projector is not built
+	bool Configure(const MiraoDiversitySettings& settings, const MiraoCalibration& calib, const MiraoProjector& projector);
+	int GetNbModes() const { return nbModes_; }
+
+	// Places the emitters on a width by height sensor
+	void SetSample(const MiraoPsfSample& sample, int width, int height);
+	// Sample aberration [um] in zernikes[1..MIRAO_MAX_ZERNIKES]
+	void SetAberration(const float* zernikes);
+	// Actuator vector of a flat mirror, as the wavefront correction that
+	// cancels the system aberration; 0 by default
+	void SetReference(const float* actuators);
+
+	void Start(int nbThreads);
+	void Stop();
+
+	// Renders the region of the sensor at x, y into pixels, width by height
+	// row by row. actuators is the mirror shape, 0 for a flat mirror.
+	void Render(const float* actuators, int x, int y, int width, int height, unsigned short* pixels);
+	// Mirror aberration [um] of an actuator vector, zernikes[0] is 0
+	void MirrorZernikes(const float* actuators, float* zernikes) const;
+
+private:
+	struct Emitter
+	{
+		int x;
+		int y;
+	};
+
+	void Psf(const float* zernikes);
+	void RenderStripes(int first, int step);
+	void RenderRows(int rowBegin, int rowEnd);
+
+	MiraoDiversitySettings settings_;
+	int n_;
+	int nbModes_;
+	const MiraoFftPlan* plan_;
+	int pupilRowBegin_;
+	int pupilRowEnd_;
+	std::vector<int> pupil_;				// pixel indices inside the pupil
+	std::vector<double> modes_;				// Zernike modes [rad/um], one pupil map per mode
+	std::vector<float> reconstructor_;		// mirror Zernikes per actuator, one row of 52 per mode
+	std::vector<double> field_;
+	std::vector<double> psf_;				// n by n in camera orientation, unit sum
+	int centreX_;							// pixel of psf_ on the optical axis
+	int centreY_;
+	int windowLeft_;						// part of psf_ that is drawn
+	int windowRight_;
+	int windowTop_;
+	int windowBottom_;
+	float aberration_[MIRAO_MAX_ZERNIKES + 1];
+	float reference_[MIRAO_NB_ACTUATORS];
+
+	MiraoPsfSample sample_;
+	int sensorWidth_;
+	int sensorHeight_;
+	std::vector<Emitter> emitters_;
+	std::vector<unsigned char> on_;			// emitters on in this frame
+	std::vector<double> backgroundCdf_;		// Poisson distribution function of the background
+	unsigned long frame_;
+
+	// Region of the frame being rendered
+	int x_;
+	int y_;
+	int width_;
+	int height_;
+	unsigned short* pixels_;
+
+	MiraoForkJoinPool<MiraoPsfSimulator> pool_;
+};
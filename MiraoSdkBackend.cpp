@@ -0,0 +1,124 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          MiraoSdkBackend.cpp
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     DeviceAdapters
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   MIRAO-52E backend on the Imagine Optic SDK
+//
+// AUTHOR:        Marijn Siemons
+
+#include "MiraoSdkBackend.h"
+
+#ifdef MIRAO_HAVE_SDK
+
+#include <cstring>
+#include "MiraoDiversity.h"
+#include "MiraoModes.h"
+#include "MiraoProjector.h"
+
+namespace {
+
+const char* commandsPath = "MIRAO/ActuatorCommands.wcs";
+const char* readbackPath = "MIRAO/ActuatorReadback.wcs";
+
+} // namespace
+
+
+bool MiraoSdkBackend::Mirror::Open(const std::string& initpath)
+{
+	delete handle;
+	handle = new imop::microscopy::Mirror(initpath);
+	handle->init_hardware();
+	return true;
+}
+
+
+MiraoSdkBackend::MiraoSdkBackend(Mirror& mirror) :
+	mirror_(mirror),
+	diversity_(0),
+	calibparams_(0),
+	divprefs_(0)
+{
+	// Relative updates only set the modes in use; the rest stay 0
+	for (int j = 1; j <= MIRAO_SDK_ZERNIKES; j++)
+		zernikes_.zernike_coefficients[j] = 0;
+}
+
+MiraoSdkBackend::~MiraoSdkBackend()
+{
+	delete diversity_;
+	delete calibparams_;
+	delete divprefs_;
+}
+
+bool MiraoSdkBackend::LoadCalibration(const std::string& path)
+{
+	if (mirror_.handle == 0)
+		return false;
+	diversity_ = new imop::microscopy::Diversity(path, *mirror_.handle);
+	return true;
+}
+
+bool MiraoSdkBackend::LoadCalibrationParams(const std::string& path)
+{
+	MiraoDiversitySettings settings;
+	if (!settings.LoadCalibrationParams(path))
+		return false;
+	calibparams_ = new imop::microscopy::CalibrationParams;
+	calibparams_->Load(path);
+	return true;
+}
+
+bool MiraoSdkBackend::LoadDiversityPrefs(const std::string& path)
+{
+	MiraoDiversitySettings settings;
+	if (!settings.LoadPreferences(path))
+		return false;
+	divprefs_ = new imop::microscopy::DiversityPreferences;
+	divprefs_->Load(path);
+	return true;
+}
+
+void MiraoSdkBackend::InitDiversity()
+{
+	diversity_->Init_Diversity(*calibparams_, *divprefs_);
+}
+
+void MiraoSdkBackend::ApplyRelative(const float* dzernikes, int nbzernikes)
+{
+	for (int j = 1; j <= nbzernikes; j++)
+		zernikes_.zernike_coefficients[j] = dzernikes[j];
+	diversity_->Apply_Relative_Commands(zernikes_);
+}
+
+bool MiraoSdkBackend::ApplyAbsolute(const MiraoWavefrontState& state, const std::string& wcspath)
+{
+	if (!wcspath.empty())
+		return ApplyAbsolute(wcspath);
+	if (!state.Save(commandsPath))
+		return false;
+	return ApplyAbsolute(commandsPath);
+}
+
+bool MiraoSdkBackend::ApplyAbsolute(const std::string& wcspath)
+{
+	diversity_->Apply_Absolute_Commands_From_File(wcspath);
+	return true;
+}
+
+void MiraoSdkBackend::SavePositions(const std::string& wcspath)
+{
+	diversity_->Save_Current_Positions_ToFile(wcspath);
+}
+
+bool MiraoSdkBackend::ReadPositions(float* actuators)
+{
+	diversity_->Save_Current_Positions_ToFile(readbackPath);
+	MiraoWavefrontState state;
+	if (!state.Load(readbackPath))
+		return false;
+	memcpy(actuators, state.position, sizeof(state.position));
+	return true;
+}
+
+#endif // MIRAO_HAVE_SDK
@@ -0,0 +1,81 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          MiraoSdkBackend.h
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     DeviceAdapters
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   MIRAO-52E backend on the Imagine Optic SDK
+//
+// AUTHOR:        Marijn Siemons
+
+#pragma once
+
+#include "MiraoBackend.h"
+
+#ifdef MIRAO_HAVE_SDK
+
+#ifndef IMPORT_IMOP_WAVEKITBIO_FROM_LIBRARY
+#define IMPORT_IMOP_WAVEKITBIO_FROM_LIBRARY
+#endif
+
+#include <string>
+#include "Mirror.hpp"
+#include "Model.h"
+#include "PhaseDiversity.h"
+#include "3NAlgorithm.h"
+#include "merit_functions.hpp"
+#include "conversion.hpp"
+#include "MiraoProjector.h"
+
+//////////////////////////////////////////////////////////////////////////////
+// The real mirror: imop::microscopy::Mirror for the driver, one
+// imop::microscopy::Diversity per calibration for everything else.
+//
+class MiraoSdkBackend
+{
+public:
+	class Mirror
+	{
+	public:
+		Mirror() : handle(0) {}
+		~Mirror() { delete handle; }
+
+		// Initialises the hardware, replacing a previous driver
+		bool Open(const std::string& initpath);
+
+		imop::microscopy::Mirror* handle;
+
+	private:
+		Mirror(const Mirror&);
+		Mirror& operator=(const Mirror&);
+	};
+
+	MiraoSdkBackend(Mirror& mirror);
+	~MiraoSdkBackend();
+
+	bool LoadCalibration(const std::string& path);
+	// The SDK does not report unusable files, so they are checked natively first
+	bool LoadCalibrationParams(const std::string& path);
+	bool LoadDiversityPrefs(const std::string& path);
+	void InitDiversity();
+
+	void ApplyRelative(const float* dzernikes, int nbzernikes);
+	// The SDK only applies absolute commands from a wavefront state file, so a
+	// state without one is written to a temporary file first
+	bool ApplyAbsolute(const MiraoWavefrontState& state, const std::string& wcspath);
+	bool ApplyAbsolute(const std::string& wcspath);
+	void SavePositions(const std::string& wcspath);
+	// The SDK only reads back through a wavefront state file
+	bool ReadPositions(float* actuators);
+
+private:
+	MiraoSdkBackend(const MiraoSdkBackend&);
+	MiraoSdkBackend& operator=(const MiraoSdkBackend&);
+
+	Mirror& mirror_;
+	imop::microscopy::Diversity* diversity_;
+	imop::microscopy::CalibrationParams* calibparams_;
+	imop::microscopy::DiversityPreferences* divprefs_;
+	imop::microscopy::Zernikes zernikes_;
+};
+
+#endif // MIRAO_HAVE_SDK
@@ -0,0 +1,89 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          MiraoSequence.h
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     DeviceAdapters
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Software-timed stepping through a pre-loaded sequence of
+//                Zernike vectors for the MIRAO-52E
+//
+// AUTHOR:        Marijn Siemons
+
+#pragma once
+
+#include "../../MMDevice/DeviceThreads.h"
+#include "../../MMDevice/DeviceUtils.h"
+
+// Calls device->SequenceStep(i) for i = 0, 1, ... (wrapping around) every
+// interval, until Stop() is called. The device owns the sequence itself.
+template <class TDevice>
+class MiraoSequenceThread : public MMDeviceThreadBase
+{
+public:
+	MiraoSequenceThread(TDevice* device) :
+		device_(device),
+		length_(0),
+		interval_ms_(10),
+		stop_(true),
+		active_(false)
+	{
+	}
+
+	~MiraoSequenceThread()
+	{
+		Stop();
+	}
+
+	void Start(int length, double interval_ms)
+	{
+		Stop();
+		length_ = length;
+		interval_ms_ = interval_ms;
+		stop_ = false;
+		active_ = true;
+		activate();
+	}
+
+	void Stop()
+	{
+		if (!active_)
+			return;
+		{
+			MMThreadGuard guard(lock_);
+			stop_ = true;
+		}
+		wait();
+		active_ = false;
+	}
+
+	bool IsRunning()
+	{
+		MMThreadGuard guard(lock_);
+		return !stop_;
+	}
+
+	int svc()
+	{
+		int index = 0;
+		while (IsRunning() && length_ > 0)
+		{
+			MM::MMTime start = device_->GetCurrentMMTime();
+			if (device_->SequenceStep(index) != DEVICE_OK)
+				break;
+			index = (index + 1) % length_;
+			double elapsed_ms = (device_->GetCurrentMMTime() - start).getMsec();
+			if (elapsed_ms < interval_ms_)
+				CDeviceUtils::SleepMs((long)(interval_ms_ - elapsed_ms));
+		}
+		MMThreadGuard guard(lock_);
+		stop_ = true;
+		return 0;
+	}
+
+private:
+	TDevice* device_;
+	int length_;
+	double interval_ms_;
+	bool stop_;
+	bool active_;
+	MMThreadLock lock_;
+};
@@ -0,0 +1,421 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          MiraoShackHartmann.cpp
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     DeviceAdapters
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Shack-Hartmann slope measurement for the MIRAO-52E: centroids
+//                of the subapertures in the calibration pupil, a ring of slope
+//                records and a frame file replay source
+//
+// AUTHOR:        Marijn Siemons
+
+#include "MiraoShackHartmann.h"
+#include <cmath>
+#include <cstring>
+#include <fstream>
+
+// SSE2 is part of every x64 processor; define MIRAO_NO_SIMD to use the plain loops
+#if !defined(MIRAO_NO_SIMD) && (defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define MIRAO_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// Frame file layout: magic, version, width, height and number of frames,
+// then the frames as 16-bit pixels row by row. Host byte order, as the
+// field correction map.
+const char framesMagic[8] = { 'M', 'I', 'R', 'A', 'O', 'S', 'H', 'F' };
+const int framesVersion = 1;
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Window kernels: sum, and sums weighted by column and by row counted from
+// the window corner, of the pixels less the threshold, clipped at 0
+//
+#ifdef MIRAO_SSE2
+
+double SumLanes(__m128i a)
+{
+	unsigned int values[4];
+	_mm_storeu_si128((__m128i*)values, a);
+	return (double)values[0] + values[1] + values[2] + values[3];
+}
+
+// Adds 8 pixels to the sum and the column moment. SSE2 multiplies 16-bit
+// integers in low and high halves; interleaving them gives the 32-bit products.
+inline void AddBlock(__m128i v, __m128i column, __m128i& total, __m128i& moment)
+{
+	const __m128i zero = _mm_setzero_si128();
+	total = _mm_add_epi32(total, _mm_add_epi32(_mm_unpacklo_epi16(v, zero), _mm_unpackhi_epi16(v, zero)));
+	const __m128i low = _mm_mullo_epi16(v, column);
+	const __m128i high = _mm_mulhi_epu16(v, column);
+	moment = _mm_add_epi32(moment, _mm_add_epi32(_mm_unpacklo_epi16(low, high), _mm_unpackhi_epi16(low, high)));
+}
+
+// Reads the window in whole blocks of 8 pixels and masks the part beyond its
+// width. Up to MIRAO_SH_MAX_WINDOW no 32-bit lane overflows: the row moment
+// follows from the sum of the running totals after every row.
+void WindowSumsBlocks(const unsigned short* window, int stride, int width, int height, int threshold, double* sums)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i level = _mm_set1_epi16((short)threshold);
+	const __m128i eight = _mm_set1_epi16(8);
+	const __m128i first = _mm_set_epi16(7, 6, 5, 4, 3, 2, 1, 0);
+	const int blocks = (width + 7) / 8;
+	const __m128i lastColumn = _mm_add_epi16(first, _mm_set1_epi16((short)(8 * (blocks - 1))));
+	const __m128i lastMask = _mm_cmplt_epi16(lastColumn, _mm_set1_epi16((short)width));
+	__m128i total = zero;
+	__m128i moment = zero;
+	__m128i running = zero;
+	for (int y = 0; y < height; ++y)
+	{
+		const unsigned short* row = window + (size_t)y * stride;
+		__m128i column = first;
+		for (int b = 0; b < blocks - 1; ++b)
+		{
+			const __m128i v = _mm_subs_epu16(_mm_loadu_si128((const __m128i*)(row + 8 * b)), level);
+			AddBlock(v, column, total, moment);
+			column = _mm_add_epi16(column, eight);
+		}
+		const __m128i v = _mm_subs_epu16(_mm_loadu_si128((const __m128i*)(row + 8 * (blocks - 1))), level);
+		AddBlock(_mm_and_si128(v, lastMask), lastColumn, total, moment);
+		running = _mm_add_epi32(running, total);
+	}
+	sums[0] = SumLanes(total);
+	sums[1] = SumLanes(moment);
+	sums[2] = height * sums[0] - SumLanes(running);
+}
+
+#endif
+
+void WindowSums(const unsigned short* window, int stride, int width, int height, int threshold, bool padded, double* sums)
+{
+#ifdef MIRAO_SSE2
+	if (padded)
+	{
+		WindowSumsBlocks(window, stride, width, height, threshold, sums);
+		return;
+	}
+#endif
+	sums[0] = sums[1] = sums[2] = 0;
+	for (int y = 0; y < height; ++y)
+	{
+		const unsigned short* row = window + (size_t)y * stride;
+		unsigned int sum = 0;
+		unsigned int moment = 0;
+		for (int x = 0; x < width; ++x)
+		{
+			const unsigned int v = row[x] > threshold ? row[x] - threshold : 0;
+			sum += v;
+			moment += x * v;
+		}
+		sums[0] += sum;
+		sums[1] += moment;
+		sums[2] += (double)y * sum;
+	}
+}
+
+} // namespace
+
+
+//////////////////////////////////////////////////////////////////////////////
+// MiraoShackHartmann
+//
+MiraoShackHartmann::MiraoShackHartmann() :
+	width_(0),
+	height_(0),
+	windowWidth_(0),
+	windowHeight_(0),
+	nbSubap_(0),
+	pixels_(0),
+	slot_(0)
+{
+	ring_ = new Slot[MIRAO_SH_LENGTH];
+}
+
+MiraoShackHartmann::~MiraoShackHartmann()
+{
+	Stop();
+	delete[] ring_;
+}
+
+bool MiraoShackHartmann::Configure(const MiraoShackHartmannSettings& settings, const MiraoCalibration& calib, int width, int height)
+{
+	if (settings.pixelSize_um <= 0 || settings.focalLength_mm <= 0 || settings.threshold < 0 || settings.threshold > 65535 ||
+		calib.nbValidSubap <= 0 || calib.nbValidSubap > MIRAO_SH_MAX_SUBAPS ||
+		(int)calib.pupil.size() != calib.nbSubapX * calib.nbSubapY)
+		return false;
+
+	const double pitchX = calib.stepX_um / settings.pixelSize_um;
+	const double pitchY = calib.stepY_um / settings.pixelSize_um;
+	const int windowWidth = (int)pitchX;
+	const int windowHeight = (int)pitchY;
+	if (windowWidth < 1 || windowHeight < 1 || windowWidth > MIRAO_SH_MAX_WINDOW || windowHeight > MIRAO_SH_MAX_WINDOW)
+		return false;
+
+	// Windows of whole pixels from the corner of every subaperture; the
+	// reference is the subaperture centre, pixel centres at whole coordinates
+	const size_t frameSize = (size_t)width * height;
+	const size_t blockWidth = (size_t)(windowWidth + 7) / 8 * 8;
+	std::vector<int> rowBegin;
+	std::vector<int> offset;
+	std::vector<unsigned char> padded;
+	std::vector<double> referenceX;
+	std::vector<double> referenceY;
+	for (int iy = 0; iy < calib.nbSubapY; ++iy)
+	{
+		rowBegin.push_back((int)offset.size());
+		for (int ix = 0; ix < calib.nbSubapX; ++ix)
+		{
+			if (!calib.pupil[iy * calib.nbSubapX + ix])
+				continue;
+			const double cornerX = settings.originX + ix * pitchX;
+			const double cornerY = settings.originY + iy * pitchY;
+			const int left = (int)std::floor(cornerX + 0.5);
+			const int top = (int)std::floor(cornerY + 0.5);
+			if (left < 0 || top < 0 || left + windowWidth > width || top + windowHeight > height)
+				return false;
+			const size_t corner = (size_t)top * width + left;
+			offset.push_back((int)corner);
+			padded.push_back(corner + (size_t)(windowHeight - 1) * width + blockWidth <= frameSize ? 1 : 0);
+			referenceX.push_back(cornerX + 0.5 * pitchX - 0.5 - left);
+			referenceY.push_back(cornerY + 0.5 * pitchY - 0.5 - top);
+		}
+	}
+	rowBegin.push_back((int)offset.size());
+	if ((int)offset.size() != calib.nbValidSubap)
+		return false;
+
+	settings_ = settings;
+	width_ = width;
+	height_ = height;
+	windowWidth_ = windowWidth;
+	windowHeight_ = windowHeight;
+	nbSubap_ = calib.nbValidSubap;
+	rowBegin_.swap(rowBegin);
+	offset_.swap(offset);
+	padded_.swap(padded);
+	referenceX_.swap(referenceX);
+	referenceY_.swap(referenceY);
+	centroidX_.assign(nbSubap_, 0);
+	centroidY_.assign(nbSubap_, 0);
+	storeReference_.Set(0);
+	published_.Set(0);
+	measureTime_.Reset();
+	return true;
+}
+
+void MiraoShackHartmann::Start(int nbThreads)
+{
+	pool_.Start(nbThreads);
+}
+
+void MiraoShackHartmann::Stop()
+{
+	pool_.Stop();
+}
+
+void MiraoShackHartmann::Measure(const unsigned short* pixels, long frame, double time_us)
+{
+	const double start = MiraoClock();
+	const long index = published_.Get();
+	Slot& slot = ring_[index % MIRAO_SH_LENGTH];
+	MiraoSlopes& record = slot.record;
+	slot.version.Increment();
+
+	pixels_ = pixels;
+	slot_ = &slot;
+	pool_.Run(this, &MiraoShackHartmann::MeasureRows);
+
+	// The centroids of this frame become the reference, so its slopes are 0
+	int lit = 0;
+	const bool storeReference = storeReference_.Get() != 0;
+	for (int s = 0; s < nbSubap_; ++s)
+	{
+		if (record.flux[s] <= 0)
+			continue;
+		++lit;
+		if (storeReference)
+		{
+			referenceX_[s] = centroidX_[s];
+			referenceY_[s] = centroidY_[s];
+			record.slopes[s] = record.slopes[nbSubap_ + s] = 0;
+		}
+	}
+	if (storeReference)
+		storeReference_.Set(0);
+
+	record.frame = frame;
+	record.time_us = time_us;
+	record.nbSubap = nbSubap_;
+	record.nbLit = lit;
+	record.measure_us = MiraoClock() - start;
+	slot.version.Increment();
+	published_.Set(index + 1);
+	measureTime_.Record(record.measure_us);
+}
+
+void MiraoShackHartmann::MeasureRows(int first, int step)
+{
+	MiraoSlopes& record = slot_->record;
+	const double scale = settings_.pixelSize_um / settings_.focalLength_mm;
+	for (int row = first; row + 1 < (int)rowBegin_.size(); row += step)
+	{
+		for (int s = rowBegin_[row]; s < rowBegin_[row + 1]; ++s)
+		{
+			double sums[3];
+			WindowSums(pixels_ + offset_[s], width_, windowWidth_, windowHeight_, settings_.threshold, padded_[s] != 0, sums);
+			if (sums[0] > 0)
+			{
+				centroidX_[s] = sums[1] / sums[0];
+				centroidY_[s] = sums[2] / sums[0];
+				record.slopes[s] = (float)((centroidX_[s] - referenceX_[s]) * scale);
+				record.slopes[nbSubap_ + s] = (float)((centroidY_[s] - referenceY_[s]) * scale);
+			}
+			else
+			{
+				record.slopes[s] = record.slopes[nbSubap_ + s] = 0;
+			}
+			record.flux[s] = (float)sums[0];
+		}
+	}
+}
+
+bool MiraoShackHartmann::Get(long index, MiraoSlopes& slopes) const
+{
+	if (index < 0 || index >= published_.Get())
+		return false;
+	const Slot& slot = ring_[index % MIRAO_SH_LENGTH];
+	long version = slot.version.Get();
+	if (version & 1)
+		return false;
+	// Only the part of the arrays in use
+	const MiraoSlopes& record = slot.record;
+	int nbSubap = record.nbSubap;
+	if (nbSubap < 0 || nbSubap > MIRAO_SH_MAX_SUBAPS)
+		nbSubap = 0;
+	slopes.frame = record.frame;
+	slopes.time_us = record.time_us;
+	slopes.measure_us = record.measure_us;
+	slopes.nbSubap = nbSubap;
+	slopes.nbLit = record.nbLit;
+	memcpy(slopes.slopes, record.slopes, nbSubap * sizeof(float));
+	memcpy(slopes.slopes + nbSubap, record.slopes + nbSubap, nbSubap * sizeof(float));
+	memcpy(slopes.flux, record.flux, nbSubap * sizeof(float));
+	// Overwritten while copying if the version changed, or the slot already
+	// holds a later record
+	return slot.version.Get() == version && index > published_.Get() - MIRAO_SH_LENGTH;
+}
+
+bool MiraoShackHartmann::GetLatest(MiraoSlopes& slopes) const
+{
+	// The latest record cannot be overwritten while copying unless the ring
+	// goes round in the meantime; try again with the new latest one then
+	for (int attempt = 0; attempt < 4; ++attempt)
+		if (Get(published_.Get() - 1, slopes))
+			return true;
+	return false;
+}
+
+double MiraoShackHartmann::GetRate() const
+{
+	const long published = published_.Get();
+	MiraoSlopes latest;
+	if (published < 2 || !Get(published - 1, latest))
+		return 0;
+	// Time stamps only: walk back through the ring without copying slopes
+	int count = 0;
+	double oldest = latest.time_us;
+	for (long index = published - 2; index >= 0 && index > published - MIRAO_SH_LENGTH; --index)
+	{
+		const Slot& slot = ring_[index % MIRAO_SH_LENGTH];
+		const long version = slot.version.Get();
+		const double time_us = slot.record.time_us;
+		if ((version & 1) || slot.version.Get() != version || time_us < latest.time_us - 1e6)
+			break;
+		oldest = time_us;
+		++count;
+	}
+	return oldest < latest.time_us ? count * 1e6 / (latest.time_us - oldest) : 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// MiraoFrameReplay
+//
+MiraoFrameReplay::MiraoFrameReplay(MiraoShackHartmann* pipeline) :
+	pipeline_(pipeline),
+	width_(0),
+	height_(0),
+	nbFrames_(0),
+	interval_ms_(1),
+	stop_(1),
+	active_(false)
+{
+}
+
+MiraoFrameReplay::~MiraoFrameReplay()
+{
+	Stop();
+}
+
+bool MiraoFrameReplay::Load(const std::string& path)
+{
+	std::ifstream in(path.c_str(), std::ios::in | std::ios::binary);
+	if (!in)
+		return false;
+
+	char magic[sizeof(framesMagic)];
+	int version = 0;
+	int width = 0;
+	int height = 0;
+	int nbFrames = 0;
+	in.read(magic, sizeof(magic));
+	if (!MiraoReadValue(in, version) || !MiraoReadValue(in, width) || !MiraoReadValue(in, height) || !MiraoReadValue(in, nbFrames))
+		return false;
+	if (memcmp(magic, framesMagic, sizeof(magic)) != 0 || version != framesVersion ||
+		width <= 0 || height <= 0 || nbFrames <= 0 || (double)width * height * nbFrames > 1e9)
+		return false;
+
+	std::vector<unsigned short> frames((size_t)width * height * nbFrames);
+	in.read((char*)&frames[0], frames.size() * sizeof(unsigned short));
+	if (!in)
+		return false;
+	frames_.swap(frames);
+	width_ = width;
+	height_ = height;
+	nbFrames_ = nbFrames;
+	return true;
+}
+
+void MiraoFrameReplay::Start(double interval_ms)
+{
+	Stop();
+	interval_ms_ = interval_ms;
+	stop_.Set(0);
+	active_ = true;
+	activate();
+}
+
+void MiraoFrameReplay::Stop()
+{
+	if (!active_)
+		return;
+	stop_.Set(1);
+	wait();
+	active_ = false;
+}
+
+// Frames are due at fixed times from the start, so a slow frame does not
+// delay the ones after it
+int MiraoFrameReplay::svc()
+{
+	const size_t frameSize = (size_t)width_ * height_;
+	const double start = MiraoClock();
+	for (long frame = 0; !stop_.Get(); ++frame)
+	{
+		MiraoWaitUntil(start + frame * interval_ms_ * 1000.0, &stop_);
+		pipeline_->Measure(&frames_[(frame % nbFrames_) * frameSize], frame, MiraoClock());
+	}
+	return 0;
+}
@@ -0,0 +1,173 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          MiraoShackHartmann.h
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     DeviceAdapters
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Shack-Hartmann slope measurement for the MIRAO-52E: centroids
+//                of the subapertures in the calibration pupil, a ring of slope
+//                records and a frame file replay source
+//
+// AUTHOR:        Marijn Siemons
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include "../../MMDevice/DeviceThreads.h"
+#include "MiraoProjector.h"
+#include "MiraoSync.h"
+#include "MiraoTelemetry.h"
+
+// Largest pupil a slope record holds, in valid subapertures
+#define MIRAO_SH_MAX_SUBAPS		2048
+// Largest subaperture window [pixels]; the 32-bit centroid sums cannot
+// overflow up to this size
+#define MIRAO_SH_MAX_WINDOW		64
+#define MIRAO_SH_LENGTH			64
+
+// Sensor and lenslet geometry. The subaperture pitch on the sensor is the
+// microlens step of the calibration divided by the pixel size.
+struct MiraoShackHartmannSettings
+{
+	MiraoShackHartmannSettings() :
+		pixelSize_um(5.5),
+		focalLength_mm(5),
+		originX(0),
+		originY(0),
+		threshold(0)
+	{
+	}
+
+	double pixelSize_um;
+	double focalLength_mm;		// microlens
+	double originX;				// sensor position [pixels] of the corner of subaperture (0, 0)
+	double originY;
+	int threshold;				// [counts], subtracted from every pixel before the centre of gravity
+};
+
+// Slopes of one frame [mrad] in the order of the interaction matrix rows:
+// x of every valid subaperture in pupil row order, then y. A subaperture
+// without signal above the threshold has zero slope and zero flux.
+struct MiraoSlopes
+{
+	long frame;				// index of the frame in its source
+	double time_us;			// frame taken from the source
+	double measure_us;		// centroiding time
+	int nbSubap;
+	int nbLit;				// subapertures with signal
+	float slopes[2 * MIRAO_SH_MAX_SUBAPS];
+	float flux[MIRAO_SH_MAX_SUBAPS];		// [counts] above the threshold
+};
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Thresholded centre of gravity in one fixed window per valid subaperture.
+// The reference positions are the window centres until StoreReference(),
+// which takes the centroids of the next frame instead. Rows of subapertures
+// are interleaved over the threads, as the stripes of MiraoPsfSimulator.
+// Every measured frame is written to a ring of MIRAO_SH_LENGTH records; as
+// in MiraoTelemetry each slot carries a version that is odd while it is
+// written, so any number of readers copy records without a lock and the
+// measuring thread never waits for them.
+//
+class MiraoShackHartmann
+{
+public:
+	MiraoShackHartmann();
+	~MiraoShackHartmann();
+
+	// Windows of the calibration pupil on a width by height sensor; false if
+	// the pupil is too large or does not fit on the sensor. Clears the
+	// reference and the ring.
+	bool Configure(const MiraoShackHartmannSettings& settings, const MiraoCalibration& calib, int width, int height);
+	int GetNbSubap() const { return nbSubap_; }
+	void StoreReference() { storeReference_.Set(1); }
+
+	void Start(int nbThreads);
+	void Stop();
+
+	// Centroids a width by height frame of the configured size and publishes
+	// its slopes. Called from one thread at a time.
+	void Measure(const unsigned short* pixels, long frame, double time_us);
+
+	// Records written since Configure()
+	long GetPublished() const { return published_.Get(); }
+	// Copy of the index-th record written (0 is the first), false if it is
+	// not written yet or was overwritten while copying
+	bool Get(long index, MiraoSlopes& slopes) const;
+	bool GetLatest(MiraoSlopes& slopes) const;
+	// Records in the second before the latest one
+	double GetRate() const;
+	const MiraoLatencyHistogram& GetMeasureTime() const { return measureTime_; }
+
+private:
+	struct Slot
+	{
+		MiraoAtomicLong version;
+		MiraoSlopes record;
+	};
+
+	void MeasureRows(int first, int step);
+
+	MiraoShackHartmannSettings settings_;
+	int width_;
+	int height_;
+	int windowWidth_;
+	int windowHeight_;
+	int nbSubap_;
+	std::vector<int> rowBegin_;			// first subaperture of every pupil row, and the end
+	std::vector<int> offset_;			// pixel index of every window's corner
+	std::vector<unsigned char> padded_;	// window can be read in whole blocks of 8 pixels
+	std::vector<double> referenceX_;	// [pixels]
+	std::vector<double> referenceY_;
+	std::vector<double> centroidX_;
+	std::vector<double> centroidY_;
+	MiraoAtomicLong storeReference_;
+
+	// Frame being measured and the record it goes to
+	const unsigned short* pixels_;
+	Slot* slot_;
+
+	Slot* ring_;
+	MiraoAtomicLong published_;
+	MiraoLatencyHistogram measureTime_;
+
+	MiraoForkJoinPool<MiraoShackHartmann> pool_;
+};
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Plays the frames of a file into a MiraoShackHartmann at a fixed interval,
+// from the first frame again after the last. For testing the slope pipeline
+// on recorded or synthetic sensor frames; see MiraoShackHartmann.cpp for the
+// file layout.
+//
+class MiraoFrameReplay : public MMDeviceThreadBase
+{
+public:
+	MiraoFrameReplay(MiraoShackHartmann* pipeline);
+	~MiraoFrameReplay();
+
+	// Not while running; false if the file cannot be read, in which case the
+	// frames are left as they were
+	bool Load(const std::string& path);
+	int GetWidth() const { return width_; }
+	int GetHeight() const { return height_; }
+	int GetNbFrames() const { return nbFrames_; }
+
+	// interval_ms 0 plays the frames as fast as they are measured
+	void Start(double interval_ms);
+	void Stop();
+	bool IsRunning() const { return stop_.Get() == 0; }
+	int svc();
+
+private:
+	MiraoShackHartmann* pipeline_;
+	std::vector<unsigned short> frames_;
+	int width_;
+	int height_;
+	int nbFrames_;
+	double interval_ms_;
+	MiraoAtomicLong stop_;
+	bool active_;
+};
@@ -0,0 +1,149 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          MiraoSimBackend.cpp
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     DeviceAdapters
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Simulated MIRAO-52E backend in plain C++, so the adapter
+//                runs without the vendor SDK and on any platform
+//
+// AUTHOR:        Marijn Siemons
+
+#include "MiraoSimBackend.h"
+#include <cmath>
+#include <cstring>
+#include "MiraoDiversity.h"
+#include "MiraoModes.h"
+#include "MiraoSync.h"
+
+MiraoSimBackend::Mirror::Mirror() :
+	moved_us_(0)
+{
+	memset(start_, 0, sizeof(start_));
+}
+
+bool MiraoSimBackend::Mirror::Open(const std::string&)
+{
+	MMThreadGuard guard(lock_);
+	state_ = MiraoWavefrontState();
+	memset(start_, 0, sizeof(start_));
+	moved_us_ = MiraoClock();
+	return true;
+}
+
+void MiraoSimBackend::Mirror::SetSettings(const MiraoSimSettings& settings)
+{
+	MMThreadGuard guard(lock_);
+	settings_ = settings;
+}
+
+MiraoSimSettings MiraoSimBackend::Mirror::GetSettings()
+{
+	MMThreadGuard guard(lock_);
+	return settings_;
+}
+
+void MiraoSimBackend::Mirror::Move(const float* target, const MiraoWavefrontState* limits)
+{
+	MiraoSimSettings settings = GetSettings();
+
+	// The driver transfer
+	MiraoWaitUntil(MiraoClock() + settings.latency_ms * 1000.0);
+
+	float shape[MIRAO_NB_ACTUATORS];
+	GetShape(shape);
+	MMThreadGuard guard(lock_);
+	if (limits)
+	{
+		memcpy(state_.valid, limits->valid, sizeof(state_.valid));
+		memcpy(state_.minCommand, limits->minCommand, sizeof(state_.minCommand));
+		memcpy(state_.maxCommand, limits->maxCommand, sizeof(state_.maxCommand));
+		state_.minSleepAfterMovementMs = limits->minSleepAfterMovementMs;
+	}
+	for (int i = 0; i < MIRAO_NB_ACTUATORS; ++i)
+	{
+		double command = target[i];
+		if (settings.resolution > 0)
+			command = std::floor(command / settings.resolution + 0.5) * settings.resolution;
+		if (command < state_.minCommand[i])
+			command = state_.minCommand[i];
+		if (command > state_.maxCommand[i])
+			command = state_.maxCommand[i];
+		state_.position[i] = (float)command;
+	}
+	memcpy(start_, shape, sizeof(start_));
+	moved_us_ = MiraoClock();
+}
+
+void MiraoSimBackend::Mirror::GetState(MiraoWavefrontState& state)
+{
+	MMThreadGuard guard(lock_);
+	state = state_;
+}
+
+void MiraoSimBackend::Mirror::GetShape(float* actuators)
+{
+	MMThreadGuard guard(lock_);
+	const double elapsed_ms = (MiraoClock() - moved_us_) / 1000.0;
+	const double remaining = settings_.settle_ms > 0 ? std::exp(-elapsed_ms / settings_.settle_ms) : 0;
+	for (int i = 0; i < MIRAO_NB_ACTUATORS; ++i)
+		actuators[i] = (float)(state_.position[i] + (start_[i] - state_.position[i]) * remaining);
+}
+
+
+MiraoSimBackend::MiraoSimBackend(Mirror& mirror) :
+	mirror_(mirror)
+{
+}
+
+bool MiraoSimBackend::LoadCalibration(const std::string& path)
+{
+	MiraoCalibration calib;
+	return calib.Load(path) && projector_.Build(calib, MIRAO_SDK_ZERNIKES);
+}
+
+bool MiraoSimBackend::LoadCalibrationParams(const std::string& path)
+{
+	MiraoDiversitySettings settings;
+	return settings.LoadCalibrationParams(path);
+}
+
+bool MiraoSimBackend::LoadDiversityPrefs(const std::string& path)
+{
+	MiraoDiversitySettings settings;
+	return settings.LoadPreferences(path);
+}
+
+void MiraoSimBackend::ApplyRelative(const float* dzernikes, int nbzernikes)
+{
+	MiraoWavefrontState state;
+	mirror_.GetState(state);
+	projector_.ProjectDelta(dzernikes, nbzernikes, state.position);
+	mirror_.Move(state.position, 0);
+}
+
+bool MiraoSimBackend::ApplyAbsolute(const MiraoWavefrontState& state, const std::string&)
+{
+	mirror_.Move(state.position, &state);
+	return true;
+}
+
+bool MiraoSimBackend::ApplyAbsolute(const std::string& wcspath)
+{
+	MiraoWavefrontState state;
+	return state.Load(wcspath) && ApplyAbsolute(state, wcspath);
+}
+
+void MiraoSimBackend::SavePositions(const std::string& wcspath)
+{
+	MiraoWavefrontState state;
+	mirror_.GetState(state);
+	state.Save(wcspath);
+}
+
+bool MiraoSimBackend::ReadPositions(float* actuators)
+{
+	MiraoWavefrontState state;
+	mirror_.GetState(state);
+	memcpy(actuators, state.position, sizeof(state.position));
+	return true;
+}
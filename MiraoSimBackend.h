@@ -0,0 +1,90 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          MiraoSimBackend.h
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     DeviceAdapters
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Simulated MIRAO-52E backend in plain C++, so the adapter
+//                runs without the vendor SDK and on any platform
+//
+// AUTHOR:        Marijn Siemons
+
+#pragma once
+
+#include <string>
+#include "../../MMDevice/DeviceThreads.h"
+#include "MiraoBackend.h"
+#include "MiraoProjector.h"
+
+// Timing and resolution of the simulated mirror
+struct MiraoSimSettings
+{
+	MiraoSimSettings() :
+		latency_ms(1),
+		settle_ms(1),
+		resolution(2.0 / 65536)
+	{
+	}
+
+	double latency_ms;		// every update blocks this long, as the driver transfer
+	double settle_ms;		// time constant of the actuators approaching a new command
+	double resolution;		// command step, as the DAC; 0 for none
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// 52 actuators whose commands are quantised and clipped to the limits of the
+// last applied wavefront state. Zernike commands are converted with the
+// least-squares control matrix of the calibration file, so an .aomi file is
+// required; the mirror init file is not read. Phase diversity is the
+// adapter's native engine, so its SDK setup is a no-op here.
+//
+class MiraoSimBackend
+{
+public:
+	class Mirror
+	{
+	public:
+		Mirror();
+
+		bool Open(const std::string& initpath);
+
+		void SetSettings(const MiraoSimSettings& settings);
+		MiraoSimSettings GetSettings();
+
+		// Blocks for the latency, then starts moving to the quantised and
+		// clipped target. limits is the wavefront state to take the
+		// actuator limits from, 0 to keep the current ones.
+		void Move(const float* target, const MiraoWavefrontState* limits);
+		// Commands and limits last applied
+		void GetState(MiraoWavefrontState& state);
+		// Where the actuators are now, settling towards the commands
+		void GetShape(float* actuators);
+
+	private:
+		MMThreadLock lock_;
+		MiraoSimSettings settings_;
+		MiraoWavefrontState state_;
+		float start_[MIRAO_NB_ACTUATORS];
+		double moved_us_;
+	};
+
+	MiraoSimBackend(Mirror& mirror);
+
+	bool LoadCalibration(const std::string& path);
+	bool LoadCalibrationParams(const std::string& path);
+	bool LoadDiversityPrefs(const std::string& path);
+	void InitDiversity() {}
+
+	void ApplyRelative(const float* dzernikes, int nbzernikes);
+	// From memory; wcspath is not read
+	bool ApplyAbsolute(const MiraoWavefrontState& state, const std::string& wcspath);
+	bool ApplyAbsolute(const std::string& wcspath);
+	void SavePositions(const std::string& wcspath);
+	bool ReadPositions(float* actuators);
+
+private:
+	MiraoSimBackend(const MiraoSimBackend&);
+	MiraoSimBackend& operator=(const MiraoSimBackend&);
+
+	Mirror& mirror_;
+	MiraoProjector projector_;
+};
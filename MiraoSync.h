@@ -0,0 +1,330 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          MiraoSync.h
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     DeviceAdapters
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Small synchronisation helpers for the MIRAO-52E adapter:
+//                memory barrier, microsecond clock and waits, atomic counter,
+//                event, a bounded lock-free single-producer/single-consumer
+//                queue and a fork/join thread pool
+//
+// AUTHOR:        Marijn Siemons
+
+#pragma once
+
+#include <vector>
+#include "../../MMDevice/DeviceThreads.h"
+#include "../../MMDevice/DeviceUtils.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#define MIRAO_MEMORY_BARRIER() MemoryBarrier()
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <sys/time.h>
+#include <time.h>
+#include <errno.h>
+#define MIRAO_MEMORY_BARRIER() __sync_synchronize()
+#endif
+
+// Microseconds since an arbitrary start, for timing loops below the
+// resolution of the core's clock. Monotonic, so a clock adjustment does not
+// stall or rush a timed loop.
+inline double MiraoClock()
+{
+#ifdef _WIN32
+	LARGE_INTEGER frequency, counter;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&counter);
+	return counter.QuadPart * 1e6 / frequency.QuadPart;
+#else
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1e6 + now.tv_nsec / 1e3;
+#endif
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Counter that can be read and written from different threads
+//
+class MiraoAtomicLong
+{
+public:
+	MiraoAtomicLong(long value = 0) : value_(value) {}
+
+	long Get() const
+	{
+		long value = value_;
+		MIRAO_MEMORY_BARRIER();
+		return value;
+	}
+
+	void Set(long value)
+	{
+		MIRAO_MEMORY_BARRIER();
+		value_ = value;
+		MIRAO_MEMORY_BARRIER();
+	}
+
+	long Increment()
+	{
+#ifdef _WIN32
+		return InterlockedIncrement(&value_);
+#else
+		return __sync_add_and_fetch(&value_, 1);
+#endif
+	}
+
+	long Add(long amount)
+	{
+#ifdef _WIN32
+		return InterlockedExchangeAdd(&value_, amount) + amount;
+#else
+		return __sync_add_and_fetch(&value_, amount);
+#endif
+	}
+
+private:
+	volatile long value_;
+};
+
+
+// Waits until MiraoClock() reaches due_us, or until stop is set. A sleeping
+// thread wakes up late by up to a timer tick, so the thread sleeps until
+// MIRAO_WAIT_MARGIN_US before due_us and yields the processor from there.
+#ifdef _WIN32
+#define MIRAO_WAIT_MARGIN_US	1000
+#else
+#define MIRAO_WAIT_MARGIN_US	200
+#endif
+
+inline void MiraoWaitUntil(double due_us, const MiraoAtomicLong* stop = 0)
+{
+	for (double left = due_us - MiraoClock(); left > 0 && !(stop && stop->Get()); left = due_us - MiraoClock())
+	{
+#ifdef _WIN32
+		if (left > MIRAO_WAIT_MARGIN_US)
+			CDeviceUtils::SleepMs((long)((left - MIRAO_WAIT_MARGIN_US + 999) / 1000));
+		else
+			SwitchToThread();
+#else
+		if (left > MIRAO_WAIT_MARGIN_US)
+		{
+			const double sleep_us = left - MIRAO_WAIT_MARGIN_US;
+			timespec interval;
+			interval.tv_sec = (time_t)(sleep_us / 1e6);
+			interval.tv_nsec = (long)((sleep_us - interval.tv_sec * 1e6) * 1e3);
+			nanosleep(&interval, 0);
+		}
+		else
+			sched_yield();
+#endif
+	}
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Auto-reset event: Wait() returns once per Set(), or after the timeout
+//
+class MiraoEvent
+{
+public:
+#ifdef _WIN32
+	MiraoEvent() { handle_ = CreateEvent(NULL, FALSE, FALSE, NULL); }
+	~MiraoEvent() { CloseHandle(handle_); }
+	void Set() { SetEvent(handle_); }
+	void Wait(long timeout_ms) { WaitForSingleObject(handle_, (DWORD)timeout_ms); }
+private:
+	HANDLE handle_;
+#else
+	MiraoEvent() : signalled_(false)
+	{
+		pthread_mutex_init(&mutex_, NULL);
+		pthread_cond_init(&cond_, NULL);
+	}
+	~MiraoEvent()
+	{
+		pthread_cond_destroy(&cond_);
+		pthread_mutex_destroy(&mutex_);
+	}
+	void Set()
+	{
+		pthread_mutex_lock(&mutex_);
+		signalled_ = true;
+		pthread_cond_signal(&cond_);
+		pthread_mutex_unlock(&mutex_);
+	}
+	void Wait(long timeout_ms)
+	{
+		struct timeval now;
+		gettimeofday(&now, NULL);
+		struct timespec deadline;
+		long long nsec = now.tv_usec * 1000LL + (timeout_ms % 1000) * 1000000LL;
+		deadline.tv_sec = now.tv_sec + timeout_ms / 1000 + (time_t)(nsec / 1000000000LL);
+		deadline.tv_nsec = (long)(nsec % 1000000000LL);
+		pthread_mutex_lock(&mutex_);
+		while (!signalled_)
+			if (pthread_cond_timedwait(&cond_, &mutex_, &deadline) == ETIMEDOUT)
+				break;
+		signalled_ = false;
+		pthread_mutex_unlock(&mutex_);
+	}
+private:
+	pthread_mutex_t mutex_;
+	pthread_cond_t cond_;
+	bool signalled_;
+#endif
+};
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Bounded single-producer/single-consumer ring buffer. Push() must only be
+// called from one thread at a time and Pop() from one (other) thread.
+// Capacity is N - 1 elements.
+//
+template <class T, int N>
+class MiraoSpscQueue
+{
+public:
+	MiraoSpscQueue() : head_(0), tail_(0) {}
+
+	bool Push(const T& item)
+	{
+		long tail = tail_.Get();
+		long next = (tail + 1) % N;
+		if (next == head_.Get())
+			return false;
+		items_[tail] = item;
+		tail_.Set(next);
+		return true;
+	}
+
+	bool Pop(T& item)
+	{
+		long head = head_.Get();
+		if (head == tail_.Get())
+			return false;
+		item = items_[head];
+		head_.Set((head + 1) % N);
+		return true;
+	}
+
+	int Size() const
+	{
+		long size = tail_.Get() - head_.Get();
+		return (int)(size < 0 ? size + N : size);
+	}
+
+	int Capacity() const { return N - 1; }
+
+private:
+	T items_[N];
+	MiraoAtomicLong head_;
+	MiraoAtomicLong tail_;
+};
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Fork/join pool for data-parallel work on an object of class T. Run() calls
+// (owner->*part)(t, threads) for every t below GetThreads(): part 0 on the
+// calling thread and the others on the pool's threads, and returns once all
+// of them are done. Start() and Stop() must not overlap a Run().
+//
+template <class T>
+class MiraoForkJoinPool
+{
+public:
+	typedef void (T::*Part)(int first, int step);
+
+	MiraoForkJoinPool() : owner_(0), part_(0), stop_(1) {}
+
+	~MiraoForkJoinPool()
+	{
+		Stop();
+	}
+
+	// Runs the parts on nbThreads threads in all, the calling one included
+	void Start(int nbThreads)
+	{
+		Stop();
+		stop_.Set(0);
+		for (int t = 1; t < nbThreads; ++t)
+		{
+			workers_.push_back(new Worker(this, t, nbThreads, generation_.Get()));
+			workers_.back()->activate();
+		}
+	}
+
+	void Stop()
+	{
+		stop_.Set(1);
+		for (size_t t = 0; t < workers_.size(); ++t)
+		{
+			workers_[t]->start_.Set();
+			workers_[t]->wait();
+			delete workers_[t];
+		}
+		workers_.clear();
+	}
+
+	int GetThreads() const { return (int)workers_.size() + 1; }
+
+	void Run(T* owner, Part part)
+	{
+		owner_ = owner;
+		part_ = part;
+		remaining_.Set((long)workers_.size());
+		generation_.Increment();
+		for (size_t t = 0; t < workers_.size(); ++t)
+			workers_[t]->start_.Set();
+		(owner->*part)(0, GetThreads());
+		while (remaining_.Get() > 0)
+			done_.Wait(100);
+	}
+
+private:
+	class Worker : public MMDeviceThreadBase
+	{
+	public:
+		Worker(MiraoForkJoinPool* pool, int first, int step, long generation) :
+			pool_(pool), first_(first), step_(step), generation_(generation) {}
+
+		int svc()
+		{
+			for (;;)
+			{
+				start_.Wait(100);
+				if (pool_->stop_.Get())
+					break;
+				const long generation = pool_->generation_.Get();
+				if (generation == generation_)
+					continue;
+				generation_ = generation;
+				(pool_->owner_->*pool_->part_)(first_, step_);
+				if (pool_->remaining_.Add(-1) == 0)
+					pool_->done_.Set();
+			}
+			return 0;
+		}
+
+		MiraoEvent start_;
+	private:
+		MiraoForkJoinPool* pool_;
+		int first_;
+		int step_;
+		long generation_;
+	};
+
+	std::vector<Worker*> workers_;
+	T* owner_;
+	Part part_;
+	MiraoAtomicLong generation_;
+	MiraoAtomicLong remaining_;
+	MiraoAtomicLong stop_;
+	MiraoEvent done_;
+};
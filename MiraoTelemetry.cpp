@@ -0,0 +1,168 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          MiraoTelemetry.cpp
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     DeviceAdapters
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Timing of the MIRAO-52E mirror update path: a ring of
+//                per-command timestamps and latency histograms
+//
+// AUTHOR:        Marijn Siemons
+
+#include "MiraoTelemetry.h"
+#include <fstream>
+
+namespace {
+
+const int subBits = 4;		// log2(MIRAO_HISTOGRAM_SUB)
+
+const char* latencyNames[MIRAO_NB_LATENCIES] = { "queue", "sdk", "settled" };
+
+double Elapsed(double from, double to)
+{
+	return from > 0 && to > 0 ? to - from : 0;
+}
+
+} // namespace
+
+
+int MiraoLatencyHistogram::Bucket(unsigned long us)
+{
+	if (us < MIRAO_HISTOGRAM_SUB)
+		return (int)us;
+	int exponent = subBits;
+	while ((us >> (exponent + 1)) != 0)
+		++exponent;
+	int sub = (int)(us >> (exponent - subBits)) - MIRAO_HISTOGRAM_SUB;
+	return MIRAO_HISTOGRAM_SUB * (exponent - subBits + 1) + sub;
+}
+
+double MiraoLatencyHistogram::BucketEnd(int bucket)
+{
+	if (bucket < MIRAO_HISTOGRAM_SUB)
+		return bucket + 1;
+	int shift = bucket / MIRAO_HISTOGRAM_SUB - 1;
+	int sub = bucket % MIRAO_HISTOGRAM_SUB;
+	return (MIRAO_HISTOGRAM_SUB + sub + 1) * (double)(1UL << shift);
+}
+
+void MiraoLatencyHistogram::Record(double us)
+{
+	if (us < 0)
+		us = 0;
+	const double limit = (double)(1UL << MIRAO_HISTOGRAM_MAX_EXP) - 1;
+	int bucket = Bucket((unsigned long)(us < limit ? us : limit));
+	counts_[bucket] = counts_[bucket] + 1;
+	sum_ = sum_ + us;
+	if (us > max_)
+		max_ = us;
+	MIRAO_MEMORY_BARRIER();
+	count_ = count_ + 1;
+}
+
+void MiraoLatencyHistogram::Reset()
+{
+	for (int b = 0; b < MIRAO_HISTOGRAM_BUCKETS; ++b)
+		counts_[b] = 0;
+	sum_ = 0;
+	max_ = 0;
+	count_ = 0;
+}
+
+double MiraoLatencyHistogram::Percentile(double fraction) const
+{
+	const long count = count_;
+	if (count == 0)
+		return 0;
+	long target = (long)(fraction * count + 0.5);
+	if (target < 1)
+		target = 1;
+	long seen = 0;
+	for (int b = 0; b < MIRAO_HISTOGRAM_BUCKETS; ++b)
+	{
+		seen += counts_[b];
+		if (seen >= target)
+			return b < MIRAO_HISTOGRAM_BUCKETS - 1 && BucketEnd(b) < max_ ? BucketEnd(b) : max_;
+	}
+	return max_;
+}
+
+
+MiraoTelemetry::MiraoTelemetry()
+{
+	for (int i = 0; i < MIRAO_TELEMETRY_LENGTH; ++i)
+	{
+		MiraoTelemetryRecord empty = { 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+		ring_[i].record = empty;
+	}
+}
+
+void MiraoTelemetry::Record(const MiraoTelemetryRecord& record)
+{
+	if (reset_.Get())
+	{
+		for (int l = 0; l < MIRAO_NB_LATENCIES; ++l)
+			latencies_[l].Reset();
+		reset_.Set(0);
+	}
+	latencies_[MIRAO_LATENCY_QUEUE].Record(Elapsed(record.requested, record.started));
+	if (record.sdkStart > 0)
+		latencies_[MIRAO_LATENCY_SDK].Record(Elapsed(record.sdkStart, record.sdkEnd));
+	latencies_[MIRAO_LATENCY_SETTLED].Record(Elapsed(record.requested, record.settled));
+
+	const long written = written_.Get();
+	Slot& slot = ring_[written % MIRAO_TELEMETRY_LENGTH];
+	slot.version.Increment();
+	slot.record = record;
+	slot.version.Increment();
+	written_.Set(written + 1);
+}
+
+bool MiraoTelemetry::Get(int count, MiraoTelemetryRecord& record) const
+{
+	const long written = written_.Get();
+	if (count < 0 || count >= MIRAO_TELEMETRY_LENGTH || count >= written)
+		return false;
+	const Slot& slot = ring_[(written - 1 - count) % MIRAO_TELEMETRY_LENGTH];
+	long version = slot.version.Get();
+	if (version & 1)
+		return false;
+	record = slot.record;
+	return slot.version.Get() == version;
+}
+
+double MiraoTelemetry::GetAppliesPerSecond(double now) const
+{
+	int applies = 0;
+	MiraoTelemetryRecord record;
+	for (int count = 0; Get(count, record) && record.started > now - 1e6; ++count)
+		if (record.sdkStart > 0 && record.sdkEnd > now - 1e6)
+			++applies;
+	return applies;
+}
+
+bool MiraoTelemetry::Dump(const std::string& path) const
+{
+	std::ofstream file(path.c_str(), std::ios::out | std::ios::trunc);
+	if (!file)
+		return false;
+	file.precision(15);
+	file << "sequence,type,requested_us,enqueued_us,started_us,sdk_start_us,sdk_end_us,settled_us,result,queue_us,sdk_us,settled_latency_us\n";
+	MiraoTelemetryRecord record;
+	for (int count = MIRAO_TELEMETRY_LENGTH - 1; count >= 0; --count)
+	{
+		if (!Get(count, record))
+			continue;
+		file << record.sequence << "," << record.type << "," << record.requested << "," << record.enqueued << ","
+			<< record.started << "," << record.sdkStart << "," << record.sdkEnd << "," << record.settled << "," << record.result << ","
+			<< Elapsed(record.requested, record.started) << "," << Elapsed(record.sdkStart, record.sdkEnd) << ","
+			<< Elapsed(record.requested, record.settled) << "\n";
+	}
+	file << "\nlatency,count,mean_us,p50_us,p90_us,p99_us,max_us\n";
+	for (int l = 0; l < MIRAO_NB_LATENCIES; ++l)
+	{
+		const MiraoLatencyHistogram& h = latencies_[l];
+		file << latencyNames[l] << "," << h.Count() << "," << h.Mean() << "," << h.Percentile(0.5) << ","
+			<< h.Percentile(0.9) << "," << h.Percentile(0.99) << "," << h.Max() << "\n";
+	}
+	return !file.fail();
+}
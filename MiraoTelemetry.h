@@ -0,0 +1,114 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          MiraoTelemetry.h
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     DeviceAdapters
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Timing of the MIRAO-52E mirror update path: a ring of
+//                per-command timestamps and latency histograms
+//
+// AUTHOR:        Marijn Siemons
+
+#pragma once
+
+#include <string>
+#include "MiraoSync.h"
+
+#define MIRAO_TELEMETRY_LENGTH		1024
+
+// Histogram buckets: exact below MIRAO_HISTOGRAM_SUB us, then every power of
+// two split in MIRAO_HISTOGRAM_SUB buckets, up to 2^MIRAO_HISTOGRAM_MAX_EXP us
+#define MIRAO_HISTOGRAM_SUB			16
+#define MIRAO_HISTOGRAM_MAX_EXP		31
+#define MIRAO_HISTOGRAM_BUCKETS		(MIRAO_HISTOGRAM_SUB * (MIRAO_HISTOGRAM_MAX_EXP - 3))
+
+// Latencies kept as histograms
+#define MIRAO_LATENCY_QUEUE			0	// request to execution start: lock and queue wait
+#define MIRAO_LATENCY_SDK			1	// SDK call
+#define MIRAO_LATENCY_SETTLED		2	// request to mirror settled
+#define MIRAO_NB_LATENCIES			3
+
+// Timestamps [us, MM time] of one executed mirror command; 0 where a stage
+// was not reached (no SDK call for a suppressed write)
+struct MiraoTelemetryRecord
+{
+	long sequence;
+	int type;
+	double requested;	// entered the device, before any lock
+	double enqueued;	// in the command queue
+	double started;		// picked up by the worker
+	double sdkStart;
+	double sdkEnd;
+	double settled;		// settling time over
+	int result;			// of ExecuteCommand(), DEVICE_OK (0) unless the mirror update failed
+};
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Latency histogram with a relative precision of 1 / MIRAO_HISTOGRAM_SUB over
+// the whole range (HDR histogram layout). Written by one thread; readers may
+// see a recording in progress, which only shifts a percentile by one count.
+//
+class MiraoLatencyHistogram
+{
+public:
+	MiraoLatencyHistogram() { Reset(); }
+
+	void Record(double us);
+	void Reset();
+
+	long Count() const { return count_; }
+	double Max() const { return max_; }
+	double Mean() const { return count_ > 0 ? sum_ / count_ : 0; }
+	// Upper edge of the bucket holding the given fraction (0..1) of the values,
+	// capped at the largest value, which the open-ended last bucket reports
+	double Percentile(double fraction) const;
+
+private:
+	static int Bucket(unsigned long us);
+	static double BucketEnd(int bucket);
+
+	volatile long counts_[MIRAO_HISTOGRAM_BUCKETS];
+	volatile long count_;
+	volatile double sum_;
+	volatile double max_;
+};
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Ring of the last MIRAO_TELEMETRY_LENGTH executed commands and the latency
+// histograms over all of them since the last reset. Record() is called from
+// the mirror worker thread only; every slot carries a version that is odd
+// while it is written, so readers copy records without taking a lock.
+//
+class MiraoTelemetry
+{
+public:
+	MiraoTelemetry();
+
+	void Record(const MiraoTelemetryRecord& record);
+	// Clears the histograms; the ring keeps its records
+	void Reset() { reset_.Set(1); }
+
+	// Copy of the record written count-th last (0 is the latest), false if
+	// there is none or it was overwritten while copying
+	bool Get(int count, MiraoTelemetryRecord& record) const;
+	const MiraoLatencyHistogram& GetLatency(int latency) const { return latencies_[latency]; }
+	// Commands that reached the SDK in the second before now
+	double GetAppliesPerSecond(double now) const;
+	long GetRecorded() const { return written_.Get(); }
+
+	// Ring and histogram summary as CSV, oldest record first
+	bool Dump(const std::string& path) const;
+
+private:
+	struct Slot
+	{
+		MiraoAtomicLong version;
+		MiraoTelemetryRecord record;
+	};
+
+	Slot ring_[MIRAO_TELEMETRY_LENGTH];
+	MiraoAtomicLong written_;
+	MiraoAtomicLong reset_;
+	MiraoLatencyHistogram latencies_[MIRAO_NB_LATENCIES];
+};
@@ -0,0 +1,331 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          MiraoWorker.h
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     DeviceAdapters
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Mirror command queue and the worker thread that owns all
+//                mirror updates of the MIRAO-52E
+//
+// AUTHOR:        Marijn Siemons
+
+#pragma once
+
+#include <string>
+#include "../../MMDevice/DeviceThreads.h"
+#include "../../MMDevice/DeviceUtils.h"
+#include "MiraoProjector.h"
+#include "MiraoSync.h"
+#include "MiraoTelemetry.h"
+
+#define MIRAO_QUEUE_LENGTH		64
+#define MIRAO_RESULT_HISTORY	256		// results kept for GetResult(), more than a full queue
+
+struct MiraoCommand
+{
+	MiraoCommand() : type(ApplyZernikes), sequence(0), preset(0), requested_us(0), enqueued_us(0) {}
+
+	enum Type
+	{
+		ApplyZernikes,		// move to the absolute Zernike vector in zernikes
+		LoadWavefront,		// apply the .wcs file in path, Zernikes reset to 0
+		ApplyActuators,		// move to the actuator commands in actuators, Zernikes reset to 0
+		ApplyPreset			// move to the device's wavefront preset number preset, Zernikes reset to 0
+	};
+
+	int type;
+	long sequence;
+	float zernikes[MIRAO_MAX_ZERNIKES + 1];
+	float actuators[MIRAO_NB_ACTUATORS];
+	int preset;
+	std::string path;
+	double requested_us;	// when the request entered the device, 0 for when it is submitted
+	double enqueued_us;
+};
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Drains the command queue and calls device->ExecuteCommand() for what is
+// left after coalescing: Zernike targets are absolute, so only the last one
+// counts, and a wavefront load, preset or actuator vector supersedes every
+// command queued before it.
+// Every executed command is timed into a MiraoTelemetry: the device reports
+// its SDK call through SdkCalled() and its settling through GetSettleEnd().
+// The result of every command is kept by its sequence number; a coalesced
+// command gets the result of the command that superseded it. Failures are
+// counted and the last one is kept for GetLastError().
+//
+template <class TDevice>
+class MiraoMirrorWorker : public MMDeviceThreadBase
+{
+public:
+	MiraoMirrorWorker(TDevice* device) :
+		device_(device),
+		stop_(true),
+		sdkstart_us_(0),
+		sdkend_us_(0),
+		active_(false)
+	{
+	}
+
+	~MiraoMirrorWorker()
+	{
+		Stop();
+	}
+
+	void Start()
+	{
+		if (active_)
+			return;
+		// commands submitted while stopped are dropped
+		MiraoCommand command;
+		while (queue_.Pop(command))
+			;
+		completed_.Set(submitted_.Get());
+		stop_.Set(0);
+		active_ = true;
+		activate();
+	}
+
+	// The commands queued so far are executed before the thread exits
+	void Stop()
+	{
+		if (!active_)
+			return;
+		stop_.Set(1);
+		wakeup_.Set();
+		wait();
+		active_ = false;
+		completed_.Set(submitted_.Get());
+	}
+
+	// Producer side; callers serialise themselves so there is a single producer
+	long Submit(MiraoCommand& command)
+	{
+		command.sequence = submitted_.Get() + 1;
+		if (command.requested_us == 0)
+			command.requested_us = Now();
+		command.enqueued_us = Now();
+		while (!queue_.Push(command))
+		{
+			wakeup_.Set();
+			CDeviceUtils::SleepMs(1);
+			command.enqueued_us = Now();
+		}
+		submitted_.Set(command.sequence);
+		wakeup_.Set();
+		return command.sequence;
+	}
+
+	// Blocks until every submitted command has been executed, or the worker
+	// is stopped
+	void Flush()
+	{
+		while (completed_.Get() < submitted_.Get() && !stop_.Get())
+			CDeviceUtils::SleepMs(1);
+	}
+
+	// Result of an executed command; DEVICE_OK while it is pending and once it
+	// is more than MIRAO_RESULT_HISTORY commands old
+	int GetResult(long sequence) const
+	{
+		const Result& slot = results_[sequence % MIRAO_RESULT_HISTORY];
+		if (slot.sequence.Get() != sequence)
+			return DEVICE_OK;
+		int result = (int)slot.result.Get();
+		return slot.sequence.Get() == sequence ? result : DEVICE_OK;
+	}
+
+	bool IsIdle() const { return completed_.Get() >= submitted_.Get() || stop_.Get(); }
+	int GetQueueDepth() const { return queue_.Size(); }
+	long GetSubmitted() const { return submitted_.Get(); }
+	long GetCompleted() const { return completed_.Get(); }
+	long GetCoalesced() const { return coalesced_.Get(); }
+	long GetFailed() const { return failed_.Get(); }
+	// Error of the last command that failed, DEVICE_OK if none did
+	int GetLastError() const { return (int)lasterror_.Get(); }
+	const MiraoTelemetry& GetTelemetry() const { return telemetry_; }
+	void ResetTelemetry() { telemetry_.Reset(); }
+
+	// Called by the device from ExecuteCommand(), around its SDK call
+	void SdkCalled(double start_us, double end_us)
+	{
+		sdkstart_us_ = start_us;
+		sdkend_us_ = end_us;
+	}
+
+	int svc()
+	{
+		MiraoCommand command;
+		MiraoCommand zernikes;
+		MiraoCommand absolute;
+		for (;;)
+		{
+			// a stop drains what is queued before the thread exits
+			bool stopping = stop_.Get() != 0;
+			if (!stopping)
+				wakeup_.Wait(100);
+
+			bool haveZernikes = false;
+			bool haveAbsolute = false;
+			long first = 0;
+			long last = 0;
+			long popped = 0;
+			while (queue_.Pop(command))
+			{
+				if (popped == 0)
+					first = command.sequence;
+				if (command.type != MiraoCommand::ApplyZernikes)
+				{
+					absolute = command;
+					haveAbsolute = true;
+					haveZernikes = false;
+				}
+				else
+				{
+					zernikes = command;
+					haveZernikes = true;
+				}
+				last = command.sequence;
+				++popped;
+			}
+			if (popped == 0)
+			{
+				if (stopping)
+					break;
+				continue;
+			}
+
+			long executed = 0;
+			int absoluteResult = DEVICE_OK;
+			int zernikesResult = DEVICE_OK;
+			if (haveAbsolute)
+			{
+				absoluteResult = Execute(absolute);
+				++executed;
+			}
+			if (haveZernikes)
+			{
+				zernikesResult = Execute(zernikes);
+				++executed;
+			}
+			for (long sequence = first; sequence <= last; sequence++)
+				SetResult(sequence, haveAbsolute && sequence <= absolute.sequence ? absoluteResult : zernikesResult);
+			coalesced_.Add(popped - executed);
+			completed_.Set(last);
+		}
+		return 0;
+	}
+
+private:
+	double Now() const { return device_->GetCurrentMMTime().getUsec(); }
+
+	struct Result
+	{
+		MiraoAtomicLong sequence;
+		MiraoAtomicLong result;
+	};
+
+	void SetResult(long sequence, int result)
+	{
+		Result& slot = results_[sequence % MIRAO_RESULT_HISTORY];
+		slot.sequence.Set(0);
+		slot.result.Set(result);
+		slot.sequence.Set(sequence);
+	}
+
+	int Execute(const MiraoCommand& command)
+	{
+		MiraoTelemetryRecord record = { command.sequence, command.type, command.requested_us, command.enqueued_us, Now(), 0, 0, 0, 0 };
+		sdkstart_us_ = sdkend_us_ = 0;
+		record.result = device_->ExecuteCommand(command);
+		if (record.result != DEVICE_OK)
+		{
+			failed_.Increment();
+			lasterror_.Set(record.result);
+		}
+		record.sdkStart = sdkstart_us_;
+		record.sdkEnd = sdkend_us_;
+		// a suppressed write leaves the previous settling end, which may be past
+		double settled = device_->GetSettleEnd().getUsec();
+		double now = Now();
+		record.settled = settled > now ? settled : now;
+		telemetry_.Record(record);
+		return record.result;
+	}
+
+	TDevice* device_;
+	MiraoSpscQueue<MiraoCommand, MIRAO_QUEUE_LENGTH> queue_;
+	MiraoEvent wakeup_;
+	MiraoAtomicLong stop_;
+	MiraoAtomicLong submitted_;
+	MiraoAtomicLong completed_;
+	MiraoAtomicLong coalesced_;
+	MiraoAtomicLong failed_;
+	MiraoAtomicLong lasterror_;
+	Result results_[MIRAO_RESULT_HISTORY];
+	MiraoTelemetry telemetry_;
+	double sdkstart_us_;
+	double sdkend_us_;
+	bool active_;
+};
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Runs one device method on its own thread, e.g. to overlap independent
+// loads during Initialize(). Join() waits for it and returns its result.
+//
+template <class TDevice>
+class MiraoTask : public MMDeviceThreadBase
+{
+public:
+	typedef int (TDevice::*Method)();
+
+	MiraoTask(TDevice* device, Method method) :
+		device_(device),
+		method_(method),
+		result_(DEVICE_OK),
+		elapsed_ms_(0),
+		active_(false)
+	{
+	}
+
+	~MiraoTask()
+	{
+		Join();
+	}
+
+	void Start()
+	{
+		if (active_)
+			return;
+		active_ = true;
+		activate();
+	}
+
+	int Join()
+	{
+		if (active_)
+		{
+			wait();
+			active_ = false;
+		}
+		return result_;
+	}
+
+	double GetElapsedMs() const { return elapsed_ms_; }
+
+	int svc()
+	{
+		MM::MMTime start = device_->GetCurrentMMTime();
+		result_ = (device_->*method_)();
+		elapsed_ms_ = (device_->GetCurrentMMTime() - start).getMsec();
+		return 0;
+	}
+
+private:
+	TDevice* device_;
+	Method method_;
+	int result_;
+	double elapsed_ms_;
+	bool active_;
+};
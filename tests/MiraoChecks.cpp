@@ -0,0 +1,1254 @@
+///////////////////////////////////////////////////////////////////////////////
+// FILE:          MiraoChecks.cpp
+// PROJECT:       Micro-Manager
+// SUBSYSTEM:     DeviceAdapters
+//-----------------------------------------------------------------------------
+// DESCRIPTION:   Checks of the parts of the MIRAO-52E adapter that run without
+//                the Imagine Optic SDK: projection and its cache, the command
+//                queue, write deadband, image metrics, presets, depth and
+//                field corrections, telemetry, calibration swaps, the
+//                simulated mirror and device, phase diversity, Shack-Hartmann
+//                centroiding and the closed loop. Each check prints its
+//                result and timing; the exit code is the number of failures.
+//                Run from the adapter directory, which holds MIRAO/init.
+//
+// AUTHOR:        Marijn Siemons
+
+#include <algorithm>
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "../../../MMDevice/ModuleInterface.h"
+#include "../MiraoCalibrationSet.h"
+#include "../MiraoDepth.h"
+#include "../MiraoDiversity.h"
+#include "../MiraoField.h"
+#include "../MiraoLoop.h"
+#include "../MiraoMetric.h"
+#include "../MiraoModes.h"
+#include "../MiraoPresets.h"
+#include "../MiraoProjector.h"
+#include "../MiraoPsf.h"
+#include "../MiraoShackHartmann.h"
+#include "../MiraoSimBackend.h"
+#include "../MiraoSync.h"
+#include "../MiraoTelemetry.h"
+#include "../MiraoWorker.h"
+
+namespace {
+
+const char* calibPath = "MIRAO/init/MIRAO_calibration.aomi";
+const char* calibParamsPath = "MIRAO/init/Diversity_calibration.xml";
+const char* prefsPath = "MIRAO/init/Diversity_prefs.xml";
+const char* wfcPath = "MIRAO/init/WavefrontCorrection.wcs";
+const char* presetsPath = "MIRAO/init/WavefrontPresets.xml";
+const char* presetPath = "MiraoChecks.wcs";
+const char* cachePath = "MiraoChecks.cache";
+
+int failures = 0;
+
+bool Check(bool passed, const char* format, ...)
+{
+	printf(passed ? "  ok    " : "  FAIL  ");
+	va_list args;
+	va_start(args, format);
+	vprintf(format, args);
+	va_end(args);
+	printf("\n");
+	if (!passed)
+		++failures;
+	return passed;
+}
+
+// Repeatable test data on every platform
+double Uniform(unsigned long& seed)
+{
+	seed = (seed * 1103515245UL + 12345UL) & 0x7fffffffUL;
+	return seed / 2147483648.0;
+}
+
+// RMS over the slopes of the interaction matrix times (a - b) [mrad]
+double SlopeError(const MiraoCalibration& calib, const float* a, const float* b)
+{
+	const int nbSlopes = 2 * calib.nbValidSubap;
+	double squares = 0;
+	for (int r = 0; r < nbSlopes; ++r)
+	{
+		double s = 0;
+		for (int i = 0; i < calib.nbActuators; ++i)
+			s += calib.matrix[r * calib.nbActuators + i] * (a[i] - b[i]);
+		squares += s * s;
+	}
+	return std::sqrt(squares / nbSlopes);
+}
+
+// Slopes of the given actuator offsets from ref, plus the offset slopes
+void Slopes(const MiraoCalibration& calib, const std::vector<double>& offset, const float* actuators, const float* ref, std::vector<double>& slopes)
+{
+	slopes = offset;
+	for (size_t r = 0; r < slopes.size(); ++r)
+		for (int i = 0; i < calib.nbActuators; ++i)
+			slopes[r] += calib.matrix[r * calib.nbActuators + i] * (actuators[i] - ref[i]);
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Projection: linear in range, box-constrained beyond, and the cache
+//
+void CheckProjector(const MiraoCalibration& calib, const MiraoWavefrontState& wfc)
+{
+	printf("Projector\n");
+	const int nbModes = MIRAO_MAX_ZERNIKES;
+
+	double start = MiraoClock();
+	MiraoCalibration parsed;
+	MiraoProjector projector;
+	bool built = parsed.Load(calibPath) && projector.Build(parsed, nbModes);
+	const double build_ms = (MiraoClock() - start) / 1000;
+	Check(built, "parse and build %d modes: %.1f ms", nbModes, build_ms);
+
+	const unsigned long long hash = MiraoFileHash(calibPath);
+	MiraoCalibration cached;
+	MiraoProjector fromCache;
+	bool saved = projector.SaveCache(cachePath, hash, parsed);
+	start = MiraoClock();
+	bool loaded = saved && fromCache.LoadCache(cachePath, hash, cached, nbModes);
+	const double cache_ms = (MiraoClock() - start) / 1000;
+	bool same = loaded && cached.matrix == parsed.matrix && cached.pupil == parsed.pupil;
+	for (int j = 1; same && j <= nbModes; ++j)
+		same = memcmp(fromCache.GetColumn(j), projector.GetColumn(j), MIRAO_NB_ACTUATORS * sizeof(float)) == 0;
+	Check(same, "cache round trip: %.2f ms instead of %.1f ms", cache_ms, build_ms);
+	Check(!fromCache.LoadCache(cachePath, hash + 1, cached, nbModes), "cache of another calibration is refused");
+	Check(!fromCache.LoadCache(cachePath, hash, cached, nbModes - 1), "cache of another number of modes is refused");
+	remove(cachePath);
+
+	projector.SetBase(wfc.position);
+	projector.SetLimits(wfc.minCommand, wfc.maxCommand);
+
+	// in range: base + C z
+	float zernikes[MIRAO_MAX_ZERNIKES + 1] = { 0 };
+	zernikes[1] = 0.02f;
+	zernikes[3] = 0.05f;
+	zernikes[8] = -0.01f;
+	float actuators[MIRAO_NB_ACTUATORS];
+	float linear[MIRAO_NB_ACTUATORS];
+	projector.Project(zernikes, nbModes, actuators);
+	memcpy(linear, wfc.position, sizeof(linear));
+	projector.ProjectDelta(zernikes, nbModes, linear);
+	double difference = 0;
+	for (int i = 0; i < MIRAO_NB_ACTUATORS; ++i)
+		difference = std::max(difference, (double)std::fabs(actuators[i] - linear[i]));
+	Check(difference < 1e-6 && projector.GetSaturated() == 0 && projector.GetResidual() == 0,
+		"request in range is linear: largest difference %.2g", difference);
+
+	// far out of range: the solve respects the limits and beats clipping
+	float request[MIRAO_MAX_ZERNIKES + 1] = { 0 };
+	request[3] = 20.0f;
+	request[4] = 5.0f;
+	request[8] = 3.0f;
+	MiraoProjector cold = projector;
+	start = MiraoClock();
+	cold.Project(request, nbModes, actuators);
+	const double cold_us = MiraoClock() - start;
+	bool within = true;
+	for (int i = 0; i < MIRAO_NB_ACTUATORS; ++i)
+		within = within && actuators[i] >= wfc.minCommand[i] && actuators[i] <= wfc.maxCommand[i];
+	Check(within, "constrained solve within the limits: %d actuators saturated, %.0f us cold",
+		cold.GetSaturated(), cold_us);
+
+	const int repeats = 200;
+	start = MiraoClock();
+	for (int k = 0; k < repeats; ++k)
+	{
+		request[1] = 0.01f * (k % 10);
+		cold.Project(request, nbModes, actuators);
+	}
+	Check(true, "constrained solve warm: %.1f us", (MiraoClock() - start) / repeats);
+
+	request[1] = 0;
+	cold.Project(request, nbModes, actuators);
+	float clipped[MIRAO_NB_ACTUATORS];
+	memcpy(linear, wfc.position, sizeof(linear));
+	cold.ProjectDelta(request, nbModes, linear);
+	wfc.Limit(linear, clipped);
+	const double constrained = SlopeError(calib, actuators, linear);
+	const double clipping = SlopeError(calib, clipped, linear);
+	Check(constrained < clipping, "RMS slope error %.3f mrad, %.1f times lower than clipping",
+		constrained, clipping / constrained);
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Command queue: the lock-free ring in order across threads, and the worker
+// coalescing what queued up behind a slow mirror update
+//
+class QueueProducer : public MMDeviceThreadBase
+{
+public:
+	QueueProducer(MiraoSpscQueue<long, 1024>& queue, long count) : queue_(queue), count_(count) {}
+
+	int svc()
+	{
+		for (long i = 1; i <= count_; ++i)
+			while (!queue_.Push(i))
+				;
+		return 0;
+	}
+
+private:
+	MiraoSpscQueue<long, 1024>& queue_;
+	long count_;
+};
+
+// Executes commands for MiraoMirrorWorker, each taking the given delay so the
+// next ones queue up behind it. A wavefront load without a path fails.
+class QueueDevice
+{
+public:
+	QueueDevice() : delay_ms_(0), entered_(0) {}
+
+	MM::MMTime GetCurrentMMTime() { return MM::MMTime(MiraoClock()); }
+	MM::MMTime GetSettleEnd() { return MM::MMTime(0.0); }
+
+	int ExecuteCommand(const MiraoCommand& command)
+	{
+		entered_.Increment();
+		CDeviceUtils::SleepMs(delay_ms_.Get());
+		executed_.push_back(command.sequence);
+		return command.type == MiraoCommand::LoadWavefront && command.path.empty() ? DEVICE_ERR : DEVICE_OK;
+	}
+
+	void SetDelay(long delay_ms) { delay_ms_.Set(delay_ms); }
+	long GetEntered() const { return entered_.Get(); }
+	const std::vector<long>& GetExecuted() const { return executed_; }
+
+private:
+	MiraoAtomicLong delay_ms_;
+	MiraoAtomicLong entered_;
+	std::vector<long> executed_;
+};
+
+void CheckCommandQueue()
+{
+	printf("Command queue\n");
+	MiraoSpscQueue<long, 8> ring;
+	long item = 0;
+	bool ordered = true;
+	for (int round = 0; round < 3; ++round)
+	{
+		long pushed = 0;
+		while (ring.Push(100 * round + pushed))
+			++pushed;
+		ordered = ordered && pushed == ring.Capacity() && ring.Size() == ring.Capacity();
+		for (long i = 0; i < pushed; ++i)
+			ordered = ordered && ring.Pop(item) && item == 100 * round + i;
+		ordered = ordered && !ring.Pop(item) && ring.Size() == 0;
+	}
+	Check(ordered, "ring of %d holds %d, in order across the wrap", 8, ring.Capacity());
+
+	// a longer ring, so a single core switches threads once per ring rather
+	// than once per item
+	MiraoSpscQueue<long, 1024> stream;
+	const long count = 200000;
+	QueueProducer producer(stream, count);
+	double start = MiraoClock();
+	producer.activate();
+	long expected = 1;
+	while (expected <= count)
+	{
+		if (!stream.Pop(item))
+			continue;
+		if (item != expected)
+			break;
+		++expected;
+	}
+	producer.wait();
+	Check(expected == count + 1, "%ld items between two threads in order, %.0f ns each",
+		count, (MiraoClock() - start) * 1000 / count);
+
+	// A slow update holds the worker while two Zernike targets, a failing
+	// wavefront load and two more targets queue up behind it
+	QueueDevice device;
+	MiraoMirrorWorker<QueueDevice> worker(&device);
+	worker.Start();
+	MiraoCommand zernikes;
+	MiraoCommand load;
+	load.type = MiraoCommand::LoadWavefront;
+	device.SetDelay(50);
+	worker.Submit(zernikes);
+	while (device.GetEntered() == 0)
+		CDeviceUtils::SleepMs(1);
+	long sequence[6];
+	for (int k = 1; k <= 5; ++k)
+		sequence[k] = worker.Submit(k == 3 ? load : zernikes);
+	worker.Flush();
+	device.SetDelay(0);
+	const std::vector<long>& executed = device.GetExecuted();
+	Check(executed.size() == 3 && executed[1] == sequence[3] && executed[2] == sequence[5] && worker.GetCoalesced() == 3,
+		"the load and the last target run, %ld commands coalesced", worker.GetCoalesced());
+	Check(worker.GetResult(sequence[1]) == DEVICE_ERR && worker.GetResult(sequence[2]) == DEVICE_ERR &&
+		worker.GetResult(sequence[3]) == DEVICE_ERR && worker.GetResult(sequence[4]) == DEVICE_OK &&
+		worker.GetResult(sequence[5]) == DEVICE_OK && worker.GetFailed() == 1 && worker.GetLastError() == DEVICE_ERR,
+		"the failed load is reported for itself and the targets it superseded");
+
+	const int repeats = 10000;
+	size_t before = executed.size();
+	start = MiraoClock();
+	for (int k = 0; k < repeats; ++k)
+		worker.Submit(zernikes);
+	const double submit_us = (MiraoClock() - start) / repeats;
+	worker.Flush();
+	Check(worker.IsIdle(), "%d targets submitted at %.2f us each, %d executed", repeats, submit_us,
+		(int)(executed.size() - before));
+
+	// Stop() runs what is still queued before the thread exits
+	before = executed.size();
+	const long entered = device.GetEntered();
+	device.SetDelay(20);
+	worker.Submit(zernikes);
+	while (device.GetEntered() == entered)
+		CDeviceUtils::SleepMs(1);
+	worker.Submit(load);
+	worker.Submit(zernikes);
+	worker.Stop();
+	Check(executed.size() == before + 3 && worker.GetCompleted() == worker.GetSubmitted() && worker.IsIdle(),
+		"Stop() executes the commands still queued");
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Deadband: actuator changes counted in DAC steps after rounding to a step
+//
+void CheckDeadband(const MiraoWavefrontState& wfc)
+{
+	printf("Write deadband\n");
+	const double step = 2.0 / 65536;
+	float centred[MIRAO_NB_ACTUATORS];
+	for (int i = 0; i < MIRAO_NB_ACTUATORS; ++i)
+		centred[i] = (float)(std::floor(wfc.position[i] / step) * step);
+	float below[MIRAO_NB_ACTUATORS];
+	for (int i = 0; i < MIRAO_NB_ACTUATORS; ++i)
+		below[i] = centred[i] + (float)(0.4 * step);
+	bool rounded = MiraoCommandSteps(centred, centred, step) == 0 && MiraoCommandSteps(below, centred, step) == 0;
+	below[7] = centred[7] + (float)(3.2 * step);
+	below[12] = centred[12] - (float)(4.2 * step);
+	rounded = rounded && MiraoCommandSteps(below, centred, step) == 4 && MiraoCommandSteps(centred, below, step) == 4;
+	Check(rounded, "largest actuator change in DAC steps, either way");
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Metrics against plain loops, on the calling thread and in the pool
+//
+void CheckMetrics()
+{
+	printf("Metrics\n");
+	const int size = 2048;
+	MiraoFrame frame;
+	frame.width = frame.height = size;
+	frame.pixels.resize((size_t)size * size);
+	unsigned long seed = 7;
+	for (int y = 0; y < size; ++y)
+	{
+		for (int x = 0; x < size; ++x)
+		{
+			const double r2 = ((x - 1000.0) * (x - 1000.0) + (y - 1100.0) * (y - 1100.0)) / (2 * 40.0 * 40.0);
+			frame.pixels[(size_t)y * size + x] = (unsigned short)(100 + 60000 * std::exp(-r2) + 50 * Uniform(seed));
+		}
+	}
+
+	double sum = 0;
+	double squares = 0;
+	double gradient = 0;
+	unsigned short peak = 0;
+	for (int y = 0; y < size; ++y)
+	{
+		for (int x = 0; x < size; ++x)
+		{
+			const double v = frame.pixels[(size_t)y * size + x];
+			sum += v;
+			squares += v * v;
+			peak = std::max(peak, frame.pixels[(size_t)y * size + x]);
+			if (x + 1 < size)
+				gradient += std::pow(frame.pixels[(size_t)y * size + x + 1] - v, 2);
+			if (y + 1 < size)
+				gradient += std::pow(frame.pixels[(size_t)(y + 1) * size + x] - v, 2);
+		}
+	}
+	double expected[MIRAO_NB_METRICS];
+	expected[MIRAO_METRIC_SHARPNESS] = squares / (sum * sum);
+	expected[MIRAO_METRIC_MAXIMUM] = peak;
+	expected[MIRAO_METRIC_VARIANCE] = (double)size * size * squares / (sum * sum) - 1.0;
+	expected[MIRAO_METRIC_GRADIENT] = gradient / (sum * sum);
+	expected[MIRAO_METRIC_BAND] = 0;
+
+	std::vector<MiraoFrame> pooled(MIRAO_NB_METRICS, frame);
+	MiraoMetricPool pool;
+	pool.Start(4);
+	for (int metric = 0; metric < MIRAO_NB_METRICS; ++metric)
+	{
+		pooled[metric].metric = metric;
+		pool.Submit(&pooled[metric]);
+	}
+	pool.Wait();
+	pool.Stop();
+
+	for (int metric = 0; metric < MIRAO_NB_METRICS; ++metric)
+	{
+		const int repeats = 10;
+		double merit = 0;
+		const double start = MiraoClock();
+		for (int k = 0; k < repeats; ++k)
+			merit = MiraoMerit(&frame.pixels[0], size, size, metric);
+		const double elapsed_ms = (MiraoClock() - start) / 1000 / repeats;
+		const double error = metric == MIRAO_METRIC_BAND ? 0 : std::fabs(merit / expected[metric] - 1);
+		const double poolError = std::fabs(pooled[metric].merit / merit - 1);
+		Check(merit > 0 && error < 1e-6 && poolError < 1e-9, "%s at %dx%d: %.2f ms, relative error %.1g, pool %.1g",
+			g_miraoMetrics[metric], size, size, elapsed_ms, error, poolError);
+	}
+
+	std::vector<unsigned short> flat((size_t)256 * 256, 1000);
+	Check(MiraoMerit(&flat[0], 256, 256, MIRAO_METRIC_BAND) < 1e-12 &&
+		std::fabs(MiraoMerit(&flat[0], 256, 256, MIRAO_METRIC_VARIANCE)) < 1e-12, "flat frame has no band energy or variance");
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Preset library: list file, replacement by name, stored states, full table
+//
+void CheckPresets(const MiraoWavefrontState& wfc)
+{
+	printf("Wavefront presets\n");
+	MiraoPresetLibrary library;
+	if (!Check(library.Load(presetsPath) && library.Size() == 1 && library.Find("Flat") == 0,
+		"load the preset list"))
+		return;
+	Check(memcmp(library.Get(0).state.position, wfc.position, sizeof(wfc.position)) == 0 &&
+		library.Get(0).path == wfcPath, "the preset holds the parsed wavefront");
+
+	MiraoWavefrontState state = wfc;
+	for (int i = 0; i < MIRAO_NB_ACTUATORS; ++i)
+		state.position[i] *= 0.5f;
+	const int stored = library.Add("Half", presetPath, state);
+	MiraoPresetLibrary reloaded;
+	bool same = stored == 1 && reloaded.Add("Half", presetPath) == 0;
+	for (int i = 0; same && i < MIRAO_NB_ACTUATORS; ++i)
+		same = std::fabs(reloaded.Get(0).state.position[i] - state.position[i]) < 1e-6;
+	Check(same, "a stored state is written once and reads back");
+	Check(library.Add("Flat", wfcPath) == 0 && library.Size() == 2 && library.Find("Half") == 1 && library.Find("None") < 0,
+		"adding a preset of the same name replaces it");
+
+	for (int k = library.Size(); k < MIRAO_MAX_PRESETS; ++k)
+		library.Add(std::string("Preset ") + CDeviceUtils::ConvertToString(k), wfcPath);
+	Check(library.Size() == MIRAO_MAX_PRESETS && library.Add("One more", wfcPath) < 0 && library.Add("Half", wfcPath) == 1,
+		"a full table refuses new names and still replaces");
+	Check(library.Add("Missing", "MIRAO/init/Missing.wcs") < 0, "a file that cannot be parsed is refused");
+	remove(presetPath);
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Depth table: the natural spline through unevenly spaced points
+//
+void CheckDepthTable()
+{
+	printf("Depth correction table\n");
+	const double z[] = { -20, -5, 0, 12, 30, 31 };
+	const int n = sizeof(z) / sizeof(z[0]);
+	MiraoDepthTable table;
+	float point[MIRAO_MAX_ZERNIKES + 1] = { 0 };
+	for (int i = n - 1; i >= 0; --i)
+	{
+		point[3] = (float)(0.01 * z[i]);
+		point[8] = (float)(0.2 * std::sin(z[i] / 10));
+		table.Add(z[i], point);
+	}
+
+	float value[MIRAO_MAX_ZERNIKES + 1];
+	double linear = 0;
+	double knots = 0;
+	for (double at = -30; at <= 40; at += 0.25)
+	{
+		table.Interpolate(at, true, value);
+		const double clamped = at < z[0] ? z[0] : at > z[n - 1] ? z[n - 1] : at;
+		linear = std::max(linear, std::fabs(value[3] - 0.01 * clamped));
+	}
+	for (int i = 0; i < n; ++i)
+	{
+		table.Interpolate(z[i], true, value);
+		knots = std::max(knots, std::fabs(value[8] - 0.2 * std::sin(z[i] / 10)));
+	}
+	Check(table.Size() == n && linear < 1e-5 && knots < 1e-6,
+		"spline through %d points reproduces a linear mode within %.1g and the points within %.1g", n, linear, knots);
+
+	// Continuous slope at the inner points, no curvature at the ends
+	const double h = 1e-3;
+	double slope = 0;
+	for (int i = 1; i < n - 1; ++i)
+	{
+		float left[MIRAO_MAX_ZERNIKES + 1];
+		float right[MIRAO_MAX_ZERNIKES + 1];
+		table.Interpolate(z[i] - h, true, left);
+		table.Interpolate(z[i] + h, true, right);
+		table.Interpolate(z[i], true, value);
+		slope = std::max(slope, std::fabs((value[8] - left[8]) / h - (right[8] - value[8]) / h));
+	}
+	float a[MIRAO_MAX_ZERNIKES + 1];
+	float b[MIRAO_MAX_ZERNIKES + 1];
+	float c[MIRAO_MAX_ZERNIKES + 1];
+	const double d = 0.5;
+	table.Interpolate(z[0], true, a);
+	table.Interpolate(z[0] + d, true, b);
+	table.Interpolate(z[0] + 2 * d, true, c);
+	const double curvature = std::fabs(a[8] - 2 * b[8] + c[8]) / (d * d);
+	Check(slope < 1e-3 && curvature < 1e-4, "slope continuous within %.1g at the inner points, end curvature %.1g",
+		slope, curvature);
+
+	table.Interpolate(6, false, value);
+	Check(std::fabs(value[8] - (0.5 * 0.2 * std::sin(0.0) + 0.5 * 0.2 * std::sin(1.2))) < 1e-6,
+		"linear interpolation between points");
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Field map: grid detection with bilinear interpolation, and the 2D tree
+// against a search of every point
+//
+void CheckFieldMap()
+{
+	printf("Field correction map\n");
+	MiraoFieldMap map;
+	float point[MIRAO_MAX_ZERNIKES + 1] = { 0 };
+	unsigned long seed = 11;
+	for (int iy = 0; iy < 3; ++iy)
+	{
+		for (int ix = 0; ix < 4; ++ix)
+		{
+			// positions within the grid tolerance of the lines
+			const double x = 100.0 * ix + 0.6 * (Uniform(seed) - 0.5);
+			const double y = -50.0 + 80.0 * iy + 0.6 * (Uniform(seed) - 0.5);
+			point[5] = (float)(0.001 * (100.0 * ix) - 0.002 * (-50.0 + 80.0 * iy));
+			map.Add(x, y, point);
+		}
+	}
+	float value[MIRAO_MAX_ZERNIKES + 1];
+	double worst = 0;
+	for (double y = -50; y <= 110; y += 10)
+	{
+		for (double x = 0; x <= 300; x += 25)
+		{
+			map.Interpolate(x, y, value);
+			worst = std::max(worst, std::fabs(value[5] - (0.001 * x - 0.002 * y)));
+		}
+	}
+	map.Interpolate(1000, -1000, value);
+	const double corner = std::fabs(value[5] - (0.001 * 300 + 0.002 * 50));
+	Check(map.IsGrid() && worst < 0.002 && corner < 0.002,
+		"4x3 grid found: plane within %.4f um, held at the edges", worst);
+
+	map.Add(150, 10, point);
+	Check(!map.IsGrid(), "a point off the lines leaves the grid");
+
+	map.Clear();
+	const int nbPoints = 500;
+	std::vector<double> px(nbPoints);
+	std::vector<double> py(nbPoints);
+	std::vector<float> pv(nbPoints);
+	for (int p = 0; p < nbPoints; ++p)
+	{
+		px[p] = 5000 * Uniform(seed);
+		py[p] = 5000 * Uniform(seed);
+		pv[p] = point[5] = (float)Uniform(seed);
+		map.Add(px[p], py[p], point);
+	}
+	const int nbQueries = 2000;
+	double start = MiraoClock();
+	worst = 0;
+	for (int q = 0; q < nbQueries; ++q)
+	{
+		const double x = 5200 * Uniform(seed) - 100;
+		const double y = 5200 * Uniform(seed) - 100;
+		map.Interpolate(x, y, value);
+
+		// inverse squared distance weights of the nearest points, by brute force
+		std::vector< std::pair<double, int> > distances(nbPoints);
+		for (int p = 0; p < nbPoints; ++p)
+			distances[p] = std::make_pair((x - px[p]) * (x - px[p]) + (y - py[p]) * (y - py[p]), p);
+		std::partial_sort(distances.begin(), distances.begin() + MIRAO_FIELD_NEIGHBOURS, distances.end());
+		double total = 0;
+		double expected = 0;
+		for (int k = 0; k < MIRAO_FIELD_NEIGHBOURS; ++k)
+		{
+			total += 1 / distances[k].first;
+			expected += pv[distances[k].second] / distances[k].first;
+		}
+		worst = std::max(worst, std::fabs(value[5] - expected / total));
+	}
+	const double elapsed_us = (MiraoClock() - start) / nbQueries;
+	map.Interpolate(px[17], py[17], value);
+	Check(!map.IsGrid() && worst < 1e-5 && value[5] == pv[17],
+		"%d scattered points: nearest %d as a full search within %.1g, exact on a point, %.1f us per query with the check",
+		nbPoints, MIRAO_FIELD_NEIGHBOURS, worst, elapsed_us);
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Latency histogram: bucket edges and percentiles against the sorted values
+//
+void CheckTelemetry()
+{
+	printf("Telemetry\n");
+	MiraoLatencyHistogram histogram;
+	const int count = 100000;
+	std::vector<double> values(count);
+	unsigned long seed = 5;
+	double sum = 0;
+	for (int i = 0; i < count; ++i)
+	{
+		// 1 us to 100 ms, log-uniform
+		values[i] = std::pow(10.0, 5 * Uniform(seed));
+		sum += values[i];
+		histogram.Record(values[i]);
+	}
+	std::sort(values.begin(), values.end());
+	const double fractions[] = { 0.01, 0.5, 0.9, 0.99, 0.999 };
+	bool within = true;
+	double relative = 0;
+	for (int f = 0; f < 5; ++f)
+	{
+		const double exact = values[(int)(fractions[f] * count + 0.5) - 1];
+		const double percentile = histogram.Percentile(fractions[f]);
+		within = within && percentile >= exact && percentile <= exact * (1 + 1.0 / MIRAO_HISTOGRAM_SUB) + 1;
+		relative = std::max(relative, percentile / exact - 1);
+	}
+	Check(within && histogram.Count() == count && histogram.Max() == values[count - 1] &&
+		std::fabs(histogram.Mean() / (sum / count) - 1) < 1e-9,
+		"percentiles from 1%% to 99.9%% at most %.1f%% above the values", 100 * relative);
+
+	histogram.Reset();
+	histogram.Record(3.5);
+	histogram.Record(3.7);
+	histogram.Record(1e12);
+	Check(histogram.Percentile(0.5) >= 3.7 && histogram.Percentile(0.5) <= 4 && histogram.Percentile(1) == 1e12 &&
+		histogram.Count() == 3, "small values round up, huge ones land in the last bucket");
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Calibration sets: a replaced set lives until its last reader lets go
+//
+struct CountingBackend
+{
+	// The "mirror" counts the backends alive
+	typedef MiraoAtomicLong Mirror;
+	CountingBackend(Mirror& alive) : alive_(alive) { alive_.Increment(); }
+	~CountingBackend() { alive_.Add(-1); }
+	Mirror& alive_;
+};
+
+typedef MiraoCalibrationSet<CountingBackend> CountingSet;
+
+class CalibrationReader : public MMDeviceThreadBase
+{
+public:
+	CalibrationReader(MiraoCalibrationSlot<CountingBackend>& slot, const MiraoAtomicLong& stop) :
+		slot_(slot), stop_(stop), reads_(0), missing_(0) {}
+
+	int svc()
+	{
+		while (stop_.Get() == 0)
+		{
+			MiraoCalibrationRef<CountingBackend> set(slot_);
+			if (set.get() == 0 || set->calibpath.empty())
+				++missing_;
+			++reads_;
+		}
+		return 0;
+	}
+
+	long GetReads() const { return reads_; }
+	long GetMissing() const { return missing_; }
+
+private:
+	MiraoCalibrationSlot<CountingBackend>& slot_;
+	const MiraoAtomicLong& stop_;
+	long reads_;
+	long missing_;
+};
+
+void CheckCalibrationSets()
+{
+	printf("Calibration sets\n");
+	MiraoAtomicLong alive;
+	{
+		MiraoCalibrationSlot<CountingBackend> slot;
+		slot.Publish(new CountingSet(alive, "first", "", ""));
+		{
+			MiraoCalibrationRef<CountingBackend> reader(slot);
+			slot.Publish(new CountingSet(alive, "second", "", ""));
+			Check(alive.Get() == 2 && reader->calibpath == "first", "a reader keeps the set it acquired");
+		}
+		Check(alive.Get() == 1, "the replaced set is deleted with its last reader");
+
+		MiraoAtomicLong stop;
+		CalibrationReader first(slot, stop);
+		CalibrationReader second(slot, stop);
+		first.activate();
+		second.activate();
+		const int swaps = 20000;
+		for (int k = 0; k < swaps; ++k)
+			slot.Publish(new CountingSet(alive, "swap", "", ""));
+		stop.Set(1);
+		first.wait();
+		second.wait();
+		Check(alive.Get() == 1 && first.GetMissing() + second.GetMissing() == 0,
+			"%d swaps under %ld reads, one set left", swaps, first.GetReads() + second.GetReads());
+	}
+	Check(alive.Get() == 0, "the slot releases its set");
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Simulated mirror: quantised and clipped commands, absolute states
+//
+void CheckSimMirror(const MiraoWavefrontState& wfc)
+{
+	printf("Simulated mirror\n");
+	MiraoSimBackend::Mirror mirror;
+	MiraoSimSettings settings;
+	settings.latency_ms = 0;
+	settings.settle_ms = 0.1;
+	mirror.Open("");
+	mirror.SetSettings(settings);
+	MiraoSimBackend backend(mirror);
+	Check(backend.ApplyAbsolute(wfc, ""), "apply a wavefront state from memory");
+
+	float target[MIRAO_NB_ACTUATORS];
+	for (int i = 0; i < MIRAO_NB_ACTUATORS; ++i)
+		target[i] = wfc.position[i] + (i % 2 ? 3.0f : 1e-4f * i);
+	mirror.Move(target, 0);
+	CDeviceUtils::SleepMs(20);
+	MiraoWavefrontState state;
+	float shape[MIRAO_NB_ACTUATORS];
+	mirror.GetState(state);
+	mirror.GetShape(shape);
+	bool quantised = true;
+	for (int i = 0; i < MIRAO_NB_ACTUATORS; ++i)
+	{
+		if (!wfc.valid[i])
+			continue;
+		const float expected = std::max(wfc.minCommand[i], std::min(wfc.maxCommand[i], target[i]));
+		if (std::fabs(state.position[i] - expected) > settings.resolution || std::fabs(shape[i] - state.position[i]) > 1e-5 ||
+			state.position[i] < wfc.minCommand[i] || state.position[i] > wfc.maxCommand[i])
+			quantised = false;
+	}
+	Check(quantised, "commands are clipped to the limits and quantised to %.2g", settings.resolution);
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// The adapter's simulated device through the Micro-Manager device interface:
+// applies, settling, sequences, presets and a calibration swap
+//
+std::string GetProperty(MM::Device* device, const char* name)
+{
+	char value[MM::MaxStrLength];
+	value[0] = 0;
+	device->GetProperty(name, value);
+	return value;
+}
+
+// The modes of a ZernikeVector value
+std::vector<double> Modes(const std::string& value)
+{
+	std::vector<double> modes;
+	std::istringstream in(value);
+	double mode;
+	while (in >> mode)
+		modes.push_back(mode);
+	return modes;
+}
+
+double MaxDifference(const std::string& actuators, const float* position)
+{
+	std::vector<double> values = Modes(actuators);
+	double worst = values.size() == MIRAO_NB_ACTUATORS ? 0 : 1e9;
+	for (size_t i = 0; i < values.size() && i < MIRAO_NB_ACTUATORS; ++i)
+		worst = std::max(worst, std::fabs(values[i] - position[i]));
+	return worst;
+}
+
+void CheckDevice(const MiraoWavefrontState& wfc)
+{
+	printf("Simulated device\n");
+	MM::Device* device = CreateDevice("MIRAO52E_FAKE");
+	if (!Check(device != 0, "create the simulated mirror"))
+		return;
+	double start = MiraoClock();
+	int ret = device->Initialize();
+	if (!Check(ret == DEVICE_OK && GetProperty(device, "Diversity state") == "Deferred",
+		"initialise in %.0f ms, diversity deferred", (MiraoClock() - start) / 1000))
+	{
+		DeleteDevice(device);
+		return;
+	}
+
+	// An apply is acknowledged when queued; Busy() covers execution and settling
+	device->SetProperty("Settle time [ms]", "20");
+	start = MiraoClock();
+	device->SetProperty("ZernikeVector", "0 0 0.1 0.05");
+	const bool busy = device->Busy();
+	while (device->Busy() && MiraoClock() - start < 1e6)
+		CDeviceUtils::SleepMs(1);
+	const double settled_ms = (MiraoClock() - start) / 1000;
+	std::vector<double> modes = Modes(GetProperty(device, "ZernikeVector"));
+	Check(busy && settled_ms >= 20 && settled_ms < 200 && modes.size() >= 3 && std::fabs(modes[2] - 0.1) < 1e-6 &&
+		MaxDifference(GetProperty(device, "ActuatorVector"), wfc.position) > 1e-4,
+		"busy until settled, %.1f ms after the apply", settled_ms);
+	Check(GetProperty(device, "Commands failed") == "0" && GetProperty(device, "Last mirror error") == "0",
+		"no mirror errors");
+
+	// Writes within the deadband are skipped
+	const long suppressed = atol(GetProperty(device, "Writes suppressed").c_str());
+	device->SetProperty("Write deadband [DAC steps]", "100");
+	device->SetProperty("ZernikeVector", "0 0 0.1005 0.05");
+	device->SetProperty("Write deadband [DAC steps]", "0");
+	device->SetProperty("ZernikeVector", "0 0 0.1 0.05");
+	while (device->Busy())
+		CDeviceUtils::SleepMs(1);
+	Check(atol(GetProperty(device, "Writes suppressed").c_str()) == suppressed + 1, "one write within the deadband skipped");
+
+	// A hardware-timed sequence of three wavefronts
+	device->SetProperty("Settle time [ms]", "0");
+	device->SetProperty("Sequence interval [ms]", "5");
+	const long submitted = atol(GetProperty(device, "Commands submitted").c_str());
+	bool sequenceable = false;
+	device->IsPropertySequenceable("ZernikeVector", sequenceable);
+	const char* sequence[] = { "0 0 0.2", "0 0 0.3", "0 0 0.4" };
+	ret = device->ClearPropertySequence("ZernikeVector");
+	for (int k = 0; k < 3; ++k)
+		ret = ret == DEVICE_OK ? device->AddToPropertySequence("ZernikeVector", sequence[k]) : ret;
+	ret = ret == DEVICE_OK ? device->SendPropertySequence("ZernikeVector") : ret;
+	ret = ret == DEVICE_OK ? device->StartPropertySequence("ZernikeVector") : ret;
+	CDeviceUtils::SleepMs(100);
+	device->StopPropertySequence("ZernikeVector");
+	while (device->Busy())
+		CDeviceUtils::SleepMs(1);
+	modes = Modes(GetProperty(device, "ZernikeVector"));
+	const double defocus = modes.size() >= 3 ? modes[2] : 0;
+	Check(sequenceable && ret == DEVICE_OK && atol(GetProperty(device, "Commands submitted").c_str()) >= submitted + 3 &&
+		(std::fabs(defocus - 0.2) < 1e-6 || std::fabs(defocus - 0.3) < 1e-6 || std::fabs(defocus - 0.4) < 1e-6),
+		"sequence of 3 wavefronts, submitted %ld commands in 100 ms",
+		atol(GetProperty(device, "Commands submitted").c_str()) - submitted);
+
+	// Store the current state and switch between presets
+	const std::string stored = GetProperty(device, "ActuatorVector");
+	ret = device->SetProperty("Store wavefront preset [input name]", "Checks");
+	const int flat = ret == DEVICE_OK ? device->SetProperty("Wavefront preset", "Flat") : ret;
+	while (device->Busy())
+		CDeviceUtils::SleepMs(1);
+	const double flatError = MaxDifference(GetProperty(device, "ActuatorVector"), wfc.position);
+	const int back = flat == DEVICE_OK ? device->SetProperty("Wavefront preset", "Checks") : flat;
+	while (device->Busy())
+		CDeviceUtils::SleepMs(1);
+	const std::string recalled = GetProperty(device, "ActuatorVector");
+	std::vector<double> before = Modes(stored);
+	float position[MIRAO_NB_ACTUATORS];
+	for (int i = 0; i < MIRAO_NB_ACTUATORS; ++i)
+		position[i] = i < (int)before.size() ? (float)before[i] : 0;
+	Check(back == DEVICE_OK && flatError < 1e-4 && MaxDifference(recalled, position) < 1e-4,
+		"store a preset, switch to Flat and back");
+	remove("MIRAO/WavefrontPreset_1.wcs");
+
+	// Replace the calibration while the device is in use
+	start = MiraoClock();
+	ret = device->SetProperty("Set calibration path", calibPath);
+	Check(ret == DEVICE_OK && GetProperty(device, "Diversity state") == "Ready",
+		"swap the calibration in %.0f ms, diversity set up for the new one", (MiraoClock() - start) / 1000);
+	device->SetProperty("ZernikeVector", "0 0 0.05");
+	while (device->Busy())
+		CDeviceUtils::SleepMs(1);
+	Check(GetProperty(device, "Commands failed") == "0", "applies after the swap");
+
+	device->Shutdown();
+	DeleteDevice(device);
+	remove((std::string(calibPath) + ".cache").c_str());
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Phase diversity on simulated PSFs of defocus, astigmatism, coma and trefoil.
+// Tip and tilt only move the PSF and are not compared.
+//
+void CheckDiversity(const MiraoCalibration& calib, const MiraoProjector& projector)
+{
+	printf("Phase diversity\n");
+	MiraoDiversitySettings settings;
+	MiraoPsfSimulator simulator;
+	MiraoPhaseRetrieval retrieval;
+	if (!Check(settings.Load(prefsPath, calibParamsPath) && simulator.Configure(settings, calib, projector) &&
+		retrieval.Configure(settings), "load the diversity settings"))
+		return;
+
+	const int size = 128;
+	MiraoPsfSample sample;
+	sample.photons = 1e6;
+	sample.background = 0;
+	sample.readNoise = 0;
+	simulator.SetSample(sample, size, size);
+	simulator.Start(1);
+
+	float aberration[MIRAO_MAX_ZERNIKES + 1] = { 0 };
+	aberration[3] = 0.03f;
+	aberration[4] = 0.05f;
+	aberration[5] = -0.02f;
+	aberration[6] = 0.03f;
+	aberration[7] = -0.02f;
+	aberration[9] = 0.02f;
+	aberration[10] = -0.03f;
+	std::vector<MiraoFrame> frames(settings.diversities.size());
+	for (size_t k = 0; k < frames.size(); ++k)
+	{
+		float zernikes[MIRAO_MAX_ZERNIKES + 1];
+		for (int j = 0; j <= MIRAO_MAX_ZERNIKES; ++j)
+			zernikes[j] = aberration[j] + settings.diversities[k][j];
+		simulator.SetAberration(zernikes);
+		frames[k].width = frames[k].height = size;
+		frames[k].pixels.resize((size_t)size * size);
+		simulator.Render(0, 0, 0, size, size, &frames[k].pixels[0]);
+	}
+	simulator.Stop();
+
+	float retrieved[MIRAO_MAX_ZERNIKES + 1];
+	const double start = MiraoClock();
+	retrieval.SetImages(frames);
+	retrieval.Retrieve(1, retrieved);
+	const double elapsed_ms = (MiraoClock() - start) / 1000;
+	double worst = 0;
+	for (int j = 3; j <= settings.nbZernikes; ++j)
+		worst = std::max(worst, (double)std::fabs(retrieved[j] - aberration[j]));
+	Check(worst < 0.005, "modes 3 to %d retrieved within %.4f um in %d iterations and %.0f ms",
+		settings.nbZernikes, worst, retrieval.GetIterations(), elapsed_ms);
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Shack-Hartmann frames with a Gaussian spot per subaperture, displaced by
+// the slopes
+//
+class SpotImage
+{
+public:
+	SpotImage(const MiraoCalibration& calib, const MiraoShackHartmannSettings& settings) :
+		calib_(calib),
+		settings_(settings)
+	{
+		pitchX_ = calib.stepX_um / settings.pixelSize_um;
+		pitchY_ = calib.stepY_um / settings.pixelSize_um;
+		width_ = (int)std::ceil(settings.originX + calib.nbSubapX * pitchX_) + 1;
+		height_ = (int)std::ceil(settings.originY + calib.nbSubapY * pitchY_) + 1;
+	}
+
+	int GetWidth() const { return width_; }
+	int GetHeight() const { return height_; }
+
+	// slopes [mrad], x then y in pupil row order; shifts are limited to 6 pixels
+	void Render(const std::vector<double>& slopes, std::vector<unsigned short>& pixels) const
+	{
+		const int nbSubap = calib_.nbValidSubap;
+		const double scale = settings_.focalLength_mm / settings_.pixelSize_um;
+		std::vector<double> image((size_t)width_ * height_, 100.0);
+		int s = 0;
+		for (int iy = 0; iy < calib_.nbSubapY; ++iy)
+		{
+			for (int ix = 0; ix < calib_.nbSubapX; ++ix)
+			{
+				if (!calib_.pupil[iy * calib_.nbSubapX + ix])
+					continue;
+				const double dx = Limit(slopes[s] * scale);
+				const double dy = Limit(slopes[nbSubap + s] * scale);
+				const double cx = settings_.originX + (ix + 0.5) * pitchX_ - 0.5 + dx;
+				const double cy = settings_.originY + (iy + 0.5) * pitchY_ - 0.5 + dy;
+				for (int y = (int)cy - 6; y <= (int)cy + 6; ++y)
+					for (int x = (int)cx - 6; x <= (int)cx + 6; ++x)
+						image[(size_t)y * width_ + x] += 3000 * std::exp(-((x - cx) * (x - cx) + (y - cy) * (y - cy)) / 2.88);
+				++s;
+			}
+		}
+		pixels.resize(image.size());
+		for (size_t i = 0; i < image.size(); ++i)
+			pixels[i] = (unsigned short)(image[i] + 0.5);
+	}
+
+private:
+	static double Limit(double shift) { return shift > 6 ? 6 : shift < -6 ? -6 : shift; }
+
+	const MiraoCalibration& calib_;
+	MiraoShackHartmannSettings settings_;
+	double pitchX_;
+	double pitchY_;
+	int width_;
+	int height_;
+};
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Centroiding of synthetic spots with known shifts
+//
+void CheckShackHartmann(const MiraoCalibration& calib)
+{
+	printf("Shack-Hartmann\n");
+	MiraoShackHartmannSettings settings;
+	settings.originX = 3.3;
+	settings.originY = 4.7;
+	settings.threshold = 150;
+	SpotImage spots(calib, settings);
+	const int nbSubap = calib.nbValidSubap;
+	const double range = 2.5 * settings.pixelSize_um / settings.focalLength_mm;
+
+	const int nbFrames = 16;
+	std::vector< std::vector<unsigned short> > frames(nbFrames);
+	std::vector< std::vector<double> > expected(nbFrames);
+	unsigned long seed = 3;
+	for (int f = 0; f < nbFrames; ++f)
+	{
+		expected[f].resize(2 * nbSubap);
+		for (int s = 0; s < 2 * nbSubap; ++s)
+			expected[f][s] = (Uniform(seed) - 0.5) * 2 * range;
+		spots.Render(expected[f], frames[f]);
+	}
+
+	MiraoShackHartmann sensor;
+	if (!Check(sensor.Configure(settings, calib, spots.GetWidth(), spots.GetHeight()),
+		"configure %d subapertures on %dx%d pixels", nbSubap, spots.GetWidth(), spots.GetHeight()))
+		return;
+	sensor.Start(1);
+	static MiraoSlopes slopes;
+	double worst = 0;
+	for (int f = 0; f < nbFrames; ++f)
+	{
+		sensor.Measure(&frames[f][0], f, 0);
+		sensor.GetLatest(slopes);
+		for (int s = 0; s < 2 * nbSubap; ++s)
+			worst = std::max(worst, std::fabs(slopes.slopes[s] - expected[f][s]));
+	}
+	Check(slopes.nbLit == nbSubap && worst < 0.01, "slopes of +-%.2f mrad within %.4f mrad", range, worst);
+
+	const int repeats = 2000;
+	const double start = MiraoClock();
+	for (int k = 0; k < repeats; ++k)
+		sensor.Measure(&frames[k % nbFrames][0], k, 0);
+	Check(true, "%.1f kHz on one thread, %.0f us mean centroiding time",
+		repeats / (MiraoClock() - start) * 1000, sensor.GetMeasureTime().Mean());
+
+	sensor.StoreReference();
+	sensor.Measure(&frames[0][0], 0, 0);
+	sensor.Measure(&frames[0][0], 0, 0);
+	sensor.GetLatest(slopes);
+	worst = 0;
+	for (int s = 0; s < 2 * nbSubap; ++s)
+		worst = std::max(worst, (double)std::fabs(slopes.slopes[s]));
+	Check(worst < 1e-6, "slopes are zero on the stored reference");
+	sensor.Stop();
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Closed loop: the loop drives the simulated mirror through the projector
+// and a camera thread renders spots of the mirror shape plus an aberration
+//
+class LoopMirror
+{
+public:
+	LoopMirror(MiraoSimBackend::Mirror& mirror, MiraoProjector& projector, int nbModes) :
+		mirror_(mirror),
+		projector_(projector),
+		nbModes_(nbModes)
+	{
+		memcpy(actuators_, projector.GetBase(), sizeof(actuators_));
+	}
+
+	// Both are called from the loop thread only
+	void ApplyLoop(const float* zernikes)
+	{
+		projector_.Project(zernikes, nbModes_, actuators_);
+		mirror_.Move(actuators_, 0);
+	}
+
+	void GetHeadroom(float* up, float* down)
+	{
+		projector_.Headroom(actuators_, nbModes_, up, down);
+	}
+
+private:
+	MiraoSimBackend::Mirror& mirror_;
+	MiraoProjector& projector_;
+	int nbModes_;
+	float actuators_[MIRAO_NB_ACTUATORS];
+};
+
+class SpotCamera : public MMDeviceThreadBase
+{
+public:
+	SpotCamera(const MiraoCalibration& calib, const SpotImage& spots, MiraoSimBackend::Mirror& mirror, MiraoShackHartmann& sensor,
+		const std::vector<double>& aberration, const float* reference) :
+		calib_(calib),
+		spots_(spots),
+		mirror_(mirror),
+		sensor_(sensor),
+		aberration_(aberration),
+		reference_(reference),
+		stop_(1)
+	{
+	}
+
+	void Start()
+	{
+		stop_.Set(0);
+		activate();
+	}
+
+	void Stop()
+	{
+		stop_.Set(1);
+		wait();
+	}
+
+	int svc()
+	{
+		std::vector<double> slopes;
+		std::vector<unsigned short> pixels;
+		for (long frame = 0; !stop_.Get(); ++frame)
+		{
+			float shape[MIRAO_NB_ACTUATORS];
+			mirror_.GetShape(shape);
+			Slopes(calib_, aberration_, shape, reference_, slopes);
+			spots_.Render(slopes, pixels);
+			sensor_.Measure(&pixels[0], frame, MiraoClock());
+			CDeviceUtils::SleepMs(3);
+		}
+		return 0;
+	}
+
+private:
+	const MiraoCalibration& calib_;
+	const SpotImage& spots_;
+	MiraoSimBackend::Mirror& mirror_;
+	MiraoShackHartmann& sensor_;
+	std::vector<double> aberration_;
+	const float* reference_;
+	MiraoAtomicLong stop_;
+};
+
+void CheckLoop(const MiraoCalibration& calib, const MiraoProjector& built, const MiraoWavefrontState& wfc)
+{
+	printf("Closed loop\n");
+	const int nbModes = MIRAO_SDK_ZERNIKES;
+	MiraoProjector projector = built;
+	projector.SetBase(wfc.position);
+	projector.SetLimits(wfc.minCommand, wfc.maxCommand);
+
+	MiraoSimBackend::Mirror mirror;
+	mirror.Open("");
+	mirror.Move(wfc.position, &wfc);
+	CDeviceUtils::SleepMs(20);
+	float reference[MIRAO_NB_ACTUATORS];
+	mirror.GetShape(reference);
+
+	// slopes of a few modes through the control matrix
+	float zernikes[MIRAO_MAX_ZERNIKES + 1] = { 0 };
+	zernikes[1] = 0.2f;
+	zernikes[3] = 0.3f;
+	zernikes[4] = -0.1f;
+	zernikes[8] = 0.05f;
+	float aberrated[MIRAO_NB_ACTUATORS];
+	memcpy(aberrated, reference, sizeof(aberrated));
+	projector.ProjectDelta(zernikes, nbModes, aberrated);
+	std::vector<double> aberration;
+	Slopes(calib, std::vector<double>(2 * calib.nbValidSubap, 0.0), aberrated, reference, aberration);
+
+	MiraoShackHartmannSettings settings;
+	settings.originX = 3.3;
+	settings.originY = 4.7;
+	settings.threshold = 150;
+	SpotImage spots(calib, settings);
+	MiraoShackHartmann sensor;
+	MiraoReconstructor reconstructor;
+	if (!Check(sensor.Configure(settings, calib, spots.GetWidth(), spots.GetHeight()) &&
+		reconstructor.Build(calib, projector, nbModes), "build the reconstructor of %d modes", nbModes))
+		return;
+	sensor.Start(1);
+
+	SpotCamera camera(calib, spots, mirror, sensor, aberration, reference);
+	camera.Start();
+	CDeviceUtils::SleepMs(100);
+	static MiraoSlopes slopes;
+	float measured[MIRAO_MAX_ZERNIKES + 1];
+	sensor.GetLatest(slopes);
+	reconstructor.Reconstruct(slopes, measured);
+	double error = 0;
+	double norm = 0;
+	for (int j = 1; j <= nbModes; ++j)
+	{
+		error += (measured[j] - zernikes[j]) * (measured[j] - zernikes[j]);
+		norm += zernikes[j] * zernikes[j];
+	}
+	Check(std::sqrt(error / norm) < 0.02, "open loop reconstruction within %.1f%%", 100 * std::sqrt(error / norm));
+
+	LoopMirror device(mirror, projector, nbModes);
+	MiraoLoop<LoopMirror> loop(&device, &sensor);
+	MiraoLoopSettings loopSettings;
+	loopSettings.rate_hz = 200;
+	loopSettings.leak = 0;
+	for (int j = 0; j <= MIRAO_MAX_ZERNIKES; ++j)
+		loopSettings.gains[j] = 0.3f;
+	loop.Start(loopSettings, reconstructor);
+	CDeviceUtils::SleepMs(300);
+	const double early = loop.GetResidual();
+	CDeviceUtils::SleepMs(2700);
+	const double late = loop.GetResidual();
+	const double rate = loop.GetRate();
+	loop.Stop();
+	camera.Stop();
+	sensor.Stop();
+	Check(late < 0.01 * std::sqrt(norm) && late < early, "residual %.4f um after 0.3 s, %.5f um after 3 s, of %.3f um at %.0f Hz",
+		early, late, std::sqrt(norm), rate);
+}
+
+} // namespace
+
+
+int main()
+{
+	MiraoCalibration calib;
+	MiraoWavefrontState wfc;
+	MiraoProjector projector;
+	if (!calib.Load(calibPath) || !wfc.Load(wfcPath) || !projector.Build(calib, MIRAO_MAX_ZERNIKES))
+	{
+		printf("Cannot read %s and %s; run from the adapter directory\n", calibPath, wfcPath);
+		return 1;
+	}
+
+	CheckProjector(calib, wfc);
+	CheckCommandQueue();
+	CheckDeadband(wfc);
+	CheckMetrics();
+	CheckPresets(wfc);
+	CheckDepthTable();
+	CheckFieldMap();
+	CheckTelemetry();
+	CheckCalibrationSets();
+	CheckSimMirror(wfc);
+	CheckDevice(wfc);
+	CheckDiversity(calib, projector);
+	CheckShackHartmann(calib);
+	CheckLoop(calib, projector, wfc);
+
+	printf(failures ? "%d checks failed\n" : "All checks passed\n", failures);
+	return failures;
+}